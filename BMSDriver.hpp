@@ -1,4 +1,7 @@
 /**@file BMSDriver.hpp */
+#ifndef BMSDRIVER_HPP_
+#define BMSDRIVER_HPP_
+
 #include <Arduino.h>
 #include "Logger.hpp"
 #include <string.h>
@@ -45,45 +48,202 @@
 #define WRITE_RECV_LEN_MISMATCH -7
 #define WRITE_CRC_FAIL -8
 
-class BMSDriver {
+/////////////////////////////////////////////////
+/// \brief A chain of Tesla module boards, as seen by the module objects.
+///
+/// The modules and the module manager only talk to the chain through this interface, one call per
+/// transaction, so a chain can be wrapped (e.g. to record or replay it) without touching them.
+/////////////////////////////////////////////////
+class BMSBus {
+  public:
+    BMSBus(Logger* logger);
+    virtual int16_t read(const uint8_t moduleAddress, const uint8_t readAddress, const uint8_t readLen, uint8_t* recvBuff) = 0;
+    virtual int16_t write(const uint8_t moduleAddress, const uint8_t writeAddress, const uint8_t sendByte) = 0;
+    void logError(const uint8_t ma, const int16_t err, const char* message, const char* file, int line, const char* function);
+    Logger* getLoggerPtr();
+    static Logger::Subsystem getLogSubsystem() {
+      return Logger::DRIVER;
+    }
+
+  protected:
+    Logger* logger;
+    static uint8_t genCRC(const uint8_t * buf, const uint8_t bufLen);
+};
+
+/////////////////////////////////////////////////
+/// \brief The BMSDriver talks to the Tesla module boards over a serial port of type Port.
+///
+/// The port type is a template parameter so the byte loops call the serial port directly, as
+/// SERIALBMS.read() did, instead of through the virtual Stream interface. The member functions are
+/// defined below so the driver can be instantiated on any port, e.g. a TracePort recording the chain.
+/////////////////////////////////////////////////
+template <class Port>
+class BMSDriverT : public BMSBus {
   public:
-    BMSDriver();
+    BMSDriverT(Port* port, Logger* logger);
     int16_t read(const uint8_t moduleAddress, const uint8_t readAddress, const uint8_t readLen, uint8_t* recvBuff);
     int16_t write(const uint8_t moduleAddress, const uint8_t writeAddress, const uint8_t sendByte);
-    void logError(const uint8_t ma, const int16_t err, const char* message);
 
   private:
-    uint8_t genCRC(const uint8_t * buf, const uint8_t bufLen);
-  
+    Port* port;
+    //qualified calls are bound at compile time, the serial classes are not final
+    int available() { return port->Port::available(); }
+    int readByte() { return port->Port::read(); }
+    void writeBytes(const uint8_t* buf, size_t len) { port->Port::write(buf, len); }
+    void flushInput() { while (available()) readByte(); }
 };
 
-//export the logger
-extern BMSDriver bmsdriver_inst;
+/////////////////////////////////////////////////
+/// \brief The BMSDriver provides a high level API to talk to the Tesla module boards.
+///
+/// The constructor will initialize the serial port to the appropriate speed of 612500.
+/////////////////////////////////////////////////
+template <class Port>
+BMSDriverT<Port>::BMSDriverT(Port* port, Logger* logger)
+  : BMSBus(logger),
+    port(port) {
+  port->begin(612500);
+}
+
+/////////////////////////////////////////////////
+/// \brief reads values from the string of bms modules.
+///
+/// @param moduleAddress The module address to read from.
+/// @param readAddress The address to read from in the module.
+/// @param readLen The number of bytes to read from the module starting from readAddress.
+/// @param recvBuff The buffer where the data will be written to.
+/////////////////////////////////////////////////
+template <class Port>
+int16_t BMSDriverT<Port>::read(const uint8_t moduleAddress, const uint8_t readAddress, const uint8_t readLen, uint8_t* recvBuff ) {
+  uint8_t fixedModAddress = moduleAddress << 1;
+  uint8_t byteIndex = 0;
+  uint8_t maxLen = readLen + 4;//[modAddr][readAddr][readLen][data][CRC]
+  uint8_t buff[MAX_PAYLOAD];
+
+  //clean out recv buffer
+  flushInput();
+
+  //check if the read is larger than our recv buffer
+  if (maxLen > MAX_PAYLOAD) return ILLEGAL_READ_LEN;
+
+  //clean buffers
+  memset(buff, 0,  sizeof(buff));
+  memset(recvBuff, 0,  readLen);
+
+  //sending read command on serial port
+  //LOG_DEBUG("Reading module:%3d, addr:0x%02x, len:%d\n", moduleAddress, readAddress, readLen );
+  uint8_t sendBuff[3] = { fixedModAddress, readAddress, readLen };
+  writeBytes(sendBuff, sizeof(sendBuff));
+
+  //receiving answer
+  delay(2 * ((readLen / 8) + 1));
+  for (byteIndex = 0; available() && (byteIndex < maxLen); byteIndex++) {
+    buff[byteIndex] = readByte();
+    //chThdSleepMilliseconds(5);
+  }
+
+  //empty out the serial read buffer
+  if (maxLen > byteIndex) {
+    //LOG_ERROR("READ_RECV_LEN_MISMATCH | Reading module:%3d, addr:0x%02x, len:%d, maxlen:%d != byteIndex:%d\n", moduleAddress, readAddress, readLen, maxLen, byteIndex );
+    return READ_RECV_LEN_MISMATCH;
+  }
+  flushInput();
+
+  //verify the CRC
+  if (genCRC(buff, maxLen - 1) != buff[maxLen - 1]) {
+    LOG_ERROR("READ_CRC_FAIL | Reading module:%3d, addr:0x%02x, len:%d\n", moduleAddress, readAddress, readLen );
+  }
+
+  //success! remove 4 bytes protocol wrapper around payload
+  memcpy(recvBuff, &buff[3], readLen); //[modAddr][readAddr][readLen][data][CRC] -> [data]
+  return byteIndex;
+}
+
+/////////////////////////////////////////////////
+/// \brief writes a byte to a module in the string of bms modules.
+///
+/// @param moduleAddress The module address to write to. Can use a boradcast.
+/// @param writeAddress The address to write to in the module.
+/// @param sendByte The byte to write.
+/////////////////////////////////////////////////
+template <class Port>
+int16_t BMSDriverT<Port>::write(const uint8_t moduleAddress, const uint8_t writeAddress, const uint8_t sendByte) {
+  uint8_t fixedModAddress = moduleAddress << 1;
+  uint8_t byteIndex = 0;
+  uint8_t maxLen = 4;//[modAddr][readAddr][data][CRC]
+  uint8_t sendBuff[4];
+  uint8_t recvBuff[4];
+
+  //clean out recv buffer
+  flushInput();
+  //clean buffer
+  memset(sendBuff, 0,  sizeof(sendBuff));
+  memset(recvBuff, 0,  sizeof(recvBuff));
+
+  //sending read command on serial port
+  //LOG_DEBUG("Writing module:%d, addr:0x%x, byte:%d\n", moduleAddress, writeAddress, sendByte );
+  sendBuff[0] = fixedModAddress | 1;
+  sendBuff[1] = writeAddress;
+  sendBuff[2] = sendByte;
+  sendBuff[3] = genCRC(sendBuff, 3);
+  writeBytes(sendBuff, sizeof(sendBuff));
+
+  //receiving answer
+  delay(2);
+  for (byteIndex = 0; available() && (byteIndex < maxLen); byteIndex++) {
+    recvBuff[byteIndex] = readByte();
+  }
+
+  //empty out the serial read buffer
+  if (maxLen < byteIndex) {
+    flushInput();
+  } else if (maxLen > byteIndex) {
+    return WRITE_RECV_LEN_MISMATCH;
+  }
+
+  //verify the CRC
+  if (sendBuff[maxLen - 1] != recvBuff[maxLen - 1]) {
+    LOG_ERROR("WRITE_CRC_FAIL | Writing module:%3d, addr:0x%02x, byte:%x\n", moduleAddress, writeAddress, sendByte );
+  }
+  return byteIndex;
+}
+
+//type of the port the modules are connected to
+typedef decltype(SERIALBMS) BMSPort;
+typedef BMSDriverT<BMSPort> BMSDriver;
 
 /////////////////////////////////////////////////
 /// \brief Helper macro that reads values from the string of bms modules.
 ///
+/// Used in the members of a class holding a BMSBus* named driver.
+///
 /// @param moduleAddress The module address to read from.
 /// @param readAddress The address to read from in the module.
 /// @param readLen The number of bytes to read from the module starting from readAddress.
 /// @param recvBuff The buffer where the data will be written to.
 /////////////////////////////////////////////////
-#define BMSDR bmsdriver_inst.read
+#define BMSDR driver->read
 
 /////////////////////////////////////////////////
 /// \brief Helper macro that writes a byte to a module in the string of bms modules.
 ///
+/// Used in the members of a class holding a BMSBus* named driver.
+///
 /// @param moduleAddress The module address to write to. Can use a boradcast.
 /// @param writeAddress The address to write to in the module.
 /// @param sendByte The byte to write.
 /////////////////////////////////////////////////
-#define BMSDW bmsdriver_inst.write
+#define BMSDW driver->write
 
 /////////////////////////////////////////////////
 /// \brief Helper macro that will print the location of the error and function to help interpret and log error codes returned by the driver.
 ///
+/// The location is resolved at compile time and printed in the same message as the error.
+///
 /// @param moduleAddress The module address.
 /// @param error The error code returned by the driver function (read or write).
 /// @param message An extra message to display defined by the user.
 /////////////////////////////////////////////////
-#define BMSD_LOG_ERR LOG_ERR("file: %s, function: %s, line: %d\n",strrchr(__FILE__,'\\'),__func__,__LINE__); bmsdriver_inst.logError
+#define BMSD_LOG_ERR(moduleAddress, error, message) driver->logError(moduleAddress, error, message, LOG_FILE, __LINE__, __func__)
+
+#endif /* BMSDRIVER_HPP_ */
@@ -7,11 +7,29 @@
 ///
 /// It's important for the constructor to be without arguments.
 /// This allows instantiating all 0x3E modules on the .bss instead of the stack.
+/// The module manager then attaches them to its chain.
 /////////////////////////////////////////////////
 BMSModule::BMSModule()
 {
   resetRecordedValues();
   moduleAddress = 0;
+  driver = 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief attaches the module to the chain it is read through.
+/////////////////////////////////////////////////
+void BMSModule::attach(BMSBus* bus)
+{
+  driver = bus;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the logger of the chain, for the LOG_ macros.
+/////////////////////////////////////////////////
+Logger* BMSModule::getLoggerPtr()
+{
+  return driver->getLoggerPtr();
 }
 
 /////////////////////////////////////////////////
@@ -25,6 +43,7 @@ void BMSModule::resetRecordedValues()
   for (int i = 0; i < 6; i++)
   {
     cellVolt[i] = 0.0f;
+    cellCounts[i] = 0;
     lowestCellVolt[i] = 5.0f;
     highestCellVolt[i] = 0.0f;
   }
@@ -122,7 +141,8 @@ bool BMSModule::updateInstanceWithModuleValues()
     if (retmoduleVolt < lowestModuleVolt) lowestModuleVolt = retmoduleVolt;
     for (int i = 0; i < 6; i++)
     {
-      cellVolt[i] = (buff[2 + (i * 2)] * 256 + buff[3 + (i * 2)]) * 0.000381493f;
+      cellCounts[i] = buff[2 + (i * 2)] * 256 + buff[3 + (i * 2)];
+      cellVolt[i] = cellCounts[i] * 0.000381493f;
       if (lowestCellVolt[i] > cellVolt[i]) lowestCellVolt[i] = cellVolt[i];
       if (highestCellVolt[i] < cellVolt[i]) highestCellVolt[i] = cellVolt[i];
     }
@@ -218,6 +238,17 @@ float BMSModule::getCellVoltage(int cell)
   return cellVolt[cell];
 }
 
+/////////////////////////////////////////////////
+/// \brief returns the raw ADC counts the voltage of a cell was read as.
+///
+/// @param cell The cell index
+//////////////////////////////////////////////////
+uint16_t BMSModule::getCellCounts(int cell)
+{
+  if (cell < 0 || cell > 5) return 0;
+  return cellCounts[cell];
+}
+
 /////////////////////////////////////////////////
 /// \brief returns the voltage of the lowest voltage cell.
 //////////////////////////////////////////////////
@@ -3,10 +3,15 @@
 #ifndef BMSMODULE_HPP_
 #define BMSMODULE_HPP_
 
+#include "Logger.hpp"
+
+class BMSBus;
+
 class BMSModule
 {
   public:
     BMSModule();
+    void attach(BMSBus* bus);
     //void readStatus();
     void resetRecordedValues();
     //void stopBalance();
@@ -15,6 +20,7 @@ class BMSModule
     
     //int getscells();
     float getCellVoltage(int cellIndex);
+    uint16_t getCellCounts(int cellIndex);
     float getLowCellV();
     float getHighCellV();
     float getAverageV();
@@ -41,8 +47,14 @@ class BMSModule
     
     
   private:
+    BMSBus* driver;
+    Logger* getLoggerPtr();
+    static Logger::Subsystem getLogSubsystem() {
+      return Logger::MODULE;
+    }
     void logError(int16_t err);
     float cellVolt[6];          // calculated as 16 bit value * 6.250 / 16383 = volts
+    uint16_t cellCounts[6];     // the 16 bit values as read
     float lowestCellVolt[6];
     float highestCellVolt[6];
     float moduleVolt;          // summed cell voltages
@@ -1,11 +1,16 @@
 #include "Config.hpp"
 #include "BMSModuleManager.hpp"
 #include "Logger.hpp"
+#include "Profiler.hpp"
 
 /////////////////////////////////////////////////
 /// \brief constructor initialized to invalid address 0.
+///
+/// The modules are read through driver and the manager logs to logger.
 /////////////////////////////////////////////////
-BMSModuleManager::BMSModuleManager(Settings* sett) {
+BMSModuleManager::BMSModuleManager(Settings* sett, BMSBus* driver, Logger* logger)
+  : driver(driver),
+    logger(logger) {
   histLowestPackVolt = 1000.0f;
   histHighestPackVolt = 0.0f;
   histLowestPackTemp = 200.0f;
@@ -16,6 +21,20 @@ BMSModuleManager::BMSModuleManager(Settings* sett) {
   lineFault = false;
   pstring = 1;
   settings = sett;
+  for (int y = 0; y <= MAX_MODULE_ADDR; y++) {
+    modules[y].attach(driver);
+  }
+}
+
+Logger* BMSModuleManager::getLoggerPtr() {
+  return logger;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the module object at an index, 0 being the module with address 1.
+/////////////////////////////////////////////////
+BMSModule* BMSModuleManager::getModulePtr(int index) {
+  return &modules[index];
 }
 
 /////////////////////////////////////////////////
@@ -168,12 +187,36 @@ void BMSModuleManager::wakeBoards() {
   }
 }
 
+/////////////////////////////////////////////////
+/// \brief returns the number of boards reporting the sleep mode active alert (0x04).
+///
+/// Used to verify that sleepBoards() was effective.
+/////////////////////////////////////////////////
+uint16_t BMSModuleManager::countSleepingBoards() {
+  int16_t err;
+  uint8_t buff[4];
+  uint16_t sleeping = 0;
+  for (int y = 0; y < MAX_MODULE_ADDR; y++) {
+    if (modules[y].getAddress() > 0) {
+      if ((err = BMSDR(modules[y].getAddress(), REG_ALERT_STATUS, 1, buff)) > 0) {
+        if (buff[0] & 0x04) sleeping++;
+      } else {
+        BMSD_LOG_ERR(modules[y].getAddress(), err, "read sleep alert");
+      }
+    } else {
+      break;
+    }
+  }
+  return sleeping;
+}
+
 /////////////////////////////////////////////////
 /// \brief This function synchronises each module instance with its physical board.
 ///
 /// Most important function called every tick
 /////////////////////////////////////////////////
 uint16_t BMSModuleManager::getAllVoltTemp() {
+  PROF_SCOPE(GET_ALL_VOLT_TEMP);
   int16_t err;
   float tempPackVolt = 0.0f;
   uint16_t numOfBoards = 0;
@@ -434,6 +477,13 @@ float BMSModuleManager::getAvgCellVolt() {
   return avg;
 }
 
+/////////////////////////////////////////////////
+/// \brief returns the number of modules found during the last renumbering.
+//////////////////////////////////////////////////
+int BMSModuleManager::getNumFoundModules() {
+  return numFoundModules;
+}
+
 /////////////////////////////////////////////////
 /// \brief returns true if the serial communication is broken.
 //////////////////////////////////////////////////
@@ -442,244 +492,277 @@ bool BMSModuleManager::getLineFault() {
 }
 
 /////////////////////////////////////////////////
-/// \brief prints the pack summary to the console.
+/// \brief prints one part of the pack summary to the console.
+///
+/// The summary is printed by calling it with part 0, 1, 2, ... until it returns false, a few parts per tick
+/// so a pack of many modules does not delay the controller. Every module has 3 parts, the pack 2 more.
+///
+/// @return false if part is past the end of the summary, nothing was printed.
+//////////////////////////////////////////////////
+bool BMSModuleManager::printPackSummary(uint16_t part) {
+  if (part < MAX_MODULE_ADDR * 3) {
+    if (modules[part / 3].getAddress() > 0) printModuleSummary(part / 3, part % 3);
+    return true;
+  }
+
+  switch (part - MAX_MODULE_ADDR * 3) {
+    case 0:
+      LOG_CONSOLE("\n=====================================================================\n");
+      LOG_CONSOLE("\nModules: %i    Voltage: %.2fV   Avg Cell Voltage: %.2fV     Avg Temp: %.2fC\n",
+                  numFoundModules, getPackVoltage(), getAvgCellVolt(), getAvgTemperature());
+
+      LOG_CONSOLE("Lowest pack voltage %.2fV was reached at ", getHistLowestPackVolt());
+      LOG_TIMESTAMP_LN(getHistLowestPackVoltTimeStamp());
+      LOG_CONSOLE("Highest pack voltage %.2fV was reached at ", getHistHighestPackVolt());
+      LOG_TIMESTAMP_LN(getHistHighestPackVoltTimeStamp());
+      LOG_CONSOLE("Lowest pack temp %.2fC was reached at ", getHistLowestPackTemp());
+      LOG_TIMESTAMP_LN(getHistLowestPackTempTimeStamp());
+      LOG_CONSOLE("Highest pack temp %.2fC was reached at ", getHistHighestPackTemp());
+      LOG_TIMESTAMP_LN(getHistHighestPackTempTimeStamp());
+      return true;
+    case 1:
+      LOG_CONSOLE("INL_EVSE_DISC: %d\n", digitalRead(INL_EVSE_DISC));
+      LOG_CONSOLE("INH_RUN: %d\n", digitalRead(INH_RUN));
+      LOG_CONSOLE("INH_CHARGING: %d\n", digitalRead(INH_CHARGING));
+
+      //testing scafolding
+      LOG_CONSOLE("getHighCellVolt() < settings->charger_cycle_v_setpoint.getVal()    : %f < %f?\n", getHighCellVolt(), settings->charger_cycle_v_setpoint.getVal());
+      LOG_CONSOLE("getHighCellVolt() < settings->max_charge_v_setpoint.getVal()    : %f < %f?\n", getHighCellVolt(), settings->max_charge_v_setpoint.getVal());
+      return true;
+  }
+  return false;
+}
+
+/////////////////////////////////////////////////
+/// \brief prints a section of the summary of module y: 0 its voltages, 1 its cells, 2 its faults and alerts.
 //////////////////////////////////////////////////
-void BMSModuleManager::printPackSummary() {
+void BMSModuleManager::printModuleSummary(int y, uint8_t section) {
   uint8_t faults;
   uint8_t alerts;
   uint8_t COV;
   uint8_t CUV;
 
-  for (int y = 0; y < MAX_MODULE_ADDR; y++) {
-    if (modules[y].getAddress() > 0) {
-      faults = modules[y].getFaults();
-      alerts = modules[y].getAlerts();
-      COV = modules[y].getCOVCells();
-      CUV = modules[y].getCUVCells();
-      LOG_CONSOLE("\n=====================================================================\n");
-      LOG_CONSOLE("=                                Module #%2i                         =\n", y + 1);
-      LOG_CONSOLE("=====================================================================\n");
-      //LOG_CONSOLE("\t============================== Cell details =====================\n");
-
-      LOG_CONSOLE("Voltage: %3.2fV (%3.2fV-%.2fV)\t\tTemperatures: (%3.2fC-%3.2fC)\n", modules[y].getModuleVoltage(),
-                  modules[y].getLowCellV(), modules[y].getHighCellV(), modules[y].getLowTemp(), modules[y].getHighTemp());
-      LOG_CONSOLE("Historic Voltages: (%3.2fV-%.2fV)\tTemperatures: (%3.2fC-%3.2fC)\n", modules[y].getLowestModuleVolt(),
-                  modules[y].getHighestModuleVolt(), modules[y].getLowestTemp(), modules[y].getHighestTemp());
-      LOG_CONSOLE("+------+---------+---------+----------+\n");
-      LOG_CONSOLE("|Cell #| Cell V  |lowest V |highest V |\n");
-      LOG_CONSOLE("+------+---------+---------+----------+\n");
+  if (section == 0) {
+    LOG_CONSOLE("\n=====================================================================\n");
+    LOG_CONSOLE("=                                Module #%2i                         =\n", y + 1);
+    LOG_CONSOLE("=====================================================================\n");
+    //LOG_CONSOLE("\t============================== Cell details =====================\n");
+
+    LOG_CONSOLE("Voltage: %3.2fV (%3.2fV-%.2fV)\t\tTemperatures: (%3.2fC-%3.2fC)\n", modules[y].getModuleVoltage(),
+                modules[y].getLowCellV(), modules[y].getHighCellV(), modules[y].getLowTemp(), modules[y].getHighTemp());
+    LOG_CONSOLE("Historic Voltages: (%3.2fV-%.2fV)\tTemperatures: (%3.2fC-%3.2fC)\n", modules[y].getLowestModuleVolt(),
+                modules[y].getHighestModuleVolt(), modules[y].getLowestTemp(), modules[y].getHighestTemp());
+    return;
+  }
+  if (section == 1) {
+    LOG_CONSOLE("+------+---------+---------+----------+\n");
+    LOG_CONSOLE("|Cell #| Cell V  |lowest V |highest V |\n");
+    LOG_CONSOLE("+------+---------+---------+----------+\n");
+    for (int i = 0; i < 6; i++) {
+      LOG_CONSOLE("|  %2d  |  %.3f  |  %.3f  |  %.3f   |\n", i + 1, modules[y].getCellVoltage(i), modules[y].getLowestCellVolt(i), modules[y].getHighestCellVolt(i));
+    }
+    LOG_CONSOLE("+------+---------+---------+----------+\n");
+    return;
+  }
+
+  faults = modules[y].getFaults();
+  alerts = modules[y].getAlerts();
+  COV = modules[y].getCOVCells();
+  CUV = modules[y].getCUVCells();
+  if (faults > 0) {
+    LOG_CONSOLE("  MODULE IS FAULTED:\n");
+    if (faults & 1) {
+      LOG_CONSOLE("    Overvoltage Cell Numbers (1-6): ");
       for (int i = 0; i < 6; i++) {
-        LOG_CONSOLE("|  %2d  |  %.3f  |  %.3f  |  %.3f   |\n", i + 1, modules[y].getCellVoltage(i), modules[y].getLowestCellVolt(i), modules[y].getHighestCellVolt(i));
-      }
-      LOG_CONSOLE("+------+---------+---------+----------+\n");
-
-      if (faults > 0) {
-        LOG_CONSOLE("  MODULE IS FAULTED:\n");
-        if (faults & 1) {
-          LOG_CONSOLE("    Overvoltage Cell Numbers (1-6): ");
-          for (int i = 0; i < 6; i++) {
-            if (COV & (1 << i)) {
-              LOG_CONSOLE("%d ", i + 1);
-            }
-          }
-          LOG_CONSOLE("\n");
-        }
-        if (faults & 2) {
-          LOG_CONSOLE("    Undervoltage Cell Numbers (1-6): ");
-          for (int i = 0; i < 6; i++) {
-            if (CUV & (1 << i)) {
-              LOG_CONSOLE("%d ", i + 1);
-            }
-          }
-          LOG_CONSOLE("\n");
-        }
-        if (faults & 4) {
-          LOG_CONSOLE("    CRC error in received packet\n");
-        }
-        if (faults & 8) {
-          LOG_CONSOLE("    Power on reset has occurred\n");
-        }
-        if (faults & 0x10) {
-          LOG_CONSOLE("    Test fault active\n");
-        }
-        if (faults & 0x20) {
-          LOG_CONSOLE("    Internal registers inconsistent\n");
+        if (COV & (1 << i)) {
+          LOG_CONSOLE("%d ", i + 1);
         }
       }
-      if (alerts > 0) {
-        LOG_CONSOLE("  MODULE HAS ALERTS:\n");
-        if (alerts & 1) {
-          LOG_CONSOLE("    Over temperature on TS1\n");
-        }
-        if (alerts & 2) {
-          LOG_CONSOLE("    Over temperature on TS2\n");
-        }
-        if (alerts & 4) {
-          LOG_CONSOLE("    Sleep mode active\n");
-        }
-        if (alerts & 8) {
-          LOG_CONSOLE("    Thermal shutdown active\n");
-        }
-        if (alerts & 0x10) {
-          LOG_CONSOLE("    Test Alert\n");
-        }
-        if (alerts & 0x20) {
-          LOG_CONSOLE("    OTP EPROM Uncorrectable Error\n");
-        }
-        if (alerts & 0x40) {
-          LOG_CONSOLE("    GROUP3 Regs Invalid\n");
-        }
-        if (alerts & 0x80) {
-          LOG_CONSOLE("    Address not registered\n");
+      LOG_CONSOLE("\n");
+    }
+    if (faults & 2) {
+      LOG_CONSOLE("    Undervoltage Cell Numbers (1-6): ");
+      for (int i = 0; i < 6; i++) {
+        if (CUV & (1 << i)) {
+          LOG_CONSOLE("%d ", i + 1);
         }
       }
-      if (faults > 0 || alerts > 0) LOG_CONSOLE("\n");
+      LOG_CONSOLE("\n");
+    }
+    if (faults & 4) {
+      LOG_CONSOLE("    CRC error in received packet\n");
+    }
+    if (faults & 8) {
+      LOG_CONSOLE("    Power on reset has occurred\n");
+    }
+    if (faults & 0x10) {
+      LOG_CONSOLE("    Test fault active\n");
+    }
+    if (faults & 0x20) {
+      LOG_CONSOLE("    Internal registers inconsistent\n");
     }
   }
-  LOG_CONSOLE("\n=====================================================================\n");
-  LOG_CONSOLE("\nModules: %i    Voltage: %.2fV   Avg Cell Voltage: %.2fV     Avg Temp: %.2fC\n",
-                  numFoundModules, getPackVoltage(), getAvgCellVolt(), getAvgTemperature());
-
-  LOG_CONSOLE("Lowest pack voltage %.2fV was reached at ", getHistLowestPackVolt());
-  LOG_TIMESTAMP_LN(getHistLowestPackVoltTimeStamp());
-  LOG_CONSOLE("Highest pack voltage %.2fV was reached at ", getHistHighestPackVolt());
-  LOG_TIMESTAMP_LN(getHistHighestPackVoltTimeStamp());
-  LOG_CONSOLE("Lowest pack temp %.2fC was reached at ", getHistLowestPackTemp());
-  LOG_TIMESTAMP_LN(getHistLowestPackTempTimeStamp());
-  LOG_CONSOLE("Highest pack temp %.2fC was reached at ", getHistHighestPackTemp());
-  LOG_TIMESTAMP_LN(getHistHighestPackTempTimeStamp());
-
-  LOG_CONSOLE("INL_EVSE_DISC: %d\n", digitalRead(INL_EVSE_DISC));
-  LOG_CONSOLE("INH_RUN: %d\n", digitalRead(INH_RUN));
-  LOG_CONSOLE("INH_CHARGING: %d\n", digitalRead(INH_CHARGING));
-
-  //testing scafolding
-  LOG_CONSOLE("getHighCellVolt() < settings->charger_cycle_v_setpoint.getVal()    : %f < %f?\n", getHighCellVolt(), settings->charger_cycle_v_setpoint.getVal());
-  LOG_CONSOLE("getHighCellVolt() < settings->max_charge_v_setpoint.getVal()    : %f < %f?\n", getHighCellVolt(), settings->max_charge_v_setpoint.getVal());
+  if (alerts > 0) {
+    LOG_CONSOLE("  MODULE HAS ALERTS:\n");
+    if (alerts & 1) {
+      LOG_CONSOLE("    Over temperature on TS1\n");
+    }
+    if (alerts & 2) {
+      LOG_CONSOLE("    Over temperature on TS2\n");
+    }
+    if (alerts & 4) {
+      LOG_CONSOLE("    Sleep mode active\n");
+    }
+    if (alerts & 8) {
+      LOG_CONSOLE("    Thermal shutdown active\n");
+    }
+    if (alerts & 0x10) {
+      LOG_CONSOLE("    Test Alert\n");
+    }
+    if (alerts & 0x20) {
+      LOG_CONSOLE("    OTP EPROM Uncorrectable Error\n");
+    }
+    if (alerts & 0x40) {
+      LOG_CONSOLE("    GROUP3 Regs Invalid\n");
+    }
+    if (alerts & 0x80) {
+      LOG_CONSOLE("    Address not registered\n");
+    }
+  }
+  if (faults > 0 || alerts > 0) LOG_CONSOLE("\n");
 }
 
 /////////////////////////////////////////////////
-/// \brief prints the pack details to the console.
+/// \brief prints one part of the pack details in CSV format to the console: the header, then a line per module.
+///
+/// @return false if part is past the last module, nothing was printed.
 //////////////////////////////////////////////////
-void BMSModuleManager::printPackGraph() {
-  char graphLine[200];
-  int cellX, coli;
-  float deltaV = highCellVolt - lowCellVolt;
-  float rowV;
-  char barchar = 'Z';
-  unsigned int seconds = millis() / 1000;
-
-  memset(graphLine, 0, 86);
-  LOG_CONSOLE("\n====================================================================================\n");
+bool BMSModuleManager::printAllCSV(uint16_t part) {
+  int y = part - 1;
 
-  LOG_CONSOLE("=  %3d days, %02d:%02d:%02d            cell voltage Graph (V)                            =\n",
-              seconds / 86400, (seconds % 86400) / 3600, (seconds % 3600) / 60, (seconds % 60));
-  LOG_CONSOLE("====================================================================================\n");
+  if (part == 0) {
+    LOG_CONSOLE("Module#,time (ms),cell1,cell2,cell3,cell4,cell5,cell6,temp1,temp2\n");
+    return true;
+  }
+  if (y >= MAX_MODULE_ADDR) return false;
+  if (modules[y].getAddress() > 0) {
+    LOG_CONSOLE("%d,%lu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%.2f\n", modules[y].getAddress(), (unsigned long)millis(),
+                modules[y].getCellVoltage(0), modules[y].getCellVoltage(1), modules[y].getCellVoltage(2),
+                modules[y].getCellVoltage(3), modules[y].getCellVoltage(4), modules[y].getCellVoltage(5),
+                modules[y].getTemperature(0), modules[y].getTemperature(1));
+  }
+  return true;
+}
 
+/////////////////////////////////////////////////
+/// \brief writes one part of what printAllCSV() prints: the time, then an object per module in "modules".
+///
+/// @return false if part is past the end of the array, nothing was written.
+//////////////////////////////////////////////////
+bool BMSModuleManager::writeAllCSV(StructuredWriter* doc, uint16_t part) {
+  int y = part - 1;
 
-  //print graph header
-  LOG_CONSOLE("          ");
-  for (int mod = 0; mod < numFoundModules; mod++) {
-    LOG_CONSOLE(" | M%-2d|", mod + 1);
+  if (part == 0) {
+    doc->putUint("millis", millis());
+    doc->beginArray("modules");
+    return true;
   }
-  LOG_CONSOLE("\n");
-
-  LOG_CONSOLE("          ");
-  for (cellX = 0; cellX < numFoundModules * 6; cellX++) {
-    if (cellX % 6 == 0) {
-      LOG_CONSOLE(" ");
-    }
-    LOG_CONSOLE("%d", cellX % 6 + 1);
+  if (y > MAX_MODULE_ADDR) return false;
+  if (y == MAX_MODULE_ADDR) {
+    doc->endArray();
+  } else if (modules[y].getAddress() > 0) {
+    writeModule(doc, y, false);
   }
-  LOG_CONSOLE("\n");
+  return true;
+}
 
-  LOG_CONSOLE("          ");
-  for (cellX = 0; cellX < numFoundModules * 7; cellX++) {
-    graphLine[cellX] = '=';
+/////////////////////////////////////////////////
+/// \brief writes one part of what printPackSummary() prints: a module per part in "modules", then the
+/// "pack" and its "inputs".
+///
+/// @return false if part is past the inputs, nothing was written.
+//////////////////////////////////////////////////
+bool BMSModuleManager::writePackSummary(StructuredWriter* doc, uint16_t part) {
+  if (part < MAX_MODULE_ADDR) {
+    if (part == 0) doc->beginArray("modules");
+    if (modules[part].getAddress() > 0) writeModule(doc, part, true);
+    return true;
   }
-  graphLine[cellX] = '\n';
-  LOG_CONSOLE(graphLine);
 
-  /*for (int row = 128; row <= 256 ; row++){
-    LOG_CONSOLE("%i : %c ", row, row);
-  }*/
-
-  for (int row = 40; row >= 0; row--) {
-    memset(graphLine, 0, 86);
-    rowV = deltaV * row / 40 + lowCellVolt;
-    LOG_CONSOLE("%.3fV |", rowV);
-
-    if (getHighCellVolt() > settings->precision_balance_v_setpoint.getVal()) {
-      if (rowV > getLowCellVolt() + settings->precision_balance_cell_v_offset.getVal()) {
-        LOG_CONSOLE("B ");
-        barchar = 'B';
-      } else {
-        LOG_CONSOLE("| ");
-        barchar = 177;
-      }
-    } else if (getHighCellVolt() > settings->rough_balance_v_setpoint.getVal()) {
-      if (rowV > getLowCellVolt() + settings->rough_balance_cell_v_offset.getVal()) {
-        LOG_CONSOLE("B ");
-        barchar = 'B';
-      } else {
-        LOG_CONSOLE("| ");
-        barchar = 177;
-      }
-    } else {
-      LOG_CONSOLE("| ");
-    }
-    for (cellX = 0, coli = 0; cellX < numFoundModules * 6; cellX++, coli++) {
-      if (cellX % 6 == 0) {
-        graphLine[coli] = '|';
-        coli++;
-      }
-      if (modules[cellX / 6].getCellVoltage(cellX % 6) < rowV) {
-        graphLine[coli] = ' ';
-      } else {
-        graphLine[coli] = barchar;
-        //graphLine[cellX] = 'X';
-      }
-    }
-    graphLine[coli] = '\n';
-    LOG_CONSOLE(graphLine);
+  switch (part - MAX_MODULE_ADDR) {
+    case 0:
+      doc->endArray();
+      doc->beginObject("pack");
+      doc->putInt("modules", numFoundModules);
+      doc->putFloat("voltage", getPackVoltage());
+      doc->putFloat("avgCellVoltage", getAvgCellVolt());
+      doc->putFloat("avgTemp", getAvgTemperature());
+      writeHistory(doc);
+      doc->endObject();
+      return true;
+    case 1:
+      doc->beginObject("inputs");
+      doc->putInt("INL_EVSE_DISC", digitalRead(INL_EVSE_DISC));
+      doc->putInt("INH_RUN", digitalRead(INH_RUN));
+      doc->putInt("INH_CHARGING", digitalRead(INH_CHARGING));
+      doc->endObject();
+      return true;
   }
+  return false;
+}
 
-  LOG_CONSOLE("          ");
-  for (cellX = 0; cellX < numFoundModules * 7; cellX++) {
-    graphLine[cellX] = '=';
-  }
-  graphLine[cellX] = '\n';
-  LOG_CONSOLE(graphLine);
-  LOG_CONSOLE("          ");
-  for (cellX = 0; cellX < numFoundModules * 6; cellX++) {
-    if (cellX % 6 == 0) {
-      LOG_CONSOLE(" ");
-    }
-    LOG_CONSOLE("%d", cellX % 6 + 1);
-  }
-  LOG_CONSOLE("\n          ");
-  for (int mod = 0; mod < numFoundModules; mod++) {
-    LOG_CONSOLE(" | M%-2d|", mod + 1);
-  }
-  LOG_CONSOLE("\n");
+/////////////////////////////////////////////////
+/// \brief writes the historic extremes of the pack and its cells, the times in seconds since the epoch.
+//////////////////////////////////////////////////
+void BMSModuleManager::writeHistory(StructuredWriter* doc) {
+  doc->putFloat("lowestVoltage", getHistLowestPackVolt());
+  doc->putUint("lowestVoltageTime", getHistLowestPackVoltTimeStamp());
+  doc->putFloat("highestVoltage", getHistHighestPackVolt());
+  doc->putUint("highestVoltageTime", getHistHighestPackVoltTimeStamp());
+  doc->putFloat("lowestTemp", getHistLowestPackTemp());
+  doc->putUint("lowestTempTime", getHistLowestPackTempTimeStamp());
+  doc->putFloat("highestTemp", getHistHighestPackTemp());
+  doc->putUint("highestTempTime", getHistHighestPackTempTimeStamp());
+  doc->putFloat("lowestCellVoltage", getHistLowestCellVolt());
+  doc->putFloat("highestCellVoltage", getHistHighestCellVolt());
+  doc->putFloat("highestCellDiff", getHistHighestCellDiffVolt());
 }
 
 /////////////////////////////////////////////////
-/// \brief prints the pack details in CSV format to the console.
+/// \brief writes module y as an object: its address, cells and temperatures, with the summary also its
+/// extremes, historic values, faults and alerts (the bits of getFaults() and getAlerts()).
 //////////////////////////////////////////////////
-void BMSModuleManager::printAllCSV() {
-  LOG_CONSOLE("Module#,time (ms),cell1,cell2,cell3,cell4,cell5,cell6,temp1,temp2\n");
-  for (int y = 0; y < MAX_MODULE_ADDR; y++) {
-    if (modules[y].getAddress() > 0) {
-      LOG_CONSOLE("%d", modules[y].getAddress());
-      LOG_CONSOLE(",");
-      LOG_CONSOLE("%d", millis());
-      LOG_CONSOLE(",");
-      for (int i = 0; i < 6; i++) {
-        LOG_CONSOLE("%.3f,", modules[y].getCellVoltage(i));
-      }
-      LOG_CONSOLE("%.2f,", modules[y].getTemperature(0));
-      LOG_CONSOLE("%.2f\n", modules[y].getTemperature(1));
-    }
+void BMSModuleManager::writeModule(StructuredWriter* doc, int y, bool summary) {
+  BMSModule& module = modules[y];
+
+  doc->beginObject();
+  doc->putUint("address", module.getAddress());
+  doc->beginArray("cells");
+  for (int i = 0; i < 6; i++) doc->putFloat(0, module.getCellVoltage(i));
+  doc->endArray();
+  doc->beginArray("temps");
+  for (int i = 0; i < 2; i++) doc->putFloat(0, module.getTemperature(i));
+  doc->endArray();
+  if (summary) {
+    doc->putFloat("voltage", module.getModuleVoltage());
+    doc->putFloat("lowCellV", module.getLowCellV());
+    doc->putFloat("highCellV", module.getHighCellV());
+    doc->putFloat("lowTemp", module.getLowTemp());
+    doc->putFloat("highTemp", module.getHighTemp());
+    doc->putFloat("lowestVoltage", module.getLowestModuleVolt());
+    doc->putFloat("highestVoltage", module.getHighestModuleVolt());
+    doc->putFloat("lowestTemp", module.getLowestTemp());
+    doc->putFloat("highestTemp", module.getHighestTemp());
+    doc->beginArray("lowestCells");
+    for (int i = 0; i < 6; i++) doc->putFloat(0, module.getLowestCellVolt(i));
+    doc->endArray();
+    doc->beginArray("highestCells");
+    for (int i = 0; i < 6; i++) doc->putFloat(0, module.getHighestCellVolt(i));
+    doc->endArray();
+    doc->putUint("faults", module.getFaults());
+    doc->putUint("alerts", module.getAlerts());
+    doc->putUint("overVoltageCells", module.getCOVCells());
+    doc->putUint("underVoltageCells", module.getCUVCells());
   }
-}
\ No newline at end of file
+  doc->endObject();
+}
@@ -3,12 +3,15 @@
 #include <Arduino.h>
 #include "BMSModule.hpp"
 #include "BMSDriver.hpp"
+#include "StructuredWriter.hpp"
 
 class BMSModuleManager
 {
   public:
-    BMSModuleManager(Settings* sett);
+    BMSModuleManager(Settings* sett, BMSBus* driver, Logger* logger);
     int seriescells();
+    int getNumFoundModules();
+    BMSModule* getModulePtr(int index);
     void resetModuleRecordedValues();
     void StopBalancing();
     void balanceCells(uint8_t duration, float cell_v_offset);
@@ -16,6 +19,7 @@ class BMSModuleManager
     void clearFaults();
     void sleepBoards();
     void wakeBoards();
+    uint16_t countSleepingBoards();
     uint16_t getAllVoltTemp();
     void readSetpoints();
     void setBatteryID(int id);
@@ -49,9 +53,11 @@ class BMSModuleManager
     /*
       void processCANMsg(CAN_FRAME &frame);
     */
-    void printAllCSV();
-    void printPackSummary();
-    void printPackGraph();
+    bool printAllCSV(uint16_t part);
+    bool printPackSummary(uint16_t part);
+    bool writeAllCSV(StructuredWriter* doc, uint16_t part);
+    bool writePackSummary(StructuredWriter* doc, uint16_t part);
+    void writeHistory(StructuredWriter* doc);
 
 
   private:
@@ -74,6 +80,14 @@ class BMSModuleManager
     bool lineFault;     //true if we lose comms with modules.
 
     Settings* settings;
+    BMSBus* driver;
+    Logger* logger;
+    Logger* getLoggerPtr();
+    void printModuleSummary(int y, uint8_t section);
+    void writeModule(StructuredWriter* doc, int y, bool summary);
+    static Logger::Subsystem getLogSubsystem() {
+      return Logger::MODULE;
+    }
 };
 
 #endif //ifndef BMSMODULEMANAGER_HPP_
@@ -0,0 +1,261 @@
+#include "CellFaultMonitor.hpp"
+#include "Logger.hpp"
+
+//temperatures at or below this value mean the sensor is not connected
+#define SENSOR_DISCONNECTED_T -70.0f
+
+/////////////////////////////////////////////////
+/// \brief Constructor, no lane is asserted or counting.
+/////////////////////////////////////////////////
+CellFaultMonitor::CellFaultMonitor(Settings* sett, Logger* logger)
+  : settings(sett),
+    logger(logger),
+    lastUpdate(0),
+    remainderMs(0) {
+  memset(cellPlanes, 0, sizeof(cellPlanes));
+  memset(cellActive, 0, sizeof(cellActive));
+  memset(cellAsserted, 0, sizeof(cellAsserted));
+  memset(sensorPlanes, 0, sizeof(sensorPlanes));
+  memset(sensorActive, 0, sizeof(sensorActive));
+  memset(sensorAsserted, 0, sizeof(sensorAsserted));
+}
+
+Logger* CellFaultMonitor::getLoggerPtr() {
+  return logger;
+}
+
+bool CellFaultMonitor::testLane(const uint32_t* words, uint32_t lane) {
+  return (words[lane >> 5] >> (lane & 31)) & 1;
+}
+
+void CellFaultMonitor::setLane(uint32_t* words, uint32_t lane) {
+  words[lane >> 5] |= 1ul << (lane & 31);
+}
+
+/////////////////////////////////////////////////
+/// \brief debounces the 32 lanes of a word and returns the lanes whose condition lasted for the window.
+///
+/// @param planes The COUNTER_BITS vertical counter planes of the word, updated in place.
+/// @param condition The lanes where the fault condition is currently true.
+/// @param previous The lanes where the fault condition was true at the previous update.
+/// @param quanta The time elapsed since the previous update in QUANTUM_MS.
+/// @param threshold The debounce window in QUANTUM_MS.
+/////////////////////////////////////////////////
+uint32_t CellFaultMonitor::debounceWord(uint32_t* planes, uint32_t condition, uint32_t previous, uint32_t quanta, uint32_t threshold) {
+  uint32_t carry = 0;
+  uint32_t keep = condition & previous;
+  uint32_t add, sum, gt = 0, eq = 0xffffffff;
+  uint32_t i;
+
+  //ripple carry add of the elapsed quanta to all the lanes at once
+  for (i = 0; i < COUNTER_BITS; i++) {
+    add = ((quanta >> i) & 1) ? 0xffffffff : 0;
+    sum = planes[i] ^ add ^ carry;
+    carry = (planes[i] & add) | (carry & (planes[i] ^ add));
+    planes[i] = sum;
+  }
+  //saturate the lanes that overflowed, lanes that just became true start counting from 0
+  for (i = 0; i < COUNTER_BITS; i++) {
+    planes[i] = (planes[i] | carry) & keep;
+  }
+  //lanes >= threshold, compared from the most significant plane down
+  for (i = COUNTER_BITS; i-- > 0;) {
+    if ((threshold >> i) & 1) {
+      eq &= planes[i];
+    } else {
+      gt |= eq & planes[i];
+      eq &= ~planes[i];
+    }
+  }
+  return (gt | eq) & condition;
+}
+
+/////////////////////////////////////////////////
+/// \brief evaluates the thresholds on every cell and sensor and advances the debounce counters.
+///
+/// Called once per controller tick with the latest readings of the modules.
+/////////////////////////////////////////////////
+void CellFaultMonitor::update(BMSModuleManager* bms) {
+  uint32_t cellCondition[2][CELL_WORDS];      //OV, UV
+  uint32_t sensorCondition[2][SENSOR_WORDS];  //OT, UT
+  uint32_t t = millis();
+  uint32_t elapsed = t - lastUpdate + remainderMs;
+  uint32_t quanta = elapsed / QUANTUM_MS;
+  uint32_t threshold = (settings->fault_debounce_ms.getVal() + QUANTUM_MS - 1) / QUANTUM_MS;
+  uint32_t reached, lane, y, i, c, w;
+  BMSModule* module;
+  float value;
+
+  remainderMs = elapsed % QUANTUM_MS;
+  lastUpdate = t;
+  if (quanta > COUNTER_MAX) quanta = COUNTER_MAX;
+  if (threshold > COUNTER_MAX) threshold = COUNTER_MAX;
+
+  memset(cellCondition, 0, sizeof(cellCondition));
+  memset(sensorCondition, 0, sizeof(sensorCondition));
+  for (y = 0; y < MAX_MODULES; y++) {
+    module = bms->getModulePtr(y);
+    if (module->getAddress() == 0) break;  //no more modules
+    for (i = 0; i < CELLS_PER_MODULE; i++) {
+      value = module->getCellVoltage(i);
+      lane = y * CELLS_PER_MODULE + i;
+      if (value > settings->over_v_setpoint.getVal()) setLane(cellCondition[OV], lane);
+      if (value < settings->under_v_setpoint.getVal()) setLane(cellCondition[UV], lane);
+    }
+    for (i = 0; i < SENSORS_PER_MODULE; i++) {
+      value = module->getTemperature(i);
+      if (value <= SENSOR_DISCONNECTED_T) continue;
+      lane = y * SENSORS_PER_MODULE + i;
+      if (value > settings->over_t_setpoint.getVal()) setLane(sensorCondition[0], lane);
+      if (value < settings->under_t_setpoint.getVal()) setLane(sensorCondition[1], lane);
+    }
+  }
+
+  for (c = 0; c < 2; c++) {
+    for (w = 0; w < CELL_WORDS; w++) {
+      reached = debounceWord(cellPlanes[c][w], cellCondition[c][w], cellActive[c][w], quanta, threshold);
+      cellActive[c][w] = cellCondition[c][w];
+      logNewLanes((Condition)(OV + c), w, reached & ~cellAsserted[c][w], CELLS_PER_MODULE);
+      cellAsserted[c][w] = reached;
+    }
+    for (w = 0; w < SENSOR_WORDS; w++) {
+      reached = debounceWord(sensorPlanes[c][w], sensorCondition[c][w], sensorActive[c][w], quanta, threshold);
+      sensorActive[c][w] = sensorCondition[c][w];
+      logNewLanes((Condition)(OT + c), w, reached & ~sensorAsserted[c][w], SENSORS_PER_MODULE);
+      sensorAsserted[c][w] = reached;
+    }
+  }
+}
+
+void CellFaultMonitor::logNewLanes(Condition condition, uint32_t word, uint32_t lanes, uint32_t lanesPerModule) {
+  uint32_t lane;
+  while (lanes) {
+    lane = word * 32 + __builtin_ctz(lanes);
+    lanes &= lanes - 1;
+    LOG_WARN("%s on module %d %s %d\n", conditionName(condition), lane / lanesPerModule + 1,
+             (lanesPerModule == CELLS_PER_MODULE) ? "cell" : "sensor", lane % lanesPerModule + 1);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if at least one cell or sensor asserts the condition.
+/////////////////////////////////////////////////
+bool CellFaultMonitor::isAsserted(Condition condition) {
+  uint32_t any = 0;
+  if (condition == OV || condition == UV) {
+    for (uint32_t w = 0; w < CELL_WORDS; w++) any |= cellAsserted[condition - OV][w];
+  } else {
+    for (uint32_t w = 0; w < SENSOR_WORDS; w++) any |= sensorAsserted[condition - OT][w];
+  }
+  return any != 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if a cell or sensor of the module asserts the condition.
+///
+/// @param module The module index, 0 being the module with address 1.
+/////////////////////////////////////////////////
+bool CellFaultMonitor::isModuleAsserted(Condition condition, uint32_t module) {
+  if (condition == OV || condition == UV) {
+    for (uint32_t i = 0; i < CELLS_PER_MODULE; i++) {
+      if (isCellAsserted(condition, module, i)) return true;
+    }
+  } else {
+    for (uint32_t i = 0; i < SENSORS_PER_MODULE; i++) {
+      if (isSensorAsserted(condition, module, i)) return true;
+    }
+  }
+  return false;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the cell asserts the voltage condition (OV or UV).
+/////////////////////////////////////////////////
+bool CellFaultMonitor::isCellAsserted(Condition condition, uint32_t module, uint32_t cell) {
+  if ((condition != OV && condition != UV) || module >= MAX_MODULES || cell >= CELLS_PER_MODULE) return false;
+  return testLane(cellAsserted[condition - OV], module * CELLS_PER_MODULE + cell);
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the sensor asserts the temperature condition (OT or UT).
+/////////////////////////////////////////////////
+bool CellFaultMonitor::isSensorAsserted(Condition condition, uint32_t module, uint32_t sensor) {
+  if ((condition != OT && condition != UT) || module >= MAX_MODULES || sensor >= SENSORS_PER_MODULE) return false;
+  return testLane(sensorAsserted[condition - OT], module * SENSORS_PER_MODULE + sensor);
+}
+
+const char* CellFaultMonitor::conditionName(Condition condition) {
+  switch (condition) {
+    case OV:
+      return "OV";
+    case UV:
+      return "UV";
+    case OT:
+      return "OT";
+    case UT:
+      return "UT";
+    default:
+      return "unknown";
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief prints the modules, cells and sensors asserting a condition to the console.
+/////////////////////////////////////////////////
+void CellFaultMonitor::printAsserted() {
+  bool voltage, any;
+  uint32_t lanesPerModule;
+
+  LOG_CONSOLE("fault debounce window: %ums\n", settings->fault_debounce_ms.getVal());
+  for (uint32_t c = 0; c < NUMBER_OF_CONDITIONS; c++) {
+    voltage = (c == OV || c == UV);
+    lanesPerModule = voltage ? CELLS_PER_MODULE : SENSORS_PER_MODULE;
+    any = false;
+    LOG_CONSOLE("%s:", conditionName((Condition)c));
+    for (uint32_t m = 0; m < MAX_MODULES; m++) {
+      if (!isModuleAsserted((Condition)c, m)) continue;
+      any = true;
+      LOG_CONSOLE(" module %d %s", m + 1, voltage ? "cells" : "sensors");
+      for (uint32_t i = 0; i < lanesPerModule; i++) {
+        if (voltage ? isCellAsserted((Condition)c, m, i) : isSensorAsserted((Condition)c, m, i)) {
+          LOG_CONSOLE(" %d", i + 1);
+        }
+      }
+      LOG_CONSOLE(";");
+    }
+    LOG_CONSOLE(any ? "\n" : " none\n");
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief writes what printAsserted() prints: per condition the modules asserting it, with their cells
+/// or sensors (numbered from 1).
+/////////////////////////////////////////////////
+void CellFaultMonitor::writeAsserted(StructuredWriter* doc) {
+  bool voltage;
+  uint32_t lanesPerModule;
+
+  doc->putUint("debounceMs", settings->fault_debounce_ms.getVal());
+  doc->beginArray("conditions");
+  for (uint32_t c = 0; c < NUMBER_OF_CONDITIONS; c++) {
+    voltage = (c == OV || c == UV);
+    lanesPerModule = voltage ? CELLS_PER_MODULE : SENSORS_PER_MODULE;
+    doc->beginObject();
+    doc->putString("name", conditionName((Condition)c));
+    doc->beginArray("modules");
+    for (uint32_t m = 0; m < MAX_MODULES; m++) {
+      if (!isModuleAsserted((Condition)c, m)) continue;
+      doc->beginObject();
+      doc->putUint("module", m + 1);
+      doc->beginArray(voltage ? "cells" : "sensors");
+      for (uint32_t i = 0; i < lanesPerModule; i++) {
+        if (voltage ? isCellAsserted((Condition)c, m, i) : isSensorAsserted((Condition)c, m, i)) doc->putUint(0, i + 1);
+      }
+      doc->endArray();
+      doc->endObject();
+    }
+    doc->endArray();
+    doc->endObject();
+  }
+  doc->endArray();
+}
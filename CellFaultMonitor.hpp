@@ -0,0 +1,68 @@
+#ifndef CELLFAULTMONITOR_HPP_
+#define CELLFAULTMONITOR_HPP_
+
+#include <Arduino.h>
+#include "Config.hpp"
+#include "BMSModuleManager.hpp"
+
+/////////////////////////////////////////////////
+/// \brief Debounces the OV/UV/OT/UT conditions of every cell and temperature sensor of the pack.
+///
+/// Each cell (module * 6 + cell) and sensor (module * 2 + sensor) is a lane in a bitset of 32 bit words.
+/// The debounce counters are vertical counters: plane i of a word holds bit i of the counter of all
+/// 32 lanes, so adding the elapsed time, saturating and comparing against the window is done for 32
+/// lanes at a time with a handful of word operations. Counters count in QUANTUM_MS and restart when
+/// the condition goes away.
+/////////////////////////////////////////////////
+class CellFaultMonitor {
+public:
+  enum Condition {
+    OV = 0,
+    UV,
+    OT,
+    UT,
+    NUMBER_OF_CONDITIONS
+  };
+  static const uint32_t CELLS_PER_MODULE = 6;
+  static const uint32_t SENSORS_PER_MODULE = 2;
+  static const uint32_t MAX_MODULES = MAX_MODULE_ADDR;
+  static const uint32_t CELL_WORDS = (MAX_MODULES * CELLS_PER_MODULE + 31) / 32;
+  static const uint32_t SENSOR_WORDS = (MAX_MODULES * SENSORS_PER_MODULE + 31) / 32;
+  static const uint32_t COUNTER_BITS = 12;  //up to 40.95s with QUANTUM_MS of 10ms
+  static const uint32_t COUNTER_MAX = (1ul << COUNTER_BITS) - 1;
+  static const uint32_t QUANTUM_MS = 10;
+
+  CellFaultMonitor(Settings* sett, Logger* logger);
+  void update(BMSModuleManager* bms);
+  bool isAsserted(Condition condition);
+  bool isModuleAsserted(Condition condition, uint32_t module);
+  bool isCellAsserted(Condition condition, uint32_t module, uint32_t cell);
+  bool isSensorAsserted(Condition condition, uint32_t module, uint32_t sensor);
+  void printAsserted();
+  void writeAsserted(StructuredWriter* doc);
+
+private:
+  Settings* settings;
+  Logger* logger;
+  Logger* getLoggerPtr();
+  static Logger::Subsystem getLogSubsystem() {
+    return Logger::MODULE;
+  }
+  uint32_t lastUpdate;
+  uint32_t remainderMs;
+  //voltage conditions (OV, UV) on the cell lanes, temperature conditions (OT, UT) on the sensor lanes
+  uint32_t cellPlanes[2][CELL_WORDS][COUNTER_BITS];
+  uint32_t cellActive[2][CELL_WORDS];
+  uint32_t cellAsserted[2][CELL_WORDS];
+  uint32_t sensorPlanes[2][SENSOR_WORDS][COUNTER_BITS];
+  uint32_t sensorActive[2][SENSOR_WORDS];
+  uint32_t sensorAsserted[2][SENSOR_WORDS];
+
+  static uint32_t debounceWord(uint32_t* planes, uint32_t condition, uint32_t previous, uint32_t quanta, uint32_t threshold);
+  static const char* conditionName(Condition condition);
+  static bool testLane(const uint32_t* words, uint32_t lane);
+  static void setLane(uint32_t* words, uint32_t lane);
+  void logNewLanes(Condition condition, uint32_t word, uint32_t lanes, uint32_t lanesPerModule);
+};
+
+#endif /* CELLFAULTMONITOR_HPP_ */
@@ -0,0 +1,271 @@
+#include "CellGraph.hpp"
+#include "ConsoleOut.hpp"
+#include "Logger.hpp"
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the graph of the modules of bms is drawn with the balancing setpoints of sett.
+/////////////////////////////////////////////////
+CellGraph::CellGraph(BMSModuleManager* bms, Settings* sett, Logger* logger)
+  : bms(bms),
+    settings(sett),
+    logger(logger),
+    lowV(0.0f),
+    deltaV(0.0f),
+    cells(0),
+    row(-1),
+    nextFrame(0),
+    cursorUp(0),
+    cursorCol(1),
+    logWritten(0),
+    redrawPart(-1) {
+  memset(shown, 0, sizeof(shown));
+  memset(next, 0, sizeof(next));
+  memset(shownChars, 0, sizeof(shownChars));
+  memset(nextChars, 0, sizeof(nextChars));
+}
+
+Logger* CellGraph::getLoggerPtr() {
+  return logger;
+}
+
+/////////////////////////////////////////////////
+/// \brief prints one part of the graph: the header, a row or the footer.
+///
+/// The graph is printed by calling it with part 0, 1, 2, ... until it returns false. Part 0 takes the
+/// scale and composes the frame, the rows printed in the following ticks line up even though the cell
+/// voltages move in between.
+///
+/// @return false if part is past the end of the graph, nothing was printed.
+/////////////////////////////////////////////////
+bool CellGraph::printPart(uint16_t part) {
+  char line[LINE_LENGTH];
+  uint16_t n = LEFT;
+  unsigned int seconds = millis() / 1000;
+
+  memset(line, ' ', LEFT);
+  switch (part) {
+    case 0:
+      cells = bms->getNumFoundModules() * 6;
+      lowV = bms->getLowCellVolt();
+      deltaV = bms->getHighCellVolt() - lowV;
+      if (deltaV < 0.0f) deltaV = 0.0f;
+      composeFrame();
+      logWritten = console_out.log.getWritten();
+      LOG_CONSOLE("\n====================================================================================\n");
+
+      LOG_CONSOLE("=  %3d days, %02d:%02d:%02d            cell voltage Graph (V)                            =\n",
+                  seconds / 86400, (seconds % 86400) / 3600, (seconds % 3600) / 60, (seconds % 60));
+      LOG_CONSOLE("====================================================================================\n");
+      return true;
+    case 1:
+    case ROWS + 7:
+      //module numbers, above and below the graph
+      for (uint16_t mod = 0; mod < cells / 6; mod++) {
+        n += snprintf(line + n, LINE_LENGTH - n, " | M%-2d|", mod + 1);
+      }
+      break;
+    case 2:
+    case ROWS + 6:
+      //cell numbers
+      for (uint16_t cell = 0; cell < cells; cell++) {
+        if (cell % 6 == 0) line[n++] = ' ';
+        line[n++] = '1' + cell % 6;
+      }
+      break;
+    case 3:
+    case ROWS + 5:
+      memset(line + n, '=', cells / 6 * 7);
+      n += cells / 6 * 7;
+      break;
+    default:
+      if (part > ROWS + 4) return false;
+      //the rows, from the highest voltage down
+      n = renderRow(ROWS + 4 - part, line);
+      break;
+  }
+  line[n++] = '\n';
+  line[n] = 0;
+  getLoggerPtr()->consolePrint(line);
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief starts redrawing the graph printed last, the cursor being on the line below it.
+/////////////////////////////////////////////////
+void CellGraph::beginLive() {
+  memcpy(shown, next, sizeof(shown));
+  memcpy(shownChars, nextChars, sizeof(shownChars));
+  row = -1;
+  nextFrame = millis() + LIVE_PERIOD_MS;
+  cursorUp = 0;
+  cursorCol = 1;
+  redrawPart = -1;
+}
+
+/////////////////////////////////////////////////
+/// \brief rewrites what changed in one row of the live graph, composing a new frame when one is due.
+///
+/// When a cell left the scale, the scale is taken again with a margin of a quarter of the spread on both
+/// sides, so a pack drifting slowly does not make every frame a whole graph.
+///
+/// @return false if no frame is due yet, nothing was printed.
+/////////////////////////////////////////////////
+bool CellGraph::printChanges() {
+  if (redrawPart >= 0) {
+    if (printPart(redrawPart++)) return true;
+    beginLive();
+  }
+  if (row < 0) {
+    if ((int32_t)(millis() - nextFrame) < 0) return false;
+    nextFrame = millis() + LIVE_PERIOD_MS;
+    if (console_out.log.getWritten() != logWritten) {
+      //log messages were printed below the graph and scrolled it, the cursor moves would miss its rows
+      LOG_CONSOLE("\x1b[2J\x1b[H");
+      redrawPart = 0;
+      return true;
+    }
+    if (bms->getLowCellVolt() < lowV || bms->getHighCellVolt() > lowV + deltaV) {
+      float spread = bms->getHighCellVolt() - bms->getLowCellVolt();
+      float margin = spread / 4 + 0.005f;
+      lowV = bms->getLowCellVolt() - margin;
+      deltaV = spread + 2 * margin;
+      memset(shownChars, 0, sizeof(shownChars));
+    }
+    composeFrame();
+    row = ROWS;
+  }
+  printRowChanges(row);
+  if (--row < 0) {
+    char line[16];
+    memcpy(shown, next, sizeof(shown));
+    line[moveTo(line, 0, 0, 1)] = 0;
+    getLoggerPtr()->consolePrint(line);
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief stops redrawing the live graph and puts the cursor back on the line below it.
+/////////////////////////////////////////////////
+void CellGraph::endLive() {
+  char line[16];
+  //while redrawing, the cursor is below the last part printed already
+  if (redrawPart < 0) {
+    line[moveTo(line, 0, 0, 1)] = 0;
+    getLoggerPtr()->consolePrint(line);
+  }
+  row = -1;
+  redrawPart = -1;
+}
+
+/////////////////////////////////////////////////
+/// \brief composes the frame of the pack on the current scale: the bar of every cell and character of every row.
+/////////////////////////////////////////////////
+void CellGraph::composeFrame() {
+  float rowV;
+  float highCellV = bms->getHighCellVolt();
+  float lowCellV = bms->getLowCellVolt();
+
+  for (uint16_t cell = 0; cell < cells; cell++) {
+    next[cell] = getHeight(bms->getModulePtr(cell / 6)->getCellVoltage(cell % 6));
+  }
+  for (int r = 0; r <= (int)ROWS; r++) {
+    rowV = getRowV(r);
+    if (highCellV > settings->precision_balance_v_setpoint.getVal()) {
+      nextChars[r] = rowV > lowCellV + settings->precision_balance_cell_v_offset.getVal() ? 'B' : 177;
+    } else if (highCellV > settings->rough_balance_v_setpoint.getVal()) {
+      nextChars[r] = rowV > lowCellV + settings->rough_balance_cell_v_offset.getVal() ? 'B' : 177;
+    } else {
+      nextChars[r] = 'Z';
+    }
+  }
+}
+
+float CellGraph::getRowV(int r) {
+  return deltaV * r / ROWS + lowV;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of rows, from the lowest one, whose voltage v reaches.
+/////////////////////////////////////////////////
+uint8_t CellGraph::getHeight(float v) {
+  float estimate = deltaV > 0.0f ? (v - lowV) * ROWS / deltaV : 0.0f;
+  int h = 0;
+
+  //the estimate is off by one at most, the rows are compared like when they are rendered
+  if (estimate > ROWS + 1) {
+    h = ROWS + 1;
+  } else if (estimate > 0.0f) {
+    h = (int)estimate;
+  }
+  while (h > 0 && v < getRowV(h - 1)) h--;
+  while (h <= (int)ROWS && !(v < getRowV(h))) h++;
+  return h;
+}
+
+/////////////////////////////////////////////////
+/// \brief renders row r of the frame into line, without line end.
+///
+/// @return the length of the row.
+/////////////////////////////////////////////////
+uint16_t CellGraph::renderRow(int r, char* line) {
+  uint16_t n = snprintf(line, LINE_LENGTH, "%.3fV |%c ", getRowV(r), nextChars[r] == 'B' ? 'B' : '|');
+
+  for (uint16_t cell = 0; cell < cells && n < LINE_LENGTH - 3; cell++) {
+    if (cell % 6 == 0) line[n++] = '|';
+    line[n++] = r < next[cell] ? nextChars[r] : ' ';
+  }
+  return n;
+}
+
+/////////////////////////////////////////////////
+/// \brief rewrites the cells of row r whose bar changed, or the whole row when its bar character changed
+/// or the changes take more than the row.
+/////////////////////////////////////////////////
+void CellGraph::printRowChanges(int r) {
+  char line[LINE_LENGTH + 16];
+  uint8_t up = 4 + r;  //below the lowest row: the footer, then the line of the cursor
+  uint8_t savedUp = cursorUp;
+  uint16_t savedCol = cursorCol;
+  uint16_t n = 0;
+  uint16_t cell = 0;
+
+  if (nextChars[r] == shownChars[r]) {
+    for (; cell < cells && n < LINE_LENGTH - 16; cell++) {
+      bool filled = r < next[cell];
+      if (filled == (r < shown[cell])) continue;
+      n = moveTo(line, n, up, LEFT + 2 + cell / 6 * 7 + cell % 6);
+      line[n++] = filled ? nextChars[r] : ' ';
+      cursorCol++;
+    }
+  }
+  if (cell < cells) {
+    //the changes do not fit, the row is rewritten whole
+    cursorUp = savedUp;
+    cursorCol = savedCol;
+    n = moveTo(line, 0, up, 1);
+    uint16_t length = renderRow(r, line + n);
+    n += length;
+    cursorCol += length;
+    shownChars[r] = nextChars[r];
+  }
+  line[n] = 0;
+  if (n) getLoggerPtr()->consolePrint(line);
+}
+
+/////////////////////////////////////////////////
+/// \brief appends the ANSI sequences moving the cursor to the column col of the line up lines above the graph.
+///
+/// @return the length of line.
+/////////////////////////////////////////////////
+uint16_t CellGraph::moveTo(char* line, uint16_t n, uint8_t up, uint16_t col) {
+  if (up > cursorUp) {
+    n += sprintf(line + n, "\x1b[%uA", (unsigned)(up - cursorUp));
+  } else if (up < cursorUp) {
+    n += sprintf(line + n, "\x1b[%uB", (unsigned)(cursorUp - up));
+  }
+  if (col != cursorCol) n += sprintf(line + n, "\x1b[%uG", (unsigned)col);
+  cursorUp = up;
+  cursorCol = col;
+  return n;
+}
@@ -0,0 +1,67 @@
+#ifndef CELLGRAPH_HPP_
+#define CELLGRAPH_HPP_
+
+#include <Arduino.h>
+#include "Config.hpp"
+#include "BMSModuleManager.hpp"
+
+/////////////////////////////////////////////////
+/// \brief Draws the cell voltage graph on the console, once or live.
+///
+/// The graph is composed into a frame first: the number of rows the bar of every cell fills and the bar
+/// character of every row, on a scale taken from the pack. The text is rendered from the frame a whole
+/// row at a time and written in one go. printPart() prints the graph a part per call (the header, one
+/// row, the footer) so a long graph spans several ticks.
+///
+/// Live, a new frame is composed every LIVE_PERIOD_MS and only the cells whose bar changed are rewritten
+/// in place with ANSI cursor moves, a row at a time per printChanges(). A row whose bar character
+/// changed, or every row when a cell leaves the scale and it is taken again, is rewritten whole. The
+/// cursor moves relative to the line below the graph, the terminal must be wider than the graph. Log
+/// messages printed meanwhile scroll the graph up, so when the log wrote since the graph was drawn the
+/// screen is cleared and the whole graph drawn again, a part per printChanges().
+/////////////////////////////////////////////////
+class CellGraph {
+public:
+  static const uint32_t ROWS = 40;  //rows of the graph above its lowest one
+  static const uint32_t MAX_CELLS = MAX_MODULE_ADDR * 6;
+  static const uint32_t LEFT = 10;  //columns left of the first module: voltage of the row and balancing mark
+  static const uint32_t LINE_LENGTH = LEFT + MAX_MODULE_ADDR * 7 + 2;
+  static const uint32_t LIVE_PERIOD_MS = 250;
+
+  CellGraph(BMSModuleManager* bms, Settings* sett, Logger* logger);
+  bool printPart(uint16_t part);
+  void beginLive();
+  bool printChanges();
+  void endLive();
+
+private:
+  BMSModuleManager* bms;
+  Settings* settings;
+  Logger* logger;
+  Logger* getLoggerPtr();
+  static Logger::Subsystem getLogSubsystem() {
+    return Logger::CONSOLE;
+  }
+  float lowV;                      //scale of the graph, voltage of the lowest row
+  float deltaV;                    //and from the lowest to the highest row
+  uint16_t cells;                  //cells in the graph, taken with the scale
+  uint8_t shown[MAX_CELLS];        //rows filled by the bar of every cell, as on the terminal
+  uint8_t next[MAX_CELLS];         //and in the frame being drawn
+  char shownChars[ROWS + 1];       //bar character of every row as on the terminal, 0 to rewrite the row
+  char nextChars[ROWS + 1];
+  int8_t row;                      //next row of the live frame being drawn, -1 until the next frame
+  uint32_t nextFrame;
+  uint8_t cursorUp;                //lines of the cursor above the line below the graph
+  uint16_t cursorCol;
+  uint32_t logWritten;             //bytes the log had written when the graph was drawn whole
+  int16_t redrawPart;              //next part of the graph drawn again, -1 when not redrawing
+
+  void composeFrame();
+  float getRowV(int r);
+  uint8_t getHeight(float v);
+  uint16_t renderRow(int r, char* line);
+  void printRowChanges(int r);
+  uint16_t moveTo(char* line, uint16_t n, uint8_t up, uint16_t col);
+};
+
+#endif /* CELLGRAPH_HPP_ */
@@ -1,4 +1,5 @@
 #include "Config.hpp"
+#include "ConsoleOut.hpp"
 #include <string>
 #include <errno.h>
 
@@ -28,10 +29,13 @@ Settings::Settings()
     bat12v_over_v_setpoint("bat12v_over_v_setpoint", true, 0.0f, 14.5f, 13.0f, 15.0f, "Triggers 12V battery OV error"),
     bat12v_under_v_setpoint("bat12v_under_v_setpoint", true, 0.0f, 10.0f, 9.0f, 12.5f, "Triggers 12V battery UV error"),
     bat12v_scaling_divisor("bat12v_scaling_divisor", true, 0.0f, 61.78f, 50.0f, 70.0f, "12V battery ADC devisor 0-1023 -> 0-15V"),
-    fault_debounce_count("fault_debounce_count", true, 0, 5, 1, 100, "Number of time a fault condition has to be counted before the fault is recorded/asserted"),
+    fault_debounce_ms("fault_debounce_ms", true, 0, 2000, 0, 40000, "Miliseconds a fault condition has to last before the fault is recorded/asserted"),
     module_count("module_count", true, 0, 7, 1, 64, "Triggers an error if we see less than this number of modules."),
     oled_cycle_time("oled_cycle_time", true, 0, 4000, 1000, 50000, "Miliseconds per oled screen cycle."),
-    time_before_first_sleep("time_before_first_sleep", true, 0, 600000, 20000, 3600000, "Miliseconds before the fisrt sleep cycle after reboot.") {
+    time_before_first_sleep("time_before_first_sleep", true, 0, 600000, 20000, 3600000, "Miliseconds before the fisrt sleep cycle after reboot."),
+    console_idle_timeout("console_idle_timeout", true, 0, 600000, 10000, 3600000, "Miliseconds the board stays awake after the last console input."),
+    module_sample_period_s("module_sample_period_s", true, 0, 60, 2, 3600, "Seconds between module measurements while the modules sleep in STANDBY."),
+    trace_capture("trace_capture", true, 0, 0, 0, 1, "1: stream a trace of the inputs from the next boot on the second USB serial port, for trace_replay.") {
   //TODO check EEPROM for initialisation and version
   //if no match push defaults to eeprom
   //load config from eeprom
@@ -60,20 +64,40 @@ Settings::Settings()
   parameters.push_back(&bat12v_over_v_setpoint);
   parameters.push_back(&bat12v_under_v_setpoint);
   parameters.push_back(&bat12v_scaling_divisor);
-  parameters.push_back(&fault_debounce_count);
+  parameters.push_back(&fault_debounce_ms);
   parameters.push_back(&module_count);
   parameters.push_back(&oled_cycle_time);
   parameters.push_back(&time_before_first_sleep);
+  parameters.push_back(&console_idle_timeout);
+  parameters.push_back(&module_sample_period_s);
+  parameters.push_back(&trace_capture);
+  for (auto i = parameters.begin(); i != parameters.end(); i++) {
+    //a name already taken, or past SETTINGS_MAX_PARAMS, would leave the parameter unreachable
+    if (!index.add((*i)->paramName, *i)) {
+      console_out.reply.printf("Parameter %s not indexed, name taken or SETTINGS_MAX_PARAMS too small\n", (*i)->paramName);
+    }
+  }
 }
 
 void Settings::printSettings() {
-  Serial.printf("%35s | %-10s | %-10s | [%10s , %-10s] | %s\n", "param name", "value", "default", "min", "max", "description");
-  Serial.println("------------------------------------------------------------------------------------------------------------");
+  console_out.reply.printf("%35s | %-10s | %-10s | [%10s , %-10s] | %s\n", "param name", "value", "default", "min", "max", "description");
+  console_out.reply.println("------------------------------------------------------------------------------------------------------------");
   for (auto i = parameters.begin(); i != parameters.end(); i++) {
     (*i)->prettyPrint();
   }
 }
 
+/////////////////////////////////////////////////
+/// \brief writes the parameters as an array of objects, the columns of printSettings().
+/////////////////////////////////////////////////
+void Settings::writeSettings(StructuredWriter* doc) {
+  doc->beginArray("settings");
+  for (auto i = parameters.begin(); i != parameters.end(); i++) {
+    (*i)->write(doc);
+  }
+  doc->endArray();
+}
+
 void Settings::reloadDefaultSettings() {
   for (auto i = parameters.begin(); i != parameters.end(); i++) {
     (*i)->resetDefault();
@@ -82,17 +106,56 @@ void Settings::reloadDefaultSettings() {
 
 template<>
 void ParamImpl<uint32_t>::prettyPrint() {
-  Serial.printf("%35s | %-10u | %-10u | [%10u , %-10u] | %s\n", paramName, value, valueDefault, valueMin, valueMax, description);
+  console_out.reply.printf("%35s | %-10u | %-10u | [%10u , %-10u] | %s\n", paramName, value, valueDefault, valueMin, valueMax, description);
 }
 
 template<>
 void ParamImpl<int32_t>::prettyPrint() {
-  Serial.printf("%35s | %-10d | %-10d | [%10d , %-10d] | %s\n", paramName, value, valueDefault, valueMin, valueMax, description);
+  console_out.reply.printf("%35s | %-10d | %-10d | [%10d , %-10d] | %s\n", paramName, value, valueDefault, valueMin, valueMax, description);
 }
 
 template<>
 void ParamImpl<float>::prettyPrint() {
-  Serial.printf("%35s | %-10.3f | %-10.3f | [%10.3f , %-10.3f] | %s\n", paramName, value, valueDefault, valueMin, valueMax, description);
+  console_out.reply.printf("%35s | %-10.3f | %-10.3f | [%10.3f , %-10.3f] | %s\n", paramName, value, valueDefault, valueMin, valueMax, description);
+}
+
+template<>
+void ParamImpl<uint32_t>::write(StructuredWriter* doc) {
+  doc->beginObject();
+  doc->putString("name", paramName);
+  doc->putUint("value", value);
+  doc->putUint("default", valueDefault);
+  doc->putUint("min", valueMin);
+  doc->putUint("max", valueMax);
+  doc->putBool("editable", editable);
+  doc->putString("description", description);
+  doc->endObject();
+}
+
+template<>
+void ParamImpl<int32_t>::write(StructuredWriter* doc) {
+  doc->beginObject();
+  doc->putString("name", paramName);
+  doc->putInt("value", value);
+  doc->putInt("default", valueDefault);
+  doc->putInt("min", valueMin);
+  doc->putInt("max", valueMax);
+  doc->putBool("editable", editable);
+  doc->putString("description", description);
+  doc->endObject();
+}
+
+template<>
+void ParamImpl<float>::write(StructuredWriter* doc) {
+  doc->beginObject();
+  doc->putString("name", paramName);
+  doc->putFloat("value", value);
+  doc->putFloat("default", valueDefault);
+  doc->putFloat("min", valueMin);
+  doc->putFloat("max", valueMax);
+  doc->putBool("editable", editable);
+  doc->putString("description", description);
+  doc->endObject();
 }
 
 template<>
@@ -167,13 +230,27 @@ int32_t ParamImpl<float>::setVal(const char* valStr) {
   return 0;
 }
 
+/////////////////////////////////////////////////
+/// \brief returns the parameter of that exact name, 0 if there is none.
+/////////////////////////////////////////////////
 Param* Settings::getParam(const char* name) {
+  return index.find(name);
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the names of the parameters, sorted, for the completion of the console.
+/////////////////////////////////////////////////
+NameIndex<Param, SETTINGS_MAX_PARAMS>* Settings::getIndex() {
+  return &index;
+}
+
+//bytes the settings take in EEPROM
+uint16_t Settings::size() {
+  uint16_t n = 0;
   for (auto i = parameters.begin(); i != parameters.end(); i++) {
-    if (strncmp((*i)->paramName, name, strlen((*i)->paramName)) == 0) {
-      return *i;
-    }
+    n += (*i)->getSize();
   }
-  return 0;
+  return n;
 }
 
 void Settings::saveAllSettingsToEEPROM(uint32_t address) {
@@ -186,4 +263,13 @@ void Settings::loadAllSettingsFromEEPROM(uint32_t address) {
   for (auto i = parameters.begin(); i != parameters.end(); i++) {
     address += (*i)->loadFromEEPROM(address);
   }
+}
+
+//true if the EEPROM at address holds the settings as they are, saving them would not change a byte
+bool Settings::matchEEPROM(uint32_t address) {
+  for (auto i = parameters.begin(); i != parameters.end(); i++) {
+    if (!(*i)->matchEEPROM(address)) return false;
+    address += (*i)->getSize();
+  }
+  return true;
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include <Arduino.h>
 #include <EEPROM.h>
 #include <list>
+#include "StructuredWriter.hpp"
+#include "NameIndex.hpp"
 
 //enable testing mode that simply cycles through all states instead of triggers
 //#define STATECYCLING 1
@@ -45,6 +47,11 @@
 //Set to the proper port for your USB connection - SerialUSB on Due (Native) or Serial for Due (Programming) or Teensy
 #define SERIALCONSOLE Serial
 
+//Port the traces of TraceRecorder are streamed to, the second port of the Dual Serial USB type
+#ifdef USB_DUAL_SERIAL
+#define SERIALTRACE SerialUSB1
+#endif
+
 /*
    State machine
 */
@@ -52,7 +59,23 @@
 #define LOOP_PERIOD_ACTIVE_MS 200
 #define LOOP_PERIOD_STANDBY_MS 2000
 
-#define EEPROM_VERSION 6
+
+/*
+   Power management
+*/
+// Conservative wake latency budgets of the Snooze modes. A mode is only entered when the time left
+// before the next deadline is at least POWER_BREAK_EVEN_FACTOR times its wake latency.
+#define POWER_SLEEP_WAKE_LATENCY_MS 1
+#define POWER_DEEPSLEEP_WAKE_LATENCY_MS 5
+#define POWER_BREAK_EVEN_FACTOR 10
+
+// Rough per module board supply currents used to estimate the parasitic drain of the modules.
+// Adjust to values measured on your modules.
+#define MODULE_AWAKE_CURRENT_UA 3000
+#define MODULE_SLEEP_CURRENT_UA 100
+
+#define EEPROM_VERSION 10
+#define SETTINGS_MAX_PARAMS 48  //the parameters the name index of the settings holds
 
 #define CPU_RESTART_ADDR (uint32_t *)0xE000ED0C
 #define CPU_RESTART_VAL 0x5FA0004
@@ -68,11 +91,13 @@ public:
   }
   const char* paramName;
   virtual void prettyPrint();
+  virtual void write(StructuredWriter* doc);
   virtual int32_t setVal(const char* valStr);
   virtual uint16_t getSize();
   virtual void resetDefault();
   virtual uint32_t saveToEEPROM(uint32_t address);
   virtual uint32_t loadFromEEPROM(uint32_t address);
+  virtual bool matchEEPROM(uint32_t address);
 protected:
   bool editable = true;
   const char* description;
@@ -90,6 +115,7 @@ public:
   }
 
   void prettyPrint();
+  void write(StructuredWriter* doc);
   int32_t setVal(const char*);
 
   C getVal() {
@@ -115,6 +141,12 @@ public:
     return sizeof(C);
   }
 
+  bool matchEEPROM(uint32_t address) {
+    C saved;
+    EEPROM.get(address, saved);
+    return memcmp(&saved, &value, sizeof(C)) == 0;
+  }
+
 private:
   C value;
   C valueDefault;
@@ -125,12 +157,15 @@ private:
 class Settings {
 public:
   void printSettings();
+  void writeSettings(StructuredWriter* doc);
   Settings();
   Param* getParam(const char* name);
+  NameIndex<Param, SETTINGS_MAX_PARAMS>* getIndex();
   uint16_t size();
   void reloadDefaultSettings();
   void saveAllSettingsToEEPROM(uint32_t address);
   void loadAllSettingsFromEEPROM(uint32_t address);
+  bool matchEEPROM(uint32_t address);
 
   ParamImpl<uint32_t> magic_bytes;
   ParamImpl<uint32_t> eeprom_version;
@@ -157,11 +192,15 @@ public:
   ParamImpl<float> bat12v_over_v_setpoint;
   ParamImpl<float> bat12v_under_v_setpoint;
   ParamImpl<float> bat12v_scaling_divisor;
-  ParamImpl<uint32_t> fault_debounce_count;
+  ParamImpl<uint32_t> fault_debounce_ms;
   ParamImpl<uint32_t> module_count;
   ParamImpl<uint32_t> oled_cycle_time;
   ParamImpl<uint32_t> time_before_first_sleep;
+  ParamImpl<uint32_t> console_idle_timeout;
+  ParamImpl<uint32_t> module_sample_period_s;
+  ParamImpl<uint32_t> trace_capture;
 
 private:
   std::list<Param*> parameters;
+  NameIndex<Param, SETTINGS_MAX_PARAMS> index;
 };
\ No newline at end of file
@@ -11,26 +11,43 @@
 #define BS '\b'
 #define NULLCHAR '\0'
 #define SPACE ' '
+#define TAB '\t'
+#define ESC 0x1b
+#define CTRL_N 0x0e
+#define CTRL_P 0x10
 
 /////////////////////////////////////////////////
 /// \brief This is the consoles main function where commands are interpreted every tick.
 /////////////////////////////////////////////////
 
 bool Cons::getCommandLineFromSerialPort(char* commandLine) {
-  static uint8_t charsRead = 0;  //note: COMAND_BUFFER_LENGTH must be less than 255 chars long
+  int input;
   //read asynchronously until full command input
-  while (Serial.available()) {
-    //Serial.println("Available");
-    char c = Serial.read();
+  while ((input = readConsole()) >= 0) {
+    char c = input;
     //Serial.printf("Received %d\n", c);
+    if (escape == 1) {
+      //the arrow keys send ESC [ A or ESC O A, up, and B, down
+      escape = (c == '[' || c == 'O') ? 2 : 0;
+      continue;
+    }
+    if (escape == 2) {
+      //the parameters of a sequence up to its final byte
+      if (c < 0x40 || c > 0x7e) continue;
+      escape = 0;
+      if (c == 'A' || c == 'B') recall(commandLine, &charsRead, c == 'A' ? 1 : -1);
+      continue;
+    }
     switch (c) {
       case CR:  //likely have full command in buffer now, commands are terminated by CR and/or LF
       case LF:
         commandLine[charsRead] = NULLCHAR;  //null terminate our command char array
         if (charsRead >= 0) {
-          charsRead = 0;  //charsRead is static, so have to reset
+          if (charsRead > 0) remember(commandLine);
+          recalled = 0;
+          charsRead = 0;  //charsRead is kept between calls, so have to reset
           //Serial.println(commandLine);
-          Serial.println("");
+          if (!doc.isStructured()) console_out.reply.println("");
           return true;
         }
         break;
@@ -38,14 +55,24 @@ bool Cons::getCommandLineFromSerialPort(char* commandLine) {
       case 0x7f:
         if (charsRead > 0) {  //and adjust commandLine and charsRead
           commandLine[--charsRead] = NULLCHAR;
-          Serial.print("\b \b");
+          if (!doc.isStructured()) console_out.reply.print("\b \b");
         }
         break;
+      case TAB:
+        if (!doc.isStructured()) complete(commandLine, &charsRead);
+        break;
+      case ESC:
+        escape = 1;
+        break;
+      case CTRL_P:
+      case CTRL_N:
+        recall(commandLine, &charsRead, c == CTRL_P ? 1 : -1);
+        break;
       default:
         // c = tolower(c);
         if (charsRead < COMMAND_BUFFER_LENGTH) {
           commandLine[charsRead++] = c;
-          Serial.print(commandLine[charsRead - 1]);
+          if (!doc.isStructured()) console_out.reply.print(commandLine[charsRead - 1]);
         }
         commandLine[charsRead] = NULLCHAR;  //just in case
         break;
@@ -54,32 +81,216 @@ bool Cons::getCommandLineFromSerialPort(char* commandLine) {
   return false;
 }
 
+/////////////////////////////////////////////////
+/// \brief completes the word being typed at the end of the line: the command, or the parameter after set.
+///
+/// A single name that starts with the word is completed and followed by a space. Several are completed as
+/// far as they agree, and when they do not agree beyond the word they are listed under the line.
+/////////////////////////////////////////////////
+void Cons::complete(char* commandLine, uint8_t* charsRead) {
+  char* word = commandLine + *charsRead;
+  while (word > commandLine && word[-1] != SPACE) word--;
+  if (word == commandLine) {
+    completeFrom(&commandIndex, commandLine, charsRead, word);
+    return;
+  }
+  //the parameter is the second word of a set
+  size_t n = strcspn(commandLine, " ");
+  if (strspn(commandLine + n, " ") != (size_t)(word - commandLine - n)) return;
+  if ((strlen(setParam.tokenLong) == n && strncmp(commandLine, setParam.tokenLong, n) == 0) ||
+      (strlen(setParam.tokenShort) == n && strncmp(commandLine, setParam.tokenShort, n) == 0)) {
+    completeFrom(controller_inst_ptr->getSettingsPtr()->getIndex(), commandLine, charsRead, word);
+  }
+}
+
+template<class T, uint8_t N> void Cons::completeFrom(NameIndex<T, N>* index, char* commandLine, uint8_t* charsRead, char* word) {
+  size_t length = commandLine + *charsRead - word;
+  const char* match = 0;
+  size_t common = 0;
+  uint8_t found = 0;
+  uint8_t first = index->lowerBound(word);
+
+  for (uint8_t i = first; index->matches(i, word, length); i++) {
+    if (!index->isListed(i)) continue;
+    const char* name = index->getName(i);
+    if (found++ == 0) {
+      match = name;
+      common = strlen(name);
+    } else {
+      size_t k = length;
+      while (k < common && name[k] == match[k]) k++;
+      common = k;
+    }
+  }
+  if (found == 0) return;
+  if (common > length || found == 1) {
+    const char* rest = match + length;
+    while (rest < match + common && *charsRead < COMMAND_BUFFER_LENGTH) commandLine[(*charsRead)++] = *rest++;
+    if (found == 1 && *charsRead < COMMAND_BUFFER_LENGTH) commandLine[(*charsRead)++] = SPACE;
+    commandLine[*charsRead] = NULLCHAR;
+    console_out.reply.print(word + length);
+    return;
+  }
+  console_out.reply.println("");
+  for (uint8_t i = first; index->matches(i, word, length); i++) {
+    if (index->isListed(i)) console_out.reply.printf("%s  ", index->getName(i));
+  }
+  console_out.reply.printf("\nBMS> %s", commandLine);
+}
+
+/////////////////////////////////////////////////
+/// \brief replaces the line being typed with a line of the history, step lines older (or newer when
+/// negative) than the one shown. Past the newest line the line is empty again.
+/////////////////////////////////////////////////
+void Cons::recall(char* commandLine, uint8_t* charsRead, int step) {
+  int to = recalled + step;
+  if (doc.isStructured() || to < 0 || to > historyCount) return;
+  recalled = to;
+  const char* text = recalled ? history[(historyNewest + CONS_HISTORY_SIZE + 1 - recalled) % CONS_HISTORY_SIZE] : "";
+  while (*charsRead > 0) {
+    commandLine[--*charsRead] = NULLCHAR;
+    console_out.reply.print("\b \b");
+  }
+  while (*text && *charsRead < COMMAND_BUFFER_LENGTH) commandLine[(*charsRead)++] = *text++;
+  commandLine[*charsRead] = NULLCHAR;
+  console_out.reply.print(commandLine);
+}
+
+/////////////////////////////////////////////////
+/// \brief adds a line entered to the history, unless it repeats the newest one.
+/////////////////////////////////////////////////
+void Cons::remember(const char* commandLine) {
+  if (historyCount > 0 && strcmp(history[historyNewest], commandLine) == 0) return;
+  historyNewest = (historyNewest + 1) % CONS_HISTORY_SIZE;
+  strcpy(history[historyNewest], commandLine);
+  if (historyCount < CONS_HISTORY_SIZE) historyCount++;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the next byte typed, -1 if there is none.
+///
+/// The frames of the RPC channel are passed to the RPC server, which answers them. No byte is read while
+/// one of its responses waits for room in the TX ring, nor while a document is written: the response
+/// would be dropped with the other output.
+/////////////////////////////////////////////////
+int Cons::readConsole() {
+  while (Serial.available() && !(rpc && (doc.isOpen() || !rpc->serve()))) {
+    char c = Serial.read();
+    if (trace) trace->console(c);
+    controller_inst_ptr->getPowerPtr()->notifyActivity();
+    if (!(rpc && rpc->feed(c))) return (uint8_t)c;
+  }
+  return -1;
+}
+
 void Cons::doConsole() {
+  Watch* watch;
+  if (rpc && !doc.isOpen()) rpc->serve();
+  if (!watchTable.isEmpty()) controller_inst_ptr->getTimerWheelPtr()->advance(millis());
+  if (running) {
+    //the input waits for the reply to complete, or stops a reply waiting for something to print; a watch
+    //never waits, what is left of its reply is for the next run
+    PROF_SCOPE(CONSOLE);
+    if (printReply() == CliCommand::WAITING && (watching || readConsole() >= 0)) {
+      while (!watching && readConsole() >= 0)
+        ;
+      running->stop();
+      running = 0;
+    }
+    if (!running) endReply();
+  } else if (getCommandLineFromSerialPort(cmdLine)) {
+    execute(cmdLine);
+  } else if ((watch = watchTable.takeDue()) != 0) {
+    //a run at most per tick, its reply is printed like a typed one, in parts within the budget of a tick
+    strcpy(watchLine, watch->line);
+    watching = watch;
+    if (!doc.isStructured()) console_out.reply.printf("\r\x1b[Kwatch %u: %s\n", watch->id, watch->line);
+    execute(watchLine);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief runs a command line, typed or watched, and prints the first part of its reply.
+/////////////////////////////////////////////////
+void Cons::execute(char* commandLine) {
   char* ptrToCommandName;
-  if (getCommandLineFromSerialPort(cmdLine)) {
-    ptrToCommandName = strtok(cmdLine, delimiters);
-    if (ptrToCommandName != NULL) {
-      auto i = cliCommands.begin();
-      for (; i != cliCommands.end(); i++) {
-        if (strcmp(ptrToCommandName, (*i)->tokenLong) == 0 || strcmp(ptrToCommandName, (*i)->tokenShort) == 0) {
-          if ((*i)->doCommand() != 0) {
-            Serial.printf("  Command failed: %s\n", ptrToCommandName);
-          }
-          break;
-        }
+  ptrToCommandName = strtok(commandLine, delimiters);
+  if (ptrToCommandName != NULL) {
+    CliCommand* command = commandIndex.find(ptrToCommandName);
+    if (doc.isStructured()) {
+      //the reply is a document, from the command up to the end of its reply in endReply()
+      console_out.hold(true);
+      if (doc.getFormat() == StructuredWriter::CBOR) docFrame.begin(RPC_DOCUMENT);
+      doc.beginObject();
+      doc.putString("command", command ? command->tokenLong : ptrToCommandName);
+      if (watching) doc.putUint("watch", watching->id);
+    }
+    if (command == 0) {
+      if (doc.isOpen()) {
+        doc.putBool("ok", false);
+        doc.putString("error", "command not found");
+      } else {
+        console_out.reply.printf("  Command not found: %s\n", ptrToCommandName);
       }
-      if (i == cliCommands.end()) {
-        Serial.printf("  Command not found: %s\n", ptrToCommandName);
+    } else {
+      PROF_SCOPE(CONSOLE);
+      int ret = command->doCommand();
+      if (ret != 0 && doc.isOpen()) {
+        doc.putBool("ok", false);
+        doc.putInt("code", ret);
+      } else if (ret != 0) {
+        console_out.reply.printf("  Command failed: %s\n", ptrToCommandName);
+      } else {
+        if (doc.isOpen()) doc.putBool("ok", true);
+        running = command;
+        printReply();
       }
     }
-    Serial.print("BMS> ");
   }
+  if (!running) endReply();
 }
 
 /////////////////////////////////////////////////
-/// \brief Constructor
+/// \brief ends a reply: ends its document and lets the log and the telemetry out again, or prompts for
+/// the next command in the text format.
 /////////////////////////////////////////////////
-Cons::Cons(Controller* cont_inst_ptr)
+void Cons::endReply() {
+  if (doc.isOpen()) doc.endObject();
+  docFrame.end();
+  console_out.hold(false);
+  if (!doc.isStructured()) {
+    console_out.reply.print("BMS> ");
+    //the line being typed when a watch ran
+    console_out.reply.write((const uint8_t*)cmdLine, charsRead);
+  }
+  watching = 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief prints the parts of the reply of the running command that fit in this tick.
+///
+/// A part is only printed when the TX ring has room for it, so a long report never waits for the USB host,
+/// and for CONS_REPLY_BUDGET_US at most, so it never delays the controller. The rest is printed the next
+/// ticks.
+///
+/// @return how the last call to the command went, the command is no longer running once COMPLETE.
+/////////////////////////////////////////////////
+CliCommand::Progress Cons::printReply() {
+  CliCommand::Progress progress = CliCommand::PRINTED;
+  uint32_t start = micros();
+  while (progress == CliCommand::PRINTED && console_out.getFree() >= CONS_REPLY_PART_MAX && micros() - start < CONS_REPLY_BUDGET_US) {
+    progress = running->printNext();
+  }
+  if (progress == CliCommand::COMPLETE) running = 0;
+  return progress;
+}
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the console input is recorded to trace when it is not 0. The telemetry command is
+/// only offered with a telemetry, the frames of the RPC channel are answered with an rpc. The replies
+/// start as text.
+/////////////////////////////////////////////////
+Cons::Cons(Controller* cont_inst_ptr, TraceRecorder* trace, Telemetry* telemetry, RpcServer* rpc)
   : commandPrintMenu(&cliCommands),
     showConfig(cont_inst_ptr->getSettingsPtr()),
     setParam(cont_inst_ptr),
@@ -87,12 +298,34 @@ Cons::Cons(Controller* cont_inst_ptr)
     showStatus(cont_inst_ptr),
     showGraph(cont_inst_ptr),
     showCSV(cont_inst_ptr),
+    showDashboard(cont_inst_ptr),
+    showProfile(),
+    showPower(cont_inst_ptr),
+    showCellFaults(cont_inst_ptr),
+    showConsoleOut(),
+    showTelemetry(telemetry),
+    setFormat(),
+    watchTable(cont_inst_ptr->getTimerWheelPtr()),
+    setWatch(&watchTable, &commandIndex),
+    unwatch(&watchTable),
+    showWatches(&watchTable),
     resetDefaultValues(cont_inst_ptr->getSettingsPtr()),
-    reboot() {
+    reboot(),
+    running(0),
+    docFrame(&console_out.reply),
+    doc(&docFrame),
+    historyCount(0),
+    historyNewest(0),
+    recalled(0),
+    escape(0),
+    charsRead(0),
+    watching(0) {
   // initialize serial communication at 115200 bits per second:
   SERIALCONSOLE.begin(115200);
   SERIALCONSOLE.setTimeout(15);
   controller_inst_ptr = cont_inst_ptr;
+  this->trace = trace;
+  this->rpc = rpc;
   cliCommands.push_back(&commandPrintMenu);
   cliCommands.push_back(&showConfig);
   cliCommands.push_back(&resetDefaultValues);
@@ -101,6 +334,27 @@ Cons::Cons(Controller* cont_inst_ptr)
   cliCommands.push_back(&showStatus);
   cliCommands.push_back(&showGraph);
   cliCommands.push_back(&showCSV);
+  cliCommands.push_back(&showDashboard);
+  cliCommands.push_back(&showProfile);
+  cliCommands.push_back(&showPower);
+  cliCommands.push_back(&showCellFaults);
+  cliCommands.push_back(&showConsoleOut);
+  if (telemetry) cliCommands.push_back(&showTelemetry);
+  cliCommands.push_back(&setFormat);
+  cliCommands.push_back(&setWatch);
+  cliCommands.push_back(&unwatch);
+  cliCommands.push_back(&showWatches);
+  cliCommands.push_back(&setVerbose);
   cliCommands.push_back(&reboot);
+  for (auto i = cliCommands.begin(); i != cliCommands.end(); i++) {
+    (*i)->doc = &doc;
+    //a name taken by another command, or past CONS_MAX_NAMES, would leave the command unreachable by it
+    const char* names[] = { (*i)->tokenLong, (*i)->tokenShort };
+    for (uint8_t n = 0; n < 2; n++) {
+      if (!commandIndex.add(names[n], *i, n == 0) && commandIndex.find(names[n]) != *i) {
+        console_out.reply.printf("Command name %s not indexed, taken or CONS_MAX_NAMES too small\n", names[n]);
+      }
+    }
+  }
   //Serial.print("Console instantiated\n");
 }
\ No newline at end of file
@@ -1,19 +1,83 @@
 #include "TimeLib.h"
 #include "Logger.hpp"
 #include "Controller.hpp"
+#include "Profiler.hpp"
+#include "ConsoleOut.hpp"
+#include "CellGraph.hpp"
+#include "Dashboard.hpp"
+#include "Telemetry.hpp"
+#include "StructuredWriter.hpp"
+#include "RpcServer.hpp"
+#include "NameIndex.hpp"
+#include "WatchTable.hpp"
 #include <string.h>
+#include <stdarg.h>
 #include <list>
 #include <TimeLib.h>
 
+#define CONS_REPLY_BUDGET_US 1000  //longest the console prints a long reply per tick
+#define CONS_REPLY_PART_MAX 512    //room a part of a long reply needs in the TX ring
+#define CONS_FAILURE_MAX 96        //longest reason a command gives for failing
+#define CONS_MAX_NAMES 48          //long and short names of the commands
+#define CONS_HISTORY_SIZE 8        //lines recalled with the arrow keys
+
 class CliCommand {
 public:
+  enum Progress {
+    COMPLETE,  ///< the reply is complete, nothing was printed
+    PRINTED,   ///< a part of the reply was printed
+    WAITING    ///< nothing to print this tick, a key stops the reply
+  };
+
   virtual int doCommand() = 0;
+
+  /////////////////////////////////////////////////
+  /// \brief prints the next part of a long reply, in the ticks following doCommand().
+  /////////////////////////////////////////////////
+  virtual Progress printNext() {
+    return COMPLETE;
+  }
+
+  /////////////////////////////////////////////////
+  /// \brief stops a reply that was WAITING, before the prompt is printed.
+  /////////////////////////////////////////////////
+  virtual void stop() {
+  }
+
+  /////////////////////////////////////////////////
+  /// \brief returns true if the reply is printed by printNext(), doCommand() printing nothing long.
+  ///
+  /// Only such a command can be watched, a run of a watch never takes more than the budget of a tick.
+  /////////////////////////////////////////////////
+  virtual bool printsInParts() {
+    return false;
+  }
   const char* name;
   const char* tokenLong;
   const char* tokenShort;
   const char* help;
+  StructuredWriter* doc;  //the reply when the console format is JSON or CBOR, set by Cons
 protected:
   Controller* controller_inst_ptr;
+  static Logger::Subsystem getLogSubsystem() {
+    return Logger::CONSOLE;
+  }
+
+  /////////////////////////////////////////////////
+  /// \brief tells why the command fails: a line of text, or the "error" of the document.
+  /////////////////////////////////////////////////
+  void fail(const char* format, ...) {
+    char reason[CONS_FAILURE_MAX];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(reason, sizeof(reason), format, args);
+    va_end(args);
+    if (doc->isStructured()) {
+      doc->putString("error", reason);
+    } else {
+      console_out.reply.printf("%s\n", reason);
+    }
+  }
 };
 
 class CommandPrintMenu : public CliCommand {
@@ -28,13 +92,26 @@ public:
   int doCommand() {
     //uint32_t i;
     uint32_t printed;
-    Serial.print("\n\\||||||||/   \\||||||||/   |||||||||/   ||           \\||||||||/\n");
-    Serial.print("    ||                    ||           ||\n");
-    Serial.print("    ||       \\||||||||/   ||||||||||   ||           ||||||||||\n");
-    Serial.print("    ||                            ||   ||           ||      ||\n");
-    Serial.print("    ||       \\||||||||/   /|||||||||   |||||||||/   ||      ||\n\n");
-    Serial.print("              Battery Management System by GuilT\n");
-    Serial.print("\n************************* SYSTEM MENU *************************\n");
+    if (doc->isStructured()) {
+      doc->beginArray("commands");
+      for (auto i = (*cliCommands).begin(); i != (*cliCommands).end(); i++) {
+        doc->beginObject();
+        doc->putString("name", (*i)->name);
+        doc->putString("long", (*i)->tokenLong);
+        doc->putString("short", (*i)->tokenShort);
+        doc->putString("help", strncmp((*i)->help, " | ", 3) == 0 ? (*i)->help + 3 : (*i)->help);
+        doc->endObject();
+      }
+      doc->endArray();
+      return 0;
+    }
+    console_out.reply.print("\n\\||||||||/   \\||||||||/   |||||||||/   ||           \\||||||||/\n");
+    console_out.reply.print("    ||                    ||           ||\n");
+    console_out.reply.print("    ||       \\||||||||/   ||||||||||   ||           ||||||||||\n");
+    console_out.reply.print("    ||                            ||   ||           ||      ||\n");
+    console_out.reply.print("    ||       \\||||||||/   /|||||||||   |||||||||/   ||      ||\n\n");
+    console_out.reply.print("              Battery Management System by GuilT\n");
+    console_out.reply.print("\n************************* SYSTEM MENU *************************\n");
     
 
     for (auto i = (*cliCommands).begin(); i != (*cliCommands).end(); i++) {
@@ -44,16 +121,16 @@ public:
         printed = 17;
       }
 
-      Serial.print((*i)->tokenShort);
-      Serial.print(" or ");
-      Serial.print((*i)->tokenLong);
+      console_out.reply.print((*i)->tokenShort);
+      console_out.reply.print(" or ");
+      console_out.reply.print((*i)->tokenLong);
       for (; printed < 18; printed++) {
-        Serial.print(" ");
+        console_out.reply.print(" ");
       }
-      Serial.print((*i)->help);
-      Serial.print("\n");
+      console_out.reply.print((*i)->help);
+      console_out.reply.print("\n");
     }
-    Serial.print("\n");
+    console_out.reply.print("\n");
     return 0;
   }
 private:
@@ -70,7 +147,11 @@ public:
     settings = sett;
   }
   int doCommand() {
-    Serial.print("GENERAL SYSTEM CONFIGURATION\n\n");
+    if (doc->isStructured()) {
+      settings->writeSettings(doc);
+      return 0;
+    }
+    console_out.reply.print("GENERAL SYSTEM CONFIGURATION\n\n");
     settings->printSettings();
     return 0;
   }
@@ -91,16 +172,15 @@ public:
   int doCommand() {
     char *paramName, *valStr;
     Param* param;
-    paramName = strtok(0, 0);
+    paramName = strtok(0, " ");
     if (paramName == 0) {
       return -1;
     } else {
-      paramName = strtok(paramName, " ");
       param = settings->getParam(paramName);
       if (param == 0) {
         return -2;
       } else {
-        valStr = strtok(0, 0);
+        valStr = strtok(0, " ");
         if (valStr == 0) {
           return -3;
         } else {
@@ -148,6 +228,10 @@ public:
       Teensy3Clock.set(now());
       ret = 0;
     }
+    if (doc->isStructured()) {
+      doc->putUint("time", now());
+      return ret;
+    }
     LOG_CONSOLE("Current Time: ");
     LOG_TIMESTAMP_LN(now());
     return ret;
@@ -164,26 +248,85 @@ public:
     controller_inst_ptr = cont_inst_ptr;
   }
   int doCommand() {
-    controller_inst_ptr->getBMSPtr()->printPackSummary();
-    LOG_CONSOLE("12V Battery: %.2fV \n", controller_inst_ptr->bat12vVoltage);
-    controller_inst_ptr->printControllerState();
+    part = 0;
     return 0;
   }
+  Progress printNext() {
+    if (part == DONE) return COMPLETE;
+    if (doc->isStructured()) {
+      if (!controller_inst_ptr->getBMSPtr()->writePackSummary(doc, part++)) {
+        doc->putFloat("bat12v", controller_inst_ptr->bat12vVoltage);
+        doc->beginObject("controller");
+        controller_inst_ptr->writeControllerState(doc);
+        doc->endObject();
+        part = DONE;
+      }
+      return PRINTED;
+    }
+    if (!controller_inst_ptr->getBMSPtr()->printPackSummary(part++)) {
+      LOG_CONSOLE("12V Battery: %.2fV \n", controller_inst_ptr->bat12vVoltage);
+      controller_inst_ptr->printControllerState();
+      part = DONE;
+    }
+    return PRINTED;
+  }
+  bool printsInParts() {
+    return true;
+  }
+private:
+  static const uint16_t DONE = 0xffff;
+  uint16_t part;
 };
 
 class ShowGraph : public CliCommand {
 public:
-  ShowGraph(Controller* cont_inst_ptr) {
+  ShowGraph(Controller* cont_inst_ptr)
+    : graph(cont_inst_ptr->getBMSPtr(), cont_inst_ptr->getSettingsPtr(), cont_inst_ptr->getLoggerPtr()) {
     name = "Show Graph";
     tokenLong = "graph";
     tokenShort = "2";
-    help = " | show cell volatage graph";
+    help = " | show cell volatage graph, 'graph live' redraws what changes until a key is pressed";
     controller_inst_ptr = cont_inst_ptr;
   }
   int doCommand() {
-    controller_inst_ptr->getBMSPtr()->printPackGraph();
+    char* arg;
+    arg = strtok(0, " ");
+    if (arg != 0 && strcmp(arg, "live") != 0) return -1;
+    live = arg != 0;
+    part = 0;
+    if (live && doc->isStructured()) {
+      fail("graph live needs the text format");
+      return -1;
+    }
     return 0;
   }
+  Progress printNext() {
+    if (doc->isStructured()) {
+      //the cells the graph draws, as the CSV command writes them
+      return controller_inst_ptr->getBMSPtr()->writeAllCSV(doc, part++) ? PRINTED : COMPLETE;
+    }
+    if (graph.printPart(part)) {
+      part++;
+      return PRINTED;
+    }
+    if (!live) return COMPLETE;
+    if (part != DONE) {
+      graph.beginLive();
+      part = DONE;
+    }
+    return graph.printChanges() ? PRINTED : WAITING;
+  }
+  void stop() {
+    graph.endLive();
+  }
+  bool printsInParts() {
+    return true;
+  }
+private:
+  static const uint16_t DONE = 0xffff;
+  CellGraph graph;
+  uint16_t part;
+  bool live;
 };
 
 class ShowCSV : public CliCommand {
@@ -196,9 +339,57 @@ public:
     controller_inst_ptr = cont_inst_ptr;
   }
   int doCommand() {
-    controller_inst_ptr->getBMSPtr()->printAllCSV();
+    part = 0;
     return 0;
   }
+  Progress printNext() {
+    if (doc->isStructured()) return controller_inst_ptr->getBMSPtr()->writeAllCSV(doc, part++) ? PRINTED : COMPLETE;
+    return controller_inst_ptr->getBMSPtr()->printAllCSV(part++) ? PRINTED : COMPLETE;
+  }
+  bool printsInParts() {
+    return true;
+  }
+private:
+  uint16_t part;
+};
+
+class ShowDashboard : public CliCommand {
+public:
+  ShowDashboard(Controller* cont_inst_ptr)
+    : dashboard(cont_inst_ptr) {
+    name = "Show Dashboard";
+    tokenLong = "top";
+    tokenShort = "4";
+    help = " | pack, faults and loop timing refreshed in place until a key is pressed, 'top X' refreshes every X ms (default 1000)";
+    controller_inst_ptr = cont_inst_ptr;
+  }
+  int doCommand() {
+    char* arg;
+    uint32_t periodMs = Dashboard::DEFAULT_PERIOD_MS;
+    if (doc->isStructured()) {
+      fail("top needs the text format, status polls the same data");
+      return -1;
+    }
+    arg = strtok(0, " ");
+    if (arg != 0) periodMs = atoi(arg);
+    if (periodMs < Dashboard::MIN_PERIOD_MS) {
+      fail("refresh period out of bounds (%u ms at least)", (unsigned)Dashboard::MIN_PERIOD_MS);
+      return -1;
+    }
+    dashboard.begin(periodMs);
+    return 0;
+  }
+  Progress printNext() {
+    return dashboard.printNext() ? PRINTED : WAITING;
+  }
+  void stop() {
+    dashboard.end();
+  }
+  bool printsInParts() {
+    return true;
+  }
+private:
+  Dashboard dashboard;
 };
 
 class ResetDefaultValues : public CliCommand {
@@ -224,27 +415,355 @@ public:
     name = "Verbose";
     tokenLong = "verbose";
     tokenShort = "v";
-    help = " | set verbosity eg.: v X (X=0:debug, X=1:info, X=2:warn, X=3:error, X=4:Cons)";
+    help = " | set verbosity eg.: v X [subsystem] (X=0:debug, X=1:info, X=2:warn, X=3:error, X=4:off, X=5:Cons), v alone shows it";
   }
   int doCommand() {
     char* verbosity;
+    char* subsystem;
     uint32_t verbo;
-    verbosity = strtok(0, 0);
-    if (verbosity != 0) {
-      verbo = atoi(verbosity);
-      if (verbo >= 0 && verbo <= 5) {
-        log_inst.setLoglevel((Logger::LogLevel)(verbo));
+    verbosity = strtok(0, " ");
+    subsystem = strtok(0, " ");
+    if (verbosity == 0 && doc->isStructured()) {
+      doc->beginObject("levels");
+      for (uint8_t s = 0; s < Logger::NUMBER_OF_SUBSYSTEMS; s++) {
+        doc->putUint(Logger::getSubsystemName((Logger::Subsystem)s), log_inst.getLogLevel((Logger::Subsystem)s));
+      }
+      doc->endObject();
+      doc->putUint("minLevel", LOG_MIN_LEVEL);
+      return 0;
+    }
+    if (verbosity == 0) {
+      for (uint8_t s = 0; s < Logger::NUMBER_OF_SUBSYSTEMS; s++) {
+        console_out.reply.printf("%-10s %d\n", Logger::getSubsystemName((Logger::Subsystem)s), log_inst.getLogLevel((Logger::Subsystem)s));
+      }
+      if (LOG_MIN_LEVEL > 0) console_out.reply.printf("levels under %d are not compiled in\n", LOG_MIN_LEVEL);
+      return 0;
+    }
+    verbo = atoi(verbosity);
+    if (verbo > 5) {
+      fail("logLevel out of bounds (0-5)");
+      return 2;
+    }
+    if (subsystem == 0) {
+      log_inst.setLoglevel((Logger::LogLevel)(verbo));
+      return 0;
+    }
+    for (uint8_t s = 0; s < Logger::NUMBER_OF_SUBSYSTEMS; s++) {
+      if (strcmp(subsystem, Logger::getSubsystemName((Logger::Subsystem)s)) == 0) {
+        log_inst.setLoglevel((Logger::Subsystem)s, (Logger::LogLevel)(verbo));
         return 0;
-      } else {
-        Serial.print("logLevel out of bounds (0-5)\n");
-        return 2;
       }
     }
-    Serial.print("missing logLevel eg.: BMS> v 3\n");
+    fail("unknown subsystem %s eg.: BMS> v 0 driver", subsystem);
     return 1;
   }
 };
 
+class ShowProfile : public CliCommand {
+public:
+  ShowProfile() {
+    name = "Show Profile";
+    tokenLong = "prof";
+    tokenShort = "p";
+    help = " | show execution time statistics per task, 'prof reset' clears them";
+  }
+  int doCommand() {
+    char* arg;
+    arg = strtok(0, " ");
+    if (arg == 0) {
+      if (doc->isStructured()) {
+        prof_inst.writeStats(doc);
+      } else {
+        prof_inst.printStats();
+      }
+      return 0;
+    } else if (strcmp(arg, "reset") == 0) {
+      prof_inst.reset();
+      if (!doc->isStructured()) LOG_CONSOLE("Profiler statistics cleared\n");
+      return 0;
+    }
+    return -1;
+  }
+};
+
+class ShowPower : public CliCommand {
+public:
+  ShowPower(Controller* cont_inst_ptr) {
+    name = "Show Power";
+    tokenLong = "power";
+    tokenShort = "pw";
+    help = " | show power states, wake sources and module duty cycling, 'power reset' clears them";
+    controller_inst_ptr = cont_inst_ptr;
+  }
+  int doCommand() {
+    char* arg;
+    arg = strtok(0, " ");
+    if (arg == 0 && doc->isStructured()) {
+      controller_inst_ptr->getPowerPtr()->writeStats(doc);
+      doc->beginObject("modules");
+      controller_inst_ptr->getModulePowerPtr()->writeStats(doc);
+      doc->endObject();
+      return 0;
+    } else if (arg == 0) {
+      controller_inst_ptr->getPowerPtr()->printStats();
+      LOG_CONSOLE("\n");
+      controller_inst_ptr->getModulePowerPtr()->printStats();
+      return 0;
+    } else if (strcmp(arg, "reset") == 0) {
+      controller_inst_ptr->getPowerPtr()->resetStats();
+      controller_inst_ptr->getModulePowerPtr()->resetStats();
+      if (!doc->isStructured()) LOG_CONSOLE("Power statistics cleared\n");
+      return 0;
+    }
+    return -1;
+  }
+};
+
+class ShowCellFaults : public CliCommand {
+public:
+  ShowCellFaults(Controller* cont_inst_ptr) {
+    name = "Show Cell Faults";
+    tokenLong = "cellfaults";
+    tokenShort = "cf";
+    help = " | show the modules, cells and temperature sensors asserting OV/UV/OT/UT";
+    controller_inst_ptr = cont_inst_ptr;
+  }
+  int doCommand() {
+    if (doc->isStructured()) {
+      controller_inst_ptr->getCellFaultsPtr()->writeAsserted(doc);
+    } else {
+      controller_inst_ptr->getCellFaultsPtr()->printAsserted();
+    }
+    return 0;
+  }
+};
+
+class ShowConsoleOut : public CliCommand {
+public:
+  ShowConsoleOut() {
+    name = "Show Console Output";
+    tokenLong = "output";
+    tokenShort = "o";
+    help = " | show the console TX ring and the bytes it dropped, o reset clears the high-water mark";
+  }
+  int doCommand() {
+    char* arg;
+    arg = strtok(0, " ");
+    if (arg == 0 && doc->isStructured()) {
+      console_out.writeStats(doc);
+      return 0;
+    } else if (arg == 0) {
+      console_out.reply.printf("TX ring: %u of %u bytes waiting, high-water %u, %lu bytes of old log lines dropped\n",
+                               console_out.getUsed(), CONSOLE_TX_RING_SIZE - 1, console_out.getHighWater(), (unsigned long)console_out.getEvicted());
+      console_out.reply.printf("%-9s | %10s | %10s\n", "stream", "written", "dropped");
+      console_out.reply.printf("%-9s | %10lu | %10lu\n", "reply", (unsigned long)console_out.reply.getWritten(), (unsigned long)console_out.reply.getDropped());
+      console_out.reply.printf("%-9s | %10lu | %10lu\n", "log", (unsigned long)console_out.log.getWritten(), (unsigned long)console_out.log.getDropped());
+      console_out.reply.printf("%-9s | %10lu | %10lu\n", "telemetry", (unsigned long)console_out.telemetry.getWritten(),
+                               (unsigned long)console_out.telemetry.getDropped());
+      console_out.reply.printf("%-9s | %10lu | %10lu\n", "rpc", (unsigned long)console_out.rpc.getWritten(), (unsigned long)console_out.rpc.getDropped());
+      return 0;
+    } else if (strcmp(arg, "reset") == 0) {
+      console_out.resetHighWater();
+      return 0;
+    }
+    return -1;
+  }
+};
+
+class ShowTelemetry : public CliCommand {
+public:
+  ShowTelemetry(Telemetry* telemetry) {
+    name = "Telemetry";
+    tokenLong = "telemetry";
+    tokenShort = "tl";
+    help = " | binary frames of the pack on this port, 'tl X [K]' sends one every X ms, a keyframe every K (default 10) and deltas between, 'tl off' stops";
+    this->telemetry = telemetry;
+  }
+  int doCommand() {
+    char* arg;
+    arg = strtok(0, " ");
+    if (arg == 0 && doc->isStructured()) {
+      doc->putUint("version", TELEMETRY_VERSION);
+      doc->putUint("periodMs", telemetry->getPeriod());
+      doc->putUint("keyframeInterval", telemetry->getKeyframeInterval());
+      doc->putUint("sent", telemetry->getSent());
+      doc->putUint("keyframes", telemetry->getKeyframes());
+      doc->putUint("bytes", console_out.telemetry.getWritten());
+      doc->putUint("dropped", telemetry->getDropped());
+      return 0;
+    } else if (arg == 0) {
+      console_out.reply.printf("telemetry v%d every %lums (0 is off), keyframe every %u, %lu frames sent (%lu keyframes, %lu bytes), %lu dropped\n",
+                               TELEMETRY_VERSION, (unsigned long)telemetry->getPeriod(), telemetry->getKeyframeInterval(),
+                               (unsigned long)telemetry->getSent(), (unsigned long)telemetry->getKeyframes(),
+                               (unsigned long)console_out.telemetry.getWritten(), (unsigned long)telemetry->getDropped());
+      return 0;
+    } else if (strcmp(arg, "off") == 0) {
+      telemetry->setPeriod(0);
+      return 0;
+    }
+    uint32_t periodMs = atoi(arg);
+    uint32_t keyframeInterval = Telemetry::DEFAULT_KEYFRAME_INTERVAL;
+    if (periodMs < Telemetry::MIN_PERIOD_MS) {
+      fail("period out of bounds (%u ms at least)", (unsigned)Telemetry::MIN_PERIOD_MS);
+      return -1;
+    }
+    arg = strtok(0, " ");
+    if (arg != 0) keyframeInterval = atoi(arg);
+    if (keyframeInterval < 1 || keyframeInterval > 255) {
+      fail("keyframe interval out of bounds (1 to 255 frames)");
+      return -1;
+    }
+    telemetry->setPeriod(periodMs, keyframeInterval);
+    return 0;
+  }
+private:
+  Telemetry* telemetry;
+};
+
+class SetFormat : public CliCommand {
+public:
+  SetFormat() {
+    name = "Format";
+    tokenLong = "format";
+    tokenShort = "f";
+    help = " | reply with text (default) or with a JSON or CBOR document per command: f text|json|cbor, f alone shows it";
+  }
+  int doCommand() {
+    char* arg;
+    bool structured = doc->isStructured();  //this reply, the new format applies from the next one
+    arg = strtok(0, " ");
+    if (arg != 0) {
+      uint8_t f = 0;
+      while (f < StructuredWriter::NUMBER_OF_FORMATS && strcmp(arg, StructuredWriter::getFormatName((StructuredWriter::Format)f)) != 0) f++;
+      if (f == StructuredWriter::NUMBER_OF_FORMATS) {
+        fail("unknown format %s (text, json or cbor)", arg);
+        return -1;
+      }
+      doc->setFormat((StructuredWriter::Format)f);
+    }
+    if (structured) {
+      doc->putString("format", StructuredWriter::getFormatName(doc->getFormat()));
+    } else if (arg == 0) {
+      console_out.reply.printf("%s\n", StructuredWriter::getFormatName(doc->getFormat()));
+    }
+    return 0;
+  }
+};
+
+class SetWatch : public CliCommand {
+public:
+  SetWatch(WatchTable* watches, NameIndex<CliCommand, CONS_MAX_NAMES>* commands) {
+    name = "Watch";
+    tokenLong = "watch";
+    tokenShort = "w";
+    help = " | run status, graph, CSV or top every period until unwatched: watch <period_ms> <command...> (eg.: watch 1000 status)";
+    this->watches = watches;
+    this->commands = commands;
+  }
+  int doCommand() {
+    char token[CONS_WATCH_LINE_MAX + 1];
+    char *periodStr, *line, *end;
+    periodStr = strtok(0, " ");
+    line = strtok(0, "");
+    if (periodStr == 0 || line == 0) {
+      fail("usage: watch <period_ms> <command...>");
+      return -1;
+    }
+    uint32_t periodMs = strtoul(periodStr, &end, 10);
+    if (*end != 0 || periodMs < CONS_WATCH_MIN_PERIOD_MS) {
+      fail("period out of bounds (%u ms at least)", (unsigned)CONS_WATCH_MIN_PERIOD_MS);
+      return -2;
+    }
+    line += strspn(line, " ");
+    size_t n = strcspn(line, ", ");
+    memcpy(token, line, n);
+    token[n] = 0;
+    CliCommand* command = commands->find(token);
+    //a run must keep to the budget of a tick: a reply printed whole by doCommand() could block the loop
+    //on a full TX ring, those commands (the watch commands among them) are not watched
+    if (command == 0 || !command->printsInParts()) {
+      fail("cannot watch %s, only status, graph, CSV and top", token);
+      return -3;
+    }
+    int id = watches->add(periodMs, line);
+    if (id < 0) {
+      fail("%u watches at most", (unsigned)CONS_MAX_WATCHES);
+      return -4;
+    }
+    if (doc->isStructured()) {
+      doc->putUint("id", id);
+    } else {
+      console_out.reply.printf("watch %d: %s every %lums\n", id, line, (unsigned long)periodMs);
+    }
+    return 0;
+  }
+private:
+  WatchTable* watches;
+  NameIndex<CliCommand, CONS_MAX_NAMES>* commands;
+};
+
+class Unwatch : public CliCommand {
+public:
+  Unwatch(WatchTable* watches) {
+    name = "Unwatch";
+    tokenLong = "unwatch";
+    tokenShort = "uw";
+    help = " | stop a watch: unwatch <id>, unwatch alone stops them all";
+    this->watches = watches;
+  }
+  int doCommand() {
+    char* arg;
+    arg = strtok(0, " ");
+    if (arg == 0) {
+      watches->clear();
+    } else if (!watches->remove(atoi(arg))) {
+      fail("no watch %s", arg);
+      return -1;
+    }
+    return 0;
+  }
+private:
+  WatchTable* watches;
+};
+
+class ShowWatches : public CliCommand {
+public:
+  ShowWatches(WatchTable* watches) {
+    name = "Watches";
+    tokenLong = "watches";
+    tokenShort = "ws";
+    help = " | list the watches: their period, runs and the periods skipped while the console was busy";
+    this->watches = watches;
+  }
+  int doCommand() {
+    if (doc->isStructured()) {
+      doc->beginArray("watches");
+    } else {
+      console_out.reply.printf("%2s | %10s | %8s | %8s | %s\n", "id", "period(ms)", "runs", "skipped", "command");
+    }
+    for (uint8_t i = 0; i < CONS_MAX_WATCHES; i++) {
+      Watch* w = watches->getWatch(i);
+      if (w == 0) continue;
+      if (doc->isStructured()) {
+        doc->beginObject();
+        doc->putUint("id", w->id);
+        doc->putUint("periodMs", w->period);
+        doc->putUint("runs", w->runs);
+        doc->putUint("skipped", w->skipped);
+        doc->putString("command", w->line);
+        doc->endObject();
+      } else {
+        console_out.reply.printf("%2u | %10lu | %8lu | %8lu | %s\n", w->id, (unsigned long)w->period, (unsigned long)w->runs,
+                                 (unsigned long)w->skipped, w->line);
+      }
+    }
+    if (doc->isStructured()) doc->endArray();
+    return 0;
+  }
+private:
+  WatchTable* watches;
+};
+
 class Reboot : public CliCommand {
 public:
   Reboot(void) {
@@ -261,7 +780,7 @@ public:
 
 class Cons {
 public:
-  Cons(Controller* cont_inst_ptr);
+  Cons(Controller* cont_inst_ptr, TraceRecorder* trace = 0, Telemetry* telemetry = 0, RpcServer* rpc = 0);
   void doConsole();
   static const uint32_t NUMBER_OF_COMMANDS = 6;
   static const uint32_t COMMAND_BUFFER_LENGTH = 64;  //length of serial buffer for incoming commands
@@ -276,12 +795,45 @@ private:
   ShowStatus showStatus;
   ShowGraph showGraph;
   ShowCSV showCSV;
+  ShowDashboard showDashboard;
+  ShowProfile showProfile;
+  ShowPower showPower;
+  ShowCellFaults showCellFaults;
+  ShowConsoleOut showConsoleOut;
+  ShowTelemetry showTelemetry;
+  SetFormat setFormat;
+  WatchTable watchTable;
+  SetWatch setWatch;
+  Unwatch unwatch;
+  ShowWatches showWatches;
   SetVerbose setVerbose;
   ResetDefaultValues resetDefaultValues;
   Reboot reboot;
   
   std::list<CliCommand*> cliCommands;
+  CliCommand* running;  //the command still printing its reply, 0 if none
+  RpcFrameStream docFrame;  //frames the CBOR replies on the port
+  StructuredWriter doc;
+  NameIndex<CliCommand, CONS_MAX_NAMES> commandIndex;
+  char history[CONS_HISTORY_SIZE][COMMAND_BUFFER_LENGTH + 1];  //the last lines entered
+  uint8_t historyCount;
+  uint8_t historyNewest;
+  uint8_t recalled;  //the line of the history shown, 1 the newest, 0 the line being typed
+  uint8_t escape;    //1 after an ESC, 2 within an escape sequence
+  uint8_t charsRead;  //length of the line being typed, COMMAND_BUFFER_LENGTH must be less than 255
+  char watchLine[COMMAND_BUFFER_LENGTH + 1];  //the line of the watch being run, apart from the one being typed
+  Watch* watching;    //the watch whose reply is running, 0 if none
   Controller* controller_inst_ptr;
+  TraceRecorder* trace;
+  RpcServer* rpc;  //0 without the RPC channel, every byte read is console input
   const char* delimiters = ", \n";
   bool getCommandLineFromSerialPort(char* commandLine);
+  int readConsole();
+  void execute(char* commandLine);
+  void complete(char* commandLine, uint8_t* charsRead);
+  template<class T, uint8_t N> void completeFrom(NameIndex<T, N>* index, char* commandLine, uint8_t* charsRead, char* word);
+  void recall(char* commandLine, uint8_t* charsRead, int step);
+  void remember(const char* commandLine);
+  CliCommand::Progress printReply();
+  void endReply();
 };
\ No newline at end of file
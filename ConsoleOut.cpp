@@ -0,0 +1,210 @@
+#include "ConsoleOut.hpp"
+#include "Config.hpp"
+
+//instantiate the console output
+#if defined(__arm__)
+ConsoleOut console_out(&SERIALCONSOLE);
+#else
+thread_local ConsoleOut console_out(&SERIALCONSOLE);
+#endif
+
+size_t ConsoleStream::write(uint8_t b) {
+  return tx->queue(this, &b, 1);
+}
+
+size_t ConsoleStream::write(const uint8_t* buffer, size_t size) {
+  return tx->queue(this, buffer, size);
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of bytes written to the stream.
+/////////////////////////////////////////////////
+uint32_t ConsoleStream::getWritten() {
+  return written;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of bytes of the stream dropped because the ring stayed full.
+/////////////////////////////////////////////////
+uint32_t ConsoleStream::getDropped() {
+  return dropped;
+}
+
+/////////////////////////////////////////////////
+/// \brief sends the waiting bytes the port takes without blocking.
+/////////////////////////////////////////////////
+void ConsoleOut::pump() {
+  while (tail != head) {
+    int room = port->availableForWrite();
+    if (room <= 0) return;
+    size_t n = (head > tail ? head : CONSOLE_TX_RING_SIZE) - tail;
+    if (n > (size_t)room) n = room;
+    n = port->write(ring + tail, n);
+    if (n == 0) return;
+    tail = (tail + n) % CONSOLE_TX_RING_SIZE;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of bytes waiting for the host.
+/////////////////////////////////////////////////
+uint16_t ConsoleOut::getUsed() {
+  return (head + CONSOLE_TX_RING_SIZE - tail) % CONSOLE_TX_RING_SIZE;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the most bytes that waited for the host at once.
+/////////////////////////////////////////////////
+uint16_t ConsoleOut::getHighWater() {
+  return highWater;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of bytes of old log lines dropped to make room for the log.
+/////////////////////////////////////////////////
+uint32_t ConsoleOut::getEvicted() {
+  return evicted;
+}
+
+void ConsoleOut::resetHighWater() {
+  highWater = getUsed();
+}
+
+/////////////////////////////////////////////////
+/// \brief holds the port for the replies: while held, the other streams drop what they write.
+///
+/// A structured document written over several ticks is held so that no log line or telemetry frame
+/// ends up in the middle of it.
+/////////////////////////////////////////////////
+void ConsoleOut::hold(bool held) {
+  this->held = held;
+}
+
+/////////////////////////////////////////////////
+/// \brief writes what the output command prints: the fill of the ring and what every stream wrote and dropped.
+/////////////////////////////////////////////////
+void ConsoleOut::writeStats(StructuredWriter* doc) {
+  ConsoleStream* streams[] = { &reply, &log, &telemetry, &rpc };
+  const char* names[] = { "reply", "log", "telemetry", "rpc" };
+  doc->putUint("used", getUsed());
+  doc->putUint("size", CONSOLE_TX_RING_SIZE - 1);
+  doc->putUint("highWater", getHighWater());
+  doc->putUint("evicted", getEvicted());
+  doc->beginArray("streams");
+  for (int i = 0; i < 4; i++) {
+    doc->beginObject();
+    doc->putString("name", names[i]);
+    doc->putUint("written", streams[i]->getWritten());
+    doc->putUint("dropped", streams[i]->getDropped());
+    doc->endObject();
+  }
+  doc->endArray();
+}
+
+/////////////////////////////////////////////////
+/// \brief queues what a stream writes, making room as its policy says.
+///
+/// @return the number of bytes queued.
+/////////////////////////////////////////////////
+size_t ConsoleOut::queue(ConsoleStream* stream, const uint8_t* buffer, size_t size) {
+  size_t queued = 0;
+  stream->written += size;
+  while (queued < size && !(held && stream != &reply)) {
+    size_t n = size - queued;
+    if (n > getFree() && !makeRoom(stream, n)) break;
+    if (n > getFree()) n = getFree();
+    put(buffer + queued, n, stream == &log);
+    queued += n;
+  }
+  stream->dropped += size - queued;
+  return queued;
+}
+
+/////////////////////////////////////////////////
+/// \brief makes room for up to size bytes, or at least one.
+///
+/// The port first takes what it can without waiting, only then the policy of the stream applies.
+///
+/// @return false if a blocking stream timed out, or is still stalled from a previous time out, or there
+/// is no room for the whole write of a DROP_WHOLE stream, or no log line left to drop for a DROP_OLDEST one.
+/////////////////////////////////////////////////
+bool ConsoleOut::makeRoom(ConsoleStream* stream, size_t size) {
+  pump();
+  if (stream->policy == ConsoleStream::DROP_WHOLE) return size <= getFree();
+  if (size > CONSOLE_TX_RING_SIZE - 1) size = CONSOLE_TX_RING_SIZE - 1;
+  if (stream->policy == ConsoleStream::DROP_OLDEST) {
+    if (size > getFree()) evict(size - getFree());
+    return getFree() > 0;
+  }
+
+  if (getFree() == 0 && !stream->stalled) {
+    uint32_t start = millis();
+    while (getFree() == 0 && millis() - start < CONSOLE_BLOCK_TIMEOUT_MS) pump();
+  }
+  stream->stalled = getFree() == 0;
+  return !stream->stalled;
+}
+
+void ConsoleOut::put(const uint8_t* buffer, size_t size, bool isLog) {
+  while (size) {
+    size_t n = (tail > head ? tail - 1 : CONSOLE_TX_RING_SIZE - (tail == 0 ? 1 : 0)) - head;
+    if (n > size) n = size;
+    memcpy(ring + head, buffer, n);
+    for (size_t i = 0; i < n; i++) markLog(head + i, isLog);
+    head = (head + n) % CONSOLE_TX_RING_SIZE;
+    buffer += n;
+    size -= n;
+  }
+  if (getUsed() > highWater) highWater = getUsed();
+}
+
+/////////////////////////////////////////////////
+/// \brief drops at least size of the oldest log bytes, up to the end of their line, fewer if the ring
+/// holds fewer.
+///
+/// The bytes of the other streams queued before them are moved up by as many bytes, so the replies and the
+/// frames reach the port whole and in order.
+/////////////////////////////////////////////////
+void ConsoleOut::evict(size_t size) {
+  uint16_t used = getUsed();
+  uint16_t end = 0;  //bytes from the tail gone through
+  uint16_t n = 0;    //log bytes among them
+  uint8_t last = '\n';
+  while (end < used && (n < size || last != '\n')) {
+    uint16_t at = (tail + end++) % CONSOLE_TX_RING_SIZE;
+    if (isLog(at)) {
+      last = ring[at];
+      n++;
+    }
+  }
+  //the other bytes of [tail, tail + end) move up to its end, the newest first
+  uint16_t to = end;
+  for (uint16_t from = end; from-- > 0;) {
+    uint16_t at = (tail + from) % CONSOLE_TX_RING_SIZE;
+    if (isLog(at)) continue;
+    uint16_t moved = (tail + --to) % CONSOLE_TX_RING_SIZE;
+    ring[moved] = ring[at];
+    markLog(moved, false);
+  }
+  tail = (tail + n) % CONSOLE_TX_RING_SIZE;
+  evicted += n;
+}
+
+bool ConsoleOut::isLog(uint16_t at) {
+  return logBytes[at / 8] & (1 << (at % 8));
+}
+
+void ConsoleOut::markLog(uint16_t at, bool isLog) {
+  if (isLog) {
+    logBytes[at / 8] |= 1 << (at % 8);
+  } else {
+    logBytes[at / 8] &= ~(1 << (at % 8));
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of bytes that can be queued without making room.
+/////////////////////////////////////////////////
+uint16_t ConsoleOut::getFree() {
+  return CONSOLE_TX_RING_SIZE - 1 - getUsed();
+}
@@ -0,0 +1,121 @@
+/**@file ConsoleOut.hpp */
+#ifndef CONSOLEOUT_HPP_
+#define CONSOLEOUT_HPP_
+
+#include <Arduino.h>
+#include "StructuredWriter.hpp"
+
+#define CONSOLE_TX_RING_SIZE 2048     //bytes waiting for the USB host, one is kept free
+#define CONSOLE_BLOCK_TIMEOUT_MS 100  //longest a blocking stream waits for the host to read
+
+class ConsoleOut;
+
+/////////////////////////////////////////////////
+/// \brief A stream of console output, queued in the TX ring of a ConsoleOut under its own policy.
+/////////////////////////////////////////////////
+class ConsoleStream : public Print {
+public:
+  enum Policy {
+    BLOCK,       ///< waits for the host to make room, up to CONSOLE_BLOCK_TIMEOUT_MS, then drops
+    DROP_OLDEST, ///< makes room by dropping its own oldest lines from the ring
+    DROP_WHOLE   ///< drops a write that does not fit whole, a binary frame is never cut
+  };
+
+  constexpr ConsoleStream(ConsoleOut* tx, Policy policy)
+    : tx(tx),
+      policy(policy),
+      written(0),
+      dropped(0),
+      stalled(false) {
+  }
+  size_t write(uint8_t b);
+  size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  uint32_t getWritten();
+  uint32_t getDropped();
+
+private:
+  friend class ConsoleOut;
+  ConsoleOut* tx;
+  Policy policy;
+  uint32_t written;
+  uint32_t dropped;  //bytes of this stream that never made it to the ring
+  bool stalled;      //timed out waiting, drops at once until the host reads again
+};
+
+/////////////////////////////////////////////////
+/// \brief The console output: a TX ring in front of the USB serial port.
+///
+/// Writing to the port blocks while the USB host does not read, so the streams only queue to the ring
+/// and pump() moves what the port takes without waiting (availableForWrite()). pump() runs in the idle
+/// time of the main loop, the timing of the control loop no longer depends on the host.
+///
+/// reply carries the command replies and the prompt and blocks when the ring is full, a user at the
+/// console reads them. log carries the log messages and drops its own oldest lines instead, never a byte of
+/// the other streams: the ring keeps a bit per byte telling the log bytes, and the bytes queued before the
+/// lines dropped move up to close the gap. When the ring holds no log line to drop, the log line being
+/// written is dropped. telemetry carries
+/// the binary telemetry frames, written one whole frame per write, and drops the frames that do not fit.
+/// rpc carries the responses of the RPC server, which only writes one when the ring has room for it.
+/// While the console holds the port for a document (see hold()), log and telemetry drop what they write.
+///
+/// The constructor is constexpr so the console can be written to from the constructors of the other
+/// global objects, whatever their order.
+/////////////////////////////////////////////////
+class ConsoleOut {
+public:
+  constexpr ConsoleOut(Print* port)
+    : reply(this, ConsoleStream::BLOCK),
+      log(this, ConsoleStream::DROP_OLDEST),
+      telemetry(this, ConsoleStream::DROP_WHOLE),
+      rpc(this, ConsoleStream::BLOCK),
+      port(port),
+      ring(),
+      head(0),
+      tail(0),
+      highWater(0),
+      evicted(0),
+      logBytes(),
+      held(false) {
+  }
+  void pump();
+  uint16_t getUsed();
+  uint16_t getFree();
+  uint16_t getHighWater();
+  uint32_t getEvicted();
+  void resetHighWater();
+  void hold(bool held);
+  void writeStats(StructuredWriter* doc);
+
+  ConsoleStream reply;
+  ConsoleStream log;
+  ConsoleStream telemetry;
+  ConsoleStream rpc;
+
+private:
+  friend class ConsoleStream;
+  Print* port;
+  uint8_t ring[CONSOLE_TX_RING_SIZE];
+  uint16_t head;       //next byte is queued here
+  uint16_t tail;       //next byte sent to the port
+  uint16_t highWater;  //most bytes waiting at once
+  uint32_t evicted;    //bytes of old log lines dropped to make room
+  uint8_t logBytes[CONSOLE_TX_RING_SIZE / 8];  //a bit per byte of the ring, set for the bytes of log
+  bool held;           //only reply is queued
+
+  size_t queue(ConsoleStream* stream, const uint8_t* buffer, size_t size);
+  bool makeRoom(ConsoleStream* stream, size_t size);
+  void put(const uint8_t* buffer, size_t size, bool isLog);
+  void evict(size_t size);
+  bool isLog(uint16_t at);
+  void markLog(uint16_t at, bool isLog);
+};
+
+//export the console output, one per thread when host tools run several controllers
+#if defined(__arm__)
+extern ConsoleOut console_out;
+#else
+extern thread_local ConsoleOut console_out;
+#endif
+
+#endif /* CONSOLEOUT_HPP_ */
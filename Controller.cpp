@@ -1,24 +1,38 @@
 #include "FlexCAN.h"
 #include "Controller.hpp"
+#include "ConsoleOut.hpp"
+
+#ifdef STATECYCLING
+#define STATECYCLING_ENABLED true
+#else
+#define STATECYCLING_ENABLED false
+#endif
 
 /////////////////////////////////////////////////
 /// \brief When instantiated, the controller is in the init state ensuring that all the signal pins are set properly.
-/////////////////////////////////////////////////
-Controller::Controller()
-  : faultModuleLoop(String("ModuleLoop"), String("A"), true, true, String("One or more BMS modules have asserted the fault loop!\n"), String("All modules have deasserted the fault loop\n")),
-    faultBatMon(String("BatMon"), String("B"), false, true, String("The battery monitor asserted a fault!\n"), String("The battery monitor deasserted a fault\n")),
-    faultBMSSerialComms(String("BMSSerialComms"), String("C"), true, true, String("Serial communication with battery modules lost!\n"), String("Serial communication with battery modules re-established!\n")),
-    faultBMSOV(String("BMSOV"), String("D"), true, true, String("A cell reached a voltage higher than the OV threshold\n"), String("All cells are back under OV threshold\n")),
-    faultBMSUV(String("BMSUV"), String("E"), false, true, String("A cell reached a voltage lower than the UV threshold\n"), String("All cells are back over UV threshold\n")),
-    faultBMSOT(String("BMSOT"), String("F"), true, true, String("A module reached a temp higher than the OT threshold\n"), String("All modules are back under OT threshold\n")),
-    faultBMSUT(String("BMSUT"), String("G"), true, true, String("A module reached a temp lower than the UT threshold\n"), String("All modules are back over UT threshold\n")),
-    fault12VBatOV(String("12VBatOV"), String("H"), false, false, String("12V battery reached a voltage higher than the OV threshold\n"), String("12V battery back under the OV threshold\n")),
-    fault12VBatUV(String("12VBatUV"), String("I"), false, true, String("12V battery reached a voltage lower than the UV threshold\n"), String("12V battery back over the UV threshold\n")),
-    faultWatSen1(String("WatSen1"), String("J"), true, true, String("The battery water sensor 1 is reporting water!\n"), String("The battery water sensor 1 is reporting dry.\n")),
-    faultWatSen2(String("WatSen2"), String("K"), true, true, String("The battery water sensor 2 is reporting water!\n"), String("The battery water sensor 2 is reporting dry.\n")),
-    faultIncorectModuleCount(String("IncorectModuleCount"), String("L"), true, true, String("Found a different ammount of modules than configured!\n"), String("Found all modules as configured!\n")),
-    bms(&settings) {
-  state = INIT;
+///
+/// The modules are read through driver and everything the controller and its parts log goes to logger,
+/// so several controllers can run side by side on their own chains.
+/////////////////////////////////////////////////
+Controller::Controller(BMSBus* driver, Logger* logger)
+  : faults(logger),
+    logger(logger),
+    bms(&settings, driver, logger),
+    power(&settings),
+    modulePower(&bms, &settings, logger),
+    cellFaults(&settings, logger),
+    timers(millis()),
+    stateTimer(onTimer, this),
+    stateTimeoutTimer(onTimer, this),
+    debounceTimer(onTimer, this),
+    dc2dcTimer(onTimer, this),
+    timerFired(false),
+    chargerInhibit(false),
+    powerLimiter(false),
+    trace(0),
+    stateMachine(STATECYCLING_ENABLED) {
+  state = ControllerStateMachine::INIT;
+  timers.arm(&stateTimer, stateMachine.getStateDef(state).minTimeMs);
 
   msg.ext = 1;
   msg.id = BMS_EVCC_STATUS_IND;
@@ -38,25 +52,13 @@ Controller::Controller()
   //try to load object
   settings.loadAllSettingsFromEEPROM(0);
   if (!((settings.magic_bytes.valueMatchDefault()) && (settings.eeprom_version.valueMatchDefault()))) {
-    Serial.print("EEPROM does not match magicbytes and version\n");
+    console_out.reply.print("EEPROM does not match magicbytes and version\n");
     (void)reloadDefaultSettings();
-    Serial.print("Default values reloaded\n");
+    console_out.reply.print("Default values reloaded\n");
   } else {
-    Serial.printf("Loaded config from EEPROM|| magicbytes: 0x%X, version = %d\n", settings.magic_bytes.getVal(), settings.eeprom_version.getVal());
+    console_out.reply.printf("Loaded config from EEPROM|| magicbytes: 0x%X, version = %d\n", settings.magic_bytes.getVal(), settings.eeprom_version.getVal());
   }
 
-  faults.push_back(&faultModuleLoop);
-  faults.push_back(&faultBatMon);
-  faults.push_back(&faultBMSSerialComms);
-  faults.push_back(&faultBMSOV);
-  faults.push_back(&faultBMSUV);
-  faults.push_back(&faultBMSOT);
-  faults.push_back(&faultBMSUT);
-  faults.push_back(&fault12VBatOV);
-  faults.push_back(&fault12VBatUV);
-  faults.push_back(&faultWatSen1);
-  faults.push_back(&faultWatSen2);
-  faults.push_back(&faultIncorectModuleCount);
   //Serial.print("Controller faults created\n");
 }
 
@@ -71,15 +73,101 @@ int32_t Controller::reloadDefaultSettings() {
   return saveSettings();
 }
 
+/////////////////////////////////////////////////
+/// \brief Actions of each state, in ControllerStateMachine::State order.
+/////////////////////////////////////////////////
+const Controller::StateActions Controller::stateActions[ControllerStateMachine::NUMBER_OF_STATES] = {
+  { 0, &Controller::init, &Controller::markReset },  // INIT
+  { 0, &Controller::standby, 0 },                    // STANDBY
+  { 0, &Controller::pre_charge, 0 },                 // PRE_CHARGE
+  { 0, &Controller::charging, 0 },                   // CHARGING
+  { 0, &Controller::top_balancing, 0 },              // TOP_BALANCING
+  { 0, &Controller::post_charge, 0 },                // POST_CHARGE
+  { 0, &Controller::run, 0 },                        // RUN
+};
+
+/////////////////////////////////////////////////
+/// \brief switches to a new state, running the exit and entry actions and arming the timers of the new state.
+///
+/// All the durations are in milliseconds on the timer wheel so they do not depend on the loop period.
+/////////////////////////////////////////////////
+void Controller::enterState(ControllerState newState) {
+  const ControllerStateMachine::StateDef& def = stateMachine.getStateDef(newState);
+
+  if (stateActions[state].onExit) (this->*stateActions[state].onExit)();
+  state = newState;
+  timers.cancel(&stateTimer);
+  timers.cancel(&stateTimeoutTimer);
+  timers.cancel(&debounceTimer);
+  if (def.minTimeMs) timers.arm(&stateTimer, def.minTimeMs);
+  if (def.timeoutMs) timers.arm(&stateTimeoutTimer, def.timeoutMs);
+  LOG_INFO("Transition to %s\n", def.name);
+  if (stateActions[state].onEntry) (this->*stateActions[state].onEntry)();
+}
+
+/////////////////////////////////////////////////
+/// \brief takes the snapshot of the inputs the state machine guards look at.
+/////////////////////////////////////////////////
+void Controller::readInputs() {
+  inputs.run = readDigital(INH_RUN) == HIGH;
+  inputs.charging = readDigital(INH_CHARGING) == HIGH;
+  inputs.evseDisconnected = readDigital(INL_EVSE_DISC) == LOW;
+  inputs.chargeCycleNeeded = bms.getHighCellVolt() < settings.charger_cycle_v_setpoint.getVal()
+                             && bms.getHighCellVolt() < settings.max_charge_v_setpoint.getVal();
+  inputs.topBalanceReached = bms.getHighCellVolt() >= settings.top_balance_v_setpoint.getVal();
+  inputs.stateTimerExpired = stateTimer.isExpired();
+  inputs.stateTimeoutExpired = stateTimeoutTimer.isExpired();
+  inputs.disconnectDebounced = debounce(&debounceTimer, inputs.evseDisconnected || !inputs.charging,
+                                        ControllerStateMachine::CHARGE_DISCONNECT_DEBOUNCE_MS);
+}
+
+/////////////////////////////////////////////////
+/// \brief reads a digital input, through the trace recorder when one is set.
+/////////////////////////////////////////////////
+int Controller::readDigital(uint8_t pin) {
+  int level = digitalRead(pin);
+  if (trace) trace->digital(pin, level);
+  return level;
+}
+
+/////////////////////////////////////////////////
+/// \brief reads an analog input, through the trace recorder when one is set.
+/////////////////////////////////////////////////
+int Controller::readAnalog(uint8_t pin) {
+  int value = analogRead(pin);
+  if (trace) trace->analog(pin, value);
+  return value;
+}
+
+/////////////////////////////////////////////////
+/// \brief records the time at which the controller left INIT.
+/////////////////////////////////////////////////
+void Controller::markReset() {
+  lastResetTimeStamp = now();
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true once the condition has been true for windowMs without interruption.
+///
+/// The window restarts every time the condition is false.
+/////////////////////////////////////////////////
+bool Controller::debounce(Timer* timer, bool condition, uint32_t windowMs) {
+  if (!condition) {
+    timers.cancel(timer);
+    return false;
+  }
+  if (!timer->isArmed() && !timer->isExpired()) {
+    timers.arm(timer, windowMs);
+  }
+  return timer->isExpired();
+}
+
 /////////////////////////////////////////////////
 /// \brief Orchestrates the activities within the BMS via a state machine.
 /////////////////////////////////////////////////
 void Controller::doController() {
-  //Serial.print("doController\n");
-  static int ticks = 0;
-  static unsigned int bat12Vcyclestart = 0;
-  static int standbyTicks = 1;  //1 because ticks slow down
-  const int stateticks = 4;
+  timers.advance(millis());
+  timerFired = false;
 
   msgStatusIns.bBMSStatusFlags = 0;
   msgStatusIns.bBMSFault = 0;
@@ -96,226 +184,25 @@ void Controller::doController() {
 
   //Serial.print("doController can done\n");
 
-  bat12vVoltage = (float)analogRead(INA_12V_BAT) / settings.bat12v_scaling_divisor.getVal();
+  bat12vVoltage = (float)readAnalog(INA_12V_BAT) / settings.bat12v_scaling_divisor.getVal();
 
-  if (state != INIT) syncModuleDataObjects();
+  if (state != ControllerStateMachine::INIT) syncModuleDataObjects();
 
   //Serial.print("doController syncModuleDataObjects\n");
 
   //figure out state transition
-  switch (state) {
-    /**************** ****************/
-    case INIT:
-      if (ticks >= stateticks) {
-        ticks = 0;
-        state = STANDBY;
-        lastResetTimeStamp = now();
-        LOG_INFO("Transition to STANDBY\n");
-      }
-      break;
-    /**************** ****************/
-    case STANDBY:
-#ifdef STATECYCLING
-      if (ticks >= stateticks) {
-        ticks = 0;
-        state = PRE_CHARGE;
-        LOG_INFO("Transition to PRE_CHARGE\n");
-      }
-#else
-      if (dc2dcON_H == 0 && bat12vVoltage < settings.dc2dc_cycle_v_setpoint.getVal()) {
-        bat12Vcyclestart = (millis() / 1000);
-        dc2dcON_H = 1;
-      } else if (dc2dcON_H == 1 && ((millis() / 1000) > bat12Vcyclestart + settings.dc2dc_cycle_time_s.getVal())) {
-        // I am ignoring the time counter loop around as it will simply result in a short charge cycle
-        // followed with a proper charging cycle.
-        dc2dcON_H = 0;
-      }
-
-      if (digitalRead(INH_RUN) == HIGH) {
-        ticks = 0;
-        state = RUN;
-        LOG_INFO("Transition to RUN\n");
-      } else if (digitalRead(INH_CHARGING) == HIGH) {
-        ticks = 0;
-        state = CHARGING;
-        LOG_INFO("Transition to CHARGING\n");
-      } else if (bms.getHighCellVolt() < settings.charger_cycle_v_setpoint.getVal() && bms.getHighCellVolt() < settings.max_charge_v_setpoint.getVal() && ticks >= standbyTicks) {
-        ticks = 0;
-        state = PRE_CHARGE;
-        LOG_INFO("Transition to PRE_CHARGE\n");
-      }
-#endif
-      break;
-    /**************** ****************/
-    case PRE_CHARGE:
-#ifdef STATECYCLING
-      if (ticks >= stateticks) {
-        ticks = 0;
-        state = CHARGING;
-        LOG_INFO("Transition to CHARGING\n");
-      }
-#else
-      if (ticks >= 10 && ticks <= 100) {  //adjust to give time to the EVCC to properly boot (5 ticks == 1 seconds)
-        if ((digitalRead(INL_EVSE_DISC) == LOW)) {
-          ticks = 0;
-          state = STANDBY;
-          LOG_INFO("Transition to STANDBY\n");
-        } else if (digitalRead(INH_CHARGING) == HIGH) {
-          ticks = 0;
-          state = CHARGING;
-          LOG_INFO("Transition to CHARGING\n");
-        }
-      } else if (ticks > 100) {
-        ticks = 0;
-        state = STANDBY;
-        LOG_ERR("charger did not start!!!\n");
-        LOG_INFO("Transition to STANDBY\n");
-      }
-#endif
-      break;
-    /**************** ****************/
-    case CHARGING:
-#ifdef STATECYCLING
-      if (ticks >= stateticks) {
-        ticks = 0;
-        state = TOP_BALANCING;
-        LOG_INFO("Transition to TOP_BALANCING\n");
-      }
-#else
-      if (ticks >= 5 && (digitalRead(INL_EVSE_DISC) == LOW || digitalRead(INH_CHARGING) == LOW)) {
-        ticks = 0;
-        state = POST_CHARGE;
-        LOG_INFO("Transition to POST_CHARGE\n");
-      } else if (digitalRead(INL_EVSE_DISC) == LOW || digitalRead(INH_CHARGING) == LOW) {
-        //debounce error by letting ticks go up to 5.
-        //LOG_INFO("INL_EVSE_DISC == LOW || INH_CHARGING == LOW\n");
-        if (digitalRead(INL_EVSE_DISC) == LOW) {
-          LOG_INFO("INL_EVSE_DISC == LOW\n");
-        } else if (digitalRead(INH_CHARGING) == LOW) {
-          LOG_INFO("INH_CHARGING == LOW\n");
-        }
-      } else if (bms.getHighCellVolt() >= settings.top_balance_v_setpoint.getVal()) {
-        ticks = 0;
-        state = TOP_BALANCING;
-        LOG_INFO("Transition to TOP_BALANCING\n");
-      } else {
-        ticks = 0;
-      }
-#endif
-      break;
-    /**************** ****************/
-    case TOP_BALANCING:
-#ifdef STATECYCLING
-      if (ticks >= stateticks) {
-        ticks = 0;
-        state = POST_CHARGE;
-        LOG_INFO("Transition to POST_CHARGE\n");
-      }
-#else
-      if (ticks >= 5 && (digitalRead(INL_EVSE_DISC) == LOW || digitalRead(INH_CHARGING) == LOW)) {
-        ticks = 0;
-        state = POST_CHARGE;
-        LOG_INFO("Transition to POST_CHARGE\n");
-      } else if (digitalRead(INL_EVSE_DISC) == LOW || digitalRead(INH_CHARGING) == LOW) {
-        //debounce error by letting ticks go up to 5.
-        //msgStatusIns.bBMSStatusFlags |= BMS_STATUS_CELL_BVC_FLAG;
-        LOG_INFO("INL_EVSE_DISC == LOW || INH_CHARGING == LOW\n");
-      } else {
-        //msgStatusIns.bBMSStatusFlags |= BMS_STATUS_CELL_BVC_FLAG;
-        ticks = 0;
-      }
-#endif
-      break;
-    /**************** ****************/
-    case POST_CHARGE:
-#ifdef STATECYCLING
-      if (ticks >= stateticks) {
-        ticks = 0;
-        state = RUN;
-        LOG_INFO("Transition to RUN\n");
-      }
-#else
-      //adjust to give time to the EVCC to properly go to sleep (5 ticks == 1 seconds)
-      //This will happen if the loop evcc input (fault line) is asserted.
-      if (ticks >= 50 && digitalRead(INH_CHARGING) == LOW) {
-        ticks = 0;
-        state = STANDBY;
-        LOG_INFO("Transition to STANDBY\n");
-      }
-#endif
-      break;
-    /**************** ****************/
-    case RUN:
-#ifdef STATECYCLING
-      if (ticks >= stateticks) {
-        ticks = 0;
-        state = INIT;
-        LOG_INFO("Transition to INIT\n");
-      }
-#else
-      if (digitalRead(INH_RUN) == LOW) {
-        ticks = 0;
-        state = STANDBY;
-        LOG_INFO("Transition to STANDBY\n");
-      }
-#endif
-      break;
-    /**************** ****************/
-    default:
-      break;
+  readInputs();
+  const ControllerStateMachine::Transition* transition = stateMachine.next(state, inputs);
+  if (transition) {
+    if (transition->error) LOG_ERR(transition->error);
+    enterState(transition->to);
   }
 
   //execute state
-  switch (state) {
-
-    case INIT:
-      period = LOOP_PERIOD_ACTIVE_MS;
-      init();
-      break;
-
-    case STANDBY:
-      //prevents sleeping if the console is connected or if within 10 minutes of a hard reset.
-      //The teensy wont let reprogram if it slept once so this allows reprograming within 10 minutes.
-      if (SERIALCONSOLE || millis() < settings.time_before_first_sleep.getVal()) {
-        period = LOOP_PERIOD_ACTIVE_MS;
-        standbyTicks = 10;
-      } else {
-        period = LOOP_PERIOD_STANDBY_MS;
-        standbyTicks = 1;
-      }
-      standby();
-      break;
-
-    case PRE_CHARGE:
-      period = LOOP_PERIOD_ACTIVE_MS;
-      pre_charge();
-      break;
-
-    case CHARGING:
-      period = LOOP_PERIOD_ACTIVE_MS;
-      charging();
-      break;
-
-    case TOP_BALANCING:
-      period = LOOP_PERIOD_ACTIVE_MS;
-      top_balancing();
-      break;
-
-    case POST_CHARGE:
-      period = LOOP_PERIOD_ACTIVE_MS;
-      post_charge();
-      break;
-
-    case RUN:
-      period = LOOP_PERIOD_ACTIVE_MS;
-      run();
-      break;
-
-    default:
-      period = LOOP_PERIOD_ACTIVE_MS;
-      break;
-  }
-  ticks++;
+  period = LOOP_PERIOD_ACTIVE_MS;
+  (this->*stateActions[state].onDo)();
+  power.setSleepAllowed(period > LOOP_PERIOD_ACTIVE_MS);
+
   //set outputs
   setOutput(OUTL_EVCC_ON, outL_evcc_on_buffer);
   setOutput(OUTH_FAULT, outH_fault_buffer);
@@ -335,96 +222,45 @@ void Controller::doController() {
 /////////////////////////////////////////////////
 void Controller::syncModuleDataObjects() {
   float bat12vVoltage;
-  bms.wakeBoards();
-
-  if (bms.getAllVoltTemp() < settings.module_count.getVal()) {
-    faultIncorectModuleCount.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultIncorectModuleCount.resetFault();
-  }
-
-  if (bms.getLineFault()) {
-    faultBMSSerialComms.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultBMSSerialComms.resetFault();
-  }
-
-  if (digitalRead(INL_BAT_PACK_FAULT) == LOW) {
-    faultModuleLoop.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultModuleLoop.resetFault();
-  }
-
-  if (digitalRead(INL_BAT_MON_FAULT) == LOW) {
-    faultBatMon.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultBatMon.resetFault();
-  }
-
-  if (digitalRead(INL_WATER_SENS1) == LOW) {
-    faultWatSen1.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultWatSen1.resetFault();
-  }
-
-  if (digitalRead(INL_WATER_SENS2) == LOW) {
-    faultWatSen2.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultWatSen2.resetFault();
-  }
-
-  if (bms.getHighCellVolt() > settings.over_v_setpoint.getVal()) {
-    faultBMSOV.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultBMSOV.resetFault();
-  }
-
-  if (bms.getLowCellVolt() < settings.under_v_setpoint.getVal()) {
-    faultBMSUV.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultBMSUV.resetFault();
-  }
-
-  if (bms.getHighTemperature() > settings.over_t_setpoint.getVal()) {
-    faultBMSOT.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultBMSOT.resetFault();
+  bool dutyCycleAllowed = isModuleSleepSafe();
+  bool validSample = false;
+  bool sampled = modulePower.beginSample(dutyCycleAllowed);
+
+  uint32_t debounceMs = settings.fault_debounce_ms.getVal();
+
+  //while the modules sleep between measurement windows, the last readings are kept
+  if (sampled) {
+    validSample = bms.getAllVoltTemp() >= settings.module_count.getVal();
+    faults.update(FaultRegistry::INCORRECT_MODULE_COUNT, !validSample, debounceMs);
+    faults.update(FaultRegistry::BMS_SERIAL_COMMS, bms.getLineFault(), debounceMs);
+    validSample &= !bms.getLineFault();
   }
 
-  if (bms.getLowTemperature() < settings.under_t_setpoint.getVal()) {
-    faultBMSUT.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    faultBMSUT.resetFault();
-  }
+  faults.update(FaultRegistry::MODULE_LOOP, readDigital(INL_BAT_PACK_FAULT) == LOW, debounceMs);
+  faults.update(FaultRegistry::BAT_MON, readDigital(INL_BAT_MON_FAULT) == LOW, debounceMs);
+  faults.update(FaultRegistry::WAT_SEN1, readDigital(INL_WATER_SENS1) == LOW, debounceMs);
+  faults.update(FaultRegistry::WAT_SEN2, readDigital(INL_WATER_SENS2) == LOW, debounceMs);
 
-  bat12vVoltage = (float)analogRead(INA_12V_BAT) / settings.bat12v_scaling_divisor.getVal();
-  if (bat12vVoltage > settings.bat12v_over_v_setpoint.getVal()) {
-    fault12VBatOV.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    fault12VBatOV.resetFault();
-  }
+  //every cell and sensor is debounced by the cell fault monitor, the pack level faults follow it
+  cellFaults.update(&bms);
+  faults.update(FaultRegistry::BMS_OV, cellFaults.isAsserted(CellFaultMonitor::OV), 0);
+  faults.update(FaultRegistry::BMS_UV, cellFaults.isAsserted(CellFaultMonitor::UV), 0);
+  faults.update(FaultRegistry::BMS_OT, cellFaults.isAsserted(CellFaultMonitor::OT), 0);
+  faults.update(FaultRegistry::BMS_UT, cellFaults.isAsserted(CellFaultMonitor::UT), 0);
 
-  if (bat12vVoltage < settings.bat12v_under_v_setpoint.getVal()) {
-    fault12VBatUV.countFault(settings.fault_debounce_count.getVal());
-  } else {
-    fault12VBatUV.resetFault();
-  }
+  bat12vVoltage = (float)readAnalog(INA_12V_BAT) / settings.bat12v_scaling_divisor.getVal();
+  faults.update(FaultRegistry::BAT12V_OV, bat12vVoltage > settings.bat12v_over_v_setpoint.getVal(), debounceMs);
+  faults.update(FaultRegistry::BAT12V_UV, bat12vVoltage < settings.bat12v_under_v_setpoint.getVal(), debounceMs);
 
-  chargerInhibit = false;
-  powerLimiter = false;
-  isFaulted = false;
+  chargerInhibit = faults.isChargerInhibit();
+  powerLimiter = faults.isPowerLimiter();
+  isFaulted = faults.getActive() != 0;
 
-  for (auto i = faults.begin(); i != faults.end(); i++) {
-    if ((*i)->getChargeFault()) chargerInhibit |= (*i)->getFault();
-    if ((*i)->getRunFault()) powerLimiter |= (*i)->getFault();
-    isFaulted |= (*i)->getFault();
-  }
-
-  if (faultBMSUV.getFault()) {
+  if (faults.isActive(FaultRegistry::BMS_UV)) {
     msgStatusIns.bBMSStatusFlags |= BMS_STATUS_CELL_LVC_FLAG;
   }
 
-  if (faultBMSOT.getFault()) {
+  if (faults.isActive(FaultRegistry::BMS_OT)) {
     msgStatusIns.bBMSFault |= BMS_FAULT_OVERTEMP_FLAG;
   }
 
@@ -441,14 +277,46 @@ void Controller::syncModuleDataObjects() {
 
   stickyFaulted |= isFaulted;
 
-  bms.clearFaults();
-  //bms.sleepBoards();
+  if (sampled) {
+    bms.clearFaults();
+    modulePower.endSample(validSample, dutyCycleAllowed);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if balanceCells() would bleed at least one cell.
+/////////////////////////////////////////////////
+bool Controller::isBalancingNeeded() {
+  float spread = bms.getHighCellVolt() - bms.getLowCellVolt();
+  if (bms.getHighCellVolt() > settings.precision_balance_v_setpoint.getVal()) {
+    return spread > settings.precision_balance_cell_v_offset.getVal();
+  } else if (bms.getHighCellVolt() > settings.rough_balance_v_setpoint.getVal()) {
+    return spread > settings.rough_balance_cell_v_offset.getVal();
+  }
+  return false;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the modules can sleep between measurement windows.
+///
+/// Only while parked (STANDBY and the PRE_CHARGE checks for an EVSE), without any fault or balancing to do
+/// and with all readings further than the warning offsets from their fault thresholds.
+/////////////////////////////////////////////////
+bool Controller::isModuleSleepSafe() {
+  if ((state != ControllerStateMachine::STANDBY && state != ControllerStateMachine::PRE_CHARGE) || isFaulted || isBalancingNeeded()) {
+    return false;
+  }
+  return bms.getHighCellVolt() < settings.over_v_setpoint.getVal() - settings.warn_cell_v_offset.getVal()
+         && bms.getLowCellVolt() > settings.under_v_setpoint.getVal() + settings.warn_cell_v_offset.getVal()
+         && bms.getHighTemperature() < settings.over_t_setpoint.getVal() - settings.warn_t_offset.getVal()
+         && bms.getLowTemperature() > settings.under_t_setpoint.getVal() + settings.warn_t_offset.getVal();
 }
 
 /////////////////////////////////////////////////
 /// \brief balances the cells according to BALANCE_CELL_V_OFFSET threshold in the CONFIG.h file
 /////////////////////////////////////////////////
 void Controller::balanceCells() {
+  if (modulePower.isSleeping()) return;
   //balance for 1 second given that the controller wakes up every second.
   if (bms.getHighCellVolt() > settings.precision_balance_v_setpoint.getVal()) {
     LOG_INFO("precision balance\n");
@@ -531,6 +399,19 @@ void Controller::setOutput(int pin, int state) {
 /// \brief standby state is when the boat is not charging and not in run state.
 /////////////////////////////////////////////////
 void Controller::standby() {
+  //prevents sleeping if the console was used recently or if within 10 minutes of a hard reset.
+  //The teensy wont let reprogram if it slept once so this allows reprograming within 10 minutes.
+  if (!power.isAwakeRequired()) period = LOOP_PERIOD_STANDBY_MS;
+
+  if (!STATECYCLING_ENABLED) {
+    if (dc2dcON_H == 0 && bat12vVoltage < settings.dc2dc_cycle_v_setpoint.getVal()) {
+      timers.arm(&dc2dcTimer, settings.dc2dc_cycle_time_s.getVal() * 1000);
+      dc2dcON_H = 1;
+    } else if (dc2dcON_H == 1 && dc2dcTimer.isExpired()) {
+      dc2dcON_H = 0;
+    }
+  }
+
   balanceCells();
   outL_evcc_on_buffer = HIGH;
   outH_fault_buffer = chargerInhibit;
@@ -556,6 +437,11 @@ void Controller::pre_charge() {
 /// to a EVSE and is actively charging until EVCC shuts itself down.
 /////////////////////////////////////////////////
 void Controller::charging() {
+  if (inputs.evseDisconnected) {
+    LOG_INFO("INL_EVSE_DISC == LOW\n");
+  } else if (!inputs.charging) {
+    LOG_INFO("INH_CHARGING == LOW\n");
+  }
   balanceCells();
   outL_evcc_on_buffer = LOW;
   outH_fault_buffer = chargerInhibit;
@@ -571,6 +457,9 @@ void Controller::charging() {
 /// as it tries to measure a current drop in the charging.
 /////////////////////////////////////////////////
 void Controller::top_balancing() {
+  if (inputs.evseDisconnected || !inputs.charging) {
+    LOG_INFO("INL_EVSE_DISC == LOW || INH_CHARGING == LOW\n");
+  }
   balanceCells();
   msgStatusIns.bBMSStatusFlags |= BMS_STATUS_CELL_BVC_FLAG;
   outL_evcc_on_buffer = LOW;
@@ -609,6 +498,13 @@ Controller::ControllerState Controller::getState() {
   return state;
 }
 
+/////////////////////////////////////////////////
+/// \brief records every input the controller reads to trace, 0 to stop.
+/////////////////////////////////////////////////
+void Controller::setTrace(TraceRecorder* trace) {
+  this->trace = trace;
+}
+
 /////////////////////////////////////////////////
 /// \brief returns the Settings instance to allow access to its members.
 /////////////////////////////////////////////////
@@ -616,6 +512,62 @@ Settings* Controller::getSettingsPtr() {
   return &settings;
 }
 
+/////////////////////////////////////////////////
+/// \brief returns the PowerManager instance to allow scheduling deadlines and idling.
+/////////////////////////////////////////////////
+PowerManager* Controller::getPowerPtr() {
+  return &power;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the ModulePowerManager instance for reporting purposes.
+/////////////////////////////////////////////////
+ModulePowerManager* Controller::getModulePowerPtr() {
+  return &modulePower;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the TimerWheel instance driving the controller timeouts.
+/////////////////////////////////////////////////
+TimerWheel* Controller::getTimerWheelPtr() {
+  return &timers;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the CellFaultMonitor instance to report which cells and sensors are faulted.
+/////////////////////////////////////////////////
+CellFaultMonitor* Controller::getCellFaultsPtr() {
+  return &cellFaults;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the Logger the controller and its parts log to.
+/////////////////////////////////////////////////
+Logger* Controller::getLoggerPtr() {
+  return logger;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true when the last tick asked the EVCC to stop charging.
+/////////////////////////////////////////////////
+bool Controller::isChargerInhibit() {
+  return chargerInhibit;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true when the last tick asked the motor controller to limit its power.
+/////////////////////////////////////////////////
+bool Controller::isPowerLimiter() {
+  return powerLimiter;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the name of a state for logging purposes.
+/////////////////////////////////////////////////
+const char* Controller::getStateName(ControllerState state) {
+  return stateMachine.getStateDef(state).name;
+}
+
 /////////////////////////////////////////////////
 /// \brief returns the BMS instance to allow access to its members for reporting purposes.
 /////////////////////////////////////////////////
@@ -630,6 +582,21 @@ uint32_t Controller::getPeriodMillis() {
   return period;
 }
 
+/////////////////////////////////////////////////
+/// \brief returns true if one of the timers of the controller expired since it last ran, it should run
+/// before its turn comes. The timer wheel must have been advanced to now.
+/////////////////////////////////////////////////
+bool Controller::isTimerDue() {
+  return timerFired;
+}
+
+/////////////////////////////////////////////////
+/// \brief marks that a timer of the controller expired, called by the timer wheel.
+/////////////////////////////////////////////////
+void Controller::onTimer(void* context) {
+  ((Controller*)context)->timerFired = true;
+}
+
 void Controller::printControllerState() {
   uint32_t seconds = millis() / 1000;
   LOG_CONSOLE("OUTL_EVCC_ON: %d\n", outL_evcc_on_buffer);
@@ -638,29 +605,7 @@ void Controller::printControllerState() {
   LOG_CONSOLE("OUTPWM_PUMP: %d\n", outpwm_pump_buffer);
   LOG_CONSOLE("====================================================================================\n");
   LOG_CONSOLE("=                     BMS Controller registered faults                             =\n");
-  switch (state) {
-    case INIT:
-      LOG_CONSOLE("=  state: INIT                                                                     =\n");
-      break;
-    case STANDBY:
-      LOG_CONSOLE("=  state: STANDBY                                                                  =\n");
-      break;
-    case PRE_CHARGE:
-      LOG_CONSOLE("=  state: PRE_CHARGE                                                               =\n");
-      break;
-    case CHARGING:
-      LOG_CONSOLE("=  state: CHARGING                                                                 =\n");
-      break;
-    case TOP_BALANCING:
-      LOG_CONSOLE("=  state: TOP_BALANCING                                                         =\n");
-      break;
-    case POST_CHARGE:
-      LOG_CONSOLE("=  state: POST_CHARGE                                                              =\n");
-      break;
-    case RUN:
-      LOG_CONSOLE("=  state: RUN                                                                      =\n");
-      break;
-  }
+  LOG_CONSOLE("=  state: %-73s=\n", getStateName(state));
   LOG_CONSOLE("=  Time since last reset:%-3d days, %02d:%02d:%02d                                        =\n",
               seconds / 86400, (seconds % 86400) / 3600, (seconds % 3600) / 60, (seconds % 60));
   LOG_CONSOLE("=  Time of last reset: ");
@@ -672,10 +617,36 @@ void Controller::printControllerState() {
   LOG_CONSOLE("====================================================================================\n");
   LOG_CONSOLE("%-22s   last fault time\n", "Fault Name");
   LOG_CONSOLE("----------------------   -----------------------------------------------------------\n");
-  for (auto i = faults.begin(); i != faults.end(); i++) {
-    if ((*i)->getSFault()) {
-      LOG_CONSOLE("%-22s @ ", (*i)->getName().c_str());
-      LOG_TIMESTAMP_LN((*i)->getTimeStamp());
-    }
+  for (uint32_t w = faults.getSticky(); w != 0; w &= w - 1) {
+    FaultRegistry::FaultId id = (FaultRegistry::FaultId)__builtin_ctz(w);
+    LOG_CONSOLE("%-22s @ ", FaultRegistry::getDef(id).name);
+    LOG_TIMESTAMP_LN(faults.getTimeStamp(id));
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief writes what printControllerState() prints: the outputs, the state, the times (seconds since
+/// the epoch, the uptime in seconds) and the sticky faults with the time they were last raised.
+/////////////////////////////////////////////////
+void Controller::writeControllerState(StructuredWriter* doc) {
+  doc->beginObject("outputs");
+  doc->putInt("OUTL_EVCC_ON", outL_evcc_on_buffer);
+  doc->putInt("OUTH_FAULT", outH_fault_buffer);
+  doc->putInt("OUTL_12V_BAT_CHRG", outL_12V_bat_chrg_buffer);
+  doc->putInt("OUTPWM_PUMP", outpwm_pump_buffer);
+  doc->endObject();
+  doc->putString("state", getStateName(state));
+  doc->putUint("uptime", millis() / 1000);
+  doc->putUint("lastReset", lastResetTimeStamp);
+  doc->putUint("time", now());
+  doc->beginArray("faults");
+  for (uint32_t w = faults.getSticky(); w != 0; w &= w - 1) {
+    FaultRegistry::FaultId id = (FaultRegistry::FaultId)__builtin_ctz(w);
+    doc->beginObject();
+    doc->putString("name", FaultRegistry::getDef(id).name);
+    doc->putBool("active", faults.getActive() & (1ul << id));
+    doc->putUint("time", faults.getTimeStamp(id));
+    doc->endObject();
   }
+  doc->endArray();
 }
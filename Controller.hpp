@@ -4,99 +4,17 @@
 #include <Arduino.h>
 #include "Config.hpp"
 #include "BMSModuleManager.hpp"
-#include <list>
-#include <String>
+#include "PowerManager.hpp"
+#include "ModulePowerManager.hpp"
+#include "TimerWheel.hpp"
+#include "CellFaultMonitor.hpp"
+#include "FaultRegistry.hpp"
+#include "ControllerStateMachine.hpp"
+#include "TraceRecorder.hpp"
 
 #ifndef CONTROLLER_HPP_
 #define CONTROLLER_HPP_
 
-class Fault {
-public:
-  Fault(const String name, const String code, bool chargeFault, bool runFault, const String msgAsserted, const String msgDeAsserted)
-    : name(name),
-      code(code),
-      fault(false),
-      sFault(false),
-      chargeFault(chargeFault),
-      runFault(runFault),
-      msgAsserted(msgAsserted),
-      msgDeAsserted(msgDeAsserted),
-      debounceCounter(0),
-      timeStamp(0) {
-    ;
-  }
-
-  void countFault(uint32_t fault_debounce_counter) {
-    debounceCounter++;
-    if (debounceCounter >= fault_debounce_counter) {
-      if (fault) {
-        LOG_ERR(msgAsserted.c_str());
-      }
-      fault = true;
-      sFault = true;
-      timeStamp = now();
-      debounceCounter = fault_debounce_counter;
-    }
-  }
-
-  void resetFault() {
-    if (fault) {
-      LOG_ERR(msgDeAsserted.c_str());
-    }
-    fault = false;
-    debounceCounter = 0;
-  }
-
-  bool getFault() {
-    return fault;
-  }
-
-  bool getSFault() {
-    return sFault;
-  }
-
-  const String getName() {
-    return name;
-  }
-
-  const String getCode() {
-    return code;
-  }
-
-  bool getChargeFault() {
-    return chargeFault;
-  }
-
-  bool getRunFault() {
-    return runFault;
-  }
-
-  const String getMsgAsserted() {
-    return msgAsserted;
-  }
-
-  const String getMsgDeAsserted() {
-    return msgDeAsserted;
-  }
-
-  time_t getTimeStamp() {
-    return timeStamp;
-  }
-
-private:
-  const String name;
-  const String code;
-  bool fault;
-  bool sFault;
-  bool chargeFault;
-  bool runFault;
-  const String msgAsserted;
-  const String msgDeAsserted;
-  uint8_t debounceCounter;
-  time_t timeStamp;
-};
-
-
 /*
 * The EVCC supports 250kbps CAN data rate and 29 bit identifiers
 */
@@ -123,38 +41,33 @@ typedef struct tBMS_EVCC_StatusInd {
 
 class Controller {
 public:
-  enum ControllerState {
-    INIT,
-    STANDBY,
-    PRE_CHARGE,
-    CHARGING,
-    TOP_BALANCING,
-    POST_CHARGE,
-    RUN
-  };
-  
+  typedef ControllerStateMachine::State ControllerState;
+
   void doController();
-  Controller();
+  Controller(BMSBus* driver, Logger* logger);
   ControllerState getState();
   BMSModuleManager* getBMSPtr();
   Settings* getSettingsPtr();
+  PowerManager* getPowerPtr();
+  ModulePowerManager* getModulePowerPtr();
+  TimerWheel* getTimerWheelPtr();
+  CellFaultMonitor* getCellFaultsPtr();
+  Logger* getLoggerPtr();
+  static Logger::Subsystem getLogSubsystem() {
+    return Logger::CONTROLLER;
+  }
+  bool isChargerInhibit();
+  bool isPowerLimiter();
+  void setTrace(TraceRecorder* trace);
+  const char* getStateName(ControllerState state);
   void printControllerState();
+  void writeControllerState(StructuredWriter* doc);
   uint32_t getPeriodMillis();
+  bool isTimerDue();
   int32_t reloadDefaultSettings();
   int32_t saveSettings();
 
-  Fault faultModuleLoop;
-  Fault faultBatMon;
-  Fault faultBMSSerialComms;
-  Fault faultBMSOV;
-  Fault faultBMSUV;
-  Fault faultBMSOT;
-  Fault faultBMSUT;
-  Fault fault12VBatOV;
-  Fault fault12VBatUV;
-  Fault faultWatSen1;
-  Fault faultWatSen2;
-  Fault faultIncorectModuleCount;
+  FaultRegistry faults;
 
   bool isFaulted;
   bool stickyFaulted;
@@ -164,15 +77,36 @@ public:
   bool outL_evcc_on_buffer;
   bool outH_fault_buffer;
 
-  std::list<Fault*> faults;
-
 private:
+  /////////////////////////////////////////////////
+  /// \brief Actions bound to a state of the ControllerStateMachine, 0 for none.
+  /////////////////////////////////////////////////
+  struct StateActions {
+    void (Controller::*onEntry)();
+    void (Controller::*onDo)();  //runs every tick spent in the state
+    void (Controller::*onExit)();
+  };
+  static const StateActions stateActions[ControllerStateMachine::NUMBER_OF_STATES];
+
+  Logger* logger;
   Settings settings;
   BMSModuleManager bms;
+  PowerManager power;
+  ModulePowerManager modulePower;
+  CellFaultMonitor cellFaults;
+  TimerWheel timers;
+  Timer stateTimer;         //minimum time spent in the state before acting on the inputs
+  Timer stateTimeoutTimer;  //maximum time spent in the state
+  Timer debounceTimer;      //input debounce window
+  Timer dc2dcTimer;         //DC2DC charge cycle of the 12V battery
+  bool timerFired;          //one of the timers expired since doController() last ran
   bool chargerInhibit;
   bool powerLimiter;
   bool dc2dcON_H;
   uint32_t period;
+  TraceRecorder* trace;
+  ControllerStateMachine stateMachine;
+  ControllerStateMachine::Inputs inputs;
   ControllerState state;
   bool canOn = false;
   time_t lastResetTimeStamp;
@@ -180,10 +114,19 @@ private:
   //run-time functions
   void syncModuleDataObjects();  //gathers all the data from the boards and populates the BMSModel object instances
   void balanceCells();           //balances the cells according to thresholds in the BMSModuleManager
+  bool isBalancingNeeded();
+  bool isModuleSleepSafe();
   void assertFaultLine();
   void clearFaultLine();
   float getCoolingPumpDuty(float);
   void setOutput(int pin, int state);
+  void enterState(ControllerState newState);
+  void readInputs();
+  int readDigital(uint8_t pin);
+  int readAnalog(uint8_t pin);
+  void markReset();
+  bool debounce(Timer* timer, bool condition, uint32_t windowMs);
+  static void onTimer(void* context);
   void init();  //reset all boards and assign address to each board
   void standby();
   void pre_charge();
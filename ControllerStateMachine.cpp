@@ -0,0 +1,151 @@
+#include "ControllerStateMachine.hpp"
+
+typedef ControllerStateMachine SM;
+
+// State timings in milliseconds, independent of the loop periods
+#define INIT_DURATION_MS 1600         //time given to the boards to settle after the renumbering
+#define STANDBY_DWELL_MS 4000         //minimum time in STANDBY before starting a charge cycle
+#define PRE_CHARGE_EVCC_BOOT_MS 4000  //time given to the EVCC to properly boot
+#define PRE_CHARGE_TIMEOUT_MS 40000   //the charger did not start if not charging by then
+#define POST_CHARGE_EVCC_SLEEP_MS 20000  //time given to the EVCC to properly go to sleep
+#define STATECYCLING_DURATION_MS 1600    //time spent in each state when cycling
+
+static constexpr SM::StateDef stateDefs[SM::NUMBER_OF_STATES] = {
+  { "INIT", INIT_DURATION_MS, 0 },
+  { "STANDBY", STANDBY_DWELL_MS, 0 },
+  { "PRE_CHARGE", PRE_CHARGE_EVCC_BOOT_MS, PRE_CHARGE_TIMEOUT_MS },
+  { "CHARGING", 0, 0 },
+  { "TOP_BALANCING", 0, 0 },
+  { "POST_CHARGE", POST_CHARGE_EVCC_SLEEP_MS, 0 },
+  { "RUN", 0, 0 },
+};
+
+static constexpr SM::StateDef cyclingStateDefs[SM::NUMBER_OF_STATES] = {
+  { "INIT", STATECYCLING_DURATION_MS, 0 },
+  { "STANDBY", STATECYCLING_DURATION_MS, 0 },
+  { "PRE_CHARGE", STATECYCLING_DURATION_MS, 0 },
+  { "CHARGING", STATECYCLING_DURATION_MS, 0 },
+  { "TOP_BALANCING", STATECYCLING_DURATION_MS, 0 },
+  { "POST_CHARGE", STATECYCLING_DURATION_MS, 0 },
+  { "RUN", STATECYCLING_DURATION_MS, 0 },
+};
+
+static bool timerExpired(const SM::Inputs& in) {
+  return in.stateTimerExpired;
+}
+
+static bool timeoutExpired(const SM::Inputs& in) {
+  return in.stateTimeoutExpired;
+}
+
+static bool runOn(const SM::Inputs& in) {
+  return in.run;
+}
+
+static bool runOff(const SM::Inputs& in) {
+  return !in.run;
+}
+
+static bool chargingOn(const SM::Inputs& in) {
+  return in.charging;
+}
+
+static bool chargeCycleDue(const SM::Inputs& in) {
+  return in.chargeCycleNeeded && in.stateTimerExpired;
+}
+
+static bool evccBootedEvseDisconnected(const SM::Inputs& in) {
+  return in.stateTimerExpired && in.evseDisconnected;
+}
+
+static bool evccBootedCharging(const SM::Inputs& in) {
+  return in.stateTimerExpired && in.charging;
+}
+
+static bool chargeEnded(const SM::Inputs& in) {
+  return in.disconnectDebounced;
+}
+
+static bool topBalanceDue(const SM::Inputs& in) {
+  return !in.evseDisconnected && in.charging && in.topBalanceReached;
+}
+
+static bool evccAsleep(const SM::Inputs& in) {
+  return in.stateTimerExpired && !in.charging;
+}
+
+/////////////////////////////////////////////////
+/// \brief All the transitions grouped by state, the first guard that holds wins.
+/////////////////////////////////////////////////
+static constexpr SM::Transition transitionTable[] = {
+  { SM::INIT, timerExpired, SM::STANDBY, 0 },
+
+  { SM::STANDBY, runOn, SM::RUN, 0 },
+  { SM::STANDBY, chargingOn, SM::CHARGING, 0 },
+  { SM::STANDBY, chargeCycleDue, SM::PRE_CHARGE, 0 },
+
+  { SM::PRE_CHARGE, timeoutExpired, SM::STANDBY, "charger did not start!!!\n" },
+  { SM::PRE_CHARGE, evccBootedEvseDisconnected, SM::STANDBY, 0 },
+  { SM::PRE_CHARGE, evccBootedCharging, SM::CHARGING, 0 },
+
+  { SM::CHARGING, chargeEnded, SM::POST_CHARGE, 0 },
+  { SM::CHARGING, topBalanceDue, SM::TOP_BALANCING, 0 },
+
+  { SM::TOP_BALANCING, chargeEnded, SM::POST_CHARGE, 0 },
+
+  { SM::POST_CHARGE, evccAsleep, SM::STANDBY, 0 },
+
+  { SM::RUN, runOff, SM::STANDBY, 0 },
+};
+
+static constexpr SM::Transition cyclingTransitionTable[] = {
+  { SM::INIT, timerExpired, SM::STANDBY, 0 },
+  { SM::STANDBY, timerExpired, SM::PRE_CHARGE, 0 },
+  { SM::PRE_CHARGE, timerExpired, SM::CHARGING, 0 },
+  { SM::CHARGING, timerExpired, SM::TOP_BALANCING, 0 },
+  { SM::TOP_BALANCING, timerExpired, SM::POST_CHARGE, 0 },
+  { SM::POST_CHARGE, timerExpired, SM::RUN, 0 },
+  { SM::RUN, timerExpired, SM::INIT, 0 },
+};
+
+/////////////////////////////////////////////////
+/// \brief Constructor, selects the normal or the state cycling tables.
+/////////////////////////////////////////////////
+ControllerStateMachine::ControllerStateMachine(bool cycling) {
+  if (cycling) {
+    states = cyclingStateDefs;
+    transitions = cyclingTransitionTable;
+    numberOfTransitions = sizeof(cyclingTransitionTable) / sizeof(cyclingTransitionTable[0]);
+  } else {
+    states = stateDefs;
+    transitions = transitionTable;
+    numberOfTransitions = sizeof(transitionTable) / sizeof(transitionTable[0]);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the name and timings of a state.
+/////////////////////////////////////////////////
+const ControllerStateMachine::StateDef& ControllerStateMachine::getStateDef(State state) {
+  return states[state];
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the transition to take from a state given the inputs, 0 to stay in the state.
+/////////////////////////////////////////////////
+const ControllerStateMachine::Transition* ControllerStateMachine::next(State state, const Inputs& in) {
+  for (uint32_t i = 0; i < numberOfTransitions; i++) {
+    if (transitions[i].from == state && transitions[i].guard(in)) {
+      return &transitions[i];
+    }
+  }
+  return 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the transition table and its length, for reporting and testing purposes.
+/////////////////////////////////////////////////
+const ControllerStateMachine::Transition* ControllerStateMachine::getTransitions(uint32_t* count) {
+  *count = numberOfTransitions;
+  return transitions;
+}
@@ -0,0 +1,71 @@
+#ifndef CONTROLLERSTATEMACHINE_HPP_
+#define CONTROLLERSTATEMACHINE_HPP_
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////
+/// \brief Declarative description of the controller state machine.
+///
+/// The states, their timings and the transitions with their guards are flat constant tables. The guards
+/// only look at an Inputs snapshot taken once per tick, so the tables have no dependency on the hardware
+/// and can be replayed on a host (see tests/state_machine_replay). The actions run in each state are
+/// bound to the states by the Controller.
+///
+/// A second set of tables simply cycles through all the states for testing (STATECYCLING).
+/////////////////////////////////////////////////
+class ControllerStateMachine {
+public:
+  enum State {
+    INIT = 0,
+    STANDBY,
+    PRE_CHARGE,
+    CHARGING,
+    TOP_BALANCING,
+    POST_CHARGE,
+    RUN,
+    NUMBER_OF_STATES
+  };
+
+  /////////////////////////////////////////////////
+  /// \brief Snapshot of everything the guards depend on.
+  /////////////////////////////////////////////////
+  struct Inputs {
+    bool run;                  //INH_RUN is high
+    bool charging;             //INH_CHARGING is high
+    bool evseDisconnected;     //INL_EVSE_DISC is low
+    bool chargeCycleNeeded;    //highest cell under charger_cycle_v_setpoint and max_charge_v_setpoint
+    bool topBalanceReached;    //highest cell at or over top_balance_v_setpoint
+    bool stateTimerExpired;    //minTimeMs of the state elapsed
+    bool stateTimeoutExpired;  //timeoutMs of the state elapsed
+    bool disconnectDebounced;  //EVSE disconnected or charger stopped for CHARGE_DISCONNECT_DEBOUNCE_MS
+  };
+
+  typedef bool (*Guard)(const Inputs& in);
+
+  struct StateDef {
+    const char* name;
+    uint32_t minTimeMs;  //arms the state timer on entry, 0 for none
+    uint32_t timeoutMs;  //arms the state timeout on entry, 0 for none
+  };
+
+  struct Transition {
+    State from;
+    Guard guard;
+    State to;
+    const char* error;  //logged as an error when the transition is taken, 0 for none
+  };
+
+  static const uint32_t CHARGE_DISCONNECT_DEBOUNCE_MS = 2000;
+
+  ControllerStateMachine(bool cycling);
+  const StateDef& getStateDef(State state);
+  const Transition* next(State state, const Inputs& in);
+  const Transition* getTransitions(uint32_t* count);
+
+private:
+  const StateDef* states;
+  const Transition* transitions;
+  uint32_t numberOfTransitions;
+};
+
+#endif /* CONTROLLERSTATEMACHINE_HPP_ */
@@ -0,0 +1,184 @@
+#include "Dashboard.hpp"
+#include "ConsoleOut.hpp"
+#include "Logger.hpp"
+#include <TimeLib.h>
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the dashboard shows the pack and the state of the controller.
+/////////////////////////////////////////////////
+Dashboard::Dashboard(Controller* cont_inst_ptr)
+  : controller(cont_inst_ptr),
+    period(DEFAULT_PERIOD_MS),
+    nextFrame(0),
+    logWritten(0),
+    line(-1),
+    lines(0) {
+  memset(hashes, 0, sizeof(hashes));
+}
+
+Logger* Dashboard::getLoggerPtr() {
+  return controller->getLoggerPtr();
+}
+
+/////////////////////////////////////////////////
+/// \brief clears the screen and starts refreshing the dashboard every periodMs.
+/////////////////////////////////////////////////
+void Dashboard::begin(uint32_t periodMs) {
+  period = periodMs;
+  nextFrame = millis();
+  logWritten = console_out.log.getWritten();
+  line = -1;
+  lines = 0;
+  memset(hashes, 0, sizeof(hashes));
+  LOG_CONSOLE("\x1b[2J");
+}
+
+/////////////////////////////////////////////////
+/// \brief renders the next line of the dashboard and rewrites it if it changed, starting a refresh when one is due.
+///
+/// @return false if no refresh is due yet, nothing was printed.
+/////////////////////////////////////////////////
+bool Dashboard::printNext() {
+  char out[LINE_LENGTH + 24];
+  char text[LINE_LENGTH];
+  uint16_t count = getLines();
+  uint16_t n;
+
+  if (line < 0) {
+    if ((int32_t)(millis() - nextFrame) < 0) return false;
+    nextFrame = millis() + period;
+    if (console_out.log.getWritten() != logWritten) {
+      //log messages were printed over the dashboard and may have scrolled it
+      LOG_CONSOLE("\x1b[2J");
+      memset(hashes, 0, sizeof(hashes));
+    }
+    line = 0;
+  }
+
+  if (line < count) {
+    n = renderLine(line, text);
+    uint32_t h = hash(text, n);
+    if (h != hashes[line]) {
+      hashes[line] = h;
+      n = sprintf(out, "\x1b[%u;1H%.*s\x1b[K", (unsigned)line + 1, n, text);
+      getLoggerPtr()->consolePrint(out);
+    }
+    line++;
+    if (line > lines) lines = line;
+    return true;
+  }
+
+  //the lines of modules no longer found, then the cursor below the dashboard
+  n = 0;
+  for (; lines > count && n < LINE_LENGTH; lines--) {
+    hashes[lines - 1] = 0;
+    n += sprintf(out + n, "\x1b[%u;1H\x1b[K", (unsigned)lines);
+  }
+  sprintf(out + n, "\x1b[%u;1H", (unsigned)count + 1);
+  getLoggerPtr()->consolePrint(out);
+  logWritten = console_out.log.getWritten();
+  line = -1;
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief stops refreshing the dashboard and puts the cursor below it.
+/////////////////////////////////////////////////
+void Dashboard::end() {
+  LOG_CONSOLE("\x1b[%u;1H", (unsigned)lines + 1);
+  line = -1;
+}
+
+uint16_t Dashboard::getLines() {
+  int modules = controller->getBMSPtr()->getNumFoundModules();
+  if (modules > MAX_MODULE_ADDR) modules = MAX_MODULE_ADDR;
+  return HEADER_LINES + modules;
+}
+
+/////////////////////////////////////////////////
+/// \brief renders line i of the dashboard into text.
+///
+/// @return the length of the line, at most LINE_LENGTH - 1.
+/////////////////////////////////////////////////
+uint16_t Dashboard::renderLine(uint16_t i, char* text) {
+  BMSModuleManager* bms = controller->getBMSPtr();
+  uint32_t seconds = millis() / 1000;
+  int n = 0;
+  tmElements_t tm;
+
+  if (i >= HEADER_LINES) {
+    BMSModule* module = bms->getModulePtr(i - HEADER_LINES);
+    n = snprintf(text, LINE_LENGTH, "M%-2d    %7.2fV   %.3fV   %.3fV  %6.1fC  %6.1fC    0x%02x    0x%02x", module->getAddress(),
+                 module->getModuleVoltage(), module->getLowCellV(), module->getHighCellV(), module->getTemperature(0),
+                 module->getTemperature(1), module->getFaults(), module->getAlerts());
+  } else if (i >= 8 && i < 8 + Profiler::NUMBER_OF_REGIONS) {
+    Profiler::Region region = (Profiler::Region)(i - 8);
+    n = snprintf(text, LINE_LENGTH, "%-16s %10lu %10.1f %10.1f", Profiler::regionName(region), (unsigned long)prof_inst.getCount(region),
+                 prof_inst.getMeanUs(region), prof_inst.getMaxUs(region));
+  } else if (i == 7) {
+    n = snprintf(text, LINE_LENGTH, "%-16s %10s %10s %10s  (period %lums)", "loop timing", "count", "mean us", "max us",
+                 (unsigned long)controller->getPeriodMillis());
+  } else if (i == 9 + Profiler::NUMBER_OF_REGIONS) {
+    n = snprintf(text, LINE_LENGTH, "module    voltage  cell min  cell max   temp 1   temp 2  faults  alerts");
+  } else {
+    switch (i) {
+      case 0:
+        breakTime(now(), tm);
+        n = snprintf(text, LINE_LENGTH, "teslaBMSBL  %-14s  up %lud %02lu:%02lu:%02lu  %04d-%02d-%02d %02d:%02d:%02d  every %lums, a key quits",
+                     controller->getStateName(controller->getState()), (unsigned long)seconds / 86400, (unsigned long)(seconds % 86400) / 3600,
+                     (unsigned long)(seconds % 3600) / 60, (unsigned long)seconds % 60, tm.Year + 1970, tm.Month, tm.Day, tm.Hour,
+                     tm.Minute, tm.Second, (unsigned long)period);
+        break;
+      case 1:
+        n = snprintf(text, LINE_LENGTH, "pack %7.2fV  %2d modules  cells %.3f-%.3fV  avg %.3fV  spread %4.0fmV", bms->getPackVoltage(),
+                     bms->getNumFoundModules(), bms->getLowCellVolt(), bms->getHighCellVolt(), bms->getAvgCellVolt(),
+                     (bms->getHighCellVolt() - bms->getLowCellVolt()) * 1000.0f);
+        break;
+      case 2:
+        n = snprintf(text, LINE_LENGTH, "temp %.1f-%.1fC  avg %.1fC  history: cells %.3f-%.3fV  pack %.2f-%.2fV  %.1f-%.1fC",
+                     bms->getLowTemperature(), bms->getHighTemperature(), bms->getAvgTemperature(), bms->getHistLowestCellVolt(),
+                     bms->getHistHighestCellVolt(), bms->getHistLowestPackVolt(), bms->getHistHighestPackVolt(),
+                     bms->getHistLowestPackTemp(), bms->getHistHighestPackTemp());
+        break;
+      case 3:
+        n = snprintf(text, LINE_LENGTH, "12V %.2fV  evcc %-3s  fault %-3s  12V charge %-3s  pump %3u  inhibit %-3s  limiter %-3s",
+                     controller->bat12vVoltage, controller->outL_evcc_on_buffer ? "on" : "off", controller->outH_fault_buffer ? "on" : "off",
+                     controller->outL_12V_bat_chrg_buffer ? "on" : "off", controller->outpwm_pump_buffer,
+                     controller->isChargerInhibit() ? "on" : "off", controller->isPowerLimiter() ? "on" : "off");
+        break;
+      case 4:
+        n = renderFaults("active", controller->faults.getActive(), text);
+        break;
+      case 5:
+        n = renderFaults("sticky", controller->faults.getSticky(), text);
+        break;
+      default:
+        text[0] = 0;
+        break;
+    }
+  }
+  return n < 0 ? 0 : (n >= (int)LINE_LENGTH ? LINE_LENGTH - 1 : n);
+}
+
+/////////////////////////////////////////////////
+/// \brief renders the names of the faults set in faults, as many as fit in the line.
+/////////////////////////////////////////////////
+uint16_t Dashboard::renderFaults(const char* title, uint32_t faults, char* text) {
+  uint16_t n = snprintf(text, LINE_LENGTH, "%s faults:%s", title, faults ? "" : " none");
+  for (uint32_t w = faults; w != 0 && n < LINE_LENGTH - 1; w &= w - 1) {
+    FaultRegistry::FaultId id = (FaultRegistry::FaultId)__builtin_ctz(w);
+    n += snprintf(text + n, LINE_LENGTH - n, " %s", FaultRegistry::getDef(id).name);
+  }
+  return n;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the FNV-1a hash of a line, 0 is left to lines not on the terminal.
+/////////////////////////////////////////////////
+uint32_t Dashboard::hash(const char* text, uint16_t length) {
+  uint32_t h = 2166136261ul;
+  for (uint16_t i = 0; i < length; i++) {
+    h = (h ^ (uint8_t)text[i]) * 16777619ul;
+  }
+  return h ? h : 1;
+}
@@ -0,0 +1,49 @@
+#ifndef DASHBOARD_HPP_
+#define DASHBOARD_HPP_
+
+#include <Arduino.h>
+#include "Controller.hpp"
+#include "Profiler.hpp"
+
+/////////////////////////////////////////////////
+/// \brief A full screen view of the pack and the controller on the console, refreshed in place like top.
+///
+/// The screen has a fixed layout: the state of the controller, the pack, the outputs, the active and sticky
+/// faults, the loop timing and a line per module. Every refresh renders the lines one per printNext() and
+/// only rewrites, with ANSI cursor addressing, the ones whose text changed since they were last written;
+/// a hash of every line on the terminal is kept rather than its text. The whole screen is written again
+/// when log messages were printed over it.
+/////////////////////////////////////////////////
+class Dashboard {
+public:
+  static const uint32_t LINE_LENGTH = 100;
+  static const uint32_t HEADER_LINES = 10 + Profiler::NUMBER_OF_REGIONS;
+  static const uint32_t MAX_LINES = HEADER_LINES + MAX_MODULE_ADDR;
+  static const uint32_t DEFAULT_PERIOD_MS = 1000;
+  static const uint32_t MIN_PERIOD_MS = 100;
+
+  Dashboard(Controller* cont_inst_ptr);
+  void begin(uint32_t periodMs);
+  bool printNext();
+  void end();
+
+private:
+  Controller* controller;
+  Logger* getLoggerPtr();
+  static Logger::Subsystem getLogSubsystem() {
+    return Logger::CONSOLE;
+  }
+  uint32_t period;
+  uint32_t nextFrame;
+  uint32_t logWritten;        //bytes of log messages at the end of the last refresh
+  int16_t line;               //next line of the refresh being drawn, -1 until the next refresh
+  uint16_t lines;             //lines on the terminal
+  uint32_t hashes[MAX_LINES];  //of the text of every line on the terminal
+
+  uint16_t getLines();
+  uint16_t renderLine(uint16_t i, char* text);
+  uint16_t renderFaults(const char* title, uint32_t faults, char* text);
+  static uint32_t hash(const char* text, uint16_t length);
+};
+
+#endif /* DASHBOARD_HPP_ */
@@ -0,0 +1,136 @@
+#include "FaultRegistry.hpp"
+#include "Logger.hpp"
+
+/////////////////////////////////////////////////
+/// \brief All the faults of the controller, in FaultId order.
+/////////////////////////////////////////////////
+static constexpr FaultDef faultDefs[FaultRegistry::NUMBER_OF_FAULTS] = {
+  { "ModuleLoop", 'A', true, true, "One or more BMS modules have asserted the fault loop!\n", "All modules have deasserted the fault loop\n" },
+  { "BatMon", 'B', false, true, "The battery monitor asserted a fault!\n", "The battery monitor deasserted a fault\n" },
+  { "BMSSerialComms", 'C', true, true, "Serial communication with battery modules lost!\n", "Serial communication with battery modules re-established!\n" },
+  { "BMSOV", 'D', true, true, "A cell reached a voltage higher than the OV threshold\n", "All cells are back under OV threshold\n" },
+  { "BMSUV", 'E', false, true, "A cell reached a voltage lower than the UV threshold\n", "All cells are back over UV threshold\n" },
+  { "BMSOT", 'F', true, true, "A module reached a temp higher than the OT threshold\n", "All modules are back under OT threshold\n" },
+  { "BMSUT", 'G', true, true, "A module reached a temp lower than the UT threshold\n", "All modules are back over UT threshold\n" },
+  { "12VBatOV", 'H', false, false, "12V battery reached a voltage higher than the OV threshold\n", "12V battery back under the OV threshold\n" },
+  { "12VBatUV", 'I', false, true, "12V battery reached a voltage lower than the UV threshold\n", "12V battery back over the UV threshold\n" },
+  { "WatSen1", 'J', true, true, "The battery water sensor 1 is reporting water!\n", "The battery water sensor 1 is reporting dry.\n" },
+  { "WatSen2", 'K', true, true, "The battery water sensor 2 is reporting water!\n", "The battery water sensor 2 is reporting dry.\n" },
+  { "IncorectModuleCount", 'L', true, true, "Found a different ammount of modules than configured!\n", "Found all modules as configured!\n" },
+};
+
+static_assert(FaultRegistry::NUMBER_OF_FAULTS <= 32, "the faults must fit in a 32 bit word");
+
+static constexpr uint32_t chargeFaultMask(uint32_t i = 0) {
+  return i >= FaultRegistry::NUMBER_OF_FAULTS ? 0 : ((faultDefs[i].chargeFault ? 1ul << i : 0) | chargeFaultMask(i + 1));
+}
+
+static constexpr uint32_t runFaultMask(uint32_t i = 0) {
+  return i >= FaultRegistry::NUMBER_OF_FAULTS ? 0 : ((faultDefs[i].runFault ? 1ul << i : 0) | runFaultMask(i + 1));
+}
+
+static constexpr uint32_t CHARGE_FAULT_MASK = chargeFaultMask();
+static constexpr uint32_t RUN_FAULT_MASK = runFaultMask();
+
+/////////////////////////////////////////////////
+/// \brief Constructor, no fault is active.
+/////////////////////////////////////////////////
+FaultRegistry::FaultRegistry(Logger* logger)
+  : logger(logger),
+    active(0),
+    sticky(0),
+    pending(0) {
+  memset(pendingSince, 0, sizeof(pendingSince));
+  memset(timeStamp, 0, sizeof(timeStamp));
+}
+
+Logger* FaultRegistry::getLoggerPtr() {
+  return logger;
+}
+
+/////////////////////////////////////////////////
+/// \brief reports the fault condition, the fault asserts once the condition lasted for debounceMs.
+///
+/// The fault deasserts as soon as the condition is false.
+/////////////////////////////////////////////////
+void FaultRegistry::update(FaultId id, bool condition, uint32_t debounceMs) {
+  uint32_t bit = 1ul << id;
+  uint32_t t = millis();
+
+  if (!condition) {
+    if (active & bit) {
+      LOG_ERR(faultDefs[id].msgDeAsserted);
+    }
+    active &= ~bit;
+    pending &= ~bit;
+    return;
+  }
+  if (!(pending & bit)) {
+    pending |= bit;
+    pendingSince[id] = t;
+  }
+  if (t - pendingSince[id] >= debounceMs) {
+    if (!(active & bit)) {
+      LOG_ERR(faultDefs[id].msgAsserted);
+    }
+    active |= bit;
+    sticky |= bit;
+    timeStamp[id] = now();
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the fault is currently asserted.
+/////////////////////////////////////////////////
+bool FaultRegistry::isActive(FaultId id) {
+  return (active >> id) & 1;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the fault was asserted since the last reset.
+/////////////////////////////////////////////////
+bool FaultRegistry::isSticky(FaultId id) {
+  return (sticky >> id) & 1;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the active fault word, bit n being the fault with FaultId n.
+/////////////////////////////////////////////////
+uint32_t FaultRegistry::getActive() {
+  return active;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the sticky fault word, bit n being the fault with FaultId n.
+/////////////////////////////////////////////////
+uint32_t FaultRegistry::getSticky() {
+  return sticky;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if an active fault must inhibit the charger.
+/////////////////////////////////////////////////
+bool FaultRegistry::isChargerInhibit() {
+  return (active & CHARGE_FAULT_MASK) != 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if an active fault must limit the motor power.
+/////////////////////////////////////////////////
+bool FaultRegistry::isPowerLimiter() {
+  return (active & RUN_FAULT_MASK) != 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the time at which the fault was last asserted.
+/////////////////////////////////////////////////
+time_t FaultRegistry::getTimeStamp(FaultId id) {
+  return timeStamp[id];
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the static description of a fault.
+/////////////////////////////////////////////////
+const FaultDef& FaultRegistry::getDef(FaultId id) {
+  return faultDefs[id];
+}
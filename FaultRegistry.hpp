@@ -0,0 +1,69 @@
+#ifndef FAULTREGISTRY_HPP_
+#define FAULTREGISTRY_HPP_
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include "Logger.hpp"
+
+/////////////////////////////////////////////////
+/// \brief Static description of a fault, the table of all faults lives in flash.
+/////////////////////////////////////////////////
+struct FaultDef {
+  const char* name;
+  char code;         //single letter shown on the oled
+  bool chargeFault;  //asserts the charger inhibit line
+  bool runFault;     //asserts the power limiter line
+  const char* msgAsserted;
+  const char* msgDeAsserted;
+};
+
+/////////////////////////////////////////////////
+/// \brief Holds the state of all the faults of the controller in packed 32 bit words.
+///
+/// Bit n of the active and sticky words is the fault with FaultId n. The charger inhibit and power limiter
+/// outputs are a single AND of the active word with masks computed at compile time from the fault table.
+/// Iterating the faults is done on the bits of a word, no heap nor list is involved.
+/////////////////////////////////////////////////
+class FaultRegistry {
+public:
+  enum FaultId {
+    MODULE_LOOP = 0,
+    BAT_MON,
+    BMS_SERIAL_COMMS,
+    BMS_OV,
+    BMS_UV,
+    BMS_OT,
+    BMS_UT,
+    BAT12V_OV,
+    BAT12V_UV,
+    WAT_SEN1,
+    WAT_SEN2,
+    INCORRECT_MODULE_COUNT,
+    NUMBER_OF_FAULTS
+  };
+
+  FaultRegistry(Logger* logger);
+  void update(FaultId id, bool condition, uint32_t debounceMs);
+  bool isActive(FaultId id);
+  bool isSticky(FaultId id);
+  uint32_t getActive();
+  uint32_t getSticky();
+  bool isChargerInhibit();
+  bool isPowerLimiter();
+  time_t getTimeStamp(FaultId id);
+  static const FaultDef& getDef(FaultId id);
+
+private:
+  Logger* logger;
+  Logger* getLoggerPtr();
+  static Logger::Subsystem getLogSubsystem() {
+    return Logger::CONTROLLER;
+  }
+  uint32_t active;
+  uint32_t sticky;
+  uint32_t pending;
+  uint32_t pendingSince[NUMBER_OF_FAULTS];
+  time_t timeStamp[NUMBER_OF_FAULTS];
+};
+
+#endif /* FAULTREGISTRY_HPP_ */
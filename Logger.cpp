@@ -26,16 +26,93 @@
 */
 
 #include "Logger.hpp"
+#include "ConsoleOut.hpp"
 
-//instantiate the logger
-Logger log_inst;
+//instantiate the logger of the console, the messages may be dropped when the host does not read
+Logger log_inst(&console_out.reply, &console_out.log);
+
+//argument taken by a conversion of a format
+enum LogArg { ARG_NONE, ARG_INT, ARG_LONG, ARG_LLONG, ARG_SIZE, ARG_DOUBLE, ARG_STRING, ARG_PTR };
+
+//header of a message in the ring, followed by its packed arguments. A size of 0 wraps to the start.
+struct LogEntry {
+  uint16_t size;    //bytes to the next entry
+  uint8_t level;
+  uint8_t argsLen;
+  uint16_t repeats; //when not 0 the entry sums up that many identical messages
+  uint32_t time;
+  const char* format;
+};
 
 /////////////////////////////////////////////////
-/// \brief Constructor for the logger
+/// \brief parses the conversion at the '%' *format points to and moves *format past it.
 /////////////////////////////////////////////////
-Logger::Logger() {
-  //logLevel = Logger::Info;
-  logLevel = Logger::Cons;
+static LogArg parseConversion(const char** format) {
+  const char* f = *format + 1;
+  LogArg arg = ARG_INT;
+  while (*f && strchr("-+ #0", *f)) f++;
+  while (*f >= '0' && *f <= '9') f++;
+  if (*f == '.') {
+    f++;
+    while (*f >= '0' && *f <= '9') f++;
+  }
+  while (*f == 'h') f++;
+  if (*f == 'l') {
+    arg = *++f == 'l' ? ARG_LLONG : ARG_LONG;
+    if (arg == ARG_LLONG) f++;
+  } else if (*f == 'z') {
+    arg = ARG_SIZE;
+    f++;
+  }
+  char c = *f;
+  if (c) f++;
+  *format = f;
+  if (c && strchr("diuxXoc", c)) return arg;
+  if (c && strchr("fFeEgGaA", c)) return ARG_DOUBLE;
+  if (c == 's') return ARG_STRING;
+  if (c == 'p') return ARG_PTR;
+  return ARG_NONE;  //%% and the unsupported conversions are printed as they are
+}
+
+template <class T>
+static bool pack(uint8_t* buf, size_t* len, size_t room, T value) {
+  if (*len + sizeof(T) > room) return false;
+  memcpy(buf + *len, &value, sizeof(T));
+  *len += sizeof(T);
+  return true;
+}
+
+//FNV-1a of the level and the packed arguments of a message
+static uint32_t hashMessage(uint8_t level, const uint8_t* args, size_t len) {
+  uint32_t h = (2166136261u ^ level) * 16777619u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ args[i]) * 16777619u;
+  }
+  return h;
+}
+
+template <class T>
+static bool unpack(const uint8_t* buf, size_t len, size_t* used, T* value) {
+  if (*used + sizeof(T) > len) return false;
+  memcpy(value, buf + *used, sizeof(T));
+  *used += sizeof(T);
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief Constructor for the logger, the messages are printed to logOut, or out when it is 0.
+/////////////////////////////////////////////////
+Logger::Logger(Print* out, Print* logOut)
+  : out(out),
+    logOut(logOut ? logOut : out),
+    head(0),
+    tail(0),
+    dropped(0),
+    droppedReported(0) {
+  memset(repeatSlots, 0, sizeof(repeatSlots));
+  memset(siteBuckets, 0, sizeof(siteBuckets));
+  //setLoglevel(Logger::Info);
+  setLoglevel(Logger::Cons);
   lastLogTime = 0;
 }
 
@@ -44,11 +121,11 @@ Logger::Logger() {
 /// with a variable amount of parameters printf() style
 /////////////////////////////////////////////////
 void Logger::debug(const char *message, ...) {
-  if (logLevel > Debug)
+  if (levels[GENERAL] > Debug)
     return;
   va_list args;
   va_start(args, message);
-  log(Debug, message, args);
+  enqueue(Debug, 0, message, args);
   va_end(args);
 }
 
@@ -57,11 +134,11 @@ void Logger::debug(const char *message, ...) {
 /// with a variable amount of parameters printf() style
 /////////////////////////////////////////////////
 void Logger::info(const char *message, ...) {
-  if (logLevel > Info)
+  if (levels[GENERAL] > Info)
     return;
   va_list args;
   va_start(args, message);
-  log(Info, message, args);
+  enqueue(Info, 0, message, args);
   va_end(args);
 }
 
@@ -70,11 +147,11 @@ void Logger::info(const char *message, ...) {
 /// with a variable amount of parameters printf() style
 /////////////////////////////////////////////////
 void Logger::warn(const char *message, ...) {
-  if (logLevel > Warn)
+  if (levels[GENERAL] > Warn)
     return;
   va_list args;
   va_start(args, message);
-  log(Warn, message, args);
+  enqueue(Warn, 0, message, args);
   va_end(args);
 }
 
@@ -83,11 +160,23 @@ void Logger::warn(const char *message, ...) {
 /// with a variable amount of parameters printf() style
 /////////////////////////////////////////////////
 void Logger::error(const char *message, ...) {
-  if (logLevel > Error)
+  if (levels[GENERAL] > Error)
     return;
   va_list args;
   va_start(args, message);
-  log(Error, message, args);
+  enqueue(Error, 0, message, args);
+  va_end(args);
+}
+
+/////////////////////////////////////////////////
+/// \brief Output a message of the given level, used by the LOG_ macros which check the level first.
+///
+/// @param site The call site the rate of the messages is limited by, 0 for the format.
+/////////////////////////////////////////////////
+void Logger::log(const void* site, LogLevel level, const char *message, ...) {
+  va_list args;
+  va_start(args, message);
+  enqueue(level, site, message, args);
   va_end(args);
 }
 
@@ -100,25 +189,54 @@ void Logger::console(const char *message, ...) {
 
   va_list args;
   va_start(args, message);
-  log(Cons, message, args);
+  logMessage(message, args);
 
   va_end(args);
 }
 
+/////////////////////////////////////////////////
+/// \brief Output a text on the console as it is, without formatting nor limit on its length.
+/////////////////////////////////////////////////
+void Logger::consolePrint(const char *text) {
+  out->print(text);
+}
+
 /////////////////////////////////////////////////
 /// \brief Set the log level. Any output below the specified log level will be omitted.
 ///
 /// @param level (0 = debug, 1=info, 2=warning, 3=error, 4=supress all)
 /////////////////////////////////////////////////
 void Logger::setLoglevel(LogLevel level) {
-  logLevel = level;
+  for (uint8_t i = 0; i < NUMBER_OF_SUBSYSTEMS; i++) levels[i] = level;
+}
+
+/////////////////////////////////////////////////
+/// \brief Set the log level of the LOG_ messages of one subsystem.
+/////////////////////////////////////////////////
+void Logger::setLoglevel(Subsystem subsystem, LogLevel level) {
+  levels[subsystem] = level;
 }
 
 /////////////////////////////////////////////////
 /// \brief Retrieve the current log level.
 /////////////////////////////////////////////////
 Logger::LogLevel Logger::getLogLevel() {
-  return logLevel;
+  return levels[GENERAL];
+}
+
+/////////////////////////////////////////////////
+/// \brief Retrieve the log level of a subsystem.
+/////////////////////////////////////////////////
+Logger::LogLevel Logger::getLogLevel(Subsystem subsystem) {
+  return levels[subsystem];
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the name the verbose command knows a subsystem by.
+/////////////////////////////////////////////////
+const char* Logger::getSubsystemName(Subsystem subsystem) {
+  static const char* names[NUMBER_OF_SUBSYSTEMS] = { "general", "driver", "module", "controller", "console", "oled" };
+  return names[subsystem];
 }
 
 /////////////////////////////////////////////////
@@ -144,7 +262,7 @@ uint32_t Logger::getLastLogTime() {
 /// }
 /////////////////////////////////////////////////
 bool Logger::isDebug() {
-  return logLevel == Debug;
+  return levels[GENERAL] == Debug;
 }
 
 /////////////////////////////////////////////////
@@ -172,39 +290,338 @@ void Logger::printTimeStampLn(time_t t) {
 }
 
 /////////////////////////////////////////////////
-/// \brief Outputs a message to screen
+/// \brief formats and prints the messages waiting in the ring, then how many were dropped.
+/////////////////////////////////////////////////
+void Logger::drain() {
+  closeWindows(millis());
+  while (tail != head) {
+    uint16_t t = tail;
+    LogEntry entry;
+    memcpy(&entry.size, ring + t, sizeof(entry.size));
+    if (entry.size == 0) {
+      tail = 0;
+      continue;
+    }
+    memcpy(&entry, ring + t, sizeof(entry));
+    printEntry((LogLevel)entry.level, entry.time, entry.format, ring + t + sizeof(entry), entry.argsLen, entry.repeats);
+    //the entry is read before the writer may reuse it
+    __sync_synchronize();
+    tail = t + entry.size;
+  }
+
+  uint32_t d = dropped;
+  if (d != droppedReported) {
+    char line[48];
+    snprintf(line, sizeof(line), "%u log messages dropped\n", (unsigned)(d - droppedReported));
+    logOut->print(millis());
+    logOut->print(" - WARNING:");
+    logOut->print(line);
+    droppedReported = d;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of messages dropped because the ring was full.
+/////////////////////////////////////////////////
+uint32_t Logger::getDropped() {
+  return dropped;
+}
+
+/////////////////////////////////////////////////
+/// \brief Queues a message, its arguments are packed as the format reads them.
+///
+/// A repeat of a recent message is only counted, a new message takes a token of its call site.
+/////////////////////////////////////////////////
+void Logger::enqueue(LogLevel level, const void* site, const char *format, va_list args) {
+  uint8_t packed[LOG_MAX_ENTRY - sizeof(LogEntry)];
+  size_t len = 0;
+  bool fits = true;
+
+  for (const char* f = format; fits && (f = strchr(f, '%'));) {
+    switch (parseConversion(&f)) {
+      case ARG_INT:
+        fits = pack(packed, &len, sizeof(packed), va_arg(args, int));
+        break;
+      case ARG_LONG:
+        fits = pack(packed, &len, sizeof(packed), va_arg(args, long));
+        break;
+      case ARG_LLONG:
+        fits = pack(packed, &len, sizeof(packed), va_arg(args, long long));
+        break;
+      case ARG_SIZE:
+        fits = pack(packed, &len, sizeof(packed), va_arg(args, size_t));
+        break;
+      case ARG_DOUBLE:
+        fits = pack(packed, &len, sizeof(packed), va_arg(args, double));
+        break;
+      case ARG_PTR:
+        fits = pack(packed, &len, sizeof(packed), va_arg(args, void*));
+        break;
+      case ARG_STRING: {
+        const char* str = va_arg(args, const char*);
+        if (!str) str = "(null)";
+        size_t n = strlen(str);
+        fits = len < sizeof(packed);
+        if (!fits) break;
+        if (n > sizeof(packed) - len - 1) n = sizeof(packed) - len - 1;
+        memcpy(packed + len, str, n);
+        packed[len + n] = 0;
+        len += n + 1;
+        break;
+      }
+      case ARG_NONE:
+        break;
+    }
+  }
+
+  uint32_t now = millis();
+  uint32_t hash = hashMessage(level, packed, len);
+  lastLogTime = now;
+  if (!site) site = format;
+
+  for (uint8_t i = 0; i < LOG_REPEAT_SLOTS; i++) {
+    RepeatSlot* slot = &repeatSlots[i];
+    if (slot->site != site || slot->hash != hash || slot->argsLen != len || memcmp(slot->args, packed, len) != 0) continue;
+    slot->lastSeen = now;
+    if (now - slot->windowStart < LOG_REPEAT_WINDOW_MS || slot->repeats) {
+      //a window drain() has not closed yet ends with this repeat
+      if (slot->repeats < 0xffff) slot->repeats++;
+      if (now - slot->windowStart >= LOG_REPEAT_WINDOW_MS) closeWindow(slot, now);
+      return;
+    }
+    //printed again, in a new window
+    if (!takeToken(site, now)) {
+      dropped = dropped + 1;
+      return;
+    }
+    slot->windowStart = now;
+    push(level, format, packed, len, 0);
+    return;
+  }
+
+  if (!takeToken(site, now)) {
+    dropped = dropped + 1;
+    return;
+  }
+  if (push(level, format, packed, len, 0)) storeRepeatSlot(level, site, format, hash, packed, len, now);
+}
+
+/////////////////////////////////////////////////
+/// \brief Writes an entry to the ring.
+///
+/// @return false if the ring is full, the message is then counted as dropped.
+/////////////////////////////////////////////////
+bool Logger::push(LogLevel level, const char* format, const uint8_t* args, size_t argsLen, uint16_t repeats) {
+  uint8_t entry[LOG_MAX_ENTRY];
+  size_t len = sizeof(LogEntry) + argsLen;
+  LogEntry header;
+  header.size = (len + 3) & ~3;
+  header.level = level;
+  header.argsLen = argsLen;
+  header.repeats = repeats;
+  header.time = millis();
+  header.format = format;
+  memcpy(entry, &header, sizeof(header));
+  memcpy(entry + sizeof(header), args, argsLen);
+
+  //an entry never wraps, the end of the ring keeps room for the wrap marker
+  uint16_t h = head;
+  uint16_t t = tail;
+  uint16_t at;
+  if (h >= t && h + header.size + sizeof(uint16_t) <= LOG_RING_SIZE) {
+    at = h;
+  } else if (h >= t && header.size < t) {
+    at = 0;
+  } else if (h < t && h + header.size < t) {
+    at = h;
+  } else {
+    dropped = dropped + 1;
+    return false;
+  }
+  memcpy(ring + at, entry, len);
+  if (at != h) {
+    uint16_t wrap = 0;
+    memcpy(ring + h, &wrap, sizeof(wrap));
+  }
+  //the entry is complete before the reader can see it
+  __sync_synchronize();
+  head = at + header.size;
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief Takes a token from the bucket of a call site, refilled by one every LOG_SITE_RATE_MS.
+///
+/// A site without a bucket takes the least recently used one, full.
+/////////////////////////////////////////////////
+bool Logger::takeToken(const void* site, uint32_t now) {
+  SiteBucket* bucket = 0;
+  SiteBucket* oldest = &siteBuckets[0];
+  for (uint8_t i = 0; i < LOG_SITES && !bucket; i++) {
+    if (siteBuckets[i].site == site) bucket = &siteBuckets[i];
+    else if (now - siteBuckets[i].lastSeen > now - oldest->lastSeen) oldest = &siteBuckets[i];
+  }
+  if (!bucket) {
+    bucket = oldest;
+    bucket->site = site;
+    bucket->refillTime = now;
+    bucket->tokens = LOG_SITE_BURST;
+  }
+  bucket->lastSeen = now;
+
+  uint32_t refills = (now - bucket->refillTime) / LOG_SITE_RATE_MS;
+  if (refills) {
+    bucket->tokens = bucket->tokens + refills < LOG_SITE_BURST ? bucket->tokens + refills : LOG_SITE_BURST;
+    bucket->refillTime += refills * LOG_SITE_RATE_MS;
+  }
+  if (!bucket->tokens) return false;
+  bucket->tokens--;
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief Remembers a message just printed so its repeats are counted, in the least recently seen slot.
 /////////////////////////////////////////////////
-void Logger::log(LogLevel level, const char *format, va_list args) {
-  if (level < Cons) {
-    lastLogTime = millis();
-    SERIALCONSOLE.print(lastLogTime);
-    SERIALCONSOLE.print(" - ");
+void Logger::storeRepeatSlot(LogLevel level, const void* site, const char* format, uint32_t hash, const uint8_t* args, size_t argsLen, uint32_t now) {
+  RepeatSlot* slot = &repeatSlots[0];
+  for (uint8_t i = 1; i < LOG_REPEAT_SLOTS; i++) {
+    if (now - repeatSlots[i].lastSeen > now - slot->lastSeen) slot = &repeatSlots[i];
   }
+  //the repeats of the message it held are printed first
+  closeWindow(slot, now);
+  slot->site = site;
+  slot->format = format;
+  slot->hash = hash;
+  slot->windowStart = now;
+  slot->lastSeen = now;
+  slot->repeats = 0;
+  slot->level = level;
+  slot->argsLen = argsLen;
+  memcpy(slot->args, args, argsLen);
+}
+
+/////////////////////////////////////////////////
+/// \brief Queues the summary of the repeats counted in the window of a slot and starts a new window.
+/////////////////////////////////////////////////
+void Logger::closeWindow(RepeatSlot* slot, uint32_t now) {
+  if (slot->repeats) push((LogLevel)slot->level, slot->format, slot->args, slot->argsLen, slot->repeats);
+  slot->repeats = 0;
+  slot->windowStart = now;
+}
+
+/////////////////////////////////////////////////
+/// \brief Closes the windows that are over and have repeats to print.
+/////////////////////////////////////////////////
+void Logger::closeWindows(uint32_t now) {
+  for (uint8_t i = 0; i < LOG_REPEAT_SLOTS; i++) {
+    RepeatSlot* slot = &repeatSlots[i];
+    if (slot->repeats && now - slot->windowStart >= LOG_REPEAT_WINDOW_MS) closeWindow(slot, now);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief Prints a message of the ring, formatting one conversion at a time.
+/////////////////////////////////////////////////
+void Logger::printEntry(LogLevel level, uint32_t time, const char* format, const uint8_t* args, size_t argsLen, uint16_t repeats) {
+  char line[LOG_MAX_LINE];
+  char spec[16];
+  size_t n = 0;
+  size_t used = 0;
+  const char* f = format;
+
+  while (*f && n < sizeof(line) - 1) {
+    if (*f != '%') {
+      line[n++] = *f++;
+      continue;
+    }
+    const char* start = f;
+    LogArg arg = parseConversion(&f);
+    size_t specLen = f - start;
+    if (arg == ARG_NONE || specLen >= sizeof(spec)) {
+      if (specLen == 2 && start[1] == '%') start++;
+      while (start < f && n < sizeof(line) - 1) line[n++] = *start++;
+      continue;
+    }
+    memcpy(spec, start, specLen);
+    spec[specLen] = 0;
+
+    size_t room = sizeof(line) - n;
+    int w = -1;
+    int i;
+    long l;
+    long long ll;
+    size_t z;
+    double d;
+    void* p;
+    switch (arg) {
+      case ARG_INT:
+        if (unpack(args, argsLen, &used, &i)) w = snprintf(line + n, room, spec, i);
+        break;
+      case ARG_LONG:
+        if (unpack(args, argsLen, &used, &l)) w = snprintf(line + n, room, spec, l);
+        break;
+      case ARG_LLONG:
+        if (unpack(args, argsLen, &used, &ll)) w = snprintf(line + n, room, spec, ll);
+        break;
+      case ARG_SIZE:
+        if (unpack(args, argsLen, &used, &z)) w = snprintf(line + n, room, spec, z);
+        break;
+      case ARG_DOUBLE:
+        if (unpack(args, argsLen, &used, &d)) w = snprintf(line + n, room, spec, d);
+        break;
+      case ARG_PTR:
+        if (unpack(args, argsLen, &used, &p)) w = snprintf(line + n, room, spec, p);
+        break;
+      case ARG_STRING:
+        if (used < argsLen) {
+          w = snprintf(line + n, room, spec, (const char*)args + used);
+          used += strlen((const char*)args + used) + 1;
+        }
+        break;
+      case ARG_NONE:
+        break;
+    }
+    //the arguments that did not fit in the entry are left out
+    if (w < 0) break;
+    n += (size_t)w < room ? w : room - 1;
+  }
+  line[n] = 0;
+  //a summary ends with the number of repeats, on the line of the message
+  if (repeats) {
+    char suffix[32];
+    size_t len = snprintf(suffix, sizeof(suffix), " [repeated %u times]\n", (unsigned)repeats);
+    if (n && line[n - 1] == '\n') n--;
+    if (n + len >= sizeof(line)) n = sizeof(line) - 1 - len;
+    memcpy(line + n, suffix, len + 1);
+  }
+
+  logOut->print(time);
+  logOut->print(" - ");
   switch (level) {
     case Debug:
-      SERIALCONSOLE.print("DEBUG  :");
+      logOut->print("DEBUG  :");
       break;
     case Info:
-      SERIALCONSOLE.print("INFO   :");
+      logOut->print("INFO   :");
       break;
     case Warn:
-      SERIALCONSOLE.print("WARNING:");
+      logOut->print("WARNING:");
       break;
     case Error:
-      SERIALCONSOLE.print("ERROR  :");
+      logOut->print("ERROR  :");
       break;
     case Off:
     case Cons:
       break;
   }
-  logMessage(format, args);
+  logOut->print(line);
 }
 
 /////////////////////////////////////////////////
-/// \brief Outputs a message to screen
+/// \brief Outputs a console message to screen
 /////////////////////////////////////////////////
 void Logger::logMessage(const char *format, va_list args) {
   char buf[128];  // resulting string limited to 128 chars
   vsnprintf(buf, 128, format, args);
-  SERIALCONSOLE.print(buf);
-}
\ No newline at end of file
+  out->print(buf);
+}
@@ -5,43 +5,177 @@
 #include "Config.hpp"
 #include <string.h>
 #include <TimeLib.h>
+#include <type_traits>
 
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0  //LOG_ messages under this Logger::LogLevel are compiled out, e.g. -DLOG_MIN_LEVEL=2
+#endif
 
+#define LOG_RING_SIZE 1024   //bytes of messages waiting to be formatted, a typical message takes 20 to 40
+#define LOG_MAX_ENTRY 128    //largest message in the ring, string arguments are truncated to fit
+#define LOG_MAX_LINE 160     //longest formatted message
+#define LOG_REPEAT_SLOTS 16          //recent messages whose identical repeats are counted
+#define LOG_REPEAT_WINDOW_MS 10000   //repeats of a message are summed up over this window
+#define LOG_SITES 16                 //call sites whose rate is limited
+#define LOG_SITE_BURST 32            //messages a call site may log at once
+#define LOG_SITE_RATE_MS 50          //then one message per this period
+
+/////////////////////////////////////////////////
+/// \brief Prints leveled messages and console output to a Print.
+///
+/// debug(), info(), warn() and error() are deferred: the call only stores the format pointer, the time
+/// and the raw arguments (strings are copied) in a ring, drain() formats and prints them later, in idle
+/// time. When the ring is full the message is dropped and counted rather than waiting. The format must
+/// therefore outlive the call (a string literal) and only use the d i u x X o c f e g s p % conversions,
+/// without * widths. console() is the user interface and is printed at once.
+///
+/// One context writes the ring and one drains it, the indices are only written by their owner.
+///
+/// A fault tends to log the same messages every tick. A message identical to a recent one (same call
+/// site, level and arguments) is only counted, and printed once per LOG_REPEAT_WINDOW_MS with how many
+/// times it repeated. The distinct messages of a call site are limited by a token bucket of
+/// LOG_SITE_BURST messages refilled every LOG_SITE_RATE_MS, the ones over it are dropped and counted.
+/// Both tables belong to the writing context, drain() closes the windows so it must run in it too.
+///
+/// Every subsystem has its own level so the debug output of one of them can be turned on alone.
+/////////////////////////////////////////////////
 class Logger {
 public:
     enum LogLevel {
         Debug = 0, Info = 1, Warn = 2, Error = 3, Off = 4, Cons = 5
     };
-    Logger();
+    enum Subsystem {
+        GENERAL = 0, DRIVER, MODULE, CONTROLLER, CONSOLE, OLED, NUMBER_OF_SUBSYSTEMS
+    };
+    Logger(Print* out, Print* logOut = 0);
+    void log(const void* site, LogLevel level, const char *, ...);
     void debug(const char *, ...);
     void info(const char *, ...);
     void warn(const char *, ...);
     void error(const char *, ...);
     void console(const char *, ...);
+    void consolePrint(const char *);
     void setLoglevel(LogLevel);
+    void setLoglevel(Subsystem, LogLevel);
     LogLevel getLogLevel();
+    LogLevel getLogLevel(Subsystem);
+    static const char* getSubsystemName(Subsystem);
+
+    /////////////////////////////////////////////////
+    /// \brief returns true if a message of level from subsystem would be printed.
+    /////////////////////////////////////////////////
+    bool isEnabled(LogLevel level, Subsystem subsystem) {
+        return level >= levels[subsystem];
+    }
+
     uint32_t getLastLogTime();
     boolean isDebug();
     void printTimeStamp(time_t t);
     void printTimeStampLn(time_t t);
+    void drain();
+    uint32_t getDropped();
 private:
-    LogLevel logLevel;
+    Print* out;     //console()
+    Print* logOut;  //the leveled messages, when drain() prints them
+    LogLevel levels[NUMBER_OF_SUBSYSTEMS];
     uint32_t lastLogTime;
-    void log(LogLevel, const char *format, va_list);
+    uint8_t ring[LOG_RING_SIZE];
+    volatile uint16_t head;  //next entry is written here, only moved by enqueue()
+    volatile uint16_t tail;  //oldest entry, only moved by drain()
+    volatile uint32_t dropped;
+    uint32_t droppedReported;
+
+    //a message printed recently, its repeats are counted until its window closes
+    struct RepeatSlot {
+        const void* site;     //0 when the slot is free
+        const char* format;
+        uint32_t hash;        //of the level and the arguments
+        uint32_t windowStart;
+        uint32_t lastSeen;
+        uint16_t repeats;
+        uint8_t level;
+        uint8_t argsLen;
+        uint8_t args[LOG_MAX_ENTRY];
+    };
+    //token bucket of a call site
+    struct SiteBucket {
+        const void* site;     //0 when the bucket is free
+        uint32_t refillTime;
+        uint32_t lastSeen;
+        uint8_t tokens;
+    };
+    RepeatSlot repeatSlots[LOG_REPEAT_SLOTS];
+    SiteBucket siteBuckets[LOG_SITES];
+
+    void enqueue(LogLevel, const void* site, const char *format, va_list);
+    bool push(LogLevel level, const char* format, const uint8_t* args, size_t argsLen, uint16_t repeats);
+    bool takeToken(const void* site, uint32_t now);
+    void storeRepeatSlot(LogLevel level, const void* site, const char* format, uint32_t hash, const uint8_t* args, size_t argsLen, uint32_t now);
+    void closeWindow(RepeatSlot* slot, uint32_t now);
+    void closeWindows(uint32_t now);
     void logMessage(const char *format, va_list args);
+    void printEntry(LogLevel level, uint32_t time, const char* format, const uint8_t* args, size_t argsLen, uint16_t repeats);
 };
 
-//export the logger
+//export the logger of the console
 extern Logger log_inst;
 
-#define LOG_DEBUG log_inst.debug
-#define LOG_INFO log_inst.info
-#define LOG_WARN log_inst.warn
-#define LOG_ERR log_inst.error
-#define LOG_ERROR log_inst.error("file: %s, function: %s, line: %d\n",strrchr(__FILE__,'\\'),__func__,__LINE__); log_inst.error
-#define LOG_CONSOLE log_inst.console
-#define LOG_TIMESTAMP log_inst.printTimeStamp
-#define LOG_TIMESTAMP_LN log_inst.printTimeStampLn
-//#define LOG_CONSOLE SERIALCONSOLE.print
+/////////////////////////////////////////////////
+/// \brief returns the logger the LOG_ macros write to.
+///
+/// The classes of the BMS stack are given their logger and have a getLoggerPtr() member returning it,
+/// which hides this one so the LOG_ macros in their members write to the logger of their stack.
+/////////////////////////////////////////////////
+inline Logger* getLoggerPtr() {
+  return &log_inst;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the subsystem the LOG_ macros file the messages under.
+///
+/// Like getLoggerPtr(), the classes of a subsystem hide it with a static member.
+/////////////////////////////////////////////////
+inline Logger::Subsystem getLogSubsystem() {
+  return Logger::GENERAL;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the offset of the file name in a source path, for LOG_FILE.
+/////////////////////////////////////////////////
+constexpr size_t logBasenameOffset(const char* path) {
+  size_t offset = 0;
+  for (size_t i = 0; path[i]; i++) {
+    if (path[i] == '/' || path[i] == '\\') offset = i + 1;
+  }
+  return offset;
+}
+
+//name of the source file without its directories, resolved by the compiler
+#define LOG_FILE (__FILE__ + std::integral_constant<size_t, logBasenameOffset(__FILE__)>::value)
+
+/////////////////////////////////////////////////
+/// \brief Logs a message when level passes both LOG_MIN_LEVEL and the level of the subsystem.
+///
+/// Under LOG_MIN_LEVEL the condition is a constant and the call, arguments included, is compiled out.
+/// Otherwise the arguments are only evaluated if the message is printed.
+/////////////////////////////////////////////////
+#define LOG_AT(level, ...) LOG_AT_SITE(0, level, __VA_ARGS__)
+
+//as LOG_AT, with the call site its rate is limited by when the format is shared by several sites
+#define LOG_AT_SITE(site, level, ...) \
+  do { \
+    if ((int)(level) >= LOG_MIN_LEVEL && getLoggerPtr()->isEnabled((level), getLogSubsystem())) \
+      getLoggerPtr()->log((site), (level), __VA_ARGS__); \
+  } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(Logger::Debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(Logger::Info, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(Logger::Warn, __VA_ARGS__)
+#define LOG_ERR(...) LOG_AT(Logger::Error, __VA_ARGS__)
+//an error prefixed with where it was logged
+#define LOG_ERROR(format, ...) LOG_AT(Logger::Error, "%s:%d %s(): " format, LOG_FILE, __LINE__, __func__, ##__VA_ARGS__)
+#define LOG_CONSOLE(...) getLoggerPtr()->console(__VA_ARGS__)
+#define LOG_TIMESTAMP(t) getLoggerPtr()->printTimeStamp(t)
+#define LOG_TIMESTAMP_LN(t) getLoggerPtr()->printTimeStampLn(t)
 
 #endif /* LOG_HPP_ */
@@ -0,0 +1,172 @@
+#include "ModulePowerManager.hpp"
+#include "Logger.hpp"
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the boards are considered awake until the first sleep request.
+/////////////////////////////////////////////////
+ModulePowerManager::ModulePowerManager(BMSModuleManager* bms, Settings* sett, Logger* logger)
+  : bms(bms),
+    settings(sett),
+    logger(logger),
+    sleeping(false),
+    waking(false),
+    lastSample(0),
+    wakeStart(0),
+    lastTransition(0) {
+  resetStats();
+}
+
+Logger* ModulePowerManager::getLoggerPtr() {
+  return logger;
+}
+
+/////////////////////////////////////////////////
+/// \brief decides if the modules are sampled this tick and wakes them up if needed.
+///
+/// Returns true if the caller must sample the modules.
+///
+/// @param dutyCycleAllowed true if the modules may stay asleep until the next measurement window.
+/////////////////////////////////////////////////
+bool ModulePowerManager::beginSample(bool dutyCycleAllowed) {
+  uint32_t t = millis();
+  if (sleeping && dutyCycleAllowed && (t - lastSample) < settings->module_sample_period_s.getVal() * 1000) {
+    return false;
+  }
+  if (sleeping) {
+    accountTime();
+    sleeping = false;
+    waking = true;
+    wakeStart = t;
+    windows++;
+  }
+  bms->wakeBoards();
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief records the outcome of a sample and puts the modules back to sleep when allowed.
+///
+/// @param validSample true if all configured modules answered with valid readings.
+/// @param dutyCycleAllowed true if the modules may sleep until the next measurement window.
+/////////////////////////////////////////////////
+void ModulePowerManager::endSample(bool validSample, bool dutyCycleAllowed) {
+  uint16_t asleep;
+  if (!validSample) {
+    return;  //stay awake until the readings are valid
+  }
+  lastSample = millis();
+  if (waking) {
+    waking = false;
+    lastWakeLatency = lastSample - wakeStart;
+    if (lastWakeLatency > maxWakeLatency) maxWakeLatency = lastWakeLatency;
+    totalWakeLatency += lastWakeLatency;
+    wakeLatencyCount++;
+  }
+  if (!dutyCycleAllowed) {
+    return;
+  }
+
+  bms->sleepBoards();
+  asleep = bms->countSleepingBoards();
+  if (asleep < bms->getNumFoundModules()) {
+    sleepVerifyFailures++;
+    LOG_WARN("Only %d of %d modules report sleep mode active\n", asleep, bms->getNumFoundModules());
+    bms->wakeBoards();
+    return;
+  }
+  accountTime();
+  sleeping = true;
+  sleepEntries++;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the module boards are sleeping.
+/////////////////////////////////////////////////
+bool ModulePowerManager::isSleeping() {
+  return sleeping;
+}
+
+void ModulePowerManager::accountTime() {
+  uint32_t t = millis();
+  if (sleeping) {
+    timeAsleep += t - lastTransition;
+  } else {
+    timeAwake += t - lastTransition;
+  }
+  lastTransition = t;
+}
+
+/////////////////////////////////////////////////
+/// \brief clears the duty cycle statistics.
+/////////////////////////////////////////////////
+void ModulePowerManager::resetStats() {
+  timeAwake = 0;
+  timeAsleep = 0;
+  windows = 0;
+  sleepEntries = 0;
+  sleepVerifyFailures = 0;
+  lastWakeLatency = 0;
+  maxWakeLatency = 0;
+  totalWakeLatency = 0;
+  wakeLatencyCount = 0;
+  lastTransition = millis();
+}
+
+/////////////////////////////////////////////////
+/// \brief brings the time awake and asleep up to date and estimates the parasitic drain of the modules.
+///
+/// The drain is estimated from the measured duty cycle and MODULE_AWAKE_CURRENT_UA/MODULE_SLEEP_CURRENT_UA.
+///
+/// @param alwaysOnAh receives the drain per month of modules that never sleep, in Ah.
+/// @param dutyCycledAh receives the drain per month at the measured duty cycle, in Ah.
+/// @return the ratio of the time the modules were awake.
+/////////////////////////////////////////////////
+double ModulePowerManager::estimateDrain(double* alwaysOnAh, double* dutyCycledAh) {
+  const double hoursPerMonth = 30.0 * 24.0;
+  double awake, asleep, awakeRatio;
+  int modules = bms->getNumFoundModules();
+
+  accountTime();
+  awake = (double)timeAwake;
+  asleep = (double)timeAsleep;
+  awakeRatio = (awake + asleep > 0) ? awake / (awake + asleep) : 1.0;
+  *alwaysOnAh = modules * MODULE_AWAKE_CURRENT_UA * hoursPerMonth / 1000000.0;
+  *dutyCycledAh = modules * (awakeRatio * MODULE_AWAKE_CURRENT_UA + (1.0 - awakeRatio) * MODULE_SLEEP_CURRENT_UA) * hoursPerMonth / 1000000.0;
+  return awakeRatio;
+}
+
+/////////////////////////////////////////////////
+/// \brief prints the duty cycle statistics and the expected parasitic drain of the modules per month.
+/////////////////////////////////////////////////
+void ModulePowerManager::printStats() {
+  double alwaysOnAh, dutyCycledAh;
+  double awakeRatio = estimateDrain(&alwaysOnAh, &dutyCycledAh);
+
+  LOG_CONSOLE("modules sleeping: %d\n", sleeping);
+  LOG_CONSOLE("time awake: %.1fs, time asleep: %.1fs, awake ratio: %.2f%%\n", timeAwake / 1000.0, timeAsleep / 1000.0, awakeRatio * 100.0);
+  LOG_CONSOLE("measurement windows: %u, sleep entries: %u, sleep verify failures: %u\n", windows, sleepEntries, sleepVerifyFailures);
+  LOG_CONSOLE("wake to valid sample latency (ms): last %u, max %u, mean %u\n", lastWakeLatency, maxWakeLatency,
+              wakeLatencyCount ? (uint32_t)(totalWakeLatency / wakeLatencyCount) : 0);
+  LOG_CONSOLE("expected module drain per month: %.2fAh always on, %.2fAh duty cycled (%.2fAh saved)\n",
+              alwaysOnAh, dutyCycledAh, alwaysOnAh - dutyCycledAh);
+}
+
+/////////////////////////////////////////////////
+/// \brief writes what printStats() prints, the latencies in ms and the expected drain per month in Ah.
+/////////////////////////////////////////////////
+void ModulePowerManager::writeStats(StructuredWriter* doc) {
+  double alwaysOnAh, dutyCycledAh;
+
+  estimateDrain(&alwaysOnAh, &dutyCycledAh);
+  doc->putBool("sleeping", sleeping);
+  doc->putFloat("awakeSeconds", timeAwake / 1000.0);
+  doc->putFloat("asleepSeconds", timeAsleep / 1000.0);
+  doc->putUint("windows", windows);
+  doc->putUint("sleepEntries", sleepEntries);
+  doc->putUint("sleepVerifyFailures", sleepVerifyFailures);
+  doc->putUint("lastWakeLatencyMs", lastWakeLatency);
+  doc->putUint("maxWakeLatencyMs", maxWakeLatency);
+  doc->putUint("meanWakeLatencyMs", wakeLatencyCount ? (uint32_t)(totalWakeLatency / wakeLatencyCount) : 0);
+  doc->putFloat("alwaysOnAhPerMonth", alwaysOnAh);
+  doc->putFloat("dutyCycledAhPerMonth", dutyCycledAh);
+}
@@ -0,0 +1,52 @@
+#ifndef MODULEPOWERMANAGER_HPP_
+#define MODULEPOWERMANAGER_HPP_
+
+#include <Arduino.h>
+#include "Config.hpp"
+#include "BMSModuleManager.hpp"
+
+/////////////////////////////////////////////////
+/// \brief Duty cycles the module boards while the boat is parked.
+///
+/// When the controller reports that the pack is far from every threshold, the boards are put to sleep
+/// between measurement windows spaced by module_sample_period_s. Otherwise the boards stay awake.
+/////////////////////////////////////////////////
+class ModulePowerManager {
+public:
+  ModulePowerManager(BMSModuleManager* bms, Settings* sett, Logger* logger);
+  bool beginSample(bool dutyCycleAllowed);
+  void endSample(bool validSample, bool dutyCycleAllowed);
+  bool isSleeping();
+  void resetStats();
+  void printStats();
+  void writeStats(StructuredWriter* doc);
+
+private:
+  BMSModuleManager* bms;
+  Settings* settings;
+  Logger* logger;
+  Logger* getLoggerPtr();
+  static Logger::Subsystem getLogSubsystem() {
+    return Logger::MODULE;
+  }
+  bool sleeping;
+  bool waking;
+  uint32_t lastSample;
+  uint32_t wakeStart;
+  uint32_t lastTransition;
+
+  uint64_t timeAwake;  //milliseconds
+  uint64_t timeAsleep;  //milliseconds
+  uint32_t windows;
+  uint32_t sleepEntries;
+  uint32_t sleepVerifyFailures;
+  uint32_t lastWakeLatency;
+  uint32_t maxWakeLatency;
+  uint64_t totalWakeLatency;
+  uint32_t wakeLatencyCount;
+
+  void accountTime();
+  double estimateDrain(double* alwaysOnAh, double* dutyCycledAh);
+};
+
+#endif /* MODULEPOWERMANAGER_HPP_ */
@@ -0,0 +1,124 @@
+/**@file NameIndex.hpp */
+#ifndef NAMEINDEX_HPP_
+#define NAMEINDEX_HPP_
+
+#include <Arduino.h>
+#include <string.h>
+
+/////////////////////////////////////////////////
+/// \brief Finds the item of a name, the commands of the console or the parameters of the settings.
+///
+/// The names are kept sorted, for the completion of a prefix: the names starting with it follow
+/// lowerBound() of it. An exact name is found in a hash table of 2 * N slots, open addressing with linear
+/// probing, in a probe or two whatever the number of names. The index is filled once, by the constructor
+/// of its owner: add() sorts the name in and rebuilds the table, which costs N^2 at most for N names but
+/// never allocates. A name that is not listed is found by find() only (the short tokens of the commands).
+///
+/// @tparam T the type of the items, held by pointer.
+/// @tparam N the most names the index holds.
+/////////////////////////////////////////////////
+template<class T, uint8_t N> class NameIndex {
+public:
+  static const uint16_t SLOTS = 2 * N;
+
+  NameIndex()
+    : count(0) {
+    memset(slots, 0, sizeof(slots));
+  }
+
+  /////////////////////////////////////////////////
+  /// \brief adds name, the string must outlive the index.
+  ///
+  /// @return false if the index is full or already holds name, the first item of a name stays.
+  /////////////////////////////////////////////////
+  bool add(const char* name, T* item, bool listed = true) {
+    if (count == N || find(name)) return false;
+    uint8_t at = lowerBound(name);
+    memmove(entries + at + 1, entries + at, (count - at) * sizeof(Entry));
+    entries[at].name = name;
+    entries[at].item = item;
+    entries[at].listed = listed;
+    count++;
+    memset(slots, 0, sizeof(slots));
+    for (uint8_t i = 0; i < count; i++) {
+      uint16_t s = hash(entries[i].name) % SLOTS;
+      while (slots[s]) s = (s + 1) % SLOTS;
+      slots[s] = i + 1;
+    }
+    return true;
+  }
+
+  /////////////////////////////////////////////////
+  /// \brief returns the item of name, 0 if there is none. Only the exact name matches.
+  /////////////////////////////////////////////////
+  T* find(const char* name) {
+    for (uint16_t s = hash(name) % SLOTS; slots[s]; s = (s + 1) % SLOTS) {
+      if (strcmp(entries[slots[s] - 1].name, name) == 0) return entries[slots[s] - 1].item;
+    }
+    return 0;
+  }
+
+  /////////////////////////////////////////////////
+  /// \brief returns the position of the first name not before prefix in the sorted names, size() if none.
+  /////////////////////////////////////////////////
+  uint8_t lowerBound(const char* prefix) {
+    uint8_t low = 0;
+    uint8_t high = count;
+    while (low < high) {
+      uint8_t mid = (low + high) / 2;
+      if (strcmp(entries[mid].name, prefix) < 0) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+
+  /////////////////////////////////////////////////
+  /// \brief returns true if the name at i starts with the length first characters of prefix.
+  /////////////////////////////////////////////////
+  bool matches(uint8_t i, const char* prefix, size_t length) {
+    return i < count && strncmp(entries[i].name, prefix, length) == 0;
+  }
+
+  uint8_t size() {
+    return count;
+  }
+
+  const char* getName(uint8_t i) {
+    return entries[i].name;
+  }
+
+  T* getItem(uint8_t i) {
+    return entries[i].item;
+  }
+
+  bool isListed(uint8_t i) {
+    return entries[i].listed;
+  }
+
+private:
+  struct Entry {
+    const char* name;
+    T* item;
+    bool listed;
+  };
+  Entry entries[N];      //sorted by name
+  uint8_t slots[SLOTS];  //the position of a name in entries + 1, 0 if the slot is free
+  uint8_t count;
+
+  /////////////////////////////////////////////////
+  /// \brief FNV-1a of name.
+  /////////////////////////////////////////////////
+  static uint32_t hash(const char* name) {
+    uint32_t h = 2166136261u;
+    while (*name) {
+      h ^= (uint8_t)*name++;
+      h *= 16777619u;
+    }
+    return h;
+  }
+};
+
+#endif /* NAMEINDEX_HPP_ */
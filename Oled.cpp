@@ -124,25 +124,25 @@ void Oled::printFormat4() {
 
 void Oled::printFormat5() {
   switch (controller_inst_ptr->getState()) {
-    case Controller::INIT:
+    case ControllerStateMachine::INIT:
       Oled::printCentre("INIT", 1);
       break;
-    case Controller::STANDBY:
+    case ControllerStateMachine::STANDBY:
       Oled::printCentre("STANDBY", 1);
       break;
-    case Controller::PRE_CHARGE:
+    case ControllerStateMachine::PRE_CHARGE:
       Oled::printCentre("PRE_CHARGE", 1);
       break;
-    case Controller::CHARGING:
+    case ControllerStateMachine::CHARGING:
       Oled::printCentre("CHARGING", 1);
       break;
-    case Controller::TOP_BALANCING:
+    case ControllerStateMachine::TOP_BALANCING:
       Oled::printCentre("TOP_BALANCING", 1);
       break;
-    case Controller::POST_CHARGE:
+    case ControllerStateMachine::POST_CHARGE:
       Oled::printCentre("PRE_CHARGE", 1);
       break;
-    case Controller::RUN:
+    case ControllerStateMachine::RUN:
       Oled::printCentre("RUN", 1);
       break;
     default:
@@ -170,10 +170,8 @@ void Oled::printStickyFaults() {
   oled_ptr->print("sFault Codes");
   oled_ptr->setCursor(col0, oled_ptr->getLCDHeight() / 2);
 
-  for (auto i = controller_inst_ptr->faults.begin(); i != controller_inst_ptr->faults.end(); i++) {
-    if ((*i)->getSFault()) {
-      oled_ptr->print((*i)->getCode());
-    }
+  for (uint32_t w = controller_inst_ptr->faults.getSticky(); w != 0; w &= w - 1) {
+    oled_ptr->print(FaultRegistry::getDef((FaultRegistry::FaultId)__builtin_ctz(w)).code);
   }
   oled_ptr->display();
 }
@@ -187,10 +185,8 @@ void Oled::printFaults() {
   oled_ptr->print("Fault Codes");
   oled_ptr->setCursor(col0, oled_ptr->getLCDHeight() / 2);
 
-  for (auto i = controller_inst_ptr->faults.begin(); i != controller_inst_ptr->faults.end(); i++) {
-    if ((*i)->getFault()) {
-      oled_ptr->print((*i)->getCode());
-    }
+  for (uint32_t w = controller_inst_ptr->faults.getActive(); w != 0; w &= w - 1) {
+    oled_ptr->print(FaultRegistry::getDef((FaultRegistry::FaultId)__builtin_ctz(w)).code);
   }
   oled_ptr->display();
 }
@@ -17,6 +17,9 @@ private:
   };
   formatState state;
   Controller* controller_inst_ptr;
+  static Logger::Subsystem getLogSubsystem() {
+    return Logger::OLED;
+  }
   TeensyView* oled_ptr;
   void printFormat1();
   void printFormat2();
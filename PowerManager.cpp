@@ -0,0 +1,298 @@
+#include "PowerManager.hpp"
+#include "Logger.hpp"
+
+#if defined(__arm__)
+extern "C" volatile uint32_t systick_millis_count;
+#endif
+
+//value returned by Snooze when the low power timer woke the cpu
+#define SNOOZE_WAKE_TIMER 36
+
+/////////////////////////////////////////////////
+/// \brief Pins that wake the cpu up when their level changes.
+///
+/// In DEEP_SLEEP (LLS) only the LLWU capable pins of the teensy 3.2 (INL_SOFT_RST and INL_BAT_PACK_FAULT)
+/// can wake the cpu, the other inputs are seen at the next deadline. In SLEEP (VLPS) all of them wake the cpu.
+/////////////////////////////////////////////////
+static const struct {
+  uint8_t pin;
+  uint8_t mode;
+  uint8_t type;
+  const char* name;
+} wakePins[PowerManager::NUMBER_OF_WAKE_PINS] = {
+  { INL_SOFT_RST, INPUT_PULLUP, FALLING, "INL_SOFT_RST" },
+  { INH_RUN, INPUT_PULLDOWN, RISING, "INH_RUN" },
+  { INH_CHARGING, INPUT_PULLDOWN, RISING, "INH_CHARGING" },
+  { INL_BAT_PACK_FAULT, INPUT_PULLUP, FALLING, "INL_BAT_PACK_FAULT" },
+  { INL_BAT_MON_FAULT, INPUT_PULLUP, FALLING, "INL_BAT_MON_FAULT" },
+  { INL_WATER_SENS1, INPUT_PULLUP, FALLING, "INL_WATER_SENS1" },
+  { INL_WATER_SENS2, INPUT_PULLUP, FALLING, "INL_WATER_SENS2" },
+};
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the board starts awake with no deadline requested.
+/////////////////////////////////////////////////
+PowerManager::PowerManager(Settings* sett)
+  : config(timer, digital, usbSerial),
+    settings(sett),
+    nextDeadline(0),
+    deadlineRequested(false),
+    sleepAllowed(false),
+    activitySeen(false),
+    lastActivity(0),
+    lastWake(0),
+    bootTime(millis()),
+    firstSleepPassed(false),
+    pinWake(false),
+    sleepFraction(0) {
+  resetStats();
+}
+
+/////////////////////////////////////////////////
+/// \brief registers a time at which the cpu must be awake. Only the earliest request of a tick is kept.
+///
+/// @param deadline The millis() value at which the cpu must be running again.
+/////////////////////////////////////////////////
+void PowerManager::requestWakeAt(uint32_t deadline) {
+  if (!deadlineRequested || (int32_t)(deadline - nextDeadline) < 0) {
+    nextDeadline = deadline;
+    deadlineRequested = true;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief allows or prevents the low power modes. When prevented, idle() simply waits.
+/////////////////////////////////////////////////
+void PowerManager::setSleepAllowed(bool allowed) {
+  sleepAllowed = allowed;
+}
+
+/////////////////////////////////////////////////
+/// \brief records user activity on the console, keeping the board awake for console_idle_timeout.
+/////////////////////////////////////////////////
+void PowerManager::notifyActivity() {
+  activitySeen = true;
+  lastActivity = millis();
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the board must stay awake.
+///
+/// The teensy wont let reprogram if it slept once so the board stays awake for time_before_first_sleep
+/// after a reset, and for console_idle_timeout after the last console input. Once passed, the first sleep
+/// and the console timeout are latched so that they do not come back every time millis() wraps around.
+/////////////////////////////////////////////////
+bool PowerManager::isAwakeRequired() {
+  uint32_t t = millis();
+  if (!firstSleepPassed) {
+    if (t - bootTime < settings->time_before_first_sleep.getVal()) return true;
+    firstSleepPassed = true;
+  }
+  if (activitySeen && t - lastActivity >= settings->console_idle_timeout.getVal()) activitySeen = false;
+  return activitySeen;
+}
+
+/////////////////////////////////////////////////
+/// \brief picks the deepest state whose wake latency fits in the remaining time.
+/////////////////////////////////////////////////
+PowerManager::PowerState PowerManager::selectState(uint32_t remaining) {
+  if (!sleepAllowed || remaining < POWER_BREAK_EVEN_FACTOR * POWER_SLEEP_WAKE_LATENCY_MS) {
+    return IDLE;
+  } else if (remaining >= POWER_BREAK_EVEN_FACTOR * POWER_DEEPSLEEP_WAKE_LATENCY_MS) {
+    return DEEP_SLEEP;
+  }
+  return SLEEP;
+}
+
+void PowerManager::armWakePins() {
+  for (uint32_t i = 0; i < NUMBER_OF_WAKE_PINS; i++) {
+    digital.pinMode(wakePins[i].pin, wakePins[i].mode, wakePins[i].type);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief counts the source of a wake, returns true if it was one of the wake pins.
+/////////////////////////////////////////////////
+bool PowerManager::accountWake(int who) {
+  if (who == SNOOZE_WAKE_TIMER) {
+    wakeByTimer++;
+    return false;
+  }
+  for (uint32_t i = 0; i < NUMBER_OF_WAKE_PINS; i++) {
+    if (who == wakePins[i].pin) {
+      wakeByPin[i]++;
+      return true;
+    }
+  }
+  wakeByOther++;
+  return false;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the time of the RTC in 1/32768 s, 0 on the host where a sleep advances the clock itself.
+/////////////////////////////////////////////////
+uint64_t PowerManager::rtcTicks() {
+#if defined(__arm__)
+  uint32_t seconds, prescaler;
+  do {
+    seconds = RTC_TSR;
+    prescaler = RTC_TPR;
+  } while (seconds != RTC_TSR);
+  return ((uint64_t)seconds << 15) | (prescaler & 0x7fff);
+#else
+  return 0;
+#endif
+}
+
+/////////////////////////////////////////////////
+/// \brief advances millis() by the time slept since rtcTicks() returned sleepStart.
+///
+/// The systick does not run in the Snooze low power modes, the RTC does. The time it counted is added
+/// back whatever ended the sleep, the low power timer or a wake pin, so that all millis() based timing
+/// stays correct. The low power timer cannot tell how long a pin wake slept: Snooze stops it, clearing
+/// its counter, before it returns. The fractions of a millisecond are carried to the next sleep.
+/////////////////////////////////////////////////
+void PowerManager::compensateMillis(uint64_t sleepStart) {
+#if defined(__arm__)
+  uint64_t elapsed = (rtcTicks() - sleepStart) * 1000 + sleepFraction;
+  __disable_irq();
+  systick_millis_count += (uint32_t)(elapsed >> 15);
+  __enable_irq();
+  sleepFraction = elapsed & 0x7fff;
+#else
+  (void)sleepStart;
+#endif
+}
+
+/////////////////////////////////////////////////
+/// \brief sleeps until the earliest requested deadline or a wake pin event.
+///
+/// Called once the work of a tick is done. Returns immediately if the deadline has already passed.
+/////////////////////////////////////////////////
+void PowerManager::idle() {
+  uint32_t start = millis();
+  uint32_t remaining = 0;
+  uint64_t sleepStart;
+  PowerState state;
+  int who;
+
+  timeInState[ACTIVE] += start - lastWake;
+  entriesInState[ACTIVE]++;
+  pinWake = false;
+
+  if (deadlineRequested && (int32_t)(nextDeadline - start) > 0) {
+    remaining = nextDeadline - start;
+  }
+  deadlineRequested = false;
+  if (remaining == 0) {
+    lastWake = start;
+    return;
+  }
+
+  state = selectState(remaining);
+  entriesInState[state]++;
+  switch (state) {
+    case SLEEP:
+    case DEEP_SLEEP:
+      if (remaining > 0xffff) remaining = 0xffff;  //limit of the low power timer
+      armWakePins();
+      timer.setTimer((uint16_t)remaining);  // milliseconds
+      sleepStart = rtcTicks();
+      if (state == SLEEP) {
+        who = Snooze.sleep(config);
+      } else {
+        who = Snooze.deepSleep(config);
+      }
+      compensateMillis(sleepStart);
+      pinWake = accountWake(who);
+      break;
+    default:
+      delay(remaining);
+      break;
+  }
+  lastWake = millis();
+  timeInState[state] += lastWake - start;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if one of the wake pins ended the last idle(), an input changed before its time.
+/////////////////////////////////////////////////
+bool PowerManager::wasWokenByPin() {
+  return pinWake;
+}
+
+/////////////////////////////////////////////////
+/// \brief clears the power state and wake source counters.
+/////////////////////////////////////////////////
+void PowerManager::resetStats() {
+  memset(timeInState, 0, sizeof(timeInState));
+  memset(entriesInState, 0, sizeof(entriesInState));
+  memset(wakeByPin, 0, sizeof(wakeByPin));
+  wakeByTimer = 0;
+  wakeByOther = 0;
+  lastWake = millis();
+}
+
+const char* PowerManager::stateName(PowerState state) {
+  switch (state) {
+    case ACTIVE:
+      return "ACTIVE";
+    case IDLE:
+      return "IDLE";
+    case SLEEP:
+      return "SLEEP";
+    case DEEP_SLEEP:
+      return "DEEP_SLEEP";
+    default:
+      return "unknown";
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief prints the time spent in each power state and the wake sources to the console.
+/////////////////////////////////////////////////
+void PowerManager::printStats() {
+  uint64_t total = 0;
+  for (int i = 0; i < NUMBER_OF_POWER_STATES; i++) {
+    total += timeInState[i];
+  }
+  if (total == 0) total = 1;
+
+  LOG_CONSOLE("%-12s | %12s | %6s | %10s\n", "power state", "time (s)", "%", "entries");
+  LOG_CONSOLE("-------------+--------------+--------+-----------\n");
+  for (int i = 0; i < NUMBER_OF_POWER_STATES; i++) {
+    LOG_CONSOLE("%-12s | %12.1f | %6.2f | %10u\n", stateName((PowerState)i), (double)timeInState[i] / 1000.0,
+                (double)timeInState[i] * 100.0 / (double)total, entriesInState[i]);
+  }
+  LOG_CONSOLE("\nwake sources\n");
+  LOG_CONSOLE("%-20s : %u\n", "timer", wakeByTimer);
+  for (uint32_t i = 0; i < NUMBER_OF_WAKE_PINS; i++) {
+    LOG_CONSOLE("%-20s : %u\n", wakePins[i].name, wakeByPin[i]);
+  }
+  LOG_CONSOLE("%-20s : %u\n", "other (usb)", wakeByOther);
+  LOG_CONSOLE("sleep allowed: %d, awake required: %d\n", sleepAllowed, isAwakeRequired());
+}
+
+/////////////////////////////////////////////////
+/// \brief writes what printStats() prints: the time (s) and entries of every power state, the wake sources.
+/////////////////////////////////////////////////
+void PowerManager::writeStats(StructuredWriter* doc) {
+  doc->beginArray("states");
+  for (int i = 0; i < NUMBER_OF_POWER_STATES; i++) {
+    doc->beginObject();
+    doc->putString("name", stateName((PowerState)i));
+    doc->putFloat("seconds", (double)timeInState[i] / 1000.0);
+    doc->putUint("entries", entriesInState[i]);
+    doc->endObject();
+  }
+  doc->endArray();
+  doc->beginObject("wake");
+  doc->putUint("timer", wakeByTimer);
+  for (uint32_t i = 0; i < NUMBER_OF_WAKE_PINS; i++) {
+    doc->putUint(wakePins[i].name, wakeByPin[i]);
+  }
+  doc->putUint("other", wakeByOther);
+  doc->endObject();
+  doc->putBool("sleepAllowed", sleepAllowed);
+  doc->putBool("awakeRequired", isAwakeRequired());
+}
@@ -0,0 +1,69 @@
+#ifndef POWERMANAGER_HPP_
+#define POWERMANAGER_HPP_
+
+#include <Arduino.h>
+#include "Config.hpp"
+#include <Snooze.h>
+
+/////////////////////////////////////////////////
+/// \brief Tickless idle manager.
+///
+/// Components request the time at which they next need the CPU. Once the tick's work is done,
+/// idle() sleeps until the earliest requested deadline or until a wake pin changes,
+/// using the deepest Snooze mode whose wake latency fits in the remaining time.
+/////////////////////////////////////////////////
+class PowerManager {
+public:
+  enum PowerState {
+    ACTIVE = 0,
+    IDLE,
+    SLEEP,
+    DEEP_SLEEP,
+    NUMBER_OF_POWER_STATES
+  };
+  static const uint32_t NUMBER_OF_WAKE_PINS = 7;
+
+  PowerManager(Settings* sett);
+  void requestWakeAt(uint32_t deadline);
+  void setSleepAllowed(bool allowed);
+  void notifyActivity();
+  bool isAwakeRequired();
+  void idle();
+  bool wasWokenByPin();
+  void resetStats();
+  void printStats();
+  void writeStats(StructuredWriter* doc);
+
+private:
+  SnoozeDigital digital;
+  SnoozeTimer timer;
+  SnoozeUSBSerial usbSerial;
+  SnoozeBlock config;
+
+  Settings* settings;
+  uint32_t nextDeadline;
+  bool deadlineRequested;
+  bool sleepAllowed;
+  bool activitySeen;
+  uint32_t lastActivity;
+  uint32_t lastWake;
+  uint32_t bootTime;  //millis() at reset
+  bool firstSleepPassed;  //time_before_first_sleep has elapsed since bootTime
+  bool pinWake;  //the last idle() was ended by one of the wake pins
+  uint32_t sleepFraction;  //time slept not added to millis() yet, in 1/32768 ms
+
+  uint64_t timeInState[NUMBER_OF_POWER_STATES];  //milliseconds
+  uint32_t entriesInState[NUMBER_OF_POWER_STATES];
+  uint32_t wakeByPin[NUMBER_OF_WAKE_PINS];
+  uint32_t wakeByTimer;
+  uint32_t wakeByOther;
+
+  PowerState selectState(uint32_t remaining);
+  void armWakePins();
+  bool accountWake(int who);
+  void compensateMillis(uint64_t sleepStart);
+  static uint64_t rtcTicks();
+  static const char* stateName(PowerState state);
+};
+
+#endif /* POWERMANAGER_HPP_ */
@@ -0,0 +1,159 @@
+#include "Profiler.hpp"
+#include "Logger.hpp"
+
+#if defined(__arm__)
+#define PROF_TICKS_PER_US (F_CPU / 1000000)
+#else
+#define PROF_TICKS_PER_US 1000
+#endif
+
+//instantiate the profiler
+#if defined(__arm__)
+Profiler prof_inst;
+#else
+thread_local Profiler prof_inst;
+#endif
+
+/////////////////////////////////////////////////
+/// \brief Constructor enabling the DWT cycle counter and clearing all statistics.
+/////////////////////////////////////////////////
+Profiler::Profiler() {
+#if defined(__arm__)
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+  reset();
+}
+
+/////////////////////////////////////////////////
+/// \brief records one execution of a region.
+///
+/// Kept branch light so that a probe costs well under a microsecond.
+/// Histogram bucket n counts executions that took [2^n, 2^(n+1)) ticks.
+///
+/// @param region The region that was executed.
+/// @param ticks The time it took in profiler ticks.
+/////////////////////////////////////////////////
+void Profiler::record(Region region, uint32_t ticks) {
+  RegionStats& s = stats[region];
+  s.count++;
+  s.total += ticks;
+  if (ticks < s.min) s.min = ticks;
+  if (ticks > s.max) s.max = ticks;
+  s.histogram[ticks == 0 ? 0 : 31 - __builtin_clz(ticks)]++;
+}
+
+/////////////////////////////////////////////////
+/// \brief clears the statistics of all regions.
+/////////////////////////////////////////////////
+void Profiler::reset() {
+  memset(stats, 0, sizeof(stats));
+  for (int i = 0; i < NUMBER_OF_REGIONS; i++) {
+    stats[i].min = 0xffffffff;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of executions of a region.
+/////////////////////////////////////////////////
+uint32_t Profiler::getCount(Region region) {
+  return stats[region].count;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the mean execution time of a region in us, 0 if it never ran.
+/////////////////////////////////////////////////
+float Profiler::getMeanUs(Region region) {
+  RegionStats& s = stats[region];
+  return s.count ? (float)(s.total / s.count) / PROF_TICKS_PER_US : 0.0f;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the longest execution time of a region in us.
+/////////////////////////////////////////////////
+float Profiler::getMaxUs(Region region) {
+  return (float)stats[region].max / PROF_TICKS_PER_US;
+}
+
+const char* Profiler::regionName(Region region) {
+  switch (region) {
+    case LOOP:
+      return "loop";
+    case CONTROLLER:
+      return "doController";
+    case GET_ALL_VOLT_TEMP:
+      return "getAllVoltTemp";
+    case OLED:
+      return "doOled";
+    case CONSOLE:
+      return "console command";
+    case LOG_DRAIN:
+      return "log drain";
+    case CONSOLE_TX:
+      return "console tx";
+    case TELEMETRY:
+      return "telemetry";
+    case RPC:
+      return "rpc";
+    default:
+      return "unknown";
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief prints the statistics of all regions to the console.
+/////////////////////////////////////////////////
+void Profiler::printStats() {
+  LOG_CONSOLE("%-16s | %8s | %10s | %10s | %10s\n", "region", "count", "min (us)", "mean (us)", "max (us)");
+  LOG_CONSOLE("-----------------+----------+------------+------------+-----------\n");
+  for (int i = 0; i < NUMBER_OF_REGIONS; i++) {
+    RegionStats& s = stats[i];
+    if (s.count == 0) {
+      LOG_CONSOLE("%-16s | %8d | %10s | %10s | %10s\n", regionName((Region)i), 0, "-", "-", "-");
+      continue;
+    }
+    LOG_CONSOLE("%-16s | %8u | %10.1f | %10.1f | %10.1f\n", regionName((Region)i), s.count,
+                (float)s.min / PROF_TICKS_PER_US, (float)(s.total / s.count) / PROF_TICKS_PER_US, (float)s.max / PROF_TICKS_PER_US);
+  }
+  LOG_CONSOLE("\nlog2 histograms (bucket: executions taking less than the given time)\n");
+  for (int i = 0; i < NUMBER_OF_REGIONS; i++) {
+    RegionStats& s = stats[i];
+    if (s.count == 0) continue;
+    LOG_CONSOLE("%s:\n", regionName((Region)i));
+    for (uint32_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+      if (s.histogram[b] > 0) {
+        LOG_CONSOLE("  < %10.1fus : %u\n", (float)(2.0 * (1u << b)) / PROF_TICKS_PER_US, s.histogram[b]);
+      }
+    }
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief writes what printStats() prints: a "regions" array, times in us, the histogram buckets that
+/// counted executions as pairs of their bound and count.
+/////////////////////////////////////////////////
+void Profiler::writeStats(StructuredWriter* doc) {
+  doc->beginArray("regions");
+  for (int i = 0; i < NUMBER_OF_REGIONS; i++) {
+    RegionStats& s = stats[i];
+    doc->beginObject();
+    doc->putString("name", regionName((Region)i));
+    doc->putUint("count", s.count);
+    if (s.count > 0) {
+      doc->putFloat("minUs", (float)s.min / PROF_TICKS_PER_US);
+      doc->putFloat("meanUs", (float)(s.total / s.count) / PROF_TICKS_PER_US);
+      doc->putFloat("maxUs", (float)s.max / PROF_TICKS_PER_US);
+    }
+    doc->beginArray("histogram");
+    for (uint32_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+      if (s.histogram[b] == 0) continue;
+      doc->beginArray();
+      doc->putFloat(0, (float)(2.0 * (1u << b)) / PROF_TICKS_PER_US);
+      doc->putUint(0, s.histogram[b]);
+      doc->endArray();
+    }
+    doc->endArray();
+    doc->endObject();
+  }
+  doc->endArray();
+}
@@ -0,0 +1,100 @@
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+#include <Arduino.h>
+#include "StructuredWriter.hpp"
+
+#if !defined(__arm__)
+#include <chrono>
+#endif
+
+/////////////////////////////////////////////////
+/// \brief Lightweight per-region execution time statistics.
+///
+/// On target the Cortex-M4 DWT cycle counter is used, on a host build a std::chrono steady clock
+/// is used instead. Every region keeps its min/max/mean and a log2 histogram in fixed memory.
+/////////////////////////////////////////////////
+class Profiler {
+public:
+  enum Region {
+    LOOP = 0,
+    CONTROLLER,
+    GET_ALL_VOLT_TEMP,
+    OLED,
+    CONSOLE,
+    LOG_DRAIN,
+    CONSOLE_TX,
+    TELEMETRY,
+    RPC,
+    NUMBER_OF_REGIONS
+  };
+  static const uint32_t HISTOGRAM_BUCKETS = 32;
+
+  Profiler();
+  void record(Region region, uint32_t ticks);
+  void reset();
+  void printStats();
+  void writeStats(StructuredWriter* doc);
+  uint32_t getCount(Region region);
+  float getMeanUs(Region region);
+  float getMaxUs(Region region);
+  static const char* regionName(Region region);
+
+  /////////////////////////////////////////////////
+  /// \brief returns the free running tick counter used to time regions.
+  /////////////////////////////////////////////////
+  static inline uint32_t ticks() {
+#if defined(__arm__)
+    return ARM_DWT_CYCCNT;
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+private:
+  struct RegionStats {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t histogram[HISTOGRAM_BUCKETS];
+  };
+  RegionStats stats[NUMBER_OF_REGIONS];
+};
+
+//export the profiler, one per thread when host tools run several controllers
+#if defined(__arm__)
+extern Profiler prof_inst;
+#else
+extern thread_local Profiler prof_inst;
+#endif
+
+/////////////////////////////////////////////////
+/// \brief Times the enclosing scope and records it against a profiler region when it goes out of scope.
+/////////////////////////////////////////////////
+class ProfScope {
+public:
+  explicit ProfScope(Profiler::Region region)
+    : region(region),
+      start(Profiler::ticks()) {
+    ;
+  }
+  ~ProfScope() {
+    prof_inst.record(region, Profiler::ticks() - start);
+  }
+private:
+  Profiler::Region region;
+  uint32_t start;
+};
+
+#define PROF_CONCAT_(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT_(a, b)
+
+/////////////////////////////////////////////////
+/// \brief Helper macro that times the rest of the enclosing scope.
+///
+/// @param region The Profiler::Region the time is recorded against (eg.: PROF_SCOPE(CONTROLLER)).
+/////////////////////////////////////////////////
+#define PROF_SCOPE(region) ProfScope PROF_CONCAT(profScope, __LINE__)(Profiler::region)
+
+#endif /* PROFILER_HPP_ */
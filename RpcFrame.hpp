@@ -0,0 +1,75 @@
+/**@file RpcFrame.hpp */
+#ifndef RPCFRAME_HPP_
+#define RPCFRAME_HPP_
+
+#include "TelemetryFrame.hpp"
+
+#define RPC_SYNC 0x00           //starts and ends every frame, the console text never holds it
+#define RPC_REQUEST 0x52        //first byte of a request ('R')
+#define RPC_RESPONSE 0x72       //first byte of a response ('r')
+#define RPC_DOCUMENT 0x44       //first byte of a CBOR reply of the console ('D')
+#define RPC_HEADER_SIZE 4       //kind, u16 id, method or status
+#define RPC_CRC_SIZE 2
+#define RPC_MAX_REQUEST_PAYLOAD 96
+#define RPC_MAX_RESPONSE_PAYLOAD 1536
+#define RPC_MAX_REQUEST_SIZE (RPC_HEADER_SIZE + RPC_MAX_REQUEST_PAYLOAD + RPC_CRC_SIZE)
+#define RPC_MAX_RESPONSE_SIZE (RPC_HEADER_SIZE + RPC_MAX_RESPONSE_PAYLOAD + RPC_CRC_SIZE)
+#define RPC_MAX_ENCODED_REQUEST_SIZE (RPC_MAX_REQUEST_SIZE + RPC_MAX_REQUEST_SIZE / 254 + 3)
+#define RPC_MAX_ENCODED_RESPONSE_SIZE (RPC_MAX_RESPONSE_SIZE + RPC_MAX_RESPONSE_SIZE / 254 + 3)
+
+/////////////////////////////////////////////////
+/// \brief Offsets of the header of a request or response frame, fields are little endian.
+/////////////////////////////////////////////////
+enum RpcField {
+  RPC_KIND = 0,    ///< u8 RPC_REQUEST, RPC_RESPONSE or RPC_DOCUMENT
+  RPC_ID = 1,      ///< u16 chosen by the client, the response carries the id of its request
+  RPC_METHOD = 3,  ///< u8 RpcMethod of a request
+  RPC_STATUS = 3,  ///< u8 RpcStatus of a response
+  RPC_PAYLOAD = 4
+};
+
+/////////////////////////////////////////////////
+/// \brief What a request asks for, its payload and the payload of the response when it is RPC_OK.
+/////////////////////////////////////////////////
+enum RpcMethod {
+  RPC_PING = 0,       ///< any payload, sent back as it is
+  RPC_SNAPSHOT = 1,   ///< no payload, a full telemetry frame of the last tick, CRC included (TelemetryFrame.hpp)
+  RPC_GET_PARAM = 2,  ///< the name of a parameter, its CBOR map as the config command writes it
+  RPC_SET_PARAM = 3,  ///< the name, a zero byte and the value as text, as the set command takes it; nothing
+  RPC_STATS = 4,      ///< u8 RpcStats, the CBOR map of those statistics
+  RPC_HISTORY = 5,    ///< no payload, a CBOR map of the historic extremes of the pack and the sticky faults
+  NUMBER_OF_RPC_METHODS
+};
+
+enum RpcStats {
+  RPC_STATS_PROFILER = 0,  ///< the prof command
+  RPC_STATS_POWER = 1,     ///< the power command
+  RPC_STATS_CONSOLE = 2,   ///< the output command and the counters of the RPC server
+};
+
+/////////////////////////////////////////////////
+/// \brief Status of a response, the payload is empty unless RPC_OK.
+/////////////////////////////////////////////////
+enum RpcStatus {
+  RPC_OK = 0,
+  RPC_ERR_METHOD = 1,     ///< unknown method
+  RPC_ERR_ARGUMENT = 2,   ///< payload malformed for the method
+  RPC_ERR_NOT_FOUND = 3,  ///< no parameter of that name
+  RPC_ERR_VALUE = 4,      ///< the parameter refused the value (out of bounds, not editable, not a number)
+  RPC_ERR_SAVE = 5,       ///< the value was set but could not be saved
+  RPC_ERR_TOO_LARGE = 6,  ///< the response did not fit RPC_MAX_RESPONSE_PAYLOAD
+  RPC_ERR_UNAVAILABLE = 7 ///< the board was built without what the method needs (no telemetry for a snapshot)
+};
+
+//Framing of the RPC channel of the console port, shared by the firmware (RpcServer) and the host client.
+//
+//A request is the header of RpcField, its payload and the CRC-16/CCITT-FALSE of both, COBS encoded
+//between two RPC_SYNC bytes with TelemetryFrame::encode(); a response is framed the same way. The
+//console tells the frames from what is typed by the sync byte. The responses come in the order of the
+//requests, a client may send several requests before it reads their responses.
+//
+//A reply of the console in the CBOR format is a frame too: RPC_DOCUMENT, the CBOR document and the CRC of
+//both, without the id and status of a response nor a bound on its length (RpcFrameStream). The port thus
+//carries no zero byte outside the delimiters of the frames, whatever the format of the replies.
+
+#endif /* RPCFRAME_HPP_ */
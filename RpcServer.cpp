@@ -0,0 +1,295 @@
+#include "RpcServer.hpp"
+#include "Controller.hpp"
+#include "ConsoleOut.hpp"
+#include "Profiler.hpp"
+#include "Telemetry.hpp"
+#include <string.h>
+
+/////////////////////////////////////////////////
+/// \brief The payload of a response, written in place after its header. What does not fit is counted and
+/// the response becomes RPC_ERR_TOO_LARGE.
+/////////////////////////////////////////////////
+class RpcPayload : public Print {
+public:
+  RpcPayload(uint8_t* data, size_t size)
+    : data(data),
+      size(size),
+      length(0),
+      overflow(false) {
+  }
+  size_t write(uint8_t b) {
+    return write(&b, 1);
+  }
+  size_t write(const uint8_t* buffer, size_t n) {
+    if (length + n > size) {
+      overflow = true;
+      return 0;
+    }
+    memcpy(data + length, buffer, n);
+    length += n;
+    return n;
+  }
+  using Print::write;
+
+  uint8_t* data;
+  size_t size;
+  size_t length;
+  bool overflow;
+};
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the responses are written to out, whole once the console has room for them.
+/////////////////////////////////////////////////
+RpcServer::RpcServer(Controller* cont_inst_ptr, Telemetry* telemetry, Print* out)
+  : controller(cont_inst_ptr),
+    telemetry(telemetry),
+    out(out),
+    framing(false),
+    overflow(false),
+    used(0),
+    pending(0),
+    requests(0),
+    errors(0),
+    dropped(0) {
+}
+
+/////////////////////////////////////////////////
+/// \brief takes a byte the console read.
+///
+/// @return true if the byte belongs to a frame, false if it is console input.
+/////////////////////////////////////////////////
+bool RpcServer::feed(uint8_t c) {
+  if (!framing) {
+    if (c != RPC_SYNC) return false;
+    framing = true;
+    overflow = false;
+    used = 0;
+    return true;
+  }
+  if (c != RPC_SYNC) {
+    if (used < sizeof(part)) {
+      part[used++] = c;
+    } else {
+      overflow = true;
+    }
+    return true;
+  }
+  if (used == 0) return true;  //two sync bytes in a row, the end of a frame and the start of the next
+  if (overflow) {
+    dropped++;
+  } else {
+    endFrame();
+  }
+  framing = false;
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true while a response waits for room in the TX ring, the console reads no input then.
+/////////////////////////////////////////////////
+bool RpcServer::isPending() {
+  return pending > 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief queues the pending response when the TX ring has room for it whole.
+///
+/// @return true if no response is pending anymore.
+/////////////////////////////////////////////////
+bool RpcServer::serve() {
+  if (pending == 0) return true;
+  if (console_out.getFree() < pending) return false;
+  PROF_SCOPE(RPC);
+  out->write(encoded, pending);
+  pending = 0;
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of requests answered.
+/////////////////////////////////////////////////
+uint32_t RpcServer::getRequests() {
+  return requests;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of requests answered with a status other than RPC_OK.
+/////////////////////////////////////////////////
+uint32_t RpcServer::getErrors() {
+  return errors;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of frames dropped unanswered: not a request, a bad CRC or too long.
+/////////////////////////////////////////////////
+uint32_t RpcServer::getDropped() {
+  return dropped;
+}
+
+void RpcServer::writeStats(StructuredWriter* doc) {
+  doc->putUint("requests", requests);
+  doc->putUint("errors", errors);
+  doc->putUint("dropped", dropped);
+}
+
+/////////////////////////////////////////////////
+/// \brief decodes the frame read, answers it if it is a good request and encodes the response.
+/////////////////////////////////////////////////
+void RpcServer::endFrame() {
+  uint8_t request[RPC_MAX_REQUEST_SIZE + 1];  //+1 for the zero ending the payload
+  PROF_SCOPE(RPC);
+  size_t length = TelemetryFrame::decode(part, used, request, RPC_MAX_REQUEST_SIZE);
+  if (length < RPC_HEADER_SIZE + RPC_CRC_SIZE || request[RPC_KIND] != RPC_REQUEST ||
+      TelemetryFrame::crc16(request, length - RPC_CRC_SIZE) != TelemetryFrame::get16(request + length - RPC_CRC_SIZE)) {
+    dropped++;
+    return;
+  }
+  length -= RPC_HEADER_SIZE + RPC_CRC_SIZE;
+  request[RPC_PAYLOAD + length] = 0;
+  requests++;
+
+  RpcPayload payload(response + RPC_PAYLOAD, RPC_MAX_RESPONSE_PAYLOAD);
+  uint8_t status = call(request[RPC_METHOD], (const char*)request + RPC_PAYLOAD, length, &payload);
+  if (status == RPC_OK && payload.overflow) status = RPC_ERR_TOO_LARGE;
+  if (status != RPC_OK) {
+    payload.length = 0;
+    errors++;
+  }
+  response[RPC_KIND] = RPC_RESPONSE;
+  TelemetryFrame::put16(response + RPC_ID, TelemetryFrame::get16(request + RPC_ID));
+  response[RPC_STATUS] = status;
+  length = RPC_HEADER_SIZE + payload.length;
+  TelemetryFrame::put16(response + length, TelemetryFrame::crc16(response, length));
+  pending = TelemetryFrame::encode(response, length + RPC_CRC_SIZE, encoded);
+}
+
+/////////////////////////////////////////////////
+/// \brief answers a request.
+///
+/// @param args the payload of the request, followed by a zero.
+/// @return the RpcStatus of the response.
+/////////////////////////////////////////////////
+uint8_t RpcServer::call(uint8_t method, const char* args, size_t length, RpcPayload* payload) {
+  StructuredWriter doc(payload);
+  Param* param;
+  doc.setFormat(StructuredWriter::CBOR);
+  switch (method) {
+    case RPC_PING:
+      payload->write((const uint8_t*)args, length);
+      return RPC_OK;
+    case RPC_SNAPSHOT:
+      if (telemetry == 0) return RPC_ERR_UNAVAILABLE;
+      payload->length = telemetry->compose(payload->data);
+      return RPC_OK;
+    case RPC_GET_PARAM:
+      param = controller->getSettingsPtr()->getParam(args);
+      if (param == 0) return RPC_ERR_NOT_FOUND;
+      param->write(&doc);
+      return RPC_OK;
+    case RPC_SET_PARAM:
+      if (strlen(args) + 1 >= length) return RPC_ERR_ARGUMENT;  //no value after the name
+      param = controller->getSettingsPtr()->getParam(args);
+      if (param == 0) return RPC_ERR_NOT_FOUND;
+      if (param->setVal(args + strlen(args) + 1) != 0) return RPC_ERR_VALUE;
+      if (controller->saveSettings() != 0) return RPC_ERR_SAVE;
+      return RPC_OK;
+    case RPC_STATS:
+      if (length != 1) return RPC_ERR_ARGUMENT;
+      doc.beginObject();
+      if (args[0] == RPC_STATS_PROFILER) {
+        prof_inst.writeStats(&doc);
+      } else if (args[0] == RPC_STATS_POWER) {
+        controller->getPowerPtr()->writeStats(&doc);
+        doc.beginObject("modules");
+        controller->getModulePowerPtr()->writeStats(&doc);
+        doc.endObject();
+      } else if (args[0] == RPC_STATS_CONSOLE) {
+        console_out.writeStats(&doc);
+        doc.beginObject("rpc");
+        writeStats(&doc);
+        doc.endObject();
+      } else {
+        return RPC_ERR_ARGUMENT;  //the payload is dropped with the status
+      }
+      doc.endObject();
+      return RPC_OK;
+    case RPC_HISTORY:
+      doc.beginObject();
+      doc.beginObject("pack");
+      controller->getBMSPtr()->writeHistory(&doc);
+      doc.endObject();
+      doc.beginObject("controller");
+      controller->writeControllerState(&doc);
+      doc.endObject();
+      doc.endObject();
+      return RPC_OK;
+    default:
+      return RPC_ERR_METHOD;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the frames and the bytes outside them go to out.
+/////////////////////////////////////////////////
+RpcFrameStream::RpcFrameStream(Print* out)
+  : out(out),
+    open(false),
+    crc(0xffff),
+    blockLength(0) {
+}
+
+/////////////////////////////////////////////////
+/// \brief starts a frame of kind, the bytes written up to end() are its payload.
+/////////////////////////////////////////////////
+void RpcFrameStream::begin(uint8_t kind) {
+  out->write((uint8_t)RPC_SYNC);
+  open = true;
+  crc = 0xffff;
+  blockLength = 0;
+  write(kind);
+}
+
+/////////////////////////////////////////////////
+/// \brief ends the frame with its CRC, nothing if no frame was begun.
+/////////////////////////////////////////////////
+void RpcFrameStream::end() {
+  if (!open) return;
+  uint16_t c = crc;
+  put(c);
+  put(c >> 8);
+  endBlock(blockLength + 1);
+  out->write((uint8_t)RPC_SYNC);
+  open = false;
+}
+
+size_t RpcFrameStream::write(uint8_t b) {
+  if (!open) return out->write(b);
+  crc = TelemetryFrame::crc16(&b, 1, crc);
+  put(b);
+  return 1;
+}
+
+size_t RpcFrameStream::write(const uint8_t* buffer, size_t size) {
+  if (!open) return out->write(buffer, size);
+  crc = TelemetryFrame::crc16(buffer, size, crc);
+  for (size_t i = 0; i < size; i++) put(buffer[i]);
+  return size;
+}
+
+/////////////////////////////////////////////////
+/// \brief adds a byte of the frame to the block, writing the block out when the byte ends it.
+/////////////////////////////////////////////////
+void RpcFrameStream::put(uint8_t b) {
+  if (b == 0) {
+    endBlock(blockLength + 1);
+    return;
+  }
+  block[blockLength++] = b;
+  if (blockLength == sizeof(block)) endBlock(0xff);
+}
+
+void RpcFrameStream::endBlock(uint8_t code) {
+  out->write(code);
+  if (blockLength) out->write(block, blockLength);
+  blockLength = 0;
+}
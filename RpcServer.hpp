@@ -0,0 +1,85 @@
+/**@file RpcServer.hpp */
+#ifndef RPCSERVER_HPP_
+#define RPCSERVER_HPP_
+
+#include <Arduino.h>
+#include "RpcFrame.hpp"
+#include "StructuredWriter.hpp"
+
+class Controller;
+class Telemetry;
+class RpcPayload;
+
+/////////////////////////////////////////////////
+/// \brief Answers the binary requests a host tool sends on the console port, between what is typed.
+///
+/// The console passes every byte it reads to feed() first. A sync byte starts a frame, the bytes up to the
+/// next sync byte are the frame (see RpcFrame.hpp) and not console input. A request that decodes with a
+/// good CRC is answered at once: its response is composed and encoded, and is pending until serve()
+/// finds room for it whole in the TX ring. The console reads no input while a response is pending, the
+/// requests a client pipelines wait in the USB receive buffer and are answered in order. A frame that is
+/// not a request, fails its CRC or outgrows RPC_MAX_REQUEST_SIZE is dropped and counted: the client gets
+/// no response and times out.
+///
+/// The payloads other than the snapshot and the ping are CBOR documents written with StructuredWriter,
+/// the data of the console commands in the layout of their JSON and CBOR formats.
+/////////////////////////////////////////////////
+class RpcServer {
+public:
+  RpcServer(Controller* cont_inst_ptr, Telemetry* telemetry, Print* out);
+  bool feed(uint8_t c);
+  bool isPending();
+  bool serve();
+  uint32_t getRequests();
+  uint32_t getErrors();
+  uint32_t getDropped();
+  void writeStats(StructuredWriter* doc);
+
+private:
+  Controller* controller;
+  Telemetry* telemetry;  //0 without telemetry, there is no snapshot then
+  Print* out;
+  bool framing;   //between the sync bytes of a frame
+  bool overflow;  //the frame outgrew a request, dropped at its end
+  size_t used;
+  uint8_t part[RPC_MAX_ENCODED_REQUEST_SIZE];
+  uint8_t response[RPC_MAX_RESPONSE_SIZE];
+  uint8_t encoded[RPC_MAX_ENCODED_RESPONSE_SIZE];
+  size_t pending;  //length of the encoded response waiting for room, 0 if none
+  uint32_t requests;
+  uint32_t errors;   //responses other than RPC_OK
+  uint32_t dropped;  //frames dropped without a response
+
+  void endFrame();
+  uint8_t call(uint8_t method, const char* args, size_t length, RpcPayload* payload);
+};
+
+/////////////////////////////////////////////////
+/// \brief Writes a frame of the console port as it comes, of any length, or passes the bytes on as they are.
+///
+/// Between begin() and end() the bytes written are the frame: they are COBS encoded a block at a time, a
+/// block ending at a zero byte or after 254 bytes, and end() appends the CRC. The console sends its CBOR
+/// replies through it, they are written over several ticks and never held whole. Outside a frame the
+/// bytes, the JSON replies, go to out unchanged.
+/////////////////////////////////////////////////
+class RpcFrameStream : public Print {
+public:
+  RpcFrameStream(Print* out);
+  void begin(uint8_t kind);
+  void end();
+  size_t write(uint8_t b);
+  size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+
+private:
+  Print* out;
+  bool open;
+  uint16_t crc;
+  uint8_t blockLength;
+  uint8_t block[254];  //the COBS block being written, without its code
+
+  void put(uint8_t b);
+  void endBlock(uint8_t code);
+};
+
+#endif /* RPCSERVER_HPP_ */
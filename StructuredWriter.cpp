@@ -0,0 +1,247 @@
+#include "StructuredWriter.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_INDEFINITE 31
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define CBOR_FLOAT32 0xfa
+#define CBOR_BREAK 0xff
+
+static const char* const formatNames[StructuredWriter::NUMBER_OF_FORMATS] = { "text", "json", "cbor" };
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the documents are written to out. The format starts as TEXT.
+/////////////////////////////////////////////////
+StructuredWriter::StructuredWriter(Print* out)
+  : out(out),
+    format(TEXT),
+    next(TEXT),
+    depth(0),
+    filled(0) {
+}
+
+/////////////////////////////////////////////////
+/// \brief sets the format of the next documents, a document open is finished in its format.
+/////////////////////////////////////////////////
+void StructuredWriter::setFormat(Format format) {
+  next = format;
+  if (depth == 0) this->format = format;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the format of the next documents.
+/////////////////////////////////////////////////
+StructuredWriter::Format StructuredWriter::getFormat() {
+  return next;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the reply being written is a document, JSON or CBOR, rather than text.
+/////////////////////////////////////////////////
+bool StructuredWriter::isStructured() {
+  return format != TEXT;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true while a document was begun and not ended.
+/////////////////////////////////////////////////
+bool StructuredWriter::isOpen() {
+  return depth > 0;
+}
+
+const char* StructuredWriter::getFormatName(Format format) {
+  return format < NUMBER_OF_FORMATS ? formatNames[format] : "unknown";
+}
+
+void StructuredWriter::beginObject(const char* key) {
+  beginContainer(key, '{', CBOR_MAP);
+}
+
+void StructuredWriter::endObject() {
+  endContainer('}');
+}
+
+void StructuredWriter::beginArray(const char* key) {
+  beginContainer(key, '[', CBOR_ARRAY);
+}
+
+void StructuredWriter::endArray() {
+  endContainer(']');
+}
+
+void StructuredWriter::putInt(const char* key, int32_t value) {
+  char text[12];
+  if (format == TEXT) return;
+  beginValue(key);
+  if (format == JSON) {
+    write(text, snprintf(text, sizeof(text), "%ld", (long)value));
+  } else if (value < 0) {
+    putHead(CBOR_NEGATIVE, (uint32_t)(-1 - value));
+  } else {
+    putHead(CBOR_UNSIGNED, value);
+  }
+}
+
+void StructuredWriter::putUint(const char* key, uint32_t value) {
+  char text[12];
+  if (format == TEXT) return;
+  beginValue(key);
+  if (format == JSON) {
+    write(text, snprintf(text, sizeof(text), "%lu", (unsigned long)value));
+  } else {
+    putHead(CBOR_UNSIGNED, value);
+  }
+}
+
+void StructuredWriter::putFloat(const char* key, float value) {
+  char text[20];
+  uint32_t bits;
+  if (format == TEXT) return;
+  beginValue(key);
+  if (format == JSON) {
+    if (isfinite(value)) {
+      write(text, snprintf(text, sizeof(text), "%.6g", (double)value));
+    } else {
+      write("null", 4);
+    }
+    return;
+  }
+  memcpy(&bits, &value, sizeof(bits));
+  text[0] = CBOR_FLOAT32;
+  for (int i = 0; i < 4; i++) text[1 + i] = bits >> (24 - 8 * i);
+  write(text, 5);
+}
+
+void StructuredWriter::putBool(const char* key, bool value) {
+  if (format == TEXT) return;
+  beginValue(key);
+  if (format == JSON) {
+    write(value ? "true" : "false", value ? 4 : 5);
+  } else {
+    out->write((uint8_t)(value ? CBOR_TRUE : CBOR_FALSE));
+  }
+}
+
+void StructuredWriter::putString(const char* key, const char* value) {
+  if (format == TEXT) return;
+  beginValue(key);
+  putText(value);
+}
+
+void StructuredWriter::putNull(const char* key) {
+  if (format == TEXT) return;
+  beginValue(key);
+  if (format == JSON) {
+    write("null", 4);
+  } else {
+    out->write((uint8_t)CBOR_NULL);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief writes what comes before a value: the tag of a new CBOR document, the comma of JSON and the key
+/// of a value in an object.
+/////////////////////////////////////////////////
+void StructuredWriter::beginValue(const char* key) {
+  if (depth == 0) {
+    if (format == CBOR) putHead(CBOR_TAG, STRUCTURED_CBOR_TAG);
+    return;
+  }
+  uint32_t bit = 1ul << ((depth - 1) % STRUCTURED_MAX_DEPTH);
+  if (format == JSON && (filled & bit)) write(",", 1);
+  filled |= bit;
+  if (key) {
+    putText(key);
+    if (format == JSON) write(":", 1);
+  }
+}
+
+void StructuredWriter::beginContainer(const char* key, char json, uint8_t cbor) {
+  if (format == TEXT) return;
+  beginValue(key);
+  if (format == JSON) {
+    write(&json, 1);
+  } else {
+    out->write((uint8_t)(cbor << 5 | CBOR_INDEFINITE));
+  }
+  depth++;
+  filled &= ~(1ul << ((depth - 1) % STRUCTURED_MAX_DEPTH));
+}
+
+/////////////////////////////////////////////////
+/// \brief ends the container open, the document with the outermost one.
+/////////////////////////////////////////////////
+void StructuredWriter::endContainer(char json) {
+  if (format == TEXT || depth == 0) return;
+  depth--;
+  if (format == JSON) {
+    write(&json, 1);
+    if (depth == 0) write("\n", 1);
+  } else {
+    out->write((uint8_t)CBOR_BREAK);
+  }
+  if (depth == 0) format = next;
+}
+
+/////////////////////////////////////////////////
+/// \brief writes the head of a CBOR item: its major type and its argument in the fewest bytes.
+/////////////////////////////////////////////////
+void StructuredWriter::putHead(uint8_t major, uint32_t value) {
+  uint8_t head[5];
+  size_t n;
+  if (value < 24) {
+    head[0] = major << 5 | value;
+    n = 1;
+  } else if (value <= 0xff) {
+    head[0] = major << 5 | 24;
+    head[1] = value;
+    n = 2;
+  } else if (value <= 0xffff) {
+    head[0] = major << 5 | 25;
+    head[1] = value >> 8;
+    head[2] = value;
+    n = 3;
+  } else {
+    head[0] = major << 5 | 26;
+    for (int i = 0; i < 4; i++) head[1 + i] = value >> (24 - 8 * i);
+    n = 5;
+  }
+  out->write(head, n);
+}
+
+/////////////////////////////////////////////////
+/// \brief writes a text string: quoted and escaped in JSON, a definite length text in CBOR.
+/////////////////////////////////////////////////
+void StructuredWriter::putText(const char* text) {
+  size_t length = text ? strlen(text) : 0;
+  if (format == CBOR) {
+    putHead(CBOR_TEXT, length);
+    write(text, length);
+    return;
+  }
+  write("\"", 1);
+  size_t start = 0;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = text[i];
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    char escape[7];
+    write(text + start, i - start);
+    write(escape, c == '"' || c == '\\' ? snprintf(escape, sizeof(escape), "\\%c", c) : snprintf(escape, sizeof(escape), "\\u%04x", c));
+    start = i + 1;
+  }
+  write(text + start, length - start);
+  write("\"", 1);
+}
+
+void StructuredWriter::write(const char* text, size_t length) {
+  if (length) out->write((const uint8_t*)text, length);
+}
@@ -0,0 +1,67 @@
+/**@file StructuredWriter.hpp */
+#ifndef STRUCTUREDWRITER_HPP_
+#define STRUCTUREDWRITER_HPP_
+
+#include <Arduino.h>
+
+#define STRUCTURED_MAX_DEPTH 32  //objects and arrays open at once, a bit of StructuredWriter::filled each
+#define STRUCTURED_CBOR_TAG 55799  //self-described CBOR, its head d9 d9 f7 starts every CBOR document
+
+/////////////////////////////////////////////////
+/// \brief Writes the console replies as structured documents, JSON or CBOR, as they are produced.
+///
+/// There is no document in memory: every call writes its value to out at once, the writer only keeps
+/// the nesting and whether the container open at every level already holds a value (for the commas of
+/// JSON). A document may thus be written over several ticks, a part per printNext() of a command.
+///
+/// The values of an object take their key, the values of an array take none (0). A document is the
+/// outermost object, it ends when that object ends. A JSON document is one line, a CBOR document is the
+/// STRUCTURED_CBOR_TAG followed by one item whose maps and arrays have an indefinite length, so neither
+/// needs to know how many values follow. Floats that are not finite are null in JSON.
+///
+/// In the TEXT format nothing is written, the commands print their tables as before. A document is
+/// finished in the format it was begun in, a new format applies from the next document on.
+/////////////////////////////////////////////////
+class StructuredWriter {
+public:
+  enum Format {
+    TEXT,
+    JSON,
+    CBOR,
+    NUMBER_OF_FORMATS
+  };
+
+  StructuredWriter(Print* out);
+  void setFormat(Format format);
+  Format getFormat();
+  bool isStructured();
+  bool isOpen();
+  static const char* getFormatName(Format format);
+
+  void beginObject(const char* key = 0);
+  void endObject();
+  void beginArray(const char* key = 0);
+  void endArray();
+  void putInt(const char* key, int32_t value);
+  void putUint(const char* key, uint32_t value);
+  void putFloat(const char* key, float value);
+  void putBool(const char* key, bool value);
+  void putString(const char* key, const char* value);
+  void putNull(const char* key);
+
+private:
+  Print* out;
+  Format format;
+  Format next;      //the format set while a document was open, from the next document on
+  uint8_t depth;    //containers open
+  uint32_t filled;  //a bit per depth, set once the container open there holds a value
+
+  void beginValue(const char* key);
+  void beginContainer(const char* key, char json, uint8_t cbor);
+  void endContainer(char json);
+  void putHead(uint8_t major, uint32_t value);
+  void putText(const char* text);
+  void write(const char* text, size_t length);
+};
+
+#endif /* STRUCTUREDWRITER_HPP_ */
@@ -0,0 +1,176 @@
+#include "Telemetry.hpp"
+#include "Controller.hpp"
+#include "Profiler.hpp"
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the frames of the controller are written to out. The telemetry starts off.
+/////////////////////////////////////////////////
+Telemetry::Telemetry(Controller* cont_inst_ptr, Print* out)
+  : controller(cont_inst_ptr),
+    out(out),
+    period(0),
+    nextFrame(0),
+    sequence(0),
+    keyframeInterval(DEFAULT_KEYFRAME_INTERVAL),
+    sinceKeyframe(0),
+    sent(0),
+    keyframes(0),
+    dropped(0),
+    referenced(false) {
+}
+
+/////////////////////////////////////////////////
+/// \brief sends a frame every periodMs from the next tick on, 0 turns the telemetry off.
+///
+/// @param keyframeInterval a full frame every that many frames, the others are delta frames. 1 (or 0)
+/// sends full frames only.
+/////////////////////////////////////////////////
+void Telemetry::setPeriod(uint32_t periodMs, uint8_t keyframeInterval) {
+  period = periodMs;
+  nextFrame = millis();
+  this->keyframeInterval = keyframeInterval ? keyframeInterval : 1;
+  referenced = false;
+}
+
+uint32_t Telemetry::getPeriod() {
+  return period;
+}
+
+uint8_t Telemetry::getKeyframeInterval() {
+  return keyframeInterval;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of frames queued to the console.
+/////////////////////////////////////////////////
+uint32_t Telemetry::getSent() {
+  return sent;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of full frames queued to the console, the others were delta frames.
+/////////////////////////////////////////////////
+uint32_t Telemetry::getKeyframes() {
+  return keyframes;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of frames dropped because the TX ring had no room for them.
+/////////////////////////////////////////////////
+uint32_t Telemetry::getDropped() {
+  return dropped;
+}
+
+/////////////////////////////////////////////////
+/// \brief sends a frame when one is due and asks the power manager to wake the cpu for the next one.
+///
+/// While streaming, the board counts as in use: it stays awake like after a console command, running
+/// the main loop every LOOP_PERIOD_ACTIVE_MS instead of sleeping through the standby period.
+/// A frame late by more than a period, the main loop running slower than the telemetry, is not caught
+/// up: the next one is due a period later.
+/////////////////////////////////////////////////
+void Telemetry::tick() {
+  if (period == 0) return;
+  PowerManager* power = controller->getPowerPtr();
+  power->notifyActivity();
+  if ((int32_t)(millis() - nextFrame) >= 0) {
+    nextFrame += period;
+    if ((int32_t)(millis() - nextFrame) >= 0) nextFrame = millis() + period;
+    send();
+  }
+  power->requestWakeAt(nextFrame);
+}
+
+/////////////////////////////////////////////////
+/// \brief composes and sends a frame. A keyframe is sent when one is due, when there is no frame to refer
+/// to or when the delta frame would not be smaller.
+/////////////////////////////////////////////////
+void Telemetry::send() {
+  size_t length = compose(frame);
+  sequence++;
+  size_t n = 0;
+  if (referenced && sinceKeyframe + 1 < keyframeInterval) n = TelemetryFrame::makeDelta(reference, frame, delta, length - 1);
+  bool keyframe = n == 0;
+  n = keyframe ? TelemetryFrame::encode(frame, length, encoded) : TelemetryFrame::encode(delta, n, encoded);
+  if (out->write(encoded, n) != n) {
+    dropped++;
+    return;
+  }
+  sent++;
+  if (keyframe) {
+    keyframes++;
+    sinceKeyframe = 0;
+  } else {
+    sinceKeyframe++;
+  }
+  if (keyframeInterval > 1) {
+    memcpy(reference, frame, length);
+    referenced = true;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief composes the full frame of the last tick of the controller into frame, TELEMETRY_MAX_SIZE bytes.
+///
+/// The frame takes the sequence number of the next frame tick() sends, a frame composed for someone else
+/// (a snapshot over RPC) leaves no gap in the stream.
+///
+/// @return the length of the frame.
+/////////////////////////////////////////////////
+size_t Telemetry::compose(uint8_t* frame) {
+  BMSModuleManager* bms = controller->getBMSPtr();
+  int modules = bms->getNumFoundModules();
+  uint8_t outputs = 0;
+
+  if (modules > TELEMETRY_MAX_MODULES) modules = TELEMETRY_MAX_MODULES;
+  if (modules < 0) modules = 0;
+  if (controller->outL_evcc_on_buffer) outputs |= TLM_OUT_EVCC_ON;
+  if (controller->outH_fault_buffer) outputs |= TLM_OUT_FAULT;
+  if (controller->outL_12V_bat_chrg_buffer) outputs |= TLM_OUT_12V_CHARGE;
+  if (controller->isChargerInhibit()) outputs |= TLM_OUT_CHARGER_INHIBIT;
+  if (controller->isPowerLimiter()) outputs |= TLM_OUT_POWER_LIMITER;
+
+  frame[TLM_VERSION] = TELEMETRY_VERSION;
+  frame[TLM_MODULES] = modules;
+  TelemetryFrame::put16(frame + TLM_SEQUENCE, sequence);
+  TelemetryFrame::put32(frame + TLM_MILLIS, millis());
+  TelemetryFrame::put32(frame + TLM_ACTIVE, controller->faults.getActive());
+  TelemetryFrame::put32(frame + TLM_STICKY, controller->faults.getSticky());
+  TelemetryFrame::put16(frame + TLM_BAT12V, saturate(controller->bat12vVoltage * 1000.0f));
+  TelemetryFrame::put16(frame + TLM_LOOP_MEAN, saturate(prof_inst.getMeanUs(Profiler::LOOP)));
+  TelemetryFrame::put16(frame + TLM_LOOP_MAX, saturate(prof_inst.getMaxUs(Profiler::LOOP)));
+  TelemetryFrame::put16(frame + TLM_CONTROLLER_MAX, saturate(prof_inst.getMaxUs(Profiler::CONTROLLER)));
+  frame[TLM_STATE] = controller->getState();
+  frame[TLM_OUTPUTS] = outputs;
+  frame[TLM_PUMP] = controller->outpwm_pump_buffer;
+  frame[TLM_RESERVED] = 0;
+
+  uint8_t* p = frame + TELEMETRY_HEADER_SIZE;
+  for (int m = 0; m < modules; m++, p += TELEMETRY_MODULE_SIZE) {
+    BMSModule* module = bms->getModulePtr(m);
+    p[TLM_MODULE_ADDRESS] = module->getAddress();
+    p[TLM_MODULE_FAULTS] = module->getFaults();
+    p[TLM_MODULE_ALERTS] = module->getAlerts();
+    for (int cell = 0; cell < 6; cell++) {
+      TelemetryFrame::put16(p + TLM_MODULE_CELLS + 2 * cell, module->getCellCounts(cell));
+    }
+    for (int sensor = 0; sensor < 2; sensor++) {
+      float t = module->getTemperature(sensor) * 100.0f;
+      int16_t v = TELEMETRY_NO_TEMPERATURE;  //also when the sensor reads NaN
+      if (t > -32767.0f && t < 32767.0f) v = (int16_t)(t < 0.0f ? t - 0.5f : t + 0.5f);
+      TelemetryFrame::put16(p + TLM_MODULE_TEMPS + 2 * sensor, v);
+    }
+  }
+
+  TelemetryFrame::put16(p, TelemetryFrame::crc16(frame, p - frame));
+  return p - frame + TELEMETRY_CRC_SIZE;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns v rounded to a u16 field, 0xffff when it does not fit.
+/////////////////////////////////////////////////
+uint16_t Telemetry::saturate(float v) {
+  if (!(v > 0.0f)) return 0;
+  if (v >= 65535.0f) return 0xffff;
+  return (uint16_t)(v + 0.5f);
+}
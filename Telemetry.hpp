@@ -0,0 +1,64 @@
+/**@file Telemetry.hpp */
+#ifndef TELEMETRY_HPP_
+#define TELEMETRY_HPP_
+
+#include <Arduino.h>
+#include "TelemetryFrame.hpp"
+
+class Controller;
+
+/////////////////////////////////////////////////
+/// \brief Streams the state of the controller and of every module as binary frames (see TelemetryFrame).
+///
+/// A frame holds what printAllCSV() prints, with the raw ADC counts of the cells instead of formatted
+/// voltages, plus the state, the faults, the outputs and the loop timing, about 1.2 kB for a full pack.
+/// Every tick() composes and sends a frame when one is due, every period ms, and has the main loop wake
+/// up for the next one. The cells and the temperatures are those of the last run of the controller: they
+/// change every controller period, the frames in between repeat them with the timing fields moving on.
+/// The frame is written to out in a single write, the telemetry stream of the console drops a
+/// frame that does not fit the TX ring whole: a host that does not keep up sees a gap in the sequence
+/// numbers, the text of the console between the frames is never mixed into one. A frame the log cuts to
+/// make room for its lines before the host read it fails its CRC and the decoder drops it.
+///
+/// Between keyframes, every keyframeInterval frames, only the differences of the fields against the last
+/// frame that made it into the TX ring are sent (see TelemetryFrame::makeDelta()): the frame of a steady
+/// pack takes a dozen bytes instead of 1.2 kB. A frame that was dropped is not referred to, a frame lost
+/// on the way to the host makes it lose the delta frames up to the next keyframe.
+/////////////////////////////////////////////////
+class Telemetry {
+public:
+  static const uint32_t MIN_PERIOD_MS = 10;
+  static const uint32_t DEFAULT_KEYFRAME_INTERVAL = 10;
+
+  Telemetry(Controller* cont_inst_ptr, Print* out);
+  void setPeriod(uint32_t periodMs, uint8_t keyframeInterval = DEFAULT_KEYFRAME_INTERVAL);
+  uint32_t getPeriod();
+  uint8_t getKeyframeInterval();
+  void tick();
+  uint32_t getSent();
+  uint32_t getKeyframes();
+  uint32_t getDropped();
+  size_t compose(uint8_t* frame);
+
+private:
+  Controller* controller;
+  Print* out;
+  uint32_t period;     //ms between frames, 0 when off
+  uint32_t nextFrame;
+  uint16_t sequence;
+  uint8_t keyframeInterval;  //1 sends full frames only
+  uint8_t sinceKeyframe;     //frames sent since the last keyframe
+  uint32_t sent;
+  uint32_t keyframes;
+  uint32_t dropped;    //frames that did not fit the TX ring
+  uint8_t frame[TELEMETRY_MAX_SIZE];
+  uint8_t reference[TELEMETRY_MAX_SIZE];  //the last frame sent, whole
+  bool referenced;                         //reference holds a frame
+  uint8_t delta[TELEMETRY_MAX_SIZE];
+  uint8_t encoded[TELEMETRY_MAX_ENCODED_SIZE];
+
+  void send();
+  static uint16_t saturate(float v);
+};
+
+#endif /* TELEMETRY_HPP_ */
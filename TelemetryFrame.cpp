@@ -0,0 +1,251 @@
+#include "TelemetryFrame.hpp"
+#include <string.h>
+
+/////////////////////////////////////////////////
+/// \brief returns the CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xffff) of data.
+///
+/// A CRC is taken over several pieces by passing the CRC of the previous ones as crc.
+/////////////////////////////////////////////////
+uint16_t TelemetryFrame::crc16(const uint8_t* data, size_t length, uint16_t crc) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+/////////////////////////////////////////////////
+/// \brief COBS encodes frame between two zero bytes into out, TELEMETRY_MAX_ENCODED_SIZE bytes at most.
+///
+/// @return the length of out.
+/////////////////////////////////////////////////
+size_t TelemetryFrame::encode(const uint8_t* frame, size_t length, uint8_t* out) {
+  size_t n = 1;
+  size_t code = n++;  //where the length of the current block goes
+
+  out[0] = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (frame[i] != 0) out[n++] = frame[i];
+    if (frame[i] == 0 || n - code == 0xff) {
+      out[code] = n - code;
+      code = n++;
+    }
+  }
+  out[code] = n - code;
+  out[n++] = 0;
+  return n;
+}
+
+/////////////////////////////////////////////////
+/// \brief COBS decodes the bytes between two zero bytes into frame, size bytes at most.
+///
+/// @return the length of the frame, 0 if in is not COBS or does not fit.
+/////////////////////////////////////////////////
+size_t TelemetryFrame::decode(const uint8_t* in, size_t length, uint8_t* frame, size_t size) {
+  size_t n = 0;
+  size_t i = 0;
+
+  while (i < length) {
+    uint8_t code = in[i++];
+    if (code == 0 || i + code - 1 > length || n + code - 1 > size) return 0;
+    memcpy(frame + n, in + i, code - 1);
+    n += code - 1;
+    i += code - 1;
+    if (code != 0xff && i < length) {
+      if (n == size) return 0;
+      frame[n++] = 0;
+    }
+  }
+  return n;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the decoded frame is a frame of this version, whole and with a good CRC.
+/////////////////////////////////////////////////
+bool TelemetryFrame::check(const uint8_t* frame, size_t length) {
+  if (length < TELEMETRY_HEADER_SIZE + TELEMETRY_CRC_SIZE) return false;
+  if (frame[TLM_VERSION] != TELEMETRY_VERSION || frame[TLM_MODULES] > TELEMETRY_MAX_MODULES) return false;
+  if (length != TELEMETRY_HEADER_SIZE + (size_t)frame[TLM_MODULES] * TELEMETRY_MODULE_SIZE + TELEMETRY_CRC_SIZE) return false;
+  return crc16(frame, length - TELEMETRY_CRC_SIZE) == get16(frame + length - TELEMETRY_CRC_SIZE);
+}
+
+//the fields a delta frame holds the differences of, offset and size, in the order of their mask bits
+static const uint8_t headerFields[][2] = {
+  { TLM_ACTIVE, 4 }, { TLM_STICKY, 4 }, { TLM_BAT12V, 2 }, { TLM_LOOP_MEAN, 2 }, { TLM_LOOP_MAX, 2 },
+  { TLM_CONTROLLER_MAX, 2 }, { TLM_STATE, 1 }, { TLM_OUTPUTS, 1 }, { TLM_PUMP, 1 }
+};
+static const uint8_t moduleFields[][2] = {
+  { TLM_MODULE_FAULTS, 1 }, { TLM_MODULE_ALERTS, 1 }, { TLM_MODULE_CELLS, 2 }, { TLM_MODULE_CELLS + 2, 2 },
+  { TLM_MODULE_CELLS + 4, 2 }, { TLM_MODULE_CELLS + 6, 2 }, { TLM_MODULE_CELLS + 8, 2 }, { TLM_MODULE_CELLS + 10, 2 },
+  { TLM_MODULE_TEMPS, 2 }, { TLM_MODULE_TEMPS + 2, 2 }
+};
+#define HEADER_FIELDS (sizeof(headerFields) / sizeof(headerFields[0]))
+#define MODULE_FIELDS (sizeof(moduleFields) / sizeof(moduleFields[0]))
+
+static uint32_t getField(const uint8_t* p, uint8_t size) {
+  uint32_t v = 0;
+  for (uint8_t i = size; i > 0; i--) v = v << 8 | p[i - 1];
+  return v;
+}
+
+static void putField(uint8_t* p, uint8_t size, uint32_t v) {
+  for (uint8_t i = 0; i < size; i++, v >>= 8) p[i] = v;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the difference of two values of a field of size bytes, sign extended from the field.
+/////////////////////////////////////////////////
+static int32_t difference(uint32_t from, uint32_t to, uint8_t size) {
+  uint8_t shift = 32 - 8 * size;
+  return (int32_t)((to - from) << shift) >> shift;
+}
+
+static bool putVarint(uint8_t* out, size_t* n, size_t size, uint32_t v) {
+  do {
+    if (*n == size) return false;
+    out[(*n)++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+    v >>= 7;
+  } while (v);
+  return true;
+}
+
+static bool putZigzag(uint8_t* out, size_t* n, size_t size, int32_t v) {
+  return putVarint(out, n, size, (uint32_t)v << 1 ^ (uint32_t)(v >> 31));
+}
+
+static bool getVarint(const uint8_t* in, size_t* i, size_t length, uint32_t* v) {
+  *v = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (*i == length) return false;
+    uint8_t b = in[(*i)++];
+    *v |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+static bool getZigzag(const uint8_t* in, size_t* i, size_t length, int32_t* v) {
+  uint32_t u;
+  if (!getVarint(in, i, length, &u)) return false;
+  *v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the decoded frame is a delta frame of this version with a good CRC.
+/////////////////////////////////////////////////
+bool TelemetryFrame::checkDelta(const uint8_t* delta, size_t length) {
+  if (length < TELEMETRY_DELTA_MIN_SIZE || delta[0] != (TELEMETRY_DELTA | TELEMETRY_VERSION)) return false;
+  return crc16(delta, length - TELEMETRY_CRC_SIZE) == get16(delta + length - TELEMETRY_CRC_SIZE);
+}
+
+/////////////////////////////////////////////////
+/// \brief writes into delta the delta frame of frame against reference, both full frames.
+///
+/// @return the length of the delta frame, 0 if frame has to be sent whole: the modules are not those of
+/// the reference, the reference is too far back or the delta frame does not fit in size.
+/////////////////////////////////////////////////
+size_t TelemetryFrame::makeDelta(const uint8_t* reference, const uint8_t* frame, uint8_t* delta, size_t size) {
+  uint16_t back = get16(frame + TLM_SEQUENCE) - get16(reference + TLM_SEQUENCE);
+  uint8_t modules = frame[TLM_MODULES];
+  uint32_t mask = 0;
+  uint8_t changed = 0;
+  size_t n = 4;
+
+  if (back == 0 || back > TELEMETRY_MAX_BACK || modules != reference[TLM_MODULES] || size < n) return 0;
+  for (uint8_t m = 0; m < modules; m++) {
+    size_t offset = TELEMETRY_HEADER_SIZE + m * TELEMETRY_MODULE_SIZE;
+    if (frame[offset + TLM_MODULE_ADDRESS] != reference[offset + TLM_MODULE_ADDRESS]) return 0;
+    if (memcmp(frame + offset, reference + offset, TELEMETRY_MODULE_SIZE) != 0) changed++;
+  }
+  delta[0] = TELEMETRY_DELTA | TELEMETRY_VERSION;
+  put16(delta + 1, get16(frame + TLM_SEQUENCE));
+  delta[3] = back;
+  if (!putVarint(delta, &n, size, get32(frame + TLM_MILLIS) - get32(reference + TLM_MILLIS))) return 0;
+
+  for (uint8_t f = 0; f < HEADER_FIELDS; f++) {
+    if (memcmp(frame + headerFields[f][0], reference + headerFields[f][0], headerFields[f][1]) != 0) mask |= 1 << f;
+  }
+  if (!putVarint(delta, &n, size, mask)) return 0;
+  for (uint8_t f = 0; f < HEADER_FIELDS; f++) {
+    if (!(mask & 1 << f)) continue;
+    const uint8_t* field = headerFields[f];
+    int32_t d = difference(getField(reference + field[0], field[1]), getField(frame + field[0], field[1]), field[1]);
+    if (!putZigzag(delta, &n, size, d)) return 0;
+  }
+
+  if (!putVarint(delta, &n, size, changed)) return 0;
+  int previous = -1;
+  for (uint8_t m = 0; m < modules && changed; m++) {
+    const uint8_t* from = reference + TELEMETRY_HEADER_SIZE + m * TELEMETRY_MODULE_SIZE;
+    const uint8_t* to = frame + TELEMETRY_HEADER_SIZE + m * TELEMETRY_MODULE_SIZE;
+    mask = 0;
+    for (uint8_t f = 0; f < MODULE_FIELDS; f++) {
+      if (memcmp(to + moduleFields[f][0], from + moduleFields[f][0], moduleFields[f][1]) != 0) mask |= 1 << f;
+    }
+    if (mask == 0) continue;
+    if (!putVarint(delta, &n, size, m - previous - 1) || !putVarint(delta, &n, size, mask)) return 0;
+    previous = m;
+    changed--;
+    for (uint8_t f = 0; f < MODULE_FIELDS; f++) {
+      if (!(mask & 1 << f)) continue;
+      const uint8_t* field = moduleFields[f];
+      if (!putZigzag(delta, &n, size, difference(getField(from + field[0], field[1]), getField(to + field[0], field[1]), field[1]))) return 0;
+    }
+  }
+
+  if (n + TELEMETRY_CRC_SIZE > size) return 0;
+  put16(delta + n, crc16(delta, n));
+  return n + TELEMETRY_CRC_SIZE;
+}
+
+/////////////////////////////////////////////////
+/// \brief writes into frame the full frame a checked delta frame makes of reference, a full frame.
+///
+/// @return the length of frame, 0 if reference is not the frame the delta frame refers to or the delta
+/// frame is not consistent.
+/////////////////////////////////////////////////
+size_t TelemetryFrame::applyDelta(const uint8_t* reference, size_t referenceLength, const uint8_t* delta, size_t length, uint8_t* frame) {
+  size_t end = length - TELEMETRY_CRC_SIZE;
+  size_t i = 4;
+  uint32_t v;
+  uint32_t mask;
+  int32_t d;
+
+  if ((uint16_t)(get16(delta + 1) - delta[3]) != get16(reference + TLM_SEQUENCE)) return 0;
+  memcpy(frame, reference, referenceLength - TELEMETRY_CRC_SIZE);
+  put16(frame + TLM_SEQUENCE, get16(delta + 1));
+  if (!getVarint(delta, &i, end, &v)) return 0;
+  put32(frame + TLM_MILLIS, get32(reference + TLM_MILLIS) + v);
+
+  if (!getVarint(delta, &i, end, &mask)) return 0;
+  for (uint8_t f = 0; f < HEADER_FIELDS; f++) {
+    if (!(mask & 1 << f)) continue;
+    const uint8_t* field = headerFields[f];
+    if (!getZigzag(delta, &i, end, &d)) return 0;
+    putField(frame + field[0], field[1], getField(frame + field[0], field[1]) + d);
+  }
+
+  uint32_t changed;
+  uint32_t m = 0;
+  if (!getVarint(delta, &i, end, &changed)) return 0;
+  for (uint32_t c = 0; c < changed; c++, m++) {
+    if (!getVarint(delta, &i, end, &v) || !getVarint(delta, &i, end, &mask)) return 0;
+    m += v;
+    if (m >= frame[TLM_MODULES]) return 0;
+    uint8_t* module = frame + TELEMETRY_HEADER_SIZE + m * TELEMETRY_MODULE_SIZE;
+    for (uint8_t f = 0; f < MODULE_FIELDS; f++) {
+      if (!(mask & 1 << f)) continue;
+      const uint8_t* field = moduleFields[f];
+      if (!getZigzag(delta, &i, end, &d)) return 0;
+      putField(module + field[0], field[1], getField(module + field[0], field[1]) + d);
+    }
+  }
+  if (i != end) return 0;
+
+  end = referenceLength - TELEMETRY_CRC_SIZE;
+  put16(frame + end, crc16(frame, end));
+  return referenceLength;
+}
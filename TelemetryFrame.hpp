@@ -0,0 +1,114 @@
+/**@file TelemetryFrame.hpp */
+#ifndef TELEMETRYFRAME_HPP_
+#define TELEMETRYFRAME_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAX_MODULES 62  //MAX_MODULE_ADDR, the layout does not depend on Config.hpp
+#define TELEMETRY_HEADER_SIZE 28
+#define TELEMETRY_MODULE_SIZE 19
+#define TELEMETRY_CRC_SIZE 2
+#define TELEMETRY_MAX_SIZE (TELEMETRY_HEADER_SIZE + TELEMETRY_MAX_MODULES * TELEMETRY_MODULE_SIZE + TELEMETRY_CRC_SIZE)
+#define TELEMETRY_MAX_ENCODED_SIZE (TELEMETRY_MAX_SIZE + TELEMETRY_MAX_SIZE / 254 + 3)  //COBS overhead and both delimiters
+#define TELEMETRY_CELL_V_PER_COUNT 0.000381493f  //the scale BMSModule reads the cells with
+#define TELEMETRY_NO_TEMPERATURE -32768
+#define TELEMETRY_DELTA 0x80         //set in the first byte of a delta frame, with TELEMETRY_VERSION
+#define TELEMETRY_DELTA_MIN_SIZE 9   //a delta frame where nothing but the time changed
+#define TELEMETRY_MAX_BACK 255       //furthest a delta frame refers back, in sequence numbers
+
+/////////////////////////////////////////////////
+/// \brief Offsets of the fields of a telemetry frame, version TELEMETRY_VERSION. Fields are little endian.
+///
+/// The header is followed by the modules, TELEMETRY_MODULE_SIZE bytes each, and the CRC.
+/////////////////////////////////////////////////
+enum TelemetryField {
+  TLM_VERSION = 0,    ///< u8 TELEMETRY_VERSION
+  TLM_MODULES = 1,    ///< u8 number of modules in the frame
+  TLM_SEQUENCE = 2,   ///< u16 counts the frames composed, a gap is a frame dropped
+  TLM_MILLIS = 4,     ///< u32 millis() of the tick
+  TLM_ACTIVE = 8,     ///< u32 active faults, a bit per FaultRegistry::FaultId
+  TLM_STICKY = 12,    ///< u32 sticky faults
+  TLM_BAT12V = 16,    ///< u16 12V battery, mV
+  TLM_LOOP_MEAN = 18, ///< u16 mean time of a pass of the main loop, us, saturated
+  TLM_LOOP_MAX = 20,  ///< u16 longest pass of the main loop, us, saturated
+  TLM_CONTROLLER_MAX = 22,  ///< u16 longest doController(), us, saturated
+  TLM_STATE = 24,     ///< u8 Controller::ControllerState
+  TLM_OUTPUTS = 25,   ///< u8 TelemetryOutput bits
+  TLM_PUMP = 26,      ///< u8 coolant pump PWM duty
+  TLM_RESERVED = 27,  ///< u8 0
+  //fields of a module, from the start of the module
+  TLM_MODULE_ADDRESS = 0,  ///< u8
+  TLM_MODULE_FAULTS = 1,   ///< u8 fault register
+  TLM_MODULE_ALERTS = 2,   ///< u8 alert register
+  TLM_MODULE_CELLS = 3,    ///< 6 x u16 raw ADC counts of the cells, TELEMETRY_CELL_V_PER_COUNT V each
+  TLM_MODULE_TEMPS = 15,   ///< 2 x i16 temperatures, 0.01C, TELEMETRY_NO_TEMPERATURE without a reading
+};
+
+/////////////////////////////////////////////////
+/// \brief Bits of TLM_OUTPUTS.
+/////////////////////////////////////////////////
+enum TelemetryOutput {
+  TLM_OUT_EVCC_ON = 0x01,
+  TLM_OUT_FAULT = 0x02,
+  TLM_OUT_12V_CHARGE = 0x04,
+  TLM_OUT_CHARGER_INHIBIT = 0x08,
+  TLM_OUT_POWER_LIMITER = 0x10,
+};
+
+/////////////////////////////////////////////////
+/// \brief Framing of the binary telemetry, shared by the firmware and the host decoder.
+///
+/// A frame is the fields of TelemetryField followed by the CRC-16/CCITT-FALSE of the fields, COBS encoded
+/// so it holds no zero byte, between two zero bytes. The console text never holds a zero byte either:
+/// a decoder splits the stream at the zeros, a part that decodes to a frame with a good CRC is a frame,
+/// anything else is text (or a frame cut by the host) and is passed on or dropped.
+///
+/// Between two full frames (keyframes) the fields can be sent as a delta frame against a reference, an
+/// earlier frame of the same modules. A delta frame holds the differences of the fields that changed as
+/// zig-zag LEB128 varints, most are a byte:
+///   u8      TELEMETRY_DELTA | TELEMETRY_VERSION
+///   u16     sequence
+///   u8      sequence - sequence of the reference, 1 to TELEMETRY_MAX_BACK
+///   varint  millis - millis of the reference
+///   varint  mask of the header fields that changed, bit n for the field n of TLM_ACTIVE, TLM_STICKY,
+///           TLM_BAT12V, TLM_LOOP_MEAN, TLM_LOOP_MAX, TLM_CONTROLLER_MAX, TLM_STATE, TLM_OUTPUTS, TLM_PUMP,
+///           then the difference of every one of them
+///   varint  number of modules that changed, then for each of them
+///     varint  its index, less the index of the previous one and 1
+///     varint  mask of its fields that changed, bit n for the field n of TLM_MODULE_FAULTS,
+///             TLM_MODULE_ALERTS, the 6 cells and the 2 temperatures, then the difference of every one
+///   u16     CRC
+/// A difference is taken modulo the size of its field and sign extended from it. The number of modules
+/// and their addresses are those of the reference, a pack that changed is sent in a keyframe. Without its
+/// CRC, the delta frame of a steady pack is 7 or 8 bytes and fits the payload of a CAN frame.
+/////////////////////////////////////////////////
+class TelemetryFrame {
+public:
+  static uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc = 0xffff);
+  static size_t encode(const uint8_t* frame, size_t length, uint8_t* out);
+  static size_t decode(const uint8_t* in, size_t length, uint8_t* frame, size_t size);
+  static bool check(const uint8_t* frame, size_t length);
+  static bool checkDelta(const uint8_t* delta, size_t length);
+  static size_t makeDelta(const uint8_t* reference, const uint8_t* frame, uint8_t* delta, size_t size);
+  static size_t applyDelta(const uint8_t* reference, size_t referenceLength, const uint8_t* delta, size_t length, uint8_t* frame);
+  static inline uint16_t get16(const uint8_t* p) {
+    return p[0] | (uint16_t)p[1] << 8;
+  }
+  static inline uint32_t get32(const uint8_t* p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+  }
+  static inline void put16(uint8_t* p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+  }
+  static inline void put32(uint8_t* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+  }
+};
+
+#endif /* TELEMETRYFRAME_HPP_ */
@@ -0,0 +1,181 @@
+#include "TimerWheel.hpp"
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the wheel starts empty at the given time.
+///
+/// @param now The current time in milliseconds, usually millis().
+/////////////////////////////////////////////////
+TimerWheel::TimerWheel(uint32_t now)
+  : current(now) {
+  memset(slots, 0, sizeof(slots));
+  memset(occupied, 0, sizeof(occupied));
+}
+
+/////////////////////////////////////////////////
+/// \brief arms a timer to expire timeoutMs after the current wheel time. Re-arming an armed timer moves it.
+/////////////////////////////////////////////////
+void TimerWheel::arm(Timer* timer, uint32_t timeoutMs) {
+  armAt(timer, current + timeoutMs);
+}
+
+/////////////////////////////////////////////////
+/// \brief arms a timer to expire at an absolute time. A deadline in the past expires on the next advance.
+/////////////////////////////////////////////////
+void TimerWheel::armAt(Timer* timer, uint32_t deadline) {
+  if (timer->armed) unlink(timer);
+  timer->deadline = deadline;
+  timer->armed = true;
+  timer->expired = false;
+  place(timer, current + 1);
+}
+
+/////////////////////////////////////////////////
+/// \brief disarms a timer and clears its expired flag.
+/////////////////////////////////////////////////
+void TimerWheel::cancel(Timer* timer) {
+  if (timer->armed) unlink(timer);
+  timer->armed = false;
+  timer->expired = false;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the time up to which all timers have been expired.
+/////////////////////////////////////////////////
+uint32_t TimerWheel::getTime() {
+  return current;
+}
+
+/////////////////////////////////////////////////
+/// \brief links a timer in the slot matching its deadline.
+///
+/// @param earliest A due timer is placed at this time, current + 1 when arming as the current slot was already
+/// expired, current when cascading into the slot about to be expired.
+/////////////////////////////////////////////////
+void TimerWheel::place(Timer* timer, uint32_t earliest) {
+  const uint32_t range = 1ul << (SLOT_BITS * LEVELS);
+  uint32_t expiry = timer->deadline;
+  uint32_t delta;
+  uint32_t level;
+
+  if ((int32_t)(expiry - earliest) < 0) expiry = earliest;
+  delta = expiry - current;
+  if (delta >= range) {
+    //too far ahead, park in the last reachable slot and re-cascade from there
+    delta = range - 1;
+    expiry = current + delta;
+  }
+  for (level = 0; level < LEVELS - 1; level++) {
+    if (delta < (1ul << (SLOT_BITS * (level + 1)))) break;
+  }
+
+  timer->level = level;
+  timer->slot = (expiry >> (SLOT_BITS * level)) & (SLOTS - 1);
+  timer->prev = 0;
+  timer->next = slots[level][timer->slot];
+  if (timer->next) timer->next->prev = timer;
+  slots[level][timer->slot] = timer;
+  occupied[level] |= 1ull << timer->slot;
+}
+
+void TimerWheel::unlink(Timer* timer) {
+  if (timer->prev) {
+    timer->prev->next = timer->next;
+  } else {
+    slots[timer->level][timer->slot] = timer->next;
+    if (!timer->next) occupied[timer->level] &= ~(1ull << timer->slot);
+  }
+  if (timer->next) timer->next->prev = timer->prev;
+  timer->next = 0;
+  timer->prev = 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief moves the timers of the current slot of a level down to the lower levels.
+/////////////////////////////////////////////////
+void TimerWheel::cascade(uint32_t level) {
+  uint32_t index = (current >> (SLOT_BITS * level)) & (SLOTS - 1);
+  Timer* timer;
+  while ((timer = slots[level][index]) != 0) {
+    unlink(timer);
+    place(timer, current);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief expires the timers of a level 0 slot. Callbacks are free to arm or cancel any timer.
+/////////////////////////////////////////////////
+void TimerWheel::expireSlot(uint32_t slot) {
+  Timer* timer;
+  while ((timer = slots[0][slot]) != 0) {
+    unlink(timer);
+    if ((int32_t)(timer->deadline - current) > 0) {
+      place(timer, current + 1);  //parked timeout longer than the wheel range
+      continue;
+    }
+    timer->armed = false;
+    timer->expired = true;
+    if (timer->callback) timer->callback(timer->context);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief expires every timer with a deadline up to now.
+///
+/// Empty level 0 slots are skipped, so the cost depends on the number of timers and 64ms boundaries
+/// crossed rather than on the elapsed milliseconds.
+/////////////////////////////////////////////////
+void TimerWheel::advance(uint32_t now) {
+  uint32_t pos, step;
+  uint64_t ahead;
+
+  while ((int32_t)(now - current) > 0) {
+    if (!(occupied[0] | occupied[1] | occupied[2] | occupied[3])) {
+      current = now;
+      return;
+    }
+    //next event: an occupied level 0 slot later in this rotation or the wrap where the upper levels cascade
+    pos = current & (SLOTS - 1);
+    ahead = (pos == SLOTS - 1) ? 0 : occupied[0] & (~0ull << (pos + 1));
+    step = ahead ? (uint32_t)__builtin_ctzll(ahead) - pos : SLOTS - pos;
+    if (now - current < step) {
+      current = now;
+      return;
+    }
+    current += step;
+    if ((current & (SLOTS - 1)) == 0) {
+      for (uint32_t level = 1; level < LEVELS; level++) {
+        cascade(level);
+        if (((current >> (SLOT_BITS * level)) & (SLOTS - 1)) != 0) break;
+      }
+    }
+    expireSlot(current & (SLOTS - 1));
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the earliest time at which a timer may expire.
+///
+/// Exact for timers due within 64ms, otherwise the start of the slot holding the next timers which
+/// is never later than their deadline. Returns false if no timer is armed.
+/////////////////////////////////////////////////
+bool TimerWheel::nextExpiry(uint32_t* at) {
+  uint32_t shift, rot, pos, candidate;
+  uint64_t ahead;
+  bool found = false;
+
+  //a timer cascaded from an upper level can be due before the ones already sitting in a lower level
+  for (uint32_t level = 0; level < LEVELS; level++) {
+    if (!occupied[level]) continue;
+    shift = SLOT_BITS * level;
+    pos = (current >> shift) & (SLOTS - 1);
+    rot = (pos + 1) & (SLOTS - 1);
+    //rotate so that bit 0 is the slot following the current one
+    ahead = rot ? (occupied[level] >> rot) | (occupied[level] << (SLOTS - rot)) : occupied[level];
+    candidate = ((current >> shift) << shift) + (((uint32_t)__builtin_ctzll(ahead) + 1) << shift);
+    if (!found || (int32_t)(candidate - *at) < 0) {
+      *at = candidate;
+      found = true;
+    }
+  }
+  return found;
+}
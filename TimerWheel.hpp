@@ -0,0 +1,99 @@
+#ifndef TIMERWHEEL_HPP_
+#define TIMERWHEEL_HPP_
+
+#include <Arduino.h>
+
+/////////////////////////////////////////////////
+/// \brief A timer that can be armed on a TimerWheel.
+///
+/// The timer is an intrusive list node so arming never allocates. Once it expires, the optional callback is
+/// called and isExpired() returns true until the timer is armed again or cancelled.
+/////////////////////////////////////////////////
+class Timer {
+public:
+  typedef void (*Callback)(void* context);
+
+  Timer()
+    : next(0),
+      prev(0),
+      deadline(0),
+      callback(0),
+      context(0),
+      level(0),
+      slot(0),
+      armed(false),
+      expired(false) {
+    ;
+  }
+
+  Timer(Callback callback, void* context)
+    : next(0),
+      prev(0),
+      deadline(0),
+      callback(callback),
+      context(context),
+      level(0),
+      slot(0),
+      armed(false),
+      expired(false) {
+    ;
+  }
+
+  bool isArmed() {
+    return armed;
+  }
+
+  bool isExpired() {
+    return expired;
+  }
+
+  uint32_t getDeadline() {
+    return deadline;
+  }
+
+private:
+  friend class TimerWheel;
+  Timer* next;
+  Timer* prev;
+  uint32_t deadline;
+  Callback callback;
+  void* context;
+  uint8_t level;
+  uint8_t slot;
+  bool armed;
+  bool expired;
+};
+
+/////////////////////////////////////////////////
+/// \brief Hierarchical timer wheel with millisecond deadlines.
+///
+/// 4 levels of 64 slots cover deadlines up to 2^24 ms (4.6 hours) ahead, longer timeouts are re-cascaded.
+/// Arm, cancel and expire are O(1). Advancing skips empty slots using a per level occupancy bitmap.
+/// All comparisons are done on differences so the millis() wrap around is handled.
+/////////////////////////////////////////////////
+class TimerWheel {
+public:
+  static const uint32_t LEVELS = 4;
+  static const uint32_t SLOT_BITS = 6;
+  static const uint32_t SLOTS = 1 << SLOT_BITS;
+
+  TimerWheel(uint32_t now);
+  void arm(Timer* timer, uint32_t timeoutMs);
+  void armAt(Timer* timer, uint32_t deadline);
+  void cancel(Timer* timer);
+  void advance(uint32_t now);
+  bool nextExpiry(uint32_t* at);
+  uint32_t getTime();
+
+private:
+  Timer* slots[LEVELS][SLOTS];
+  uint64_t occupied[LEVELS];
+  uint32_t current;  //wheel time, every deadline up to current has expired
+
+  void place(Timer* timer, uint32_t earliest);
+  void unlink(Timer* timer);
+  void cascade(uint32_t level);
+  void expireSlot(uint32_t slot);
+};
+
+#endif /* TIMERWHEEL_HPP_ */
@@ -0,0 +1,220 @@
+#include "TraceRecorder.hpp"
+#include "Controller.hpp"
+#include <EEPROM.h>
+#include <TimeLib.h>
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the trace is written to out once begin() is called.
+/////////////////////////////////////////////////
+TraceRecorder::TraceRecorder(Print* out)
+  : out(out),
+    controller(0),
+    capturing(false),
+    lastTick(0),
+    lastRtc(0),
+    lastState(0),
+    digitalKnown(0),
+    digitalLevels(0),
+    used(0),
+    runStart(0),
+    runTag(0) {
+  memset(analogPins, 0xff, sizeof(analogPins));
+  memset(analogValues, 0, sizeof(analogValues));
+}
+
+/////////////////////////////////////////////////
+/// \brief writes the header and starts recording, before the first tick of the controller.
+///
+/// The settings are saved first so the image in the header is what the controller runs with, unless the
+/// EEPROM holds them already: a capture starting at every boot does not wear it out.
+/////////////////////////////////////////////////
+void TraceRecorder::begin(Controller* controller) {
+  Settings* settings = controller->getSettingsPtr();
+  uint16_t size = settings->size();
+
+  this->controller = controller;
+  capturing = true;
+  lastTick = millis();
+  lastRtc = (uint32_t)now() - lastTick / 1000;
+  lastState = controller->getState();
+
+  for (uint8_t i = 0; i < 4; i++) put(TRACE_MAGIC[i]);
+  put(TRACE_VERSION);
+  putVarint(controller->getTimerWheelPtr()->getTime());
+  putVarint(lastTick);
+  putVarint(lastRtc);
+  put(lastState);
+
+  if (!settings->matchEEPROM(0)) settings->saveAllSettingsToEEPROM(0);
+  putVarint(size);
+  for (uint16_t i = 0; i < size; i++) {
+    uint8_t b;
+    EEPROM.get(i, b);
+    reserve(1);
+    put(b);
+  }
+  flush();
+  controller->getLoggerPtr()->info("Trace capture started, %u bytes of settings\n", size);
+}
+
+bool TraceRecorder::isCapturing() {
+  return capturing;
+}
+
+/////////////////////////////////////////////////
+/// \brief starts a pass of the main loop running the controller, writes the records of the previous one.
+///
+/// The console input of the passes in between, those of the OLED and the wakes for the console alone,
+/// goes with the records of the previous tick.
+/////////////////////////////////////////////////
+void TraceRecorder::tick() {
+  if (!capturing) return;
+  uint32_t t = millis();
+  uint32_t rtc = (uint32_t)now() - t / 1000;
+  uint8_t state = controller->getState();
+
+  flush();
+  put(TRACE_TICK);
+  putVarint(t - lastTick);
+  lastTick = t;
+  if (rtc != lastRtc) {
+    put(TRACE_RTC);
+    putVarint(rtc);
+    lastRtc = rtc;
+  }
+  if (state != lastState) {
+    put(TRACE_STATE);
+    put(state);
+    lastState = state;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief writes the records of the last tick and stops recording.
+/////////////////////////////////////////////////
+void TraceRecorder::end() {
+  if (!capturing) return;
+  flush();
+  capturing = false;
+}
+
+/////////////////////////////////////////////////
+/// \brief records the level of a digital input read by the controller.
+/////////////////////////////////////////////////
+void TraceRecorder::digital(uint8_t pin, int level) {
+  if (!capturing || pin >= 64) return;
+  uint64_t bit = (uint64_t)1 << pin;
+  uint64_t value = level ? bit : 0;
+  if ((digitalKnown & bit) && (digitalLevels & bit) == value) return;
+  digitalKnown |= bit;
+  digitalLevels = (digitalLevels & ~bit) | value;
+  reserve(3);
+  put(TRACE_DIGITAL);
+  put(pin);
+  put(level ? 1 : 0);
+}
+
+/////////////////////////////////////////////////
+/// \brief records the value of an analog input read by the controller.
+/////////////////////////////////////////////////
+void TraceRecorder::analog(uint8_t pin, int value) {
+  if (!capturing) return;
+  uint8_t i = 0;
+  while (i < TRACE_ANALOG_PINS && analogPins[i] != pin && analogPins[i] != 0xff) i++;
+  if (i == TRACE_ANALOG_PINS) return;
+  if (analogPins[i] == pin && analogValues[i] == value) return;
+  analogPins[i] = pin;
+  analogValues[i] = value;
+  reserve(7);
+  put(TRACE_ANALOG);
+  put(pin);
+  putVarint((uint32_t)value);
+}
+
+/////////////////////////////////////////////////
+/// \brief records a byte read from the console.
+/////////////////////////////////////////////////
+void TraceRecorder::console(uint8_t b) {
+  if (capturing) runByte(TRACE_CONSOLE, b);
+}
+
+/////////////////////////////////////////////////
+/// \brief records bytes written to the modules with the time they were sent at.
+///
+/// A write too long for the buffer is written out right after its header, the record stays whole.
+/////////////////////////////////////////////////
+void TraceRecorder::tx(const uint8_t* buf, size_t len) {
+  if (!capturing) return;
+  bool fits = len <= TRACE_BUFFER_SIZE - TRACE_TX_HEAD;
+  reserve(fits ? len + TRACE_TX_HEAD : TRACE_BUFFER_SIZE);
+  put(TRACE_TX);
+  putVarint(millis() - lastTick);
+  putVarint(len);
+  if (!fits) {
+    flush();
+    out->write(buf, len);
+    return;
+  }
+  for (size_t i = 0; i < len; i++) put(buf[i]);
+}
+
+/////////////////////////////////////////////////
+/// \brief records a byte read from the modules.
+/////////////////////////////////////////////////
+void TraceRecorder::rx(uint8_t b) {
+  if (capturing) runByte(TRACE_RX, b);
+}
+
+/////////////////////////////////////////////////
+/// \brief records that no byte from the modules was waiting.
+/////////////////////////////////////////////////
+void TraceRecorder::rxEmpty() {
+  if (!capturing) return;
+  reserve(1);
+  put(TRACE_RX_EMPTY);
+}
+
+/////////////////////////////////////////////////
+/// \brief makes room for n bytes of records, writing the buffer out if needed.
+/////////////////////////////////////////////////
+void TraceRecorder::reserve(uint16_t n) {
+  closeRun();
+  if (used + n > TRACE_BUFFER_SIZE) flush();
+}
+
+void TraceRecorder::put(uint8_t b) {
+  buffer[used++] = b;
+}
+
+void TraceRecorder::putVarint(uint32_t v) {
+  while (v >= 0x80) {
+    put((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  put(v);
+}
+
+/////////////////////////////////////////////////
+/// \brief appends a byte to the open run of tag, or opens a new run.
+/////////////////////////////////////////////////
+void TraceRecorder::runByte(uint8_t tag, uint8_t b) {
+  if (runStart == 0 || runTag != tag || buffer[runStart] == TRACE_MAX_RUN || used == TRACE_BUFFER_SIZE) {
+    reserve(3);
+    put(tag);
+    runStart = used;
+    runTag = tag;
+    put(0);
+  }
+  buffer[runStart]++;
+  put(b);
+}
+
+void TraceRecorder::closeRun() {
+  runStart = 0;
+}
+
+void TraceRecorder::flush() {
+  closeRun();
+  if (used) out->write(buffer, used);
+  used = 0;
+}
@@ -0,0 +1,122 @@
+/**@file TraceRecorder.hpp */
+#ifndef TRACERECORDER_HPP_
+#define TRACERECORDER_HPP_
+
+#include <Arduino.h>
+
+class Controller;
+
+#define TRACE_MAGIC "BMST"
+#define TRACE_VERSION 2
+#define TRACE_BUFFER_SIZE 256
+#define TRACE_MAX_RUN 127  //the length of a run is a single byte varint
+#define TRACE_ANALOG_PINS 4
+#define TRACE_TX_HEAD 11   //longest TRACE_TX record header: the tag and two varints
+
+/////////////////////////////////////////////////
+/// \brief Tags of the records of a trace, each followed by its fields. Numbers are unsigned LEB128 varints.
+/////////////////////////////////////////////////
+enum TraceTag {
+  TRACE_TICK = 1,  ///< [ms since the previous tick] a pass of the main loop running the controller starts
+  TRACE_STATE,     ///< [state] the controller state at the start of the pass, when it changed
+  TRACE_RTC,       ///< [now() - millis() / 1000] when it changed
+  TRACE_DIGITAL,   ///< [pin][level] an input read by the controller, when it changed
+  TRACE_ANALOG,    ///< [pin][value] an analog input read by the controller, when it changed
+  TRACE_CONSOLE,   ///< [n][n bytes] read from the console
+  TRACE_TX,        ///< [ms since the tick][n][n bytes] written to the modules
+  TRACE_RX,        ///< [n][n bytes] read from the modules
+  TRACE_RX_EMPTY,  ///< available() of the module port returned 0
+};
+
+/////////////////////////////////////////////////
+/// \brief Records everything the controller reads from the outside world into a compact binary trace.
+///
+/// The trace starts with a header: TRACE_MAGIC, TRACE_VERSION, the millis() the controller was built at,
+/// the millis() and the RTC time capture started at and the settings in their EEPROM layout. Records
+/// (see TraceTag) follow in the order the controller made the calls, so a replay making the same calls
+/// consumes them in the same order and the first call that does not match is where it diverged.
+///
+/// Inputs are only recorded when they change and consecutive bytes read from a port are packed in
+/// runs, so a standby tick costs a few bytes and an active one about the traffic of the module chain.
+/// The records are buffered and written to out when the buffer is full or at the next tick.
+/////////////////////////////////////////////////
+class TraceRecorder {
+public:
+  TraceRecorder(Print* out);
+  void begin(Controller* controller);
+  bool isCapturing();
+  void tick();
+  void end();
+  void digital(uint8_t pin, int level);
+  void analog(uint8_t pin, int value);
+  void console(uint8_t b);
+  void tx(const uint8_t* buf, size_t len);
+  void rx(uint8_t b);
+  void rxEmpty();
+
+private:
+  Print* out;
+  Controller* controller;
+  bool capturing;
+  uint32_t lastTick;
+  uint32_t lastRtc;
+  uint8_t lastState;
+  uint64_t digitalKnown;
+  uint64_t digitalLevels;
+  uint8_t analogPins[TRACE_ANALOG_PINS];
+  int analogValues[TRACE_ANALOG_PINS];
+  uint8_t buffer[TRACE_BUFFER_SIZE];
+  uint16_t used;
+  uint16_t runStart;  //index of the length of the open run, 0 when none is open
+  uint8_t runTag;
+
+  void reserve(uint16_t n);
+  void put(uint8_t b);
+  void putVarint(uint32_t v);
+  void runByte(uint8_t tag, uint8_t b);
+  void closeRun();
+  void flush();
+};
+
+/////////////////////////////////////////////////
+/// \brief A serial port of type Port whose traffic is recorded by a TraceRecorder.
+///
+/// It has the calls the BMSDriver makes on its port, so BMSDriverT<TracePort<BMSPort> > is a driver
+/// recording the module chain without a virtual call on the byte loops.
+/////////////////////////////////////////////////
+template <class Port>
+class TracePort {
+public:
+  TracePort(Port* port, TraceRecorder* trace)
+    : port(port),
+      trace(trace) {
+    ;
+  }
+
+  void begin(uint32_t baud) {
+    port->begin(baud);
+  }
+
+  int available() {
+    int n = port->Port::available();
+    if (n == 0) trace->rxEmpty();
+    return n;
+  }
+
+  int read() {
+    int b = port->Port::read();
+    if (b >= 0) trace->rx(b);
+    return b;
+  }
+
+  size_t write(const uint8_t* buf, size_t len) {
+    trace->tx(buf, len);
+    return port->Port::write(buf, len);
+  }
+
+private:
+  Port* port;
+  TraceRecorder* trace;
+};
+
+#endif /* TRACERECORDER_HPP_ */
@@ -0,0 +1,82 @@
+#include "WatchTable.hpp"
+#include <string.h>
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the timers of the watches go on wheel. There is no watch at first.
+/////////////////////////////////////////////////
+WatchTable::WatchTable(TimerWheel* wheel)
+  : wheel(wheel) {
+  for (uint8_t i = 0; i < CONS_MAX_WATCHES; i++) {
+    watches[i].id = i;
+    watches[i].period = 0;
+    watches[i].line[0] = 0;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief adds a watch running line every periodMs, the first run is due at once.
+///
+/// @return the id of the watch, -1 if there are CONS_MAX_WATCHES already.
+/////////////////////////////////////////////////
+int WatchTable::add(uint32_t periodMs, const char* line) {
+  for (uint8_t i = 0; i < CONS_MAX_WATCHES; i++) {
+    Watch* w = &watches[i];
+    if (w->period) continue;
+    w->period = periodMs;
+    w->runs = 0;
+    w->skipped = 0;
+    strncpy(w->line, line, CONS_WATCH_LINE_MAX);
+    w->line[CONS_WATCH_LINE_MAX] = 0;
+    wheel->armAt(&w->timer, millis());
+    return i;
+  }
+  return -1;
+}
+
+/////////////////////////////////////////////////
+/// \brief removes a watch, returns false if there is no watch of that id.
+/////////////////////////////////////////////////
+bool WatchTable::remove(uint8_t id) {
+  Watch* w = getWatch(id);
+  if (w == 0) return false;
+  wheel->cancel(&w->timer);
+  w->period = 0;
+  return true;
+}
+
+void WatchTable::clear() {
+  for (uint8_t i = 0; i < CONS_MAX_WATCHES; i++) remove(i);
+}
+
+bool WatchTable::isEmpty() {
+  for (uint8_t i = 0; i < CONS_MAX_WATCHES; i++) {
+    if (watches[i].period) return false;
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the watch of that id, 0 if there is none.
+/////////////////////////////////////////////////
+Watch* WatchTable::getWatch(uint8_t id) {
+  return id < CONS_MAX_WATCHES && watches[id].period ? &watches[id] : 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the watch whose run is the most overdue, 0 if no run is due, and arms it for its next run.
+///
+/// The wheel must have been advanced to now.
+/////////////////////////////////////////////////
+Watch* WatchTable::takeDue() {
+  Watch* due = 0;
+  for (uint8_t i = 0; i < CONS_MAX_WATCHES; i++) {
+    Watch* w = &watches[i];
+    if (w->period && w->timer.isExpired() && (due == 0 || (int32_t)(w->timer.getDeadline() - due->timer.getDeadline()) < 0)) due = w;
+  }
+  if (due == 0) return 0;
+  uint32_t missed = (millis() - due->timer.getDeadline()) / due->period;
+  due->skipped += missed;
+  due->runs++;
+  wheel->armAt(&due->timer, due->timer.getDeadline() + (missed + 1) * due->period);
+  return due;
+}
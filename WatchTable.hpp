@@ -0,0 +1,47 @@
+/**@file WatchTable.hpp */
+#ifndef WATCHTABLE_HPP_
+#define WATCHTABLE_HPP_
+
+#include <Arduino.h>
+#include "TimerWheel.hpp"
+
+#define CONS_MAX_WATCHES 4             //command lines the console runs every period at once
+#define CONS_WATCH_MIN_PERIOD_MS 100   //shortest period of a watch
+#define CONS_WATCH_LINE_MAX 64         //longest command line of a watch, the length of a typed line
+
+/////////////////////////////////////////////////
+/// \brief A command line the console runs every period.
+/////////////////////////////////////////////////
+struct Watch {
+  Timer timer;       //expires when the next run is due
+  uint8_t id;
+  uint32_t period;   //0 while the watch is free
+  uint32_t runs;
+  uint32_t skipped;  //periods that passed without a run, the console being busy with another reply
+  char line[CONS_WATCH_LINE_MAX + 1];
+};
+
+/////////////////////////////////////////////////
+/// \brief The watches of the console, scheduled on a timer wheel.
+///
+/// Every watch has a timer on the wheel, armed for its next run, so the console finds the runs due without
+/// going through every watch every pass and the main loop knows when to wake up for the next one. The runs
+/// keep to the period they started with: a run late by less than a period does not shift the next ones, the
+/// periods missed while the console was busy are skipped and counted.
+/////////////////////////////////////////////////
+class WatchTable {
+public:
+  WatchTable(TimerWheel* wheel);
+  int add(uint32_t periodMs, const char* line);
+  bool remove(uint8_t id);
+  void clear();
+  bool isEmpty();
+  Watch* getWatch(uint8_t id);
+  Watch* takeDue();
+
+private:
+  TimerWheel* wheel;
+  Watch watches[CONS_MAX_WATCHES];
+};
+
+#endif /* WATCHTABLE_HPP_ */
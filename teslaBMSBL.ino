@@ -2,8 +2,13 @@
 #include <Arduino.h>
 #include "Controller.hpp"
 #include "Cons.hpp"
+#include "ConsoleOut.hpp"
 #include "Logger.hpp"
 #include "Oled.hpp"
+#include "Profiler.hpp"
+#include "RpcServer.hpp"
+#include "Telemetry.hpp"
+#include "TraceRecorder.hpp"
 #include <Snooze.h>
 #include <TimeLib.h>
 
@@ -25,19 +30,21 @@
 //instantiate all objects
 TeensyView teensyView_inst(OLED_PIN_RESET, OLED_PIN_DC, OLED_PIN_CS, OLED_PIN_SCK, OLED_PIN_MOSI);
 //static Settings settings;
-static Controller controller_inst;        ///< The controller is responsible for orchestrating all major functions of the BMS.
-static Cons cons_inst(&controller_inst);  ///< The console is a 2 way user interface available on usb serial port at baud 115200.
+#ifdef SERIALTRACE
+static TraceRecorder trace_inst(&SERIALTRACE);  ///< Records the inputs of the controller when trace_capture is set.
+static TraceRecorder* trace_ptr = &trace_inst;
+static TracePort<BMSPort> bmsport_inst(&SERIALBMS, &trace_inst);
+static BMSDriverT<TracePort<BMSPort> > bmsdriver_inst(&bmsport_inst, &log_inst);  ///< The driver talks to the chain of module boards.
+#else
+static TraceRecorder* trace_ptr = 0;  ///< Traces need the Dual Serial USB type.
+static BMSDriver bmsdriver_inst(&SERIALBMS, &log_inst);  ///< The driver talks to the chain of module boards.
+#endif
+static Controller controller_inst(&bmsdriver_inst, &log_inst);  ///< The controller is responsible for orchestrating all major functions of the BMS.
+static Telemetry telemetry_inst(&controller_inst, &console_out.telemetry);  ///< Binary frames of the pack on the console port, off until asked for.
+static RpcServer rpc_inst(&controller_inst, &telemetry_inst, &console_out.rpc);  ///< Answers the binary requests of host tools on the console port.
+static Cons cons_inst(&controller_inst, trace_ptr, &telemetry_inst, &rpc_inst);  ///< The console is a 2 way user interface available on usb serial port at baud 115200.
 static Oled oled_inst(&controller_inst, &teensyView_inst);  ///< The oled is a 1 way user interface displaying the most critical information.
 
-// Load drivers
-//SnoozeTouch touch;
-SnoozeDigital digital;
-SnoozeTimer timer;
-SnoozeUSBSerial usbSerial;
-
-// install drivers to a SnoozeBlock
-SnoozeBlock config(timer, digital, usbSerial);
-
 time_t getTeensy3Time() {
   return Teensy3Clock.get();
 }
@@ -46,25 +53,29 @@ time_t getTeensy3Time() {
 /////////////////////////////////////////////////
 void setup() {
 
-  Serial.println("setup");
+  console_out.reply.println("setup");
   pinMode(INL_SOFT_RST, INPUT_PULLUP);
-  Serial.println("setup pinmode");
+  console_out.reply.println("setup pinmode");
   // set the Time library to use Teensy 3.0's RTC to keep time
   setSyncProvider(getTeensy3Time);
-  Serial.println("setup setSyncProvider");
+  console_out.reply.println("setup setSyncProvider");
   delay(100);
   if (timeStatus() != timeSet) {
-    Serial.println("Unable to sync with the RTC");
+    console_out.reply.println("Unable to sync with the RTC");
   } else {
-    Serial.println("RTC has set the system time");
+    console_out.reply.println("RTC has set the system time");
+  }
+  console_out.reply.println("setup");
+  if (trace_ptr && controller_inst.getSettingsPtr()->trace_capture.getVal()) {
+    controller_inst.setTrace(trace_ptr);
+    trace_ptr->begin(&controller_inst);
   }
-  Serial.println("setup");
   LOG_CONSOLE("BMS> ");
 }
 
 
 /////////////////////////////////////////////////
-/// Holds all the code that runs every period.
+/// Holds all the code that runs every pass, also on a wake for the console alone.
 /////////////////////////////////////////////////
 void phase1main() {
   if (digitalRead(INL_SOFT_RST) == LOW) {
@@ -75,61 +86,79 @@ void phase1main() {
 }
 
 /////////////////////////////////////////////////
-/// Holds code that runs every two periods.
+/// Holds code that runs every two periods, in turn with phase1B(), and when a wake pin woke the cpu.
 /////////////////////////////////////////////////
 void phase1A() {
+  PROF_SCOPE(CONTROLLER);
   controller_inst.doController();
 }
 
 /////////////////////////////////////////////////
-/// Holds code that runs every two periods.
+/// Holds code that runs every two periods, in turn with phase1A().
 /////////////////////////////////////////////////
 void phase1B() {
+  PROF_SCOPE(OLED);
   oled_inst.doOled();
 }
 
 /////////////////////////////////////////////////
 /// Once setup is complete, loop is called for ever.
+///
+/// The controller and the OLED take turns every period of the controller, on the clock: a pass woken
+/// before the turn, for a watch of the console, runs the console alone. A wake pin or a timer of the
+/// controller lets the controller run out of turn, the OLED then has the next turn.
 /////////////////////////////////////////////////
 void loop() {
-  uint32_t starttime, endtime, delaytime, timespent, period;
+  uint32_t starttime;
+  uint32_t nextTurn = millis();  //when the controller or the OLED runs next
+  uint32_t at;
   bool phaseA = true;
+  bool turn;
+  bool control;  //the controller runs this pass
+  PowerManager* power = controller_inst.getPowerPtr();
+  TimerWheel* timers = controller_inst.getTimerWheelPtr();
 
   for (;;) {
     starttime = millis();
-
-    phase1main();
-    if (phaseA)
-      phase1A();
-    else
-      phase1B();
-    phaseA = !phaseA;
-
-    digital.pinMode(INL_SOFT_RST, INPUT_PULLUP, FALLING);  //pin, mode, type
-
-    //get loop period from controller
-    period = controller_inst.getPeriodMillis();
-
-    endtime = millis();
-    if (endtime > starttime) {
-      timespent = endtime - starttime;
-    } else {
-      starttime = 0xffffffff - starttime;
-      timespent = starttime + endtime;
+    timers->advance(starttime);
+    turn = (int32_t)(starttime - nextTurn) >= 0;
+    control = (turn && phaseA) || power->wasWokenByPin() || controller_inst.isTimerDue();
+    //a tick of the trace is a run of the controller, the replay runs it every tick
+    if (control && trace_ptr) trace_ptr->tick();
+
+    {
+      PROF_SCOPE(LOOP);
+      phase1main();
+      if (control)
+        phase1A();
+      else if (turn)
+        phase1B();
     }
-    if (timespent >= period) {
-      delaytime = 0;
-    } else {
-      delaytime = period - timespent;
+    if (turn || control) {
+      phaseA = !control;
+      nextTurn = starttime + controller_inst.getPeriodMillis();
     }
-
-    //sleep board instead of delay, if not in active state
-    if (delaytime > LOOP_PERIOD_ACTIVE_MS) {
-      timer.setTimer(delaytime);  // milliseconds
-      //who = Snooze.deepSleep( config );
-      (void)Snooze.deepSleep(config);
-    } else {
-      delay(delaytime);
+    //the messages of the pass are formatted and printed in the idle time left
+    {
+      PROF_SCOPE(LOG_DRAIN);
+      log_inst.drain();
+    }
+    //the telemetry frame of the pass goes after the log, when the ring is short the frame is dropped whole
+    {
+      PROF_SCOPE(TELEMETRY);
+      telemetry_inst.tick();
     }
+    //the console output goes out as fast as the USB host reads it, never waiting for it
+    {
+      PROF_SCOPE(CONSOLE_TX);
+      console_out.pump();
+    }
+
+    //sleep until the next turn, the next timer of the wheel (the controller's and the watches of the
+    //console) or the earliest deadline requested during the pass.
+    //The power manager only uses the low power modes when the controller allows it.
+    power->requestWakeAt(nextTurn);
+    if (timers->nextExpiry(&at)) power->requestWakeAt(at);
+    power->idle();
   }
 }
\ No newline at end of file
@@ -0,0 +1,380 @@
+/**@file fleet_simulator.cpp
+ * Runs a fleet of virtual boats, each a full controller stack against its own simulated pack, and reports
+ * what the fleet went through: time in each controller state, fault frequencies and invariant violations.
+ *
+ *   g++ -O2 -std=gnu++14 -fno-rtti -pthread -I../host -I../.. -o fleet_simulator fleet_simulator.cpp \
+ *       ../host/HostBoard.cpp ../host/PackSimulator.cpp ../host/VirtualBoat.cpp ../host/Scenario.cpp \
+ *       ../../TraceRecorder.cpp ../../Config.cpp ../../StructuredWriter.cpp ../../Logger.cpp ../../ConsoleOut.cpp ../../Profiler.cpp ../../BMSDriver.cpp ../../BMSModule.cpp \
+ *       ../../BMSModuleManager.cpp ../../Controller.cpp ../../PowerManager.cpp ../../ModulePowerManager.cpp \
+ *       ../../TimerWheel.cpp ../../CellFaultMonitor.cpp ../../FaultRegistry.cpp ../../ControllerStateMachine.cpp
+ *
+ *   ./fleet_simulator [-n boats] [-j threads] [-s seed] [-a max_age_years] [-e max_bus_error_rate]
+ *                     [-N max_adc_noise_v] [-J jitter_minutes] [-m modules] [-b boat [-v]] [scenario]
+ *
+ * Every boat draws from the seed and its index: the age of its pack (capacity fade, resistance growth and
+ * a wider spread between cells), its state of charge, the noise of its cell readings, the rate of lost or
+ * corrupted replies on its module bus and a shift of up to the jitter of every scenario event. The same
+ * seed always gives the same fleet, and -b runs a single boat of it with -v printing its controller log
+ * to stderr, to look into a boat that broke an invariant.
+ *
+ * The boats share nothing: each thread of the pool is a host board of its own and runs one boat at a
+ * time. The boats are dealt in blocks to per thread queues and a thread that runs out of boats steals
+ * from the others, since a boat can take much longer than another.
+ *
+ * Invariants, violated when the condition lasts more than INVARIANT_GRACE_MS:
+ *   charge_inhibited   the EVCC charges while the controller inhibits the charger
+ *   cell_ov_charging   a cell is above over_v_setpoint while charging
+ *   cell_uv_running    a cell is under under_v_setpoint under load without the power limiter
+ *   ot_charging        a module is above over_t_setpoint while charging
+ *
+ * Returns 1 when an invariant was violated.
+ */
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Scenario.hpp"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//time for a condition to reach the fault line through the fault debounce and a few controller ticks
+#define INVARIANT_GRACE_MS 5000
+
+//pack aging per year
+#define CAPACITY_FADE_PER_YEAR 0.02f
+#define RESISTANCE_GROWTH_PER_YEAR 0.05f
+#define CAPACITY_SPREAD_PER_YEAR 0.004f
+#define RESISTANCE_SPREAD_PER_YEAR 0.02f
+
+enum Invariant {
+  CHARGE_INHIBITED = 0,
+  CELL_OV_CHARGING,
+  CELL_UV_RUNNING,
+  OT_CHARGING,
+  NUMBER_OF_INVARIANTS
+};
+
+static const char* invariantNames[NUMBER_OF_INVARIANTS] = { "charge_inhibited", "cell_ov_charging", "cell_uv_running", "ot_charging" };
+
+struct FleetConfig {
+  uint32_t seed;
+  float maxAgeYears;
+  float maxBusErrorRate;
+  float maxNoiseV;
+  uint32_t jitterMs;
+  bool verbose;
+  PackConfig pack;
+  EvccConfig evcc;
+  Scenario scenario;
+};
+
+struct BoatResult {
+  float ageYears;
+  float busErrorRate;
+  uint64_t timeInState[ControllerStateMachine::NUMBER_OF_STATES];
+  uint32_t faultCount[FaultRegistry::NUMBER_OF_FAULTS];
+  uint32_t violations[NUMBER_OF_INVARIANTS];
+  uint32_t firstViolationMs[NUMBER_OF_INVARIANTS];
+  uint32_t busErrors;
+  float chargedAh;
+};
+
+/////////////////////////////////////////////////
+/// \brief Per thread queues of boat indexes, a thread takes from the back of its own queue and steals
+/// from the front of the others.
+/////////////////////////////////////////////////
+class BoatQueues {
+public:
+  BoatQueues(uint32_t threads, uint32_t boats)
+    : queues(threads),
+      steals(threads, 0) {
+    for (uint32_t i = 0; i < boats; i++) {
+      queues[(uint64_t)i * threads / boats].items.push_back(i);
+    }
+  }
+
+  bool take(uint32_t self, uint32_t* boat) {
+    if (pop(&queues[self], boat, false)) return true;
+    for (uint32_t k = 1; k < queues.size(); k++) {
+      if (pop(&queues[(self + k) % queues.size()], boat, true)) {
+        steals[self]++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint32_t getSteals(uint32_t thread) {
+    return steals[thread];
+  }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<uint32_t> items;
+  };
+  std::vector<Queue> queues;
+  std::vector<uint32_t> steals;
+
+  static bool pop(Queue* q, uint32_t* boat, bool front) {
+    std::lock_guard<std::mutex> guard(q->lock);
+    if (q->items.empty()) return false;
+    if (front) {
+      *boat = q->items.front();
+      q->items.pop_front();
+    } else {
+      *boat = q->items.back();
+      q->items.pop_back();
+    }
+    return true;
+  }
+};
+
+/////////////////////////////////////////////////
+/// \brief Tracks how long each invariant condition has held and counts a violation once per episode.
+/////////////////////////////////////////////////
+class InvariantChecker {
+public:
+  InvariantChecker(BoatResult* result)
+    : result(result) {
+    memset(since, 0, sizeof(since));
+    memset(holding, 0, sizeof(holding));
+    memset(counted, 0, sizeof(counted));
+  }
+
+  void check(Invariant i, bool condition, uint32_t t) {
+    if (!condition) {
+      holding[i] = false;
+      return;
+    }
+    if (!holding[i]) {
+      holding[i] = true;
+      counted[i] = false;
+      since[i] = t;
+    }
+    if (!counted[i] && t - since[i] > INVARIANT_GRACE_MS) {
+      counted[i] = true;
+      if (result->violations[i]++ == 0) result->firstViolationMs[i] = since[i];
+    }
+  }
+
+private:
+  BoatResult* result;
+  uint32_t since[NUMBER_OF_INVARIANTS];
+  bool holding[NUMBER_OF_INVARIANTS];
+  bool counted[NUMBER_OF_INVARIANTS];
+};
+
+/////////////////////////////////////////////////
+/// \brief builds boat index of the fleet and runs it through the scenario on the calling thread.
+/////////////////////////////////////////////////
+static void runBoat(const FleetConfig& fleet, uint32_t index, BoatResult* r) {
+  SimRandom random(fleet.seed * 2654435761u + index + 1);
+  PackConfig config = fleet.pack;
+  Scenario scenario = fleet.scenario;
+
+  memset(r, 0, sizeof(*r));
+  r->ageYears = fleet.maxAgeYears * random.uniform();
+  r->busErrorRate = fleet.maxBusErrorRate * random.uniform();
+  config.capacityAh *= 1.0f - CAPACITY_FADE_PER_YEAR * r->ageYears;
+  config.resistanceOhm *= 1.0f + RESISTANCE_GROWTH_PER_YEAR * r->ageYears;
+  config.capacitySpread += CAPACITY_SPREAD_PER_YEAR * r->ageYears;
+  config.resistanceSpread += RESISTANCE_SPREAD_PER_YEAR * r->ageYears;
+  config.socMean = 0.2f + 0.7f * random.uniform();
+  config.adcNoiseV = fleet.maxNoiseV * random.uniform();
+  config.busErrorRate = r->busErrorRate;
+  config.seed = random.next();
+  scenario.jitter(&random, fleet.jitterMs);
+
+  //a fresh board with a blank EEPROM
+  host_board.reset(1700000000);
+  memset(EEPROM.mem, 0, sizeof(EEPROM.mem));
+  Logger logger(&console_out.reply, &console_out.log);
+  logger.setLoglevel(fleet.verbose ? Logger::Info : Logger::Off);
+  BMSDriver driver(&SERIALBMS, &logger);
+  std::unique_ptr<Controller> controller(new Controller(&driver, &logger));
+  Settings* settings = controller->getSettingsPtr();
+  PackSimulator pack(config);
+  VirtualBoat boat(controller.get(), &pack, fleet.evcc);
+  InvariantChecker invariants(r);
+  uint32_t lastActive = 0;
+  uint32_t last = millis();
+
+  while (scenario.apply(&boat)) {
+    boat.loop();
+    uint32_t t = millis();
+    r->timeInState[controller->getState()] += t - last;
+    last = t;
+
+    uint32_t active = controller->faults.getActive();
+    for (uint32_t f = 0; f < FaultRegistry::NUMBER_OF_FAULTS; f++) {
+      if ((active & ~lastActive) & (1ul << f)) r->faultCount[f]++;
+    }
+    lastActive = active;
+
+    bool charging = boat.isCharging();
+    bool loaded = boat.inputs.run && boat.inputs.loadA > 0;
+    invariants.check(CHARGE_INHIBITED, charging && controller->isChargerInhibit(), t);
+    invariants.check(CELL_OV_CHARGING, charging && pack.getMaxCellVoltage() > settings->over_v_setpoint.getVal(), t);
+    invariants.check(CELL_UV_RUNNING, loaded && pack.getMinCellVoltage() < settings->under_v_setpoint.getVal() && !controller->isPowerLimiter(), t);
+    invariants.check(OT_CHARGING, charging && pack.getMaxTemp() > settings->over_t_setpoint.getVal(), t);
+  }
+  console_out.pump();
+  r->busErrors = pack.getBusErrors();
+  r->chargedAh = pack.getChargedAh();
+}
+
+static void usage() {
+  fprintf(stderr, "usage: fleet_simulator [-n boats] [-j threads] [-s seed] [-a max_age_years] [-e max_bus_error_rate]\n"
+                  "                       [-N max_adc_noise_v] [-J jitter_minutes] [-m modules] [-b boat [-v]] [scenario]\n");
+}
+
+int main(int argc, char** argv) {
+  FleetConfig fleet;
+  uint32_t boats = 1000;
+  long threads = std::thread::hardware_concurrency();
+  long single = -1;
+  const char* scenarioPath = 0;
+
+  fleet.seed = 1;
+  fleet.maxAgeYears = 10.0f;
+  fleet.maxBusErrorRate = 0.001f;
+  fleet.maxNoiseV = 0.005f;
+  fleet.jitterMs = 30 * 60000;
+  fleet.verbose = false;
+  fleet.pack = PackSimulator::defaultConfig();
+  fleet.evcc = VirtualBoat::defaultEvccConfig();
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "-n") == 0 && hasValue) {
+      boats = strtoul(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-j") == 0 && hasValue) {
+      threads = strtol(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-s") == 0 && hasValue) {
+      fleet.seed = strtoul(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-a") == 0 && hasValue) {
+      fleet.maxAgeYears = strtof(argv[++i], 0);
+    } else if (strcmp(argv[i], "-e") == 0 && hasValue) {
+      fleet.maxBusErrorRate = strtof(argv[++i], 0);
+    } else if (strcmp(argv[i], "-N") == 0 && hasValue) {
+      fleet.maxNoiseV = strtof(argv[++i], 0);
+    } else if (strcmp(argv[i], "-J") == 0 && hasValue) {
+      fleet.jitterMs = strtoul(argv[++i], 0, 10) * 60000;
+    } else if (strcmp(argv[i], "-m") == 0 && hasValue) {
+      fleet.pack.modules = strtoul(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-b") == 0 && hasValue) {
+      single = strtol(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-v") == 0) {
+      fleet.verbose = true;
+    } else if (argv[i][0] != '-' && !scenarioPath) {
+      scenarioPath = argv[i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (threads < 1) threads = 1;
+  if (boats == 0 || fleet.pack.modules == 0 || fleet.pack.modules > SIM_MAX_MODULES ||
+      fleet.maxAgeYears < 0 || fleet.maxAgeYears * CAPACITY_FADE_PER_YEAR >= 1.0f) {
+    usage();
+    return 2;
+  }
+  if (!fleet.scenario.load(scenarioPath)) {
+    fprintf(stderr, "cannot load %s, or it has no end event\n", scenarioPath);
+    return 2;
+  }
+  if (single >= 0) {
+    boats = 1;
+    threads = 1;
+  } else if (threads > (long)boats) {
+    threads = boats;
+  }
+
+  std::vector<BoatResult> results(boats);
+  BoatQueues queues(threads, boats);
+  std::vector<uint32_t> boatsRun(threads, 0);
+  std::vector<std::thread> pool;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  if (single >= 0) {
+    if (fleet.verbose) Serial.setOutput(stderr);
+    runBoat(fleet, single, &results[0]);
+    boatsRun[0] = 1;
+  } else {
+    for (long t = 0; t < threads; t++) {
+      pool.push_back(std::thread([&, t]() {
+        uint32_t boat;
+        while (queues.take(t, &boat)) {
+          runBoat(fleet, boat, &results[boat]);
+          boatsRun[t]++;
+        }
+      }));
+    }
+    for (uint32_t t = 0; t < pool.size(); t++) pool[t].join();
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  uint64_t timeInState[ControllerStateMachine::NUMBER_OF_STATES] = { 0 };
+  uint64_t totalMs = 0;
+  uint32_t faultCount[FaultRegistry::NUMBER_OF_FAULTS] = { 0 };
+  uint32_t faultBoats[FaultRegistry::NUMBER_OF_FAULTS] = { 0 };
+  uint32_t violations[NUMBER_OF_INVARIANTS] = { 0 };
+  uint32_t violationBoats[NUMBER_OF_INVARIANTS] = { 0 };
+  long firstBoat[NUMBER_OF_INVARIANTS];
+  uint64_t busErrors = 0;
+  bool violated = false;
+
+  for (uint32_t i = 0; i < NUMBER_OF_INVARIANTS; i++) firstBoat[i] = -1;
+  for (uint32_t b = 0; b < boats; b++) {
+    const BoatResult& r = results[b];
+    for (uint32_t s = 0; s < ControllerStateMachine::NUMBER_OF_STATES; s++) {
+      timeInState[s] += r.timeInState[s];
+      totalMs += r.timeInState[s];
+    }
+    for (uint32_t f = 0; f < FaultRegistry::NUMBER_OF_FAULTS; f++) {
+      faultCount[f] += r.faultCount[f];
+      faultBoats[f] += r.faultCount[f] > 0;
+    }
+    for (uint32_t i = 0; i < NUMBER_OF_INVARIANTS; i++) {
+      violations[i] += r.violations[i];
+      violationBoats[i] += r.violations[i] > 0;
+      if (r.violations[i] && firstBoat[i] < 0) firstBoat[i] = single >= 0 ? single : b;
+    }
+    busErrors += r.busErrors;
+  }
+
+  printf("%u boats, %.0f simulated hours in %.2fs on %ld threads (%.0f boat hours/s)\n", boats, totalMs / 3600000.0,
+         elapsed, threads, totalMs / 3600000.0 / (elapsed > 0 ? elapsed : 1e-9));
+  for (long t = 0; t < threads; t++) {
+    printf("  thread %2ld: %u boats, %u stolen\n", t, boatsRun[t], queues.getSteals(t));
+  }
+  printf("bus errors injected: %llu\n", (unsigned long long)busErrors);
+
+  ControllerStateMachine states(false);
+  printf("\n%-16s | %12s | %6s\n", "state", "hours", "%");
+  for (uint32_t s = 0; s < ControllerStateMachine::NUMBER_OF_STATES; s++) {
+    printf("%-16s | %12.1f | %6.2f\n", states.getStateDef((ControllerStateMachine::State)s).name,
+           timeInState[s] / 3600000.0, totalMs ? 100.0 * timeInState[s] / totalMs : 0.0);
+  }
+
+  printf("\n%-24s | %10s | %6s\n", "fault", "assertions", "boats");
+  for (uint32_t f = 0; f < FaultRegistry::NUMBER_OF_FAULTS; f++) {
+    printf("%-24s | %10u | %6u\n", FaultRegistry::getDef((FaultRegistry::FaultId)f).name, faultCount[f], faultBoats[f]);
+  }
+
+  printf("\n%-18s | %10s | %6s | %s\n", "invariant", "violations", "boats", "first boat");
+  for (uint32_t i = 0; i < NUMBER_OF_INVARIANTS; i++) {
+    if (firstBoat[i] >= 0) {
+      const BoatResult& r = results[single >= 0 ? 0 : firstBoat[i]];
+      printf("%-18s | %10u | %6u | %ld at %.2fh (age %.1f years, bus error rate %.5f)\n", invariantNames[i], violations[i],
+             violationBoats[i], firstBoat[i], r.firstViolationMs[i] / 3600000.0, r.ageYears, r.busErrorRate);
+      violated = true;
+    } else {
+      printf("%-18s | %10u | %6u | -\n", invariantNames[i], violations[i], violationBoats[i]);
+    }
+  }
+  return violated ? 1 : 0;
+}
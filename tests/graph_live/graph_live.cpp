@@ -0,0 +1,245 @@
+/**@file graph_live.cpp
+ * Checks the in place redraw of `graph live` on an emulated terminal.
+ *
+ *   g++ -O2 -std=gnu++14 -fno-rtti -I../host -I../.. -o graph_live graph_live.cpp ../host/HostBoard.cpp \
+ *       ../host/PackSimulator.cpp ../host/VirtualBoat.cpp ../../TraceRecorder.cpp ../../Cons.cpp ../../CellGraph.cpp \
+ *       ../../Dashboard.cpp ../../Telemetry.cpp ../../TelemetryFrame.cpp ../../RpcServer.cpp ../../WatchTable.cpp \
+ *       ../../Config.cpp ../../StructuredWriter.cpp ../../Logger.cpp ../../ConsoleOut.cpp ../../Profiler.cpp \
+ *       ../../BMSDriver.cpp ../../BMSModule.cpp ../../BMSModuleManager.cpp ../../Controller.cpp \
+ *       ../../PowerManager.cpp ../../ModulePowerManager.cpp ../../TimerWheel.cpp ../../CellFaultMonitor.cpp \
+ *       ../../FaultRegistry.cpp ../../ControllerStateMachine.cpp
+ *
+ *   ./graph_live [-v]
+ *
+ * A controller reads a simulated pack at rest, without ADC noise, so only the cells the test changes move
+ * and the scale the graph was drawn with stays that of the pack. `graph live` runs while cells in the
+ * middle of the range are changed and log messages are printed in between, scrolling the terminal. The
+ * console port goes through a terminal emulation (the cursor moves, erasures and scrolling the graph
+ * uses); once the live graph is stopped, `graph` prints a fresh graph below it and the two must match
+ * line for line. -v prints the screen at the end. Returns 0 when they match.
+ */
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Cons.hpp"
+#include "VirtualBoat.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/////////////////////////////////////////////////
+/// \brief A terminal of HEIGHT lines with its scrollback, for the sequences the console writes.
+/////////////////////////////////////////////////
+class Terminal {
+public:
+  static const int HEIGHT = 60;
+
+  Terminal()
+    : top(0),
+      row(0),
+      col(0),
+      clears(0),
+      state(TEXT),
+      param(0) {
+    params[0] = params[1] = 0;
+    lines.push_back("");
+  }
+
+  void feed(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) put(data[i]);
+  }
+
+  uint32_t getClears() {
+    return clears;
+  }
+
+  std::vector<std::string> lines;
+
+private:
+  enum State { TEXT, ESCAPE, CSI };
+  int top;  //first line of the screen
+  int row;
+  int col;
+  uint32_t clears;
+  State state;
+  int param;
+  int params[2];
+
+  void put(uint8_t c) {
+    if (state == ESCAPE) {
+      state = c == '[' ? CSI : TEXT;
+      param = 0;
+      params[0] = params[1] = 0;
+      return;
+    }
+    if (state == CSI) {
+      if (c >= '0' && c <= '9') {
+        params[param] = params[param] * 10 + c - '0';
+      } else if (c == ';') {
+        param = 1;
+      } else {
+        control(c);
+        state = TEXT;
+      }
+      return;
+    }
+    if (c == 0x1b) {
+      state = ESCAPE;
+    } else if (c == '\r') {
+      col = 0;
+    } else if (c == '\n') {
+      //the port is a tty, a line end also returns the carriage
+      moveTo(row + 1, 0, true);
+    } else {
+      std::string& line = at(row);
+      if ((int)line.size() <= col) line.resize(col + 1, ' ');
+      line[col++] = c;
+    }
+  }
+
+  void control(uint8_t c) {
+    int n = params[0] ? params[0] : 1;
+    switch (c) {
+      case 'A':
+        moveTo(std::max(row - n, top), col, false);
+        break;
+      case 'B':
+        moveTo(std::min(row + n, top + HEIGHT - 1), col, false);
+        break;
+      case 'G':
+        col = n - 1;
+        break;
+      case 'H':
+        moveTo(top + (params[0] ? params[0] : 1) - 1, (params[1] ? params[1] : 1) - 1, false);
+        break;
+      case 'J':
+        for (int r = top; r < top + HEIGHT; r++) at(r).clear();
+        clears++;
+        break;
+      case 'K':
+        if ((int)at(row).size() > col) at(row).resize(col);
+        break;
+    }
+  }
+
+  void moveTo(int r, int c, bool scroll) {
+    if (scroll && r >= top + HEIGHT) top = r - HEIGHT + 1;
+    row = r;
+    col = c;
+  }
+
+  std::string& at(int r) {
+    while ((int)lines.size() <= r) lines.push_back("");
+    return lines[r];
+  }
+};
+
+static FILE* port;
+static long portRead = 0;
+static Terminal terminal;
+
+/////////////////////////////////////////////////
+/// \brief passes what the board wrote to its console port since the last call to the terminal.
+/////////////////////////////////////////////////
+static void readPort() {
+  uint8_t buffer[4096];
+  size_t n;
+  fflush(port);
+  fseek(port, portRead, SEEK_SET);
+  while ((n = fread(buffer, 1, sizeof(buffer), port)) > 0) {
+    terminal.feed(buffer, n);
+    portRead += n;
+  }
+}
+
+static void run(VirtualBoat* boat, Cons* cons, uint32_t ms) {
+  uint32_t start = millis();
+  while (millis() - start < ms) {
+    boat->loop();
+    cons->doConsole();
+    console_out.pump();
+    readPort();
+  }
+}
+
+static std::string trimmed(const std::string& s) {
+  size_t end = s.find_last_not_of(' ');
+  return end == std::string::npos ? "" : s.substr(0, end + 1);
+}
+
+int main(int argc, char** argv) {
+  bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+  port = tmpfile();
+  Serial.setOutput(port);
+  host_board.reset(1700000000);
+  memset(EEPROM.mem, 0, sizeof(EEPROM.mem));
+
+  Logger logger(&console_out.reply, &console_out.log);
+  logger.setLoglevel(Logger::Info);
+  BMSDriver driver(&SERIALBMS, &logger);
+  Controller controller(&driver, &logger);
+  PackConfig config = PackSimulator::defaultConfig();
+  config.adcNoiseV = 0;
+  config.busErrorRate = 0;
+  config.selfDischargePerMonth = 0;
+  PackSimulator pack(config);
+  VirtualBoat boat(&controller, &pack, VirtualBoat::defaultEvccConfig());
+  Cons cons(&controller, 0, 0);
+
+  //the cells by voltage, the ones changed lie between the lowest and the highest
+  std::vector<std::pair<float, uint32_t> > cells;
+  for (uint32_t m = 0; m < pack.getModuleCount(); m++) {
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) cells.push_back(std::make_pair(pack.getCellVoltage(m, c), m * SIM_CELLS_PER_MODULE + c));
+  }
+  std::sort(cells.begin(), cells.end());
+  size_t count = cells.size();
+  const size_t changes[][2] = { { count / 4, count * 3 / 4 }, { count / 2, count / 8 }, { count * 3 / 4, count / 3 }, { count / 3, count * 7 / 8 } };
+
+  run(&boat, &cons, 60000);
+  Serial.inject("graph live\r");
+  run(&boat, &cons, 5000);
+  for (size_t k = 0; k < sizeof(changes) / sizeof(changes[0]); k++) {
+    uint32_t to = cells[changes[k][0]].second;
+    uint32_t from = cells[changes[k][1]].second;
+    PackSimulator::Cell* cell = &pack.getModule(to / SIM_CELLS_PER_MODULE)->cells[to % SIM_CELLS_PER_MODULE];
+    cell->soc = pack.getModule(from / SIM_CELLS_PER_MODULE)->cells[from % SIM_CELLS_PER_MODULE].soc;
+    if (k % 2 == 0) {
+      logger.info("cell %u set like cell %u\n", to, from);
+      logger.info("a second line scrolling the terminal\n");
+    }
+    run(&boat, &cons, 20000);
+  }
+  Serial.inject("q");
+  run(&boat, &cons, 1000);
+  Serial.inject("graph\r");
+  run(&boat, &cons, 2000);
+
+  std::vector<std::string>& lines = terminal.lines;
+  std::vector<size_t> headers;
+  for (size_t i = 0; i < lines.size(); i++) {
+    if (lines[i].find("cell voltage Graph") != std::string::npos) headers.push_back(i);
+  }
+  if (verbose) {
+    for (size_t i = 0; i < lines.size(); i++) printf("%s\n", lines[i].c_str());
+  }
+  if (headers.size() < 2) {
+    printf("FAIL: %zu graphs on the terminal\n", headers.size());
+    return 1;
+  }
+  size_t live = headers[headers.size() - 2] + 2;
+  size_t fresh = headers.back() + 2;
+  int failures = 0;
+  if (terminal.getClears() == 0) {
+    printf("FAIL: the log never made the live graph redraw\n");
+    failures++;
+  }
+  for (size_t i = 0; i < CellGraph::ROWS + 7; i++) {
+    std::string a = live + i < lines.size() ? trimmed(lines[live + i]) : "";
+    std::string b = fresh + i < lines.size() ? trimmed(lines[fresh + i]) : "";
+    if (a != b) {
+      printf("FAIL: line %zu of the graph\n  live:  %s\n  fresh: %s\n", i, a.c_str(), b.c_str());
+      failures++;
+    }
+  }
+  if (failures == 0) printf("live graph matches a fresh one after %u redraws\n", terminal.getClears());
+  return failures ? 1 : 0;
+}
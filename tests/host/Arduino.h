@@ -0,0 +1,240 @@
+/**@file Arduino.h
+ * Host implementation of the small part of the Teensyduino core used by the controller.
+ *
+ * Time only moves when the simulation advances it (delay(), Snooze or HostBoard::advance()), so a
+ * controller built against this header runs as fast as the host allows and is fully deterministic.
+ * Pins, analog inputs and serial ports are plain memory owned by the HostBoard.
+ */
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <deque>
+
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+#define CHANGE 4
+#define FALLING 2
+#define RISING 3
+#define A7 21
+#define F_CPU 72000000
+
+#define NUMBER_OF_HOST_PINS 64
+
+//the host board has the second USB serial port of the Dual Serial USB type, traces are written to it
+#define USB_DUAL_SERIAL
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t level);
+void pinMode(uint8_t pin, uint8_t mode);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+static inline void __disable_irq() {}
+static inline void __enable_irq() {}
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char* str) {
+    return write((const uint8_t*)str, strlen(str));
+  }
+  virtual int availableForWrite() {
+    return 0;
+  }
+  virtual void flush() {}
+  size_t print(const char* s) {
+    return write(s);
+  }
+  size_t print(char c) {
+    return write((uint8_t)c);
+  }
+  size_t print(int v) {
+    return printf("%d", v);
+  }
+  size_t print(unsigned int v) {
+    return printf("%u", v);
+  }
+  size_t print(long v) {
+    return printf("%ld", v);
+  }
+  size_t print(unsigned long v) {
+    return printf("%lu", v);
+  }
+  size_t print(double v, int digits = 2) {
+    return printf("%.*f", digits, v);
+  }
+  size_t println(const char* s = "") {
+    return write(s) + write("\n");
+  }
+  int printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    write(buf);
+    return n;
+  }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  void setTimeout(unsigned long) {}
+};
+
+/////////////////////////////////////////////////
+/// \brief USB serial console, printed to a host file (stderr, a log or nowhere) and fed from a string.
+/////////////////////////////////////////////////
+class usb_serial_class : public Stream {
+public:
+  usb_serial_class();
+  void begin(long) {}
+  void end() {}
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t b);
+  size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  int availableForWrite() {
+    return 64;
+  }
+  uint8_t dtr() {
+    return 1;
+  }
+  operator bool() {
+    return true;
+  }
+
+  void setOutput(FILE* out);
+  const char* openPty();
+  void inject(const char* input);
+
+private:
+  FILE* out;
+  int pty;  //the pseudo terminal the input is read from, -1 if none
+  std::deque<uint8_t> rx;
+};
+
+class HardwareSerial;
+
+/////////////////////////////////////////////////
+/// \brief Something at the other end of a HardwareSerial, the module chain in the simulator.
+/////////////////////////////////////////////////
+class HostSerialDevice {
+public:
+  virtual ~HostSerialDevice() {}
+  virtual void receive(HardwareSerial* port, uint8_t b) = 0;
+};
+
+/////////////////////////////////////////////////
+/// \brief UART whose transmitted bytes go to an attached HostSerialDevice and whose received bytes are
+/// injected by that device. Bytes sent with nothing attached are lost, like on an unplugged port.
+/////////////////////////////////////////////////
+class HardwareSerial : public Stream {
+public:
+  HardwareSerial()
+    : device(0) {
+    ;
+  }
+  void begin(uint32_t) {}
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t b);
+  size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+
+  void attach(HostSerialDevice* device);
+  void inject(const uint8_t* buffer, size_t size);
+
+private:
+  HostSerialDevice* device;
+  std::deque<uint8_t> rx;
+};
+
+extern thread_local usb_serial_class Serial;
+extern thread_local usb_serial_class SerialUSB1;
+extern thread_local HardwareSerial Serial3;
+
+class teensy3_clock_class {
+public:
+  static unsigned long get();
+  static void set(unsigned long t);
+};
+extern thread_local teensy3_clock_class Teensy3Clock;
+
+/////////////////////////////////////////////////
+/// \brief Supplies the inputs read by the controller in place of the levels set on the board, a trace
+/// being replayed. level and value are what the board would have returned.
+/////////////////////////////////////////////////
+class HostInputSource {
+public:
+  virtual ~HostInputSource() {}
+  virtual int digitalRead(uint8_t pin, int level) = 0;
+  virtual int analogRead(uint8_t pin, int value) = 0;
+};
+
+/////////////////////////////////////////////////
+/// \brief The simulated board: clock, pin levels, analog values and the RTC.
+///
+/// Inputs are driven by the simulation with setInput()/setAnalogInput(), outputs are read back with
+/// getOutput()/getAnalogOutput(). getOutput() honours the open collector outputs of the controller:
+/// a pin left as an INPUT floats and reads as HIGH. While inputSource is set, it has the last word on
+/// every digitalRead() and analogRead().
+///
+/// The board, like the serial ports and the EEPROM, is thread local: every thread of a host tool is a
+/// separate board running its own controller.
+/////////////////////////////////////////////////
+class HostBoard {
+public:
+  HostBoard();
+  void reset(uint32_t epoch, uint32_t startMs = 0);
+  void advance(uint32_t ms);
+  uint64_t getMicros();
+  uint32_t getUptime();
+  void setInput(uint8_t pin, uint8_t level);
+  void setAnalogInput(uint8_t pin, int value);
+  uint8_t getOutput(uint8_t pin);
+  int getAnalogOutput(uint8_t pin);
+
+  uint64_t micros;
+  uint64_t startMicros;  //micros at reset()
+  uint32_t epoch;        //now() - micros / 1000000, the RTC does not wrap around with millis()
+  uint8_t mode[NUMBER_OF_HOST_PINS];
+  uint8_t input[NUMBER_OF_HOST_PINS];
+  uint8_t output[NUMBER_OF_HOST_PINS];
+  int analogInput[NUMBER_OF_HOST_PINS];
+  int analogOutput[NUMBER_OF_HOST_PINS];
+  HostInputSource* inputSource;
+};
+
+extern thread_local HostBoard host_board;
+
+#endif /* HOST_ARDUINO_H_ */
@@ -0,0 +1,29 @@
+/**@file EEPROM.h
+ * Host EEPROM, blank (all zeroes) at start so the controller loads its default settings.
+ */
+#ifndef HOST_EEPROM_H_
+#define HOST_EEPROM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+class EEPROMClass {
+public:
+  EEPROMClass() {
+    memset(mem, 0, sizeof(mem));
+  }
+  template<class T> T& get(int address, T& value) {
+    memcpy(&value, mem + address, sizeof(T));
+    return value;
+  }
+  template<class T> const T& put(int address, const T& value) {
+    memcpy(mem + address, &value, sizeof(T));
+    return value;
+  }
+
+  uint8_t mem[2048];
+};
+
+extern thread_local EEPROMClass EEPROM;
+
+#endif /* HOST_EEPROM_H_ */
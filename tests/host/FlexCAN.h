@@ -0,0 +1,43 @@
+/**@file FlexCAN.h
+ * Host CAN controller, keeps the last frame written so the simulation can look at it.
+ */
+#ifndef HOST_FLEXCAN_H_
+#define HOST_FLEXCAN_H_
+
+#include <stdint.h>
+
+typedef struct CAN_message_t {
+  uint32_t id;
+  uint8_t ext;
+  uint8_t len;
+  uint16_t timeout;
+  uint8_t buf[8];
+} CAN_message_t;
+
+class FlexCAN {
+public:
+  FlexCAN()
+    : on(false),
+      written(0) {
+    ;
+  }
+  void begin(uint32_t) {
+    on = true;
+  }
+  void end() {
+    on = false;
+  }
+  int write(const CAN_message_t& msg) {
+    last = msg;
+    written++;
+    return 1;
+  }
+
+  bool on;
+  uint32_t written;
+  CAN_message_t last;
+};
+
+extern thread_local FlexCAN Can0;
+
+#endif /* HOST_FLEXCAN_H_ */
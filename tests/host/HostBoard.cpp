@@ -0,0 +1,325 @@
+/**@file HostBoard.cpp
+ * Host implementation of the Teensyduino core, EEPROM, FlexCAN, Snooze and TimeLib used by the controller.
+ */
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "FlexCAN.h"
+#include "Snooze.h"
+#include "TimeLib.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+//value returned by Snooze when the low power timer woke the cpu
+#define SNOOZE_WAKE_TIMER 36
+
+//every thread is a board of its own, with its own clock, pins, ports and EEPROM
+thread_local HostBoard host_board;
+thread_local usb_serial_class Serial;
+thread_local usb_serial_class SerialUSB1;
+thread_local HardwareSerial Serial3;
+thread_local teensy3_clock_class Teensy3Clock;
+thread_local EEPROMClass EEPROM;
+thread_local FlexCAN Can0;
+thread_local SnoozeClass Snooze;
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the board starts at time 0 with all inputs low.
+/////////////////////////////////////////////////
+HostBoard::HostBoard() {
+  reset(0);
+}
+
+/////////////////////////////////////////////////
+/// \brief puts the board back to its power on state.
+///
+/// @param epoch The RTC time at power on, in seconds since 1970.
+/// @param startMs The millis() value at power on, close to 0xFFFFFFFF to run the controller across the wrap around.
+/////////////////////////////////////////////////
+void HostBoard::reset(uint32_t epoch, uint32_t startMs) {
+  micros = (uint64_t)startMs * 1000;
+  startMicros = micros;
+  this->epoch = epoch - startMs / 1000;
+  memset(mode, INPUT, sizeof(mode));
+  memset(input, LOW, sizeof(input));
+  memset(output, LOW, sizeof(output));
+  memset(analogInput, 0, sizeof(analogInput));
+  memset(analogOutput, 0, sizeof(analogOutput));
+  inputSource = 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief moves the simulated time forward.
+/////////////////////////////////////////////////
+void HostBoard::advance(uint32_t ms) {
+  micros += (uint64_t)ms * 1000;
+}
+
+uint64_t HostBoard::getMicros() {
+  return micros;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the milliseconds since reset(), which unlike millis() do not wrap around.
+/////////////////////////////////////////////////
+uint32_t HostBoard::getUptime() {
+  return (uint32_t)((micros - startMicros) / 1000);
+}
+
+/////////////////////////////////////////////////
+/// \brief sets the level seen by digitalRead() on a pin.
+/////////////////////////////////////////////////
+void HostBoard::setInput(uint8_t pin, uint8_t level) {
+  if (pin < NUMBER_OF_HOST_PINS) input[pin] = level;
+}
+
+/////////////////////////////////////////////////
+/// \brief sets the value returned by analogRead() on a pin.
+/////////////////////////////////////////////////
+void HostBoard::setAnalogInput(uint8_t pin, int value) {
+  if (pin < NUMBER_OF_HOST_PINS) analogInput[pin] = value;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the level a pin presents to the outside, HIGH when floating.
+/////////////////////////////////////////////////
+uint8_t HostBoard::getOutput(uint8_t pin) {
+  if (pin >= NUMBER_OF_HOST_PINS || mode[pin] != OUTPUT) return HIGH;
+  return output[pin];
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the last analogWrite() value of a pin.
+/////////////////////////////////////////////////
+int HostBoard::getAnalogOutput(uint8_t pin) {
+  if (pin >= NUMBER_OF_HOST_PINS) return 0;
+  return analogOutput[pin];
+}
+
+uint32_t millis() {
+  return (uint32_t)(host_board.micros / 1000);
+}
+
+uint32_t micros() {
+  return (uint32_t)host_board.micros;
+}
+
+void delay(uint32_t ms) {
+  host_board.advance(ms);
+}
+
+void delayMicroseconds(uint32_t us) {
+  host_board.micros += us;
+}
+
+int digitalRead(uint8_t pin) {
+  int level = LOW;
+  if (pin < NUMBER_OF_HOST_PINS) level = host_board.mode[pin] == OUTPUT ? host_board.output[pin] : host_board.input[pin];
+  return host_board.inputSource ? host_board.inputSource->digitalRead(pin, level) : level;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  if (pin < NUMBER_OF_HOST_PINS) host_board.output[pin] = level ? HIGH : LOW;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < NUMBER_OF_HOST_PINS) host_board.mode[pin] = mode;
+}
+
+int analogRead(uint8_t pin) {
+  int value = pin < NUMBER_OF_HOST_PINS ? host_board.analogInput[pin] : 0;
+  return host_board.inputSource ? host_board.inputSource->analogRead(pin, value) : value;
+}
+
+void analogWrite(uint8_t pin, int value) {
+  if (pin < NUMBER_OF_HOST_PINS) host_board.analogOutput[pin] = value;
+}
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the console output is discarded until setOutput() is called.
+/////////////////////////////////////////////////
+usb_serial_class::usb_serial_class()
+  : out(0),
+    pty(-1) {
+  ;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of bytes received. With a pseudo terminal, the output written so far is
+/// sent first and what the other end wrote since is read without waiting.
+/////////////////////////////////////////////////
+int usb_serial_class::available() {
+  if (pty >= 0) {
+    struct pollfd fds = { pty, POLLIN, 0 };
+    uint8_t buffer[256];
+    ssize_t n;
+    fflush(out);
+    while (poll(&fds, 1, 0) > 0 && (fds.revents & POLLIN) && (n = ::read(pty, buffer, sizeof(buffer))) > 0) {
+      rx.insert(rx.end(), buffer, buffer + n);
+    }
+  }
+  return (int)rx.size();
+}
+
+int usb_serial_class::read() {
+  if (rx.empty()) return -1;
+  uint8_t b = rx.front();
+  rx.pop_front();
+  return b;
+}
+
+int usb_serial_class::peek() {
+  return rx.empty() ? -1 : rx.front();
+}
+
+size_t usb_serial_class::write(uint8_t b) {
+  if (out) fputc(b, out);
+  return 1;
+}
+
+size_t usb_serial_class::write(const uint8_t* buffer, size_t size) {
+  if (out) fwrite(buffer, 1, size, out);
+  return size;
+}
+
+/////////////////////////////////////////////////
+/// \brief sends the console output to a host file, 0 to discard it.
+/////////////////////////////////////////////////
+void usb_serial_class::setOutput(FILE* out) {
+  this->out = out;
+}
+
+/////////////////////////////////////////////////
+/// \brief sends the output to a new raw pseudo terminal and reads the input from it, the way the port of
+/// a board appears on a host.
+///
+/// @return the path of the terminal to open at the other end, 0 on failure.
+/////////////////////////////////////////////////
+const char* usb_serial_class::openPty() {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  struct termios raw;
+  if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0 || tcgetattr(fd, &raw) != 0) return 0;
+  cfmakeraw(&raw);
+  tcsetattr(fd, TCSANOW, &raw);
+  out = fdopen(fd, "w");
+  if (out) pty = fd;
+  return out ? ptsname(fd) : 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief queues characters as if they were typed on the console.
+/////////////////////////////////////////////////
+void usb_serial_class::inject(const char* input) {
+  while (*input) rx.push_back((uint8_t)*input++);
+}
+
+int HardwareSerial::available() {
+  return (int)rx.size();
+}
+
+int HardwareSerial::read() {
+  if (rx.empty()) return -1;
+  uint8_t b = rx.front();
+  rx.pop_front();
+  return b;
+}
+
+int HardwareSerial::peek() {
+  return rx.empty() ? -1 : rx.front();
+}
+
+size_t HardwareSerial::write(uint8_t b) {
+  if (device) device->receive(this, b);
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) write(buffer[i]);
+  return size;
+}
+
+/////////////////////////////////////////////////
+/// \brief connects the device that answers the bytes written on this port, 0 to unplug it.
+/////////////////////////////////////////////////
+void HardwareSerial::attach(HostSerialDevice* device) {
+  this->device = device;
+  rx.clear();
+}
+
+/////////////////////////////////////////////////
+/// \brief queues bytes sent by the attached device, read back with read().
+/////////////////////////////////////////////////
+void HardwareSerial::inject(const uint8_t* buffer, size_t size) {
+  rx.insert(rx.end(), buffer, buffer + size);
+}
+
+unsigned long teensy3_clock_class::get() {
+  return now();
+}
+
+void teensy3_clock_class::set(unsigned long t) {
+  setTime((time_t)t);
+}
+
+static int snoozeFor(SnoozeBlock& block) {
+  if (block.timer) host_board.advance(block.timer->period);
+  return SNOOZE_WAKE_TIMER;
+}
+
+int SnoozeClass::sleep(SnoozeBlock& block) {
+  return snoozeFor(block);
+}
+
+int SnoozeClass::deepSleep(SnoozeBlock& block) {
+  return snoozeFor(block);
+}
+
+int SnoozeClass::hibernate(SnoozeBlock& block) {
+  return snoozeFor(block);
+}
+
+time_t now() {
+  return (time_t)host_board.epoch + (time_t)(host_board.micros / 1000000);
+}
+
+void setTime(time_t t) {
+  host_board.epoch = (uint32_t)(t - (time_t)(host_board.micros / 1000000));
+}
+
+void setTime(int hr, int min, int sec, int day, int month, int yr) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_hour = hr;
+  tm.tm_min = min;
+  tm.tm_sec = sec;
+  tm.tm_mday = day;
+  tm.tm_mon = month - 1;
+  tm.tm_year = (yr < 100 ? yr + 2000 : yr) - 1900;
+  setTime(timegm(&tm));
+}
+
+void breakTime(time_t t, tmElements_t& tm) {
+  struct tm utc;
+  gmtime_r(&t, &utc);
+  tm.Second = utc.tm_sec;
+  tm.Minute = utc.tm_min;
+  tm.Hour = utc.tm_hour;
+  tm.Wday = utc.tm_wday + 1;
+  tm.Day = utc.tm_mday;
+  tm.Month = utc.tm_mon + 1;
+  tm.Year = utc.tm_year + 1900 - 1970;
+}
+
+const char* monthShortStr(uint8_t month) {
+  static const char* names[] = { "Err", "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  return names[month <= 12 ? month : 0];
+}
+
+void setSyncProvider(getExternalTime provider) {
+  (void)provider;
+}
+
+timeStatus_t timeStatus() {
+  return timeSet;
+}
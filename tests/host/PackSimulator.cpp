@@ -0,0 +1,485 @@
+#include "PackSimulator.hpp"
+
+//board supply thresholds of the cell over/under voltage fault bits
+#define SIM_COV_THRESHOLD_V 4.25f
+#define SIM_CUV_THRESHOLD_V 2.5f
+
+#define SIM_SECONDS_PER_MONTH (30.0 * 24.0 * 3600.0)
+
+//steinhart-hart coefficients used by BMSModule to convert the thermistor readings
+#define THERM_A 0.0007610373573
+#define THERM_B 0.0002728524832
+#define THERM_C 0.0000001022822735
+
+/////////////////////////////////////////////////
+/// \brief Open circuit voltage of a NCA cell against its state of charge, in 10% steps.
+/////////////////////////////////////////////////
+static const float ocvTable[] = { 3.00f, 3.45f, 3.55f, 3.62f, 3.68f, 3.75f, 3.84f, 3.93f, 4.01f, 4.09f, 4.20f };
+
+SimRandom::SimRandom(uint32_t seed)
+  : state(seed ? seed : 0x9e3779b9) {
+  ;
+}
+
+uint32_t SimRandom::next() {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns a number in ]0, 1[.
+/////////////////////////////////////////////////
+float SimRandom::uniform() {
+  return ((next() >> 8) + 0.5f) / 16777216.0f;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns a normally distributed number (Box-Muller), mean 0 and standard deviation 1.
+/////////////////////////////////////////////////
+float SimRandom::gaussian() {
+  float u1 = uniform();
+  float u2 = uniform();
+  return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+/////////////////////////////////////////////////
+/// \brief Constructor, draws the cells of the pack from the seed. All boards start unaddressed, awake and
+/// with the power on reset fault set.
+/////////////////////////////////////////////////
+PackSimulator::PackSimulator(const PackConfig& config)
+  : config(config),
+    random(config.seed),
+    frameLen(0),
+    bleedWh(0),
+    chargedAh(0),
+    busErrors(0) {
+  memset(modules, 0, sizeof(modules));
+  if (this->config.modules > SIM_MAX_MODULES) this->config.modules = SIM_MAX_MODULES;
+  connected = this->config.modules;
+  for (uint32_t m = 0; m < this->config.modules; m++) {
+    Module* mod = &modules[m];
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) {
+      Cell* cell = &mod->cells[c];
+      double soc = config.socMean + config.socSpread * random.gaussian();
+      cell->soc = soc < 0.02 ? 0.02 : (soc > 0.98 ? 0.98 : soc);
+      cell->capacityAs = config.capacityAh * 3600.0 * (1.0 + config.capacitySpread * random.gaussian());
+      cell->r0 = config.resistanceOhm * (1.0 + config.resistanceSpread * random.gaussian());
+      cell->r1 = config.polarizationOhm * (1.0 + config.resistanceSpread * random.gaussian());
+      cell->tauS = config.polarizationTauS;
+      cell->selfDischargeA = config.capacityAh * config.selfDischargePerMonth / (SIM_SECONDS_PER_MONTH / 3600.0)
+                             * (1.0 + config.selfDischargeSpread * random.gaussian());
+      if (cell->selfDischargeA < 0) cell->selfDischargeA = 0;
+    }
+    mod->tempC = config.initialTempC;
+    mod->sensorOffsetC[0] = 0.5f * random.gaussian();
+    mod->sensorOffsetC[1] = 0.5f * random.gaussian();
+    mod->faults = 0x08;  //power on reset
+    convert(mod);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns a pack of 7 Model S modules (6s74p) at 30%, about one year old.
+/////////////////////////////////////////////////
+PackConfig PackSimulator::defaultConfig() {
+  PackConfig config;
+  config.modules = 7;
+  config.capacityAh = 232.0f;  //74p of 3.1Ah cells
+  config.capacitySpread = 0.02f;
+  config.resistanceOhm = 0.0006f;
+  config.resistanceSpread = 0.10f;
+  config.polarizationOhm = 0.0004f;
+  config.polarizationTauS = 30.0f;
+  config.selfDischargePerMonth = 0.02f;
+  config.selfDischargeSpread = 0.5f;
+  config.bleedOhm = 33.0f;
+  config.socMean = 0.3f;
+  config.socSpread = 0.01f;
+  config.thermalMassJPerK = 25000.0f;
+  config.passiveConductanceWPerK = 1.5f;
+  config.pumpConductanceWPerK = 15.0f;
+  config.initialTempC = 20.0f;
+  config.adcNoiseV = 0.0005f;
+  config.busErrorRate = 0;
+  config.seed = 1;
+  return config;
+}
+
+/////////////////////////////////////////////////
+/// \brief interpolates the open circuit voltage of a cell.
+/////////////////////////////////////////////////
+float PackSimulator::openCircuitVoltage(double soc) {
+  const int last = sizeof(ocvTable) / sizeof(ocvTable[0]) - 1;
+  double x = soc * last;
+  int i = (int)x;
+  if (i < 0) i = 0;
+  if (i > last - 1) i = last - 1;
+  return ocvTable[i] + (float)(x - i) * (ocvTable[i + 1] - ocvTable[i]);
+}
+
+/////////////////////////////////////////////////
+/// \brief advances the electrical and thermal state of the pack.
+///
+/// Called after the simulated clock moved by dtMs. The bleed resistors are accounted for the part of the
+/// step during which the balancing timer of their board was running.
+///
+/// @param dtMs Duration of the step.
+/// @param packCurrentA Current into the pack, positive when charging.
+/// @param ambientC Temperature the modules cool down to.
+/// @param pumpDuty Coolant pump duty from 0.0 to 1.0.
+/////////////////////////////////////////////////
+void PackSimulator::step(uint32_t dtMs, float packCurrentA, float ambientC, float pumpDuty) {
+  double dt = dtMs / 1000.0;
+  uint32_t stepStart = millis() - dtMs;
+
+  if (dtMs == 0) return;
+  for (uint32_t m = 0; m < config.modules; m++) {
+    Module* mod = &modules[m];
+    double heat = 0;
+    double boardA = ((mod->ioCtrl & 0x04) ? MODULE_SLEEP_CURRENT_UA : MODULE_AWAKE_CURRENT_UA) * 1e-6;
+    double bleedS = 0;
+    if (mod->balanceMask && (int32_t)(mod->balanceUntil - stepStart) > 0) {
+      bleedS = (mod->balanceUntil - stepStart) / 1000.0;
+      if (bleedS > dt) bleedS = dt;
+    }
+
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) {
+      Cell* cell = &mod->cells[c];
+      double v = getCellVoltage(m, c);
+      double bleedA = 0;
+      if (bleedS > 0 && (mod->balanceMask & (1 << c))) {
+        bleedA = v / config.bleedOhm * bleedS / dt;
+        heat += v * bleedA;
+        bleedWh += v * bleedA * dt / 3600.0;
+      }
+      cell->current = packCurrentA - bleedA - cell->selfDischargeA - boardA;
+      cell->soc += cell->current * dt / cell->capacityAs;
+      if (cell->soc < 0) cell->soc = 0;
+      if (cell->soc > 1.1) cell->soc = 1.1;
+      cell->v1 = cell->current * cell->r1 + (cell->v1 - cell->current * cell->r1) * exp(-dt / cell->tauS);
+      heat += cell->current * cell->current * cell->r0 + cell->v1 * cell->v1 / cell->r1;
+    }
+
+    //exact solution of C dT/dt = heat - G (T - ambient) over the step
+    double g = config.passiveConductanceWPerK + pumpDuty * config.pumpConductanceWPerK;
+    double settled = ambientC + heat / g;
+    mod->tempC = settled + (mod->tempC - settled) * exp(-g * dt / config.thermalMassJPerK);
+  }
+  if (packCurrentA > 0) chargedAh += packCurrentA * dt / 3600.0;
+}
+
+/////////////////////////////////////////////////
+/// \brief receives a byte sent by the BMSDriver, answering complete frames like the string of boards would.
+///
+/// Read frames are [address << 1][register][length], write frames [address << 1 | 1][register][value][CRC].
+/////////////////////////////////////////////////
+void PackSimulator::receive(HardwareSerial* port, uint8_t b) {
+  frame[frameLen++] = b;
+  if (!(frame[0] & 1) && frameLen == 3) {
+    frameLen = 0;
+    handleRead(port, frame[0] >> 1, frame[1], frame[2]);
+  } else if (frameLen == 4) {
+    frameLen = 0;
+    if (genCRC(frame, 3) == frame[3]) {
+      handleWrite(port, frame[0] >> 1, frame[1], frame[2]);
+    }
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief cuts the chain after the given number of boards, the ones behind neither hear nor answer frames.
+///
+/// @param boards Boards left on the bus, the number of modules or more mends the chain.
+/////////////////////////////////////////////////
+void PackSimulator::sever(uint32_t boards) {
+  connected = boards < config.modules ? boards : config.modules;
+}
+
+void PackSimulator::handleRead(HardwareSerial* port, uint8_t address, uint8_t reg, uint8_t len) {
+  uint8_t buff[MAX_PAYLOAD];
+  Module* target = 0;
+
+  //only the first unaddressed board of the chain answers on address 0
+  for (uint32_t m = 0; m < connected && !target; m++) {
+    if (modules[m].address == address) target = &modules[m];
+  }
+  if (!target || len + 4 > MAX_PAYLOAD) return;
+
+  buff[0] = address << 1;
+  buff[1] = reg;
+  buff[2] = len;
+  for (uint8_t i = 0; i < len; i++) {
+    buff[3 + i] = readRegister(target, reg + i);
+  }
+  buff[3 + len] = genCRC(buff, 3 + len);
+  reply(port, buff, 4 + len);
+}
+
+void PackSimulator::handleWrite(HardwareSerial* port, uint8_t address, uint8_t reg, uint8_t value) {
+  bool answered = false;
+
+  for (uint32_t m = 0; m < connected; m++) {
+    if (address == BROADCAST_ADDR || modules[m].address == address) {
+      writeRegister(&modules[m], reg, value);
+      answered = true;
+      if (address != BROADCAST_ADDR) break;
+    }
+  }
+  if (answered) reply(port, frame, 4);
+}
+
+/////////////////////////////////////////////////
+/// \brief sends a reply to the BMSDriver, losing it or flipping one of its bits at busErrorRate.
+/////////////////////////////////////////////////
+void PackSimulator::reply(HardwareSerial* port, uint8_t* buf, uint8_t len) {
+  if (config.busErrorRate > 0 && random.uniform() < config.busErrorRate) {
+    busErrors++;
+    if (random.next() & 1) return;
+    buf[random.next() % len] ^= 1 << (random.next() & 7);
+  }
+  port->inject(buf, len);
+}
+
+void PackSimulator::writeRegister(Module* m, uint8_t reg, uint8_t value) {
+  switch (reg) {
+    case REG_ALERT_STATUS:
+      m->alerts &= ~value;
+      break;
+    case REG_FAULT_STATUS:
+      m->faults &= ~value;
+      break;
+    case REG_IO_CTRL:
+      m->ioCtrl = value;
+      break;
+    case REG_BAL_TIME:
+      m->balanceTimeS = value;
+      break;
+    case REG_BAL_CTRL:
+      m->balanceMask = value & 0x3f;
+      m->balanceUntil = millis() + m->balanceTimeS * 1000;
+      break;
+    case REG_ADC_CONV:
+      convert(m);
+      break;
+    case REG_ADDR_CTRL:
+      m->address = value & 0x3f;
+      break;
+    case 0x3C:  //reset
+      if (value == 0xA5) {
+        m->address = 0;
+        m->balanceMask = 0;
+      }
+      break;
+    default:
+      break;
+  }
+  if (m->ioCtrl & 0x04) m->alerts |= 0x04;  //sleep mode active
+}
+
+uint8_t PackSimulator::readRegister(Module* m, uint8_t reg) {
+  if (reg < sizeof(m->regs)) return m->regs[reg];
+  switch (reg) {
+    case REG_ALERT_STATUS:
+      return m->alerts;
+    case REG_FAULT_STATUS:
+      return m->faults;
+    case REG_COV_FAULT:
+    case REG_CUV_FAULT: {
+      uint8_t mask = 0;
+      for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) {
+        float v = (m->regs[REG_VCELL1 + 2 * c] * 256 + m->regs[REG_VCELL1 + 2 * c + 1]) * 0.000381493f;
+        if (reg == REG_COV_FAULT ? v > SIM_COV_THRESHOLD_V : v < SIM_CUV_THRESHOLD_V) mask |= 1 << c;
+      }
+      return mask;
+    }
+    case REG_IO_CTRL:
+      return m->ioCtrl;
+    case REG_BAL_CTRL:
+      return m->balanceMask;
+    case REG_BAL_TIME:
+      return m->balanceTimeS;
+    case REG_ADDR_CTRL:
+      return m->address | 0x80;
+    default:
+      return 0;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the raw thermistor reading BMSModule converts back to the given temperature.
+/////////////////////////////////////////////////
+static uint16_t thermistorCounts(double tempC, double fullScale, double offset) {
+  double target = 1.0 / (tempC + 273.15);
+  double x = 9.2;  //ln(10k)
+  for (int i = 0; i < 20; i++) {
+    double f = THERM_A + THERM_B * x + THERM_C * x * x * x - target;
+    x -= f / (THERM_B + 3 * THERM_C * x * x);
+  }
+  double counts = 1.78 / (exp(x) / 1000.0 + 3.57) * fullScale - offset;
+  return counts < 0 ? 0 : (counts > 65535 ? 65535 : (uint16_t)(counts + 0.5));
+}
+
+/////////////////////////////////////////////////
+/// \brief latches the module, cell and temperature readings in the ADC result registers.
+/////////////////////////////////////////////////
+void PackSimulator::convert(Module* m) {
+  uint32_t index = m - modules;
+  double moduleV = 0;
+  uint16_t counts;
+
+  for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) {
+    double v = getCellVoltage(index, c) + config.adcNoiseV * random.gaussian();
+    moduleV += v;
+    counts = v <= 0 ? 0 : (uint16_t)(v / 0.000381493 + 0.5);
+    m->regs[REG_VCELL1 + 2 * c] = counts >> 8;
+    m->regs[REG_VCELL1 + 2 * c + 1] = counts & 0xff;
+  }
+  counts = (uint16_t)(moduleV / 0.0020346293922562 + 0.5);
+  m->regs[REG_GPAI] = counts >> 8;
+  m->regs[REG_GPAI + 1] = counts & 0xff;
+
+  counts = thermistorCounts(m->tempC + m->sensorOffsetC[0], 33046.0, 2.0);
+  m->regs[REG_TEMPERATURE1] = counts >> 8;
+  m->regs[REG_TEMPERATURE1 + 1] = counts & 0xff;
+  counts = thermistorCounts(m->tempC + m->sensorOffsetC[1], 33068.0, 9.0);
+  m->regs[REG_TEMPERATURE2] = counts >> 8;
+  m->regs[REG_TEMPERATURE2 + 1] = counts & 0xff;
+
+  for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) {
+    float v = getCellVoltage(index, c);
+    if (v > SIM_COV_THRESHOLD_V) m->faults |= 0x01;
+    if (v < SIM_CUV_THRESHOLD_V) m->faults |= 0x02;
+  }
+}
+
+bool PackSimulator::isBleeding(Module* m, uint32_t cell) {
+  return (m->balanceMask & (1 << cell)) && (int32_t)(m->balanceUntil - millis()) > 0;
+}
+
+uint32_t PackSimulator::getModuleCount() {
+  return config.modules;
+}
+
+PackSimulator::Module* PackSimulator::getModule(uint32_t index) {
+  return &modules[index];
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the terminal voltage of a cell group for the last current that went through it.
+/////////////////////////////////////////////////
+float PackSimulator::getCellVoltage(uint32_t module, uint32_t cell) {
+  const Cell* c = &modules[module].cells[cell];
+  return openCircuitVoltage(c->soc) + c->v1 + c->current * c->r0;
+}
+
+float PackSimulator::getPackVoltage() {
+  float v = 0;
+  for (uint32_t m = 0; m < config.modules; m++) {
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) v += getCellVoltage(m, c);
+  }
+  return v;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the pack voltage the charger would see at zero current (open circuit plus polarization).
+/////////////////////////////////////////////////
+float PackSimulator::getPackInternalVoltage() {
+  float v = 0;
+  for (uint32_t m = 0; m < config.modules; m++) {
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) {
+      v += openCircuitVoltage(modules[m].cells[c].soc) + modules[m].cells[c].v1;
+    }
+  }
+  return v;
+}
+
+float PackSimulator::getPackResistance() {
+  float r = 0;
+  for (uint32_t m = 0; m < config.modules; m++) {
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) r += modules[m].cells[c].r0;
+  }
+  return r;
+}
+
+float PackSimulator::getMinCellVoltage() {
+  float v = 10.0f;
+  for (uint32_t m = 0; m < config.modules; m++) {
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) v = fminf(v, getCellVoltage(m, c));
+  }
+  return v;
+}
+
+float PackSimulator::getMaxCellVoltage() {
+  float v = 0.0f;
+  for (uint32_t m = 0; m < config.modules; m++) {
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) v = fmaxf(v, getCellVoltage(m, c));
+  }
+  return v;
+}
+
+float PackSimulator::getMinSoc() {
+  double soc = 2.0;
+  for (uint32_t m = 0; m < config.modules; m++) {
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) soc = fmin(soc, modules[m].cells[c].soc);
+  }
+  return soc;
+}
+
+float PackSimulator::getMaxSoc() {
+  double soc = 0.0;
+  for (uint32_t m = 0; m < config.modules; m++) {
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) soc = fmax(soc, modules[m].cells[c].soc);
+  }
+  return soc;
+}
+
+float PackSimulator::getMaxTemp() {
+  double t = -100.0;
+  for (uint32_t m = 0; m < config.modules; m++) t = fmax(t, modules[m].tempC);
+  return t;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the energy burnt in the bleed resistors since the start.
+/////////////////////////////////////////////////
+double PackSimulator::getBleedWh() {
+  return bleedWh;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the charge that went into the pack since the start.
+/////////////////////////////////////////////////
+double PackSimulator::getChargedAh() {
+  return chargedAh;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of cells with a bleed resistor currently on.
+/////////////////////////////////////////////////
+uint32_t PackSimulator::getBleedingCells() {
+  uint32_t n = 0;
+  for (uint32_t m = 0; m < config.modules; m++) {
+    for (uint32_t c = 0; c < SIM_CELLS_PER_MODULE; c++) n += isBleeding(&modules[m], c);
+  }
+  return n;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of replies lost or corrupted so far.
+/////////////////////////////////////////////////
+uint32_t PackSimulator::getBusErrors() {
+  return busErrors;
+}
+
+uint8_t PackSimulator::genCRC(const uint8_t* buf, uint8_t len) {
+  uint8_t crc = 0;
+  for (uint8_t x = 0; x < len; x++) {
+    crc ^= buf[x];
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
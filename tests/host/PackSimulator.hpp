@@ -0,0 +1,132 @@
+#ifndef PACKSIMULATOR_HPP_
+#define PACKSIMULATOR_HPP_
+
+#include "Arduino.h"
+#include "BMSDriver.hpp"
+
+#define SIM_CELLS_PER_MODULE 6
+#define SIM_MAX_MODULES 16
+
+/////////////////////////////////////////////////
+/// \brief Parameters of a simulated pack, the spreads are relative standard deviations drawn per cell.
+/////////////////////////////////////////////////
+struct PackConfig {
+  uint32_t modules;
+  float capacityAh;              //of a parallel cell group
+  float capacitySpread;
+  float resistanceOhm;           //series resistance R0 of a cell group
+  float resistanceSpread;
+  float polarizationOhm;         //R1 of the R1//C1 polarization branch
+  float polarizationTauS;        //R1 * C1
+  float selfDischargePerMonth;   //fraction of the capacity lost per month
+  float selfDischargeSpread;
+  float bleedOhm;                //balancing resistor of the module boards
+  float socMean;
+  float socSpread;               //absolute standard deviation of the initial state of charge
+  float thermalMassJPerK;        //of a module
+  float passiveConductanceWPerK; //module to ambient, pump off
+  float pumpConductanceWPerK;    //added at full pump duty
+  float initialTempC;
+  float adcNoiseV;               //standard deviation of the cell voltage readings
+  float busErrorRate;            //probability of a reply being lost or having a bit flipped
+  uint32_t seed;
+};
+
+/////////////////////////////////////////////////
+/// \brief Simple deterministic random generator (xorshift), so a seed always gives the same pack.
+/////////////////////////////////////////////////
+class SimRandom {
+public:
+  SimRandom(uint32_t seed);
+  uint32_t next();
+  float uniform();
+  float gaussian();
+
+private:
+  uint32_t state;
+};
+
+/////////////////////////////////////////////////
+/// \brief Closed loop model of a string of Tesla modules and of their BMS boards.
+///
+/// Every parallel cell group is an equivalent circuit: an open circuit voltage looked up from the state
+/// of charge, a series resistance and one R//C polarization branch, plus self-discharge. Each module has
+/// a thermal mass heated by the cell losses and the bleed resistors and cooled to ambient, more so when
+/// the coolant pump runs.
+///
+/// Attached to Serial3, the boards answer the frames sent by the real BMSDriver: address assignment,
+/// ADC conversions, alert and fault registers, sleep and REG_BAL_TIME/REG_BAL_CTRL, whose bleed resistors
+/// then discharge the selected cells for the requested time.
+/////////////////////////////////////////////////
+class PackSimulator : public HostSerialDevice {
+public:
+  struct Cell {
+    double soc;
+    double capacityAs;
+    double r0;
+    double r1;
+    double tauS;
+    double v1;              //polarization voltage
+    double selfDischargeA;
+    double current;         //last current into the cell, positive when charging
+  };
+
+  struct Module {
+    Cell cells[SIM_CELLS_PER_MODULE];
+    double tempC;
+    float sensorOffsetC[2];
+    uint8_t address;
+    uint8_t alerts;
+    uint8_t faults;
+    uint8_t ioCtrl;
+    uint8_t balanceMask;
+    uint8_t balanceTimeS;
+    uint32_t balanceUntil;  //millis() at which the balancing timer of the board expires
+    uint8_t regs[0x14];     //ADC results latched by the last conversion, from REG_GPAI
+  };
+
+  PackSimulator(const PackConfig& config);
+  static PackConfig defaultConfig();
+  void step(uint32_t dtMs, float packCurrentA, float ambientC, float pumpDuty);
+  void receive(HardwareSerial* port, uint8_t b);
+  void sever(uint32_t boards);
+
+  uint32_t getModuleCount();
+  Module* getModule(uint32_t index);
+  float getCellVoltage(uint32_t module, uint32_t cell);
+  float getPackVoltage();
+  float getPackInternalVoltage();
+  float getPackResistance();
+  float getMinCellVoltage();
+  float getMaxCellVoltage();
+  float getMinSoc();
+  float getMaxSoc();
+  float getMaxTemp();
+  double getBleedWh();
+  double getChargedAh();
+  uint32_t getBleedingCells();
+  uint32_t getBusErrors();
+  static float openCircuitVoltage(double soc);
+
+private:
+  PackConfig config;
+  SimRandom random;
+  Module modules[SIM_MAX_MODULES];
+  uint8_t frame[4];
+  uint8_t frameLen;
+  double bleedWh;
+  double chargedAh;
+  uint32_t busErrors;
+  uint32_t connected;  //boards on the bus side of a cut in the chain
+
+  void handleRead(HardwareSerial* port, uint8_t address, uint8_t reg, uint8_t len);
+  void handleWrite(HardwareSerial* port, uint8_t address, uint8_t reg, uint8_t value);
+  void reply(HardwareSerial* port, uint8_t* buf, uint8_t len);
+  void writeRegister(Module* m, uint8_t reg, uint8_t value);
+  uint8_t readRegister(Module* m, uint8_t reg);
+  void convert(Module* m);
+  bool isBleeding(Module* m, uint32_t cell);
+  static uint8_t genCRC(const uint8_t* buf, uint8_t len);
+};
+
+#endif /* PACKSIMULATOR_HPP_ */
@@ -0,0 +1,123 @@
+#include "Scenario.hpp"
+
+//plugged in at 0 and left alone for the night
+static const char* defaultScenario[] = {
+  "0 plug 1",
+  "12h end",
+};
+
+Scenario::Scenario()
+  : next(0) {
+  ;
+}
+
+bool Scenario::parse(const char* line, Event* e) {
+  char unit = 's';
+  double t;
+  int n;
+  if (line[0] == '#' || sscanf(line, "%lf%n", &t, &n) != 1) return false;
+  if (line[n] == 'h' || line[n] == 'm' || line[n] == 's') unit = line[n++];
+  e->value = 0;
+  if (sscanf(line + n, "%15s %f", e->name, &e->value) < 1) return false;
+  e->timeMs = (uint32_t)(t * (unit == 'h' ? 3600000.0 : unit == 'm' ? 60000.0 : 1000.0));
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief loads a scenario file, or the default overnight charge when path is 0.
+///
+/// Returns false if the file cannot be read or has no end event.
+/////////////////////////////////////////////////
+bool Scenario::load(const char* path) {
+  char line[128];
+  Event e;
+
+  events.clear();
+  next = 0;
+  if (!path) {
+    for (uint32_t i = 0; i < sizeof(defaultScenario) / sizeof(defaultScenario[0]); i++) {
+      if (parse(defaultScenario[i], &e)) events.push_back(e);
+    }
+  } else {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    while (fgets(line, sizeof(line), f)) {
+      if (parse(line, &e)) events.push_back(e);
+    }
+    fclose(f);
+  }
+  for (uint32_t i = 0; i < events.size(); i++) {
+    if (strcmp(events[i].name, "end") == 0) return true;
+  }
+  return false;
+}
+
+/////////////////////////////////////////////////
+/// \brief applies the events due since the board was reset to the boat, returns false once the end event is reached.
+/////////////////////////////////////////////////
+bool Scenario::apply(VirtualBoat* boat) {
+  while (next < events.size() && events[next].timeMs <= host_board.getUptime()) {
+    const Event& e = events[next++];
+    if (strcmp(e.name, "plug") == 0) {
+      boat->inputs.evseConnected = e.value != 0;
+    } else if (strcmp(e.name, "run") == 0) {
+      boat->inputs.run = e.value != 0;
+    } else if (strcmp(e.name, "load") == 0) {
+      boat->inputs.loadA = e.value;
+    } else if (strcmp(e.name, "ambient") == 0) {
+      boat->inputs.ambientC = e.value;
+    } else if (strcmp(e.name, "bat12v") == 0) {
+      boat->inputs.bat12vV = e.value;
+    } else if (strcmp(e.name, "sever") == 0) {
+      boat->inputs.chainBoards = (uint32_t)e.value;
+    } else if (strcmp(e.name, "mend") == 0) {
+      boat->inputs.chainBoards = SIM_MAX_MODULES;
+    } else if (strcmp(e.name, "end") == 0) {
+      return false;
+    } else {
+      fprintf(stderr, "unknown event %s\n", e.name);
+    }
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the time of the end event.
+/////////////////////////////////////////////////
+uint32_t Scenario::getEndMs() {
+  for (uint32_t i = 0; i < events.size(); i++) {
+    if (strcmp(events[i].name, "end") == 0) return events[i].timeMs;
+  }
+  return 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief moves every event but the ones at 0 and the end by up to maxMs either way, keeping their order
+/// when they do not cross.
+/////////////////////////////////////////////////
+void Scenario::jitter(SimRandom* random, uint32_t maxMs) {
+  uint32_t endMs = getEndMs();
+  for (uint32_t i = 0; i < events.size(); i++) {
+    Event& e = events[i];
+    if (e.timeMs == 0 || strcmp(e.name, "end") == 0) continue;
+    int64_t t = (int64_t)e.timeMs + (int64_t)((2.0f * random->uniform() - 1.0f) * maxMs);
+    e.timeMs = t < 1 ? 1 : (t >= endMs ? endMs - 1 : (uint32_t)t);
+  }
+  std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.timeMs < b.timeMs; });
+  next = 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief sets a controller setting from a "name=value" string, returns false if it is not accepted.
+/////////////////////////////////////////////////
+bool applySetting(Settings* settings, const char* assignment) {
+  char name[64];
+  const char* eq = strchr(assignment, '=');
+  Param* param;
+
+  if (!eq || eq - assignment >= (int)sizeof(name)) return false;
+  memcpy(name, assignment, eq - assignment);
+  name[eq - assignment] = 0;
+  param = settings->getParam(name);
+  return param && param->setVal(eq + 1) == 0;
+}
@@ -0,0 +1,37 @@
+#ifndef SCENARIO_HPP_
+#define SCENARIO_HPP_
+
+#include "VirtualBoat.hpp"
+#include <algorithm>
+#include <vector>
+
+/////////////////////////////////////////////////
+/// \brief Timed events driving a VirtualBoat.
+///
+/// One "<time> <event> [value]" per line, the time in seconds or suffixed with m or h, # starts a comment:
+///   plug 0|1, run 0|1, load <amps>, ambient <C>, bat12v <V>, sever <boards>, mend, end
+/// sever cuts the module chain after the given number of boards (0 cuts it at the controller), mend joins it.
+/////////////////////////////////////////////////
+class Scenario {
+public:
+  struct Event {
+    uint32_t timeMs;
+    char name[16];
+    float value;
+  };
+
+  Scenario();
+  bool load(const char* path);
+  bool apply(VirtualBoat* boat);
+  uint32_t getEndMs();
+  void jitter(SimRandom* random, uint32_t maxMs);
+
+private:
+  std::vector<Event> events;
+  uint32_t next;
+  static bool parse(const char* line, Event* e);
+};
+
+bool applySetting(Settings* settings, const char* assignment);
+
+#endif /* SCENARIO_HPP_ */
@@ -0,0 +1,57 @@
+/**@file Snooze.h
+ * Host Snooze, a sleep simply advances the simulated clock by the low power timer period.
+ */
+#ifndef HOST_SNOOZE_H_
+#define HOST_SNOOZE_H_
+
+#include <stdint.h>
+
+class SnoozeDriver {};
+
+class SnoozeDigital : public SnoozeDriver {
+public:
+  int pinMode(int, int, int) {
+    return 0;
+  }
+};
+
+class SnoozeTimer : public SnoozeDriver {
+public:
+  SnoozeTimer()
+    : period(0) {
+    ;
+  }
+  void setTimer(uint16_t ms) {
+    period = ms;
+  }
+  uint16_t period;
+};
+
+class SnoozeUSBSerial : public SnoozeDriver {};
+
+class SnoozeBlock {
+public:
+  template<class... Drivers> SnoozeBlock(Drivers&... drivers)
+    : timer(0) {
+    int unused[] = { 0, (bind(drivers), 0)... };
+    (void)unused;
+  }
+  SnoozeTimer* timer;
+
+private:
+  void bind(SnoozeTimer& t) {
+    timer = &t;
+  }
+  void bind(SnoozeDriver&) {}
+};
+
+class SnoozeClass {
+public:
+  int sleep(SnoozeBlock& block);
+  int deepSleep(SnoozeBlock& block);
+  int hibernate(SnoozeBlock& block);
+};
+
+extern thread_local SnoozeClass Snooze;
+
+#endif /* HOST_SNOOZE_H_ */
@@ -0,0 +1,36 @@
+/**@file TimeLib.h
+ * Host TimeLib, the system time is the RTC epoch of the HostBoard plus the simulated uptime.
+ */
+#ifndef HOST_TIMELIB_H_
+#define HOST_TIMELIB_H_
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+  uint8_t Second;
+  uint8_t Minute;
+  uint8_t Hour;
+  uint8_t Wday;
+  uint8_t Day;
+  uint8_t Month;
+  uint8_t Year;  //offset from 1970
+} tmElements_t;
+
+typedef enum {
+  timeNotSet,
+  timeNeedsSync,
+  timeSet
+} timeStatus_t;
+
+typedef time_t (*getExternalTime)();
+
+time_t now();
+void setTime(time_t t);
+void setTime(int hr, int min, int sec, int day, int month, int yr);
+void breakTime(time_t t, tmElements_t& tm);
+const char* monthShortStr(uint8_t month);
+void setSyncProvider(getExternalTime provider);
+timeStatus_t timeStatus();
+
+#endif /* HOST_TIMELIB_H_ */
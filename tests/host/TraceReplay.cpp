@@ -0,0 +1,235 @@
+#include "TraceReplay.hpp"
+#include "TimeLib.h"
+
+static const char* tagName(int tag) {
+  static const char* names[] = { "end-of-trace", "TICK", "STATE", "RTC", "DIGITAL", "ANALOG", "CONSOLE", "TX", "RX", "RX_EMPTY" };
+  if (tag < 0) return names[0];
+  return tag <= TRACE_RX_EMPTY ? names[tag] : "unknown";
+}
+
+static std::string hex(const uint8_t* buf, size_t len) {
+  std::string s;
+  char byte[4];
+  for (size_t i = 0; i < len; i++) {
+    snprintf(byte, sizeof(byte), i ? " %02x" : "%02x", buf[i]);
+    s += byte;
+  }
+  return s;
+}
+
+/////////////////////////////////////////////////
+/// \brief Constructor, load() a trace before replaying it.
+/////////////////////////////////////////////////
+TraceReplay::TraceReplay()
+  : wheelMs(0),
+    beginMs(0),
+    rtc(0),
+    pos(0),
+    runLeft(0),
+    ticks(0),
+    tickStart(0),
+    state(0) {
+  memset(levels, 0, sizeof(levels));
+  memset(levelKnown, 0, sizeof(levelKnown));
+}
+
+/////////////////////////////////////////////////
+/// \brief reads a trace file (or a terminal, until it is closed) and its header.
+///
+/// @return false if it cannot be read or is not a trace.
+/////////////////////////////////////////////////
+bool TraceReplay::load(const char* path) {
+  FILE* in = fopen(path, "rb");
+  if (!in) return false;
+  uint8_t chunk[4096];
+  size_t n;
+  data.clear();
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) data.insert(data.end(), chunk, chunk + n);
+  fclose(in);
+
+  if (data.size() < 6 || memcmp(&data[0], TRACE_MAGIC, 4) != 0 || data[4] != TRACE_VERSION) return false;
+  pos = 5;
+  wheelMs = getVarint();
+  beginMs = getVarint();
+  rtc = getVarint();
+  state = pos < data.size() ? data[pos++] : 0;
+  uint32_t size = getVarint();
+  if (pos + size > data.size()) return false;
+  settings.assign(data.begin() + pos, data.begin() + pos + size);
+  pos += size;
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief starts the replay, once the controller is built and the clock is at beginMs.
+/////////////////////////////////////////////////
+void TraceReplay::begin() {
+  tickStart = beginMs;
+  ticks = 0;
+  host_board.inputSource = this;
+}
+
+/////////////////////////////////////////////////
+/// \brief moves to the next pass of the main loop running the controller.
+///
+/// @return false at the end of the trace or once diverged.
+/////////////////////////////////////////////////
+bool TraceReplay::beginTick() {
+  consoleInput.clear();
+  int tag = peek();
+  if (tag < 0) return false;
+  if (tag != TRACE_TICK) {
+    diverge("the recorded controller went on with a %s record", tagName(tag));
+    return false;
+  }
+  pos++;
+  tickStart += getVarint();
+  ticks++;
+  if ((int32_t)(tickStart - millis()) > 0) host_board.advance(tickStart - millis());
+
+  for (;;) {
+    tag = peek();
+    if (tag == TRACE_RTC) {
+      pos++;
+      rtc = getVarint();
+      setTime((time_t)rtc + millis() / 1000);
+    } else if (tag == TRACE_STATE && pos + 1 < data.size()) {
+      state = data[pos + 1];
+      pos += 2;
+    } else if (tag == TRACE_CONSOLE) {
+      pos++;
+      uint32_t n = getVarint();
+      for (; n && pos < data.size(); n--) consoleInput += (char)data[pos++];
+    } else {
+      return true;
+    }
+  }
+}
+
+uint32_t TraceReplay::getTicks() {
+  return ticks;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the recorded state of the controller at the start of the tick.
+/////////////////////////////////////////////////
+uint8_t TraceReplay::getState() {
+  return state;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns what was typed on the console during the tick.
+/////////////////////////////////////////////////
+const std::string& TraceReplay::getConsoleInput() {
+  return consoleInput;
+}
+
+bool TraceReplay::isDiverged() {
+  return !divergence.empty();
+}
+
+const char* TraceReplay::getDivergence() {
+  return divergence.c_str();
+}
+
+int TraceReplay::available() {
+  int tag = peek();
+  if (tag == TRACE_RX) return 1;
+  if (tag == TRACE_RX_EMPTY) {
+    pos++;
+    return 0;
+  }
+  diverge("available() of the module port met a %s record", tagName(tag));
+  return 0;
+}
+
+int TraceReplay::read() {
+  if (!runLeft) {
+    int tag = peek();
+    if (tag != TRACE_RX) {
+      diverge("read() of the module port met a %s record", tagName(tag));
+      return -1;
+    }
+    pos++;
+    runLeft = getVarint();
+    if (!runLeft || pos + runLeft > data.size()) {
+      diverge("truncated RX record");
+      return -1;
+    }
+  }
+  runLeft--;
+  return data[pos++];
+}
+
+/////////////////////////////////////////////////
+/// \brief checks bytes written to the modules against the trace, at the time they were recorded.
+/////////////////////////////////////////////////
+void TraceReplay::write(const uint8_t* buf, size_t len) {
+  int tag = peek();
+  if (tag != TRACE_TX) {
+    diverge("wrote %s to the modules where the trace has a %s record", hex(buf, len).c_str(), tagName(tag));
+    return;
+  }
+  pos++;
+  uint32_t at = tickStart + getVarint();
+  uint32_t n = getVarint();
+  if (pos + n > data.size()) {
+    diverge("truncated TX record");
+    return;
+  }
+  if ((int32_t)(at - millis()) > 0) host_board.advance(at - millis());
+  if (n != len || memcmp(&data[pos], buf, n) != 0) {
+    diverge("wrote %s to the modules instead of %s", hex(buf, len).c_str(), hex(&data[pos], n).c_str());
+  }
+  pos += n;
+}
+
+int TraceReplay::digitalRead(uint8_t pin, int level) {
+  if (pin >= NUMBER_OF_HOST_PINS) return level;
+  if (peek() == TRACE_DIGITAL && pos + 2 < data.size() && data[pos + 1] == pin) {
+    levels[pin] = data[pos + 2];
+    levelKnown[pin] = true;
+    pos += 3;
+  }
+  return levelKnown[pin] ? levels[pin] : level;
+}
+
+int TraceReplay::analogRead(uint8_t pin, int value) {
+  uint32_t i = 0;
+  while (i < analogValues.size() && analogValues[i].first != pin) i++;
+  if (peek() == TRACE_ANALOG && pos + 1 < data.size() && data[pos + 1] == pin) {
+    pos += 2;
+    if (i == analogValues.size()) analogValues.push_back(std::make_pair(pin, 0));
+    analogValues[i].second = (int)getVarint();
+  }
+  return i < analogValues.size() ? analogValues[i].second : value;
+}
+
+//tag of the next record, -1 at the end of the trace or once diverged
+int TraceReplay::peek() {
+  if (!divergence.empty()) return -1;
+  if (runLeft) return TRACE_RX;
+  return pos < data.size() ? data[pos] : -1;
+}
+
+uint32_t TraceReplay::getVarint() {
+  uint32_t v = 0;
+  for (uint32_t shift = 0; pos < data.size() && shift < 35; shift += 7) {
+    uint8_t b = data[pos++];
+    v |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) break;
+  }
+  return v;
+}
+
+//keeps the first divergence, with the tick and time it happened at
+void TraceReplay::diverge(const char* format, ...) {
+  if (!divergence.empty()) return;
+  char message[256];
+  int n = snprintf(message, sizeof(message), "tick %u (%.3fs): ", ticks, millis() / 1000.0);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message + n, sizeof(message) - n, format, args);
+  va_end(args);
+  divergence = message;
+}
@@ -0,0 +1,92 @@
+#ifndef TRACEREPLAY_HPP_
+#define TRACEREPLAY_HPP_
+
+#include "Arduino.h"
+#include "TraceRecorder.hpp"
+#include <string>
+#include <vector>
+
+/////////////////////////////////////////////////
+/// \brief A trace written by TraceRecorder, fed back to a controller on the host board.
+///
+/// The controller of the replay makes the calls the recorded one made, each call consumes the record it
+/// produced: the module port (see ReplayPort) gets the bytes the modules answered, the inputs (as the
+/// HostInputSource of the board) the levels that were read. beginTick() moves the clock to the start of
+/// the next pass of the main loop running the controller and applies the RTC, state and console records
+/// found there.
+///
+/// The first call that does not find its record (an extra call, or a different byte written to the
+/// modules) or a tick that finds records left over marks the replay as diverged, getDivergence() tells
+/// where. Past that point the replay only returns empty reads.
+/////////////////////////////////////////////////
+class TraceReplay : public HostInputSource {
+public:
+  TraceReplay();
+  bool load(const char* path);
+  void begin();
+  bool beginTick();
+  uint32_t getTicks();
+  uint8_t getState();
+  const std::string& getConsoleInput();
+  bool isDiverged();
+  const char* getDivergence();
+
+  int available();
+  int read();
+  void write(const uint8_t* buf, size_t len);
+  int digitalRead(uint8_t pin, int level);
+  int analogRead(uint8_t pin, int value);
+
+  uint32_t wheelMs;   //millis() the controller was built at
+  uint32_t beginMs;   //millis() the capture started at
+  uint32_t rtc;       //now() - millis() / 1000
+  std::vector<uint8_t> settings;  //EEPROM image of the settings
+
+private:
+  std::vector<uint8_t> data;
+  size_t pos;
+  uint32_t runLeft;  //bytes left in the RX run being read
+  uint32_t ticks;
+  uint32_t tickStart;
+  uint8_t state;
+  std::string consoleInput;
+  std::string divergence;
+  uint8_t levels[NUMBER_OF_HOST_PINS];
+  bool levelKnown[NUMBER_OF_HOST_PINS];
+  std::vector<std::pair<uint8_t, int> > analogValues;
+
+  int peek();
+  uint32_t getVarint();
+  void diverge(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+/////////////////////////////////////////////////
+/// \brief The module port of a replay, BMSDriverT<ReplayPort> is a driver talking to a trace.
+/////////////////////////////////////////////////
+class ReplayPort {
+public:
+  ReplayPort(TraceReplay* trace)
+    : trace(trace) {
+    ;
+  }
+
+  void begin(uint32_t) {}
+
+  int available() {
+    return trace->available();
+  }
+
+  int read() {
+    return trace->read();
+  }
+
+  size_t write(const uint8_t* buf, size_t len) {
+    trace->write(buf, len);
+    return len;
+  }
+
+private:
+  TraceReplay* trace;
+};
+
+#endif /* TRACEREPLAY_HPP_ */
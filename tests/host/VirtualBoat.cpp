@@ -0,0 +1,177 @@
+#include "VirtualBoat.hpp"
+
+/////////////////////////////////////////////////
+/// \brief Constructor, attaches the pack to the BMS serial port. The boat starts parked and unplugged.
+/////////////////////////////////////////////////
+VirtualBoat::VirtualBoat(Controller* controller, PackSimulator* pack, const EvccConfig& evcc)
+  : controller(controller),
+    pack(pack),
+    evcc(evcc),
+    trace(0),
+    phaseA(true),
+    nextTurn(millis()),
+    lastStep(millis()),
+    evccOn(false),
+    evccOnSince(0),
+    charging(false),
+    terminated(false),
+    chargeStart(0),
+    chargeCurrent(0) {
+  inputs.evseConnected = false;
+  inputs.run = false;
+  inputs.loadA = 0;
+  inputs.ambientC = 20.0f;
+  inputs.bat12vV = 12.8f;
+  inputs.chainBoards = SIM_MAX_MODULES;
+  SERIALBMS.attach(pack);
+
+  Settings* settings = controller->getSettingsPtr();
+  char count[12];
+  snprintf(count, sizeof(count), "%u", pack->getModuleCount());
+  settings->module_count.setVal(count);
+  if (this->evcc.maxVoltage == 0) {
+    this->evcc.maxVoltage = pack->getModuleCount() * SIM_CELLS_PER_MODULE * settings->max_charge_v_setpoint.getVal();
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief Destructor, unplugs the pack so the port can serve the next boat of the thread.
+/////////////////////////////////////////////////
+VirtualBoat::~VirtualBoat() {
+  SERIALBMS.attach(0);
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the EVCC of misc/EVCC_config.txt with a TSM2500 charger.
+/////////////////////////////////////////////////
+EvccConfig VirtualBoat::defaultEvccConfig() {
+  EvccConfig evcc;
+  evcc.maxCurrentA = 15.0f;
+  evcc.maxVoltage = 0;
+  evcc.termCurrentA = 0.5f;
+  evcc.termTimeMs = 24 * 3600000u;
+  evcc.bootMs = 3000;
+  return evcc;
+}
+
+/////////////////////////////////////////////////
+/// \brief records a tick of trace at every run of the controller.
+/////////////////////////////////////////////////
+void VirtualBoat::setTrace(TraceRecorder* trace) {
+  this->trace = trace;
+}
+
+/////////////////////////////////////////////////
+/// \brief runs one pass of the sketch main loop and steps the pack over the time it took.
+/////////////////////////////////////////////////
+void VirtualBoat::loop() {
+  uint32_t starttime = millis();
+  uint32_t at;
+  PowerManager* power = controller->getPowerPtr();
+  TimerWheel* timers = controller->getTimerWheelPtr();
+  timers->advance(starttime);
+  bool turn = (int32_t)(starttime - nextTurn) >= 0;
+  bool control = (turn && phaseA) || power->wasWokenByPin() || controller->isTimerDue();
+
+  drivePins();
+  pack->sever(inputs.chainBoards);
+  if (control && trace) trace->tick();
+  {
+    PROF_SCOPE(LOOP);
+    if (control) controller->doController();
+  }
+  if (turn || control) {
+    phaseA = !control;
+    nextTurn = starttime + controller->getPeriodMillis();
+  }
+  updateEvcc();
+  {
+    PROF_SCOPE(LOG_DRAIN);
+    controller->getLoggerPtr()->drain();
+  }
+  {
+    PROF_SCOPE(CONSOLE_TX);
+    console_out.pump();
+  }
+
+  power->requestWakeAt(nextTurn);
+  if (timers->nextExpiry(&at)) power->requestWakeAt(at);
+  power->idle();
+
+  pack->step(millis() - lastStep, getPackCurrent(), inputs.ambientC, getPumpDuty());
+  lastStep = millis();
+}
+
+/////////////////////////////////////////////////
+/// \brief sets the controller inputs from the state of the boat and of the EVCC.
+/////////////////////////////////////////////////
+void VirtualBoat::drivePins() {
+  host_board.setInput(INL_SOFT_RST, HIGH);
+  host_board.setInput(INL_BAT_PACK_FAULT, HIGH);
+  host_board.setInput(INL_BAT_MON_FAULT, HIGH);
+  host_board.setInput(INL_WATER_SENS1, HIGH);
+  host_board.setInput(INL_WATER_SENS2, HIGH);
+  host_board.setInput(INH_RUN, inputs.run ? HIGH : LOW);
+  host_board.setInput(INH_CHARGING, charging ? HIGH : LOW);
+  //OUT2 of the EVCC pulls the line low when the J1772 cable is disconnected, only while it is powered
+  host_board.setInput(INL_EVSE_DISC, evccOn && !inputs.evseConnected ? LOW : HIGH);
+  host_board.setAnalogInput(INA_12V_BAT, (int)(inputs.bat12vV * controller->getSettingsPtr()->bat12v_scaling_divisor.getVal()));
+}
+
+/////////////////////////////////////////////////
+/// \brief reacts to OUTL_EVCC_ON and OUTH_FAULT and sets the charge current.
+/////////////////////////////////////////////////
+void VirtualBoat::updateEvcc() {
+  uint32_t t = millis();
+  bool on = host_board.getOutput(OUTL_EVCC_ON) == LOW;
+  bool loopClosed = host_board.getOutput(OUTH_FAULT) == LOW;
+  float current;
+
+  if (on && !evccOn) {
+    evccOnSince = t;
+    terminated = false;
+  }
+  evccOn = on;
+
+  if (!evccOn || !inputs.evseConnected || !loopClosed || terminated || t - evccOnSince < evcc.bootMs) {
+    charging = false;
+    chargeCurrent = 0;
+    return;
+  }
+  if (!charging) {
+    charging = true;
+    chargeStart = t;
+  }
+
+  //constant current until the pack reaches maxv, then constant voltage
+  current = (evcc.maxVoltage - pack->getPackInternalVoltage()) / pack->getPackResistance();
+  if (current > evcc.maxCurrentA) current = evcc.maxCurrentA;
+  if (current < evcc.termCurrentA || t - chargeStart >= evcc.termTimeMs) {
+    terminated = true;
+    charging = false;
+    current = 0;
+  }
+  chargeCurrent = current;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the current into the pack, positive when charging.
+/////////////////////////////////////////////////
+float VirtualBoat::getPackCurrent() {
+  return chargeCurrent - (inputs.run ? inputs.loadA : 0.0f);
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the coolant pump duty set by the controller, from 0.0 to 1.0.
+/////////////////////////////////////////////////
+float VirtualBoat::getPumpDuty() {
+  return host_board.getAnalogOutput(OUTPWM_PUMP) / 255.0f;
+}
+
+bool VirtualBoat::isCharging() {
+  return charging;
+}
+
+bool VirtualBoat::isEvccOn() {
+  return evccOn;
+}
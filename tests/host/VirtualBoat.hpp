@@ -0,0 +1,84 @@
+#ifndef VIRTUALBOAT_HPP_
+#define VIRTUALBOAT_HPP_
+
+#include "Arduino.h"
+#include "Controller.hpp"
+#include "PackSimulator.hpp"
+#include "Profiler.hpp"
+#include "ConsoleOut.hpp"
+#include "TraceRecorder.hpp"
+
+/////////////////////////////////////////////////
+/// \brief The world outside the controller, changed by the scenario.
+/////////////////////////////////////////////////
+struct BoatInputs {
+  bool evseConnected;  //J1772 plug in the inlet
+  bool run;            //key switch, INH_RUN
+  float loadA;         //motor current drawn from the pack while in run
+  float ambientC;
+  float bat12vV;
+  uint32_t chainBoards;  //boards the controller reaches, the module chain is severed after them
+};
+
+/////////////////////////////////////////////////
+/// \brief Settings of the EVCC and of its charger (see misc/EVCC_config.txt).
+/////////////////////////////////////////////////
+struct EvccConfig {
+  float maxCurrentA;   //maxc, constant current phase
+  float maxVoltage;    //maxv, constant voltage phase of the pack
+  float termCurrentA;  //termc, the charge ends under this current
+  uint32_t termTimeMs; //termt, the charge ends after this time
+  uint32_t bootMs;     //time from power on to the first charge current
+};
+
+/////////////////////////////////////////////////
+/// \brief Runs the controller like teslaBMSBL.ino does and closes the loop through the boat around it.
+///
+/// Every loop() is one pass of the sketch main loop on the simulated clock: the controller runs every
+/// other period, in turn with the OLED the host does not have, or out of turn when one of its timers
+/// expired, then the power manager idles until the next turn, the next timer of the wheel or the
+/// deadline another part of the loop requested (advancing the clock). The trace given
+/// to setTrace() gets a tick every run of the controller. The EVCC then
+/// reacts to the outputs of the controller and the pack is stepped over the elapsed time.
+///
+/// The EVCC is powered while OUTL_EVCC_ON is low. Once booted, with an EVSE connected and the fault loop
+/// closed (OUTH_FAULT low) it charges at constant current then constant voltage, raising INH_CHARGING,
+/// until the current drops under termCurrentA. It only starts a new charge after a power cycle.
+///
+/// module_count is set to the number of simulated modules and, when maxVoltage is 0, the EVCC stops at
+/// max_charge_v_setpoint on every cell.
+/////////////////////////////////////////////////
+class VirtualBoat {
+public:
+  VirtualBoat(Controller* controller, PackSimulator* pack, const EvccConfig& evcc);
+  ~VirtualBoat();
+  static EvccConfig defaultEvccConfig();
+  void loop();
+  void setTrace(TraceRecorder* trace);
+  float getPackCurrent();
+  float getPumpDuty();
+  bool isCharging();
+  bool isEvccOn();
+
+  BoatInputs inputs;
+
+private:
+  Controller* controller;
+  PackSimulator* pack;
+  EvccConfig evcc;
+  TraceRecorder* trace;
+  bool phaseA;
+  uint32_t nextTurn;  //when the controller or the OLED runs next
+  uint32_t lastStep;
+  bool evccOn;
+  uint32_t evccOnSince;
+  bool charging;
+  bool terminated;
+  uint32_t chargeStart;
+  float chargeCurrent;
+
+  void drivePins();
+  void updateEvcc();
+};
+
+#endif /* VIRTUALBOAT_HPP_ */
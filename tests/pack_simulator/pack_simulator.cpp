@@ -0,0 +1,200 @@
+/**@file pack_simulator.cpp
+ * Closed loop simulation of the real controller against a simulated pack, EVCC and boat.
+ *
+ * The sketch sources are compiled as is against the host Arduino layer of tests/host, whose clock only
+ * moves when the controller idles, so hours of charge run in seconds:
+ *
+ *   g++ -O2 -std=gnu++14 -fno-rtti -I../host -I../.. -o pack_simulator pack_simulator.cpp ../host/HostBoard.cpp \
+ *       ../host/PackSimulator.cpp ../host/VirtualBoat.cpp ../host/Scenario.cpp ../../TraceRecorder.cpp ../../Config.cpp ../../StructuredWriter.cpp ../../Logger.cpp ../../ConsoleOut.cpp ../../Profiler.cpp ../../BMSDriver.cpp ../../BMSModule.cpp \
+ *       ../../Telemetry.cpp ../../TelemetryFrame.cpp \
+ *       ../../BMSModuleManager.cpp ../../Controller.cpp ../../PowerManager.cpp ../../ModulePowerManager.cpp \
+ *       ../../TimerWheel.cpp ../../CellFaultMonitor.cpp ../../FaultRegistry.cpp ../../ControllerStateMachine.cpp
+ *
+ *   ./pack_simulator [options] [scenario]
+ *     -s <seed>          draws the pack (default 1), the same seed always gives the same output
+ *     -i <seconds>       time series sample period (default 60)
+ *     -o <file>          time series output (default stdout)
+ *     -v                 prints the controller console on stderr
+ *     -l <level>         log level of the controller (0:debug .. 3:error, default 5: the console only)
+ *     -p                 prints the profile of the main loop on stderr at the end
+ *     -m <modules>       number of modules (default 7)
+ *     -c <amps>          charger maxc (default 15)
+ *     --soc <mean>       initial state of charge (default 0.3)
+ *     --set <name>=<v>   overrides a controller setting
+ *     -t <file>|pty      records a trace of the controller for trace_replay, pty writes it to a new
+ *                        pseudo terminal like a board would to its second USB serial port
+ *     -T <file>          writes the console port to file with a telemetry frame every simulated second,
+ *                        for telemetry_decoder
+ *     -w <seconds>       starts millis() the given time before it wraps around, the time series must be
+ *                        the same as without
+ *
+ * The scenario format is described in tests/host/Scenario.hpp. Without a scenario the boat is plugged
+ * in at 0 and the simulation ends at 12h (see charge.scenario for a fuller day).
+ *
+ * The time series is CSV, one line per sample period, suitable for diffing between two runs.
+ */
+#include "Arduino.h"
+#include "Scenario.hpp"
+#include "Telemetry.hpp"
+#include <chrono>
+#include <vector>
+
+static void printSample(FILE* out, Controller* controller, PackSimulator* pack, VirtualBoat* boat) {
+  fprintf(out, "%.0f,%s,%.3f,%.4f,%.4f,%.1f,%.4f,%.4f,%.3f,%.4f,%.2f,%.2f,%d,%u,%.3f,%.3f,%04x\n",
+          host_board.getUptime() / 1000.0, controller->getStateName(controller->getState()), pack->getPackVoltage(),
+          pack->getMinCellVoltage(), pack->getMaxCellVoltage(), (pack->getMaxCellVoltage() - pack->getMinCellVoltage()) * 1000.0f,
+          pack->getMinSoc(), pack->getMaxSoc(), boat->getPackCurrent(), controller->getBMSPtr()->getHighCellVolt(),
+          pack->getMaxTemp(), boat->getPumpDuty(), boat->isCharging(), pack->getBleedingCells(), pack->getBleedWh(),
+          pack->getChargedAh(), controller->faults.getActive());
+}
+
+static void usage() {
+  fprintf(stderr, "usage: pack_simulator [-s seed] [-i seconds] [-o file] [-v] [-l level] [-p] [-m modules] [-c amps] [--soc mean] [--set name=value]... [-t file|pty] [-T file] [-w seconds] [scenario]\n");
+}
+
+int main(int argc, char** argv) {
+  PackConfig config = PackSimulator::defaultConfig();
+  EvccConfig evcc = VirtualBoat::defaultEvccConfig();
+  uint32_t intervalMs = 60000;
+  uint32_t startMs = 0;
+  const char* scenarioPath = 0;
+  const char* outPath = 0;
+  const char* tracePath = 0;
+  const char* telemetryPath = 0;
+  bool profile = false;
+  std::vector<const char*> overrides;
+  Scenario scenario;
+  FILE* out = stdout;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "-s") == 0 && hasValue) {
+      config.seed = strtoul(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-i") == 0 && hasValue) {
+      intervalMs = strtoul(argv[++i], 0, 10) * 1000;
+    } else if (strcmp(argv[i], "-o") == 0 && hasValue) {
+      outPath = argv[++i];
+    } else if (strcmp(argv[i], "-v") == 0) {
+      Serial.setOutput(stderr);
+    } else if (strcmp(argv[i], "-l") == 0 && hasValue) {
+      log_inst.setLoglevel((Logger::LogLevel)atoi(argv[++i]));
+    } else if (strcmp(argv[i], "-p") == 0) {
+      profile = true;
+    } else if (strcmp(argv[i], "-m") == 0 && hasValue) {
+      config.modules = strtoul(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-c") == 0 && hasValue) {
+      evcc.maxCurrentA = strtof(argv[++i], 0);
+    } else if (strcmp(argv[i], "--soc") == 0 && hasValue) {
+      config.socMean = strtof(argv[++i], 0);
+    } else if (strcmp(argv[i], "--set") == 0 && hasValue) {
+      overrides.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "-t") == 0 && hasValue) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "-T") == 0 && hasValue) {
+      telemetryPath = argv[++i];
+    } else if (strcmp(argv[i], "-w") == 0 && hasValue) {
+      startMs = 0 - (uint32_t)strtoul(argv[++i], 0, 10) * 1000;
+    } else if (argv[i][0] != '-' && !scenarioPath) {
+      scenarioPath = argv[i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (intervalMs == 0 || config.modules == 0 || config.modules > SIM_MAX_MODULES) {
+    usage();
+    return 2;
+  }
+  if (!scenario.load(scenarioPath)) {
+    fprintf(stderr, "cannot load %s, or it has no end event\n", scenarioPath);
+    return 2;
+  }
+  if (outPath && !(out = fopen(outPath, "w"))) {
+    fprintf(stderr, "cannot open %s\n", outPath);
+    return 2;
+  }
+  FILE* traceOut = 0;
+  if (tracePath && strcmp(tracePath, "pty") == 0) {
+    const char* pty = SerialUSB1.openPty();
+    if (!pty) {
+      fprintf(stderr, "cannot open a pseudo terminal\n");
+      return 2;
+    }
+    fprintf(stderr, "trace on %s\n", pty);
+  } else if (tracePath) {
+    if (!(traceOut = fopen(tracePath, "wb"))) {
+      fprintf(stderr, "cannot open %s\n", tracePath);
+      return 2;
+    }
+    SerialUSB1.setOutput(traceOut);
+  }
+  FILE* telemetryOut = 0;
+  if (telemetryPath) {
+    if (!(telemetryOut = fopen(telemetryPath, "wb"))) {
+      fprintf(stderr, "cannot open %s\n", telemetryPath);
+      return 2;
+    }
+    Serial.setOutput(telemetryOut);
+  }
+
+  host_board.reset(1700000000, startMs);
+  static TraceRecorder trace(&SERIALTRACE);
+  static TracePort<BMSPort> port(&SERIALBMS, &trace);
+  static BMSDriverT<TracePort<BMSPort> > driver(&port, &log_inst);
+  static Controller controller(&driver, &log_inst);
+  for (uint32_t i = 0; i < overrides.size(); i++) {
+    if (!applySetting(controller.getSettingsPtr(), overrides[i])) {
+      fprintf(stderr, "cannot set %s\n", overrides[i]);
+      return 2;
+    }
+  }
+
+  PackSimulator pack(config);
+  VirtualBoat boat(&controller, &pack, evcc);
+  Telemetry telemetry(&controller, &console_out.telemetry);
+  if (telemetryPath) telemetry.setPeriod(1000);
+  if (tracePath) {
+    controller.setTrace(&trace);
+    trace.begin(&controller);
+    boat.setTrace(&trace);
+  }
+
+  uint32_t nextSample = 0;
+  uint64_t timeInState[ControllerStateMachine::NUMBER_OF_STATES] = { 0 };
+  uint32_t last = millis();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  fprintf(out, "t_s,state,pack_v,cell_min_v,cell_max_v,spread_mv,soc_min,soc_max,current_a,bms_high_cell_v,temp_max_c,pump_duty,charging,bleeding,bleed_wh,charged_ah,faults\n");
+  while (scenario.apply(&boat)) {
+    if (host_board.getUptime() >= nextSample) {
+      printSample(out, &controller, &pack, &boat);
+      nextSample += intervalMs;
+    }
+    boat.loop();
+    telemetry.tick();
+    timeInState[controller.getState()] += millis() - last;
+    last = millis();
+  }
+  printSample(out, &controller, &pack, &boat);
+  if (out != stdout) fclose(out);
+  trace.end();
+  if (traceOut) fclose(traceOut);
+  if (telemetryOut) {
+    console_out.pump();
+    fclose(telemetryOut);
+  }
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "simulated %.2fh in %.2fs (%.0fx real time), charged %.1fAh, spread %.1fmV, bleed %.2fWh\n",
+          host_board.getUptime() / 3600000.0, elapsed, host_board.getUptime() / 1000.0 / (elapsed > 0 ? elapsed : 1e-9), pack.getChargedAh(),
+          (pack.getMaxCellVoltage() - pack.getMinCellVoltage()) * 1000.0f, pack.getBleedWh());
+  for (uint32_t s = 0; s < ControllerStateMachine::NUMBER_OF_STATES; s++) {
+    fprintf(stderr, "  %-14s %8.2fh\n", controller.getStateName((ControllerStateMachine::State)s), timeInState[s] / 3600000.0);
+  }
+  if (profile) {
+    Serial.setOutput(stderr);
+    prof_inst.printStats();
+    console_out.pump();
+  }
+  return 0;
+}
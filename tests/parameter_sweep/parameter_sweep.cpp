@@ -0,0 +1,309 @@
+/**@file parameter_sweep.cpp
+ * Runs the controller against the simulated pack for every point of a grid of settings and ranks them.
+ *
+ * Built against the same host Arduino layer as the pack simulator:
+ *
+ *   g++ -O2 -std=gnu++14 -fno-rtti -I../host -I../.. -o parameter_sweep parameter_sweep.cpp \
+ *       ../host/HostBoard.cpp ../host/PackSimulator.cpp ../host/VirtualBoat.cpp ../host/Scenario.cpp \
+ *       ../../TraceRecorder.cpp ../../Config.cpp ../../StructuredWriter.cpp ../../Logger.cpp ../../ConsoleOut.cpp ../../Profiler.cpp ../../BMSDriver.cpp ../../BMSModule.cpp \
+ *       ../../BMSModuleManager.cpp ../../Controller.cpp ../../PowerManager.cpp ../../ModulePowerManager.cpp \
+ *       ../../TimerWheel.cpp ../../CellFaultMonitor.cpp ../../FaultRegistry.cpp ../../ControllerStateMachine.cpp
+ *
+ *   ./parameter_sweep [-s seed] [-j jobs] [-r time|spread|bleed] [-m modules] [-c amps] [--soc mean]
+ *                     --grid <name>=<v1>,<v2>,... | --grid <name>=<start>:<stop>:<step> ... [scenario]
+ *
+ * Every --grid adds a dimension, the points are the cartesian product of all of them. The scenario and
+ * the seed are the same for every point so the pack is identical and only the settings differ, e.g.
+ *
+ *   ./parameter_sweep --grid precision_balance_cell_v_offset=0.002:0.01:0.002 \
+ *                     --grid top_balance_v_setpoint=4.15,4.17,4.19 ../pack_simulator/charge.scenario
+ *
+ * Each point runs in its own forked process with up to -j of them at a time (all the cores by default),
+ * so a point that crashes or hangs past its end is reported as failed instead of taking the sweep down.
+ *
+ * The table is sorted on the -r metric, the others break ties:
+ *   charge_h   time from the first to the last charge current
+ *   spread_mv  cell spread at the end of the scenario
+ *   bleed_wh   energy burnt in the balancing resistors
+ */
+#include "Arduino.h"
+#include "Scenario.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Dimension {
+  std::string name;
+  std::vector<std::string> values;
+};
+
+struct Result {
+  uint32_t point;
+  uint32_t ok;
+  float chargeH;
+  float spreadMv;
+  float bleedWh;
+  float chargedAh;
+  float maxCellV;
+  uint32_t sticky;
+};
+
+enum Rank { RANK_TIME, RANK_SPREAD, RANK_BLEED };
+
+static std::vector<Dimension> grid;
+static Rank rank = RANK_SPREAD;
+
+static bool parseGrid(const char* spec, Dimension* d) {
+  const char* eq = strchr(spec, '=');
+  double start, stop, step;
+  char trailing;
+  if (!eq || eq == spec) return false;
+  d->name.assign(spec, eq - spec);
+  d->values.clear();
+
+  if (sscanf(eq + 1, "%lf:%lf:%lf%c", &start, &stop, &step, &trailing) == 3) {
+    if (step <= 0 || stop < start) return false;
+    //the half step absorbs the rounding of the last value
+    for (double v = start; v <= stop + step / 2; v += step) {
+      char value[32];
+      snprintf(value, sizeof(value), "%g", v);
+      d->values.push_back(value);
+    }
+  } else {
+    std::string list(eq + 1);
+    size_t pos = 0;
+    while (pos <= list.size()) {
+      size_t comma = list.find(',', pos);
+      if (comma == std::string::npos) comma = list.size();
+      if (comma == pos) return false;
+      d->values.push_back(list.substr(pos, comma - pos));
+      pos = comma + 1;
+    }
+  }
+  return !d->values.empty();
+}
+
+static uint32_t countPoints() {
+  uint32_t n = 1;
+  for (uint32_t i = 0; i < grid.size(); i++) n *= grid[i].values.size();
+  return n;
+}
+
+//the first dimension varies the slowest
+static const std::string& valueAt(uint32_t point, uint32_t dim) {
+  for (uint32_t i = grid.size() - 1; i > dim; i--) point /= grid[i].values.size();
+  return grid[dim].values[point % grid[dim].values.size()];
+}
+
+/////////////////////////////////////////////////
+/// \brief runs one point of the grid, in the forked child.
+/////////////////////////////////////////////////
+static Result runPoint(uint32_t point, const PackConfig& config, const EvccConfig& evcc, Scenario scenario) {
+  Result r;
+  memset(&r, 0, sizeof(r));
+  r.point = point;
+
+  host_board.reset(1700000000);
+  static BMSDriver driver(&SERIALBMS, &log_inst);
+  static Controller controller(&driver, &log_inst);
+  for (uint32_t i = 0; i < grid.size(); i++) {
+    std::string assignment = grid[i].name + "=" + valueAt(point, i);
+    if (!applySetting(controller.getSettingsPtr(), assignment.c_str())) {
+      fprintf(stderr, "point %u: cannot set %s\n", point, assignment.c_str());
+      return r;
+    }
+  }
+  PackSimulator pack(config);
+  VirtualBoat boat(&controller, &pack, evcc);
+
+  uint32_t firstCharge = 0;
+  uint32_t lastCharge = 0;
+  bool charged = false;
+  while (scenario.apply(&boat)) {
+    boat.loop();
+    if (boat.isCharging()) {
+      if (!charged) firstCharge = millis();
+      charged = true;
+      lastCharge = millis();
+    }
+    if (pack.getMaxCellVoltage() > r.maxCellV) r.maxCellV = pack.getMaxCellVoltage();
+  }
+
+  r.ok = 1;
+  r.chargeH = (lastCharge - firstCharge) / 3600000.0f;
+  r.spreadMv = (pack.getMaxCellVoltage() - pack.getMinCellVoltage()) * 1000.0f;
+  r.bleedWh = pack.getBleedWh();
+  r.chargedAh = pack.getChargedAh();
+  r.sticky = controller.faults.getSticky();
+  return r;
+}
+
+static float metric(const Result& r, Rank k) {
+  return k == RANK_TIME ? r.chargeH : k == RANK_SPREAD ? r.spreadMv : r.bleedWh;
+}
+
+static bool better(const Result& a, const Result& b) {
+  static const Rank order[3][3] = {
+    { RANK_TIME, RANK_SPREAD, RANK_BLEED },
+    { RANK_SPREAD, RANK_TIME, RANK_BLEED },
+    { RANK_BLEED, RANK_SPREAD, RANK_TIME },
+  };
+  //failed points and points that tripped a fault sink to the bottom
+  bool aClean = a.ok && !a.sticky;
+  bool bClean = b.ok && !b.sticky;
+  if (aClean != bClean) return aClean;
+  for (uint32_t i = 0; i < 3; i++) {
+    float ma = metric(a, order[rank][i]);
+    float mb = metric(b, order[rank][i]);
+    if (ma != mb) return ma < mb;
+  }
+  return a.point < b.point;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: parameter_sweep [-s seed] [-j jobs] [-r time|spread|bleed] [-m modules] [-c amps] [--soc mean]\n"
+                  "                       --grid name=v1,v2,...|name=start:stop:step ... [scenario]\n");
+}
+
+int main(int argc, char** argv) {
+  PackConfig config = PackSimulator::defaultConfig();
+  EvccConfig evcc = VirtualBoat::defaultEvccConfig();
+  const char* scenarioPath = 0;
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  Scenario scenario;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "-s") == 0 && hasValue) {
+      config.seed = strtoul(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-j") == 0 && hasValue) {
+      jobs = strtol(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-r") == 0 && hasValue) {
+      const char* k = argv[++i];
+      if (strcmp(k, "time") == 0) {
+        rank = RANK_TIME;
+      } else if (strcmp(k, "spread") == 0) {
+        rank = RANK_SPREAD;
+      } else if (strcmp(k, "bleed") == 0) {
+        rank = RANK_BLEED;
+      } else {
+        usage();
+        return 2;
+      }
+    } else if (strcmp(argv[i], "-m") == 0 && hasValue) {
+      config.modules = strtoul(argv[++i], 0, 10);
+    } else if (strcmp(argv[i], "-c") == 0 && hasValue) {
+      evcc.maxCurrentA = strtof(argv[++i], 0);
+    } else if (strcmp(argv[i], "--soc") == 0 && hasValue) {
+      config.socMean = strtof(argv[++i], 0);
+    } else if (strcmp(argv[i], "--grid") == 0 && hasValue) {
+      Dimension d;
+      if (!parseGrid(argv[++i], &d)) {
+        fprintf(stderr, "bad grid %s\n", argv[i]);
+        return 2;
+      }
+      grid.push_back(d);
+    } else if (argv[i][0] != '-' && !scenarioPath) {
+      scenarioPath = argv[i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (grid.empty() || jobs < 1 || config.modules == 0 || config.modules > SIM_MAX_MODULES) {
+    usage();
+    return 2;
+  }
+  if (!scenario.load(scenarioPath)) {
+    fprintf(stderr, "cannot load %s, or it has no end event\n", scenarioPath);
+    return 2;
+  }
+
+  //reject a bad name or an out of range value once rather than in every child
+  Settings check;
+  for (uint32_t i = 0; i < grid.size(); i++) {
+    for (uint32_t v = 0; v < grid[i].values.size(); v++) {
+      std::string assignment = grid[i].name + "=" + grid[i].values[v];
+      if (!applySetting(&check, assignment.c_str())) {
+        fprintf(stderr, "cannot set %s\n", assignment.c_str());
+        return 2;
+      }
+    }
+  }
+
+  uint32_t points = countPoints();
+  std::vector<Result> results(points);
+  std::vector<int> pipes(points, -1);
+  std::vector<pid_t> pids(points, 0);
+  uint32_t started = 0;
+  uint32_t done = 0;
+  long running = 0;
+
+  fprintf(stderr, "%u points on %ld jobs\n", points, jobs);
+  while (done < points) {
+    while (running < jobs && started < points) {
+      int fd[2];
+      if (pipe(fd) != 0) {
+        perror("pipe");
+        return 1;
+      }
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        return 1;
+      }
+      if (pid == 0) {
+        close(fd[0]);
+        //a hung controller would stall the sweep, give it a minute per simulated day
+        alarm(60 + scenario.getEndMs() / 1440000);
+        Result r = runPoint(started, config, evcc, scenario);
+        if (write(fd[1], &r, sizeof(r)) != sizeof(r)) _exit(1);
+        _exit(0);
+      }
+      close(fd[1]);
+      pipes[started] = fd[0];
+      pids[started] = pid;
+      started++;
+      running++;
+    }
+
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      if (errno == EINTR) continue;
+      perror("wait");
+      return 1;
+    }
+    for (uint32_t p = 0; p < started; p++) {
+      if (pids[p] != pid) continue;
+      //the result is smaller than the pipe buffer, it is already there when the child exits
+      if (read(pipes[p], &results[p], sizeof(Result)) != sizeof(Result)) {
+        memset(&results[p], 0, sizeof(Result));
+        results[p].point = p;
+        fprintf(stderr, "point %u failed (%s %d)\n", p, WIFSIGNALED(status) ? "signal" : "exit",
+                WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+      }
+      close(pipes[p]);
+      pids[p] = 0;
+      done++;
+      running--;
+      break;
+    }
+  }
+
+  std::sort(results.begin(), results.end(), better);
+  printf("rank,");
+  for (uint32_t i = 0; i < grid.size(); i++) printf("%s,", grid[i].name.c_str());
+  printf("charge_h,spread_mv,bleed_wh,charged_ah,max_cell_v,sticky_faults,ok\n");
+  for (uint32_t i = 0; i < results.size(); i++) {
+    const Result& r = results[i];
+    printf("%u,", i + 1);
+    for (uint32_t d = 0; d < grid.size(); d++) printf("%s,", valueAt(r.point, d).c_str());
+    printf("%.2f,%.1f,%.2f,%.1f,%.4f,%04x,%u\n", r.chargeH, r.spreadMv, r.bleedWh, r.chargedAh, r.maxCellV, r.sticky, r.ok);
+  }
+  return 0;
+}
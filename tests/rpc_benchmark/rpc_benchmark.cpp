@@ -0,0 +1,192 @@
+/**@file rpc_benchmark.cpp
+ * Measures the RPC channel of the console: requests per second, bytes per second and the round trip time,
+ * for a few requests and as many requests on their way at once.
+ *
+ *   g++ -O2 -std=gnu++14 -fno-rtti -pthread -I../host -I../.. -I../rpc_client -o rpc_benchmark rpc_benchmark.cpp \
+ *       ../rpc_client/RpcClient.cpp ../host/HostBoard.cpp ../host/PackSimulator.cpp ../host/VirtualBoat.cpp \
+ *       ../../TraceRecorder.cpp ../../Cons.cpp ../../CellGraph.cpp ../../Dashboard.cpp ../../Telemetry.cpp \
+ *       ../../TelemetryFrame.cpp ../../RpcServer.cpp ../../Config.cpp ../../StructuredWriter.cpp ../../Logger.cpp \
+ *       ../../ConsoleOut.cpp ../../Profiler.cpp ../../BMSDriver.cpp ../../BMSModule.cpp ../../BMSModuleManager.cpp \
+ *       ../../Controller.cpp ../../PowerManager.cpp ../../ModulePowerManager.cpp ../../TimerWheel.cpp ../../WatchTable.cpp \
+ *       ../../CellFaultMonitor.cpp ../../FaultRegistry.cpp ../../ControllerStateMachine.cpp
+ *
+ *   ./rpc_benchmark [-d seconds] [-l] [-t] [-p]
+ *
+ * A thread is the board: a controller on a simulated pack, its telemetry, RPC server and console, run as
+ * the main loop of the sketch runs them, with the console port on a pseudo terminal. -l logs at the Info
+ * level and -t sends the telemetry every 100 ms, both interleaved with the responses as on the board.
+ * -p prints the path of the terminal and keeps the board running, for rpc_client or a terminal.
+ *
+ * The main thread is the host. It keeps 1, 4 then 16 requests on their way for the duration given (1 s by
+ * default) and sends the next one as every response comes. The table gives the requests answered per
+ * second, the response payloads per second and the round trip times; the simulated pack runs faster than
+ * real time, the board spends no time sleeping. A request unanswered for 200 ms is counted lost.
+ */
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Cons.hpp"
+#include "RpcClient.hpp"
+#include "VirtualBoat.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <thread>
+
+#define LOST_AFTER_MS 200
+
+static std::atomic<bool> stopBoard(false);
+
+/////////////////////////////////////////////////
+/// \brief runs a board until stopBoard, the path of its console goes to pty once it serves.
+/////////////////////////////////////////////////
+static void runBoard(bool log, bool telemetryOn, std::promise<std::string>* pty) {
+  host_board.reset(1700000000);
+  memset(EEPROM.mem, 0, sizeof(EEPROM.mem));
+  Logger logger(&console_out.reply, &console_out.log);
+  logger.setLoglevel(log ? Logger::Info : Logger::Off);
+  BMSDriver driver(&SERIALBMS, &logger);
+  std::unique_ptr<Controller> controller(new Controller(&driver, &logger));
+  PackSimulator pack(PackSimulator::defaultConfig());
+  VirtualBoat boat(controller.get(), &pack, VirtualBoat::defaultEvccConfig());
+  Telemetry telemetry(controller.get(), &console_out.telemetry);
+  RpcServer rpc(controller.get(), &telemetry, &console_out.rpc);
+  Cons cons(controller.get(), 0, &telemetry, &rpc);
+
+  //a minute of the pack first, the modules are read and their history is filled
+  uint32_t start = millis();
+  while (millis() - start < 60000) boat.loop();
+  const char* path = Serial.openPty();
+  pty->set_value(path ? path : "");
+  if (!path) return;
+  if (telemetryOn) telemetry.setPeriod(100, 10);
+  while (!stopBoard) {
+    boat.loop();
+    cons.doConsole();
+    telemetry.tick();
+    console_out.pump();
+  }
+}
+
+struct Result {
+  uint32_t answered;
+  uint32_t errors;
+  uint32_t lost;
+  uint64_t bytes;
+  std::vector<double> latencyUs;
+};
+
+/////////////////////////////////////////////////
+/// \brief keeps depth requests on their way for seconds.
+/////////////////////////////////////////////////
+static void run(RpcClient* client, uint8_t method, const std::string& payload, int depth, double seconds, Result* r) {
+  typedef std::chrono::steady_clock Clock;
+  std::map<uint16_t, Clock::time_point> outstanding;
+  Clock::time_point end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+  RpcResponse response;
+
+  r->answered = r->errors = r->lost = 0;
+  r->bytes = 0;
+  r->latencyUs.clear();
+  while (Clock::now() < end) {
+    while ((int)outstanding.size() < depth) outstanding[client->send(method, payload.data(), payload.size())] = Clock::now();
+    if (!client->receive(&response, LOST_AFTER_MS)) {
+      r->lost += outstanding.size();
+      outstanding.clear();
+      continue;
+    }
+    std::map<uint16_t, Clock::time_point>::iterator i = outstanding.find(response.id);
+    if (i == outstanding.end()) continue;  //a response to a request already counted lost
+    r->latencyUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - i->second).count());
+    outstanding.erase(i);
+    r->answered++;
+    r->bytes += response.payload.size();
+    if (response.status != RPC_OK || (method == RPC_PING && std::string(response.payload.begin(), response.payload.end()) != payload)) r->errors++;
+  }
+  //the responses still on their way, not to be taken for those of the next run
+  while (!outstanding.empty() && client->receive(&response, LOST_AFTER_MS)) outstanding.erase(response.id);
+}
+
+static double percentile(std::vector<double>* v, double p) {
+  if (v->empty()) return 0;
+  std::sort(v->begin(), v->end());
+  return (*v)[std::min(v->size() - 1, (size_t)(p * v->size()))];
+}
+
+int main(int argc, char** argv) {
+  static const int depths[] = { 1, 4, 16 };
+  double seconds = 1.0;
+  bool log = false;
+  bool telemetryOn = false;
+  bool serve = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0) {
+      log = true;
+    } else if (strcmp(argv[i], "-t") == 0) {
+      telemetryOn = true;
+    } else if (strcmp(argv[i], "-p") == 0) {
+      serve = true;
+    } else {
+      fprintf(stderr, "usage: rpc_benchmark [-d seconds] [-l] [-t] [-p]\n");
+      return 2;
+    }
+  }
+
+  std::promise<std::string> pty;
+  std::future<std::string> path = pty.get_future();
+  std::thread board(runBoard, log, telemetryOn, &pty);
+  std::string name = path.get();
+  int fd = name.empty() ? -1 : RpcClient::openPort(name.c_str());
+  if (fd < 0) {
+    fprintf(stderr, "cannot open a pseudo terminal\n");
+    stopBoard = true;
+    board.join();
+    return 2;
+  }
+  if (serve) {
+    fprintf(stderr, "board on %s\n", name.c_str());
+    board.join();
+    return 0;
+  }
+
+  struct Request {
+    const char* name;
+    uint8_t method;
+    std::string payload;
+  };
+  const Request requests[] = {
+    { "ping", RPC_PING, "0123456789abcdef" },
+    { "snapshot", RPC_SNAPSHOT, "" },
+    { "get_param", RPC_GET_PARAM, "over_v_setpoint" },
+    { "history", RPC_HISTORY, "" },
+  };
+  RpcClient client(fd);
+  RpcResponse response;
+  int failed = 0;
+  if (!client.call(RPC_PING, "", 0, &response)) {
+    fprintf(stderr, "no response from the board\n");
+    failed = 1;
+  }
+
+  printf("%-10s | %5s | %9s | %8s | %8s | %8s | %8s | %6s | %6s\n", "request", "depth", "req/s", "MB/s", "p50 us", "p99 us", "max us", "errors", "lost");
+  for (size_t k = 0; k < sizeof(requests) / sizeof(requests[0]) && !failed; k++) {
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+      Result r;
+      run(&client, requests[k].method, requests[k].payload, depths[d], seconds, &r);
+      double p50 = percentile(&r.latencyUs, 0.5);
+      double p99 = percentile(&r.latencyUs, 0.99);
+      double max = r.latencyUs.empty() ? 0 : r.latencyUs.back();
+      printf("%-10s | %5d | %9.0f | %8.2f | %8.0f | %8.0f | %8.0f | %6u | %6u\n", requests[k].name, depths[d], r.answered / seconds,
+             r.bytes / seconds / 1e6, p50, p99, max, r.errors, r.lost);
+      if (r.errors || r.answered == 0) failed = 1;
+    }
+  }
+  if (client.getCorrupt()) printf("%llu corrupt responses\n", (unsigned long long)client.getCorrupt());
+  stopBoard = true;
+  board.join();
+  return failed;
+}
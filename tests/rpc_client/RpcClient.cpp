@@ -0,0 +1,256 @@
+#include "RpcClient.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+
+static const char* const statusNames[] = { "ok", "unknown method", "bad argument", "not found", "value refused",
+                                           "not saved", "too large", "unavailable" };
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the port fd is read and written raw. What is not a response goes to text, if given.
+/////////////////////////////////////////////////
+RpcClient::RpcClient(int fd, FILE* text)
+  : fd(fd),
+    text(text),
+    nextId(1),
+    used(0),
+    overflow(false),
+    corrupt(0) {
+}
+
+/////////////////////////////////////////////////
+/// \brief opens the console port of a board, or the pseudo terminal of a host board, as a raw port.
+///
+/// @return the fd, -1 on failure.
+/////////////////////////////////////////////////
+int RpcClient::openPort(const char* path) {
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  struct termios raw;
+  if (fd < 0) return -1;
+  if (tcgetattr(fd, &raw) == 0) {
+    cfmakeraw(&raw);
+    tcsetattr(fd, TCSANOW, &raw);
+  }
+  return fd;
+}
+
+/////////////////////////////////////////////////
+/// \brief writes a request.
+///
+/// @return the id of the request, its response carries it.
+/////////////////////////////////////////////////
+uint16_t RpcClient::send(uint8_t method, const void* payload, size_t length) {
+  uint8_t request[RPC_MAX_REQUEST_SIZE];
+  uint8_t encoded[RPC_MAX_ENCODED_REQUEST_SIZE];
+  uint16_t id = nextId++;
+  if (length > RPC_MAX_REQUEST_PAYLOAD) length = RPC_MAX_REQUEST_PAYLOAD;
+  request[RPC_KIND] = RPC_REQUEST;
+  TelemetryFrame::put16(request + RPC_ID, id);
+  request[RPC_METHOD] = method;
+  if (length) memcpy(request + RPC_PAYLOAD, payload, length);
+  length += RPC_HEADER_SIZE;
+  TelemetryFrame::put16(request + length, TelemetryFrame::crc16(request, length));
+  size_t n = TelemetryFrame::encode(request, length + RPC_CRC_SIZE, encoded);
+  for (size_t done = 0; done < n;) {
+    ssize_t w = write(fd, encoded + done, n - done);
+    if (w < 0 && errno != EINTR) break;
+    if (w > 0) done += w;
+  }
+  return id;
+}
+
+/////////////////////////////////////////////////
+/// \brief waits up to timeoutMs for the next response.
+/////////////////////////////////////////////////
+bool RpcClient::receive(RpcResponse* response, int timeoutMs) {
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  uint8_t buffer[4096];
+  while (received.empty()) {
+    int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    struct pollfd fds = { fd, POLLIN, 0 };
+    if (left < 0 || poll(&fds, 1, left) <= 0) return false;
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0) return false;
+    feed(buffer, n);
+  }
+  *response = received.front();
+  received.pop_front();
+  return true;
+}
+
+/////////////////////////////////////////////////
+/// \brief sends a request and waits for its response, up to tries times. The responses of earlier
+/// requests that come in the meantime are dropped.
+/////////////////////////////////////////////////
+bool RpcClient::call(uint8_t method, const void* payload, size_t length, RpcResponse* response, int timeoutMs, int tries) {
+  for (int t = 0; t < tries; t++) {
+    uint16_t id = send(method, payload, length);
+    while (receive(response, timeoutMs)) {
+      if (response->id == id) return true;
+    }
+  }
+  return false;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of responses dropped because their CRC was wrong.
+/////////////////////////////////////////////////
+uint64_t RpcClient::getCorrupt() {
+  return corrupt;
+}
+
+const char* RpcClient::getStatusName(uint8_t status) {
+  return status < sizeof(statusNames) / sizeof(statusNames[0]) ? statusNames[status] : "unknown status";
+}
+
+void RpcClient::feed(const uint8_t* data, size_t length) {
+  while (length) {
+    const uint8_t* zero = (const uint8_t*)memchr(data, 0, length);
+    size_t n = zero ? zero - data : length;
+
+    if (!overflow && used + n > sizeof(part)) {
+      if (text) fwrite(part, 1, used, text);
+      used = 0;
+      overflow = true;
+    }
+    if (overflow) {
+      if (text) fwrite(data, 1, n, text);
+    } else {
+      memcpy(part + used, data, n);
+      used += n;
+    }
+    if (!zero) return;
+    endPart();
+    data += n + 1;
+    length -= n + 1;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief queues the part cut at a zero byte if it is a response, passes it on as text otherwise.
+/////////////////////////////////////////////////
+void RpcClient::endPart() {
+  uint8_t frame[RPC_MAX_RESPONSE_SIZE];
+  size_t length = overflow ? 0 : TelemetryFrame::decode(part, used, frame, sizeof(frame));
+  if (length >= RPC_HEADER_SIZE + RPC_CRC_SIZE && frame[RPC_KIND] == RPC_RESPONSE) {
+    if (TelemetryFrame::crc16(frame, length - RPC_CRC_SIZE) == TelemetryFrame::get16(frame + length - RPC_CRC_SIZE)) {
+      RpcResponse response;
+      response.id = TelemetryFrame::get16(frame + RPC_ID);
+      response.status = frame[RPC_STATUS];
+      response.payload.assign(frame + RPC_PAYLOAD, frame + length - RPC_CRC_SIZE);
+      received.push_back(response);
+    } else {
+      corrupt++;
+    }
+  } else if (!overflow && text) {
+    fwrite(part, 1, used, text);
+  }
+  used = 0;
+  overflow = false;
+}
+
+/////////////////////////////////////////////////
+/// \brief converts a CBOR document of the board, as StructuredWriter writes them, to a line of JSON.
+///
+/// @return false if the document is not well formed or holds what StructuredWriter never writes.
+/////////////////////////////////////////////////
+bool RpcClient::cborToJson(const uint8_t* data, size_t length, std::string* json) {
+  json->clear();
+  return cborItem(data, length, 0, json) == length;
+}
+
+/////////////////////////////////////////////////
+/// \brief converts the item at of a CBOR document.
+///
+/// @return where the next item starts, 0 if the item is not well formed.
+/////////////////////////////////////////////////
+size_t RpcClient::cborItem(const uint8_t* data, size_t length, size_t at, std::string* json) {
+  char number[32];
+  if (at >= length) return 0;
+  uint8_t major = data[at] >> 5;
+  uint8_t info = data[at] & 0x1f;
+  uint64_t value = info;
+  size_t size = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : info == 27 ? 8 : 0;
+  if (info > 27 && info != 31) return 0;
+  if (at + 1 + size > length) return 0;
+  if (size) {
+    value = 0;
+    for (size_t i = 0; i < size; i++) value = value << 8 | data[at + 1 + i];
+  }
+  at += 1 + size;
+
+  switch (major) {
+    case 0:
+      snprintf(number, sizeof(number), "%llu", (unsigned long long)value);
+      *json += number;
+      return at;
+    case 1:
+      snprintf(number, sizeof(number), "-%llu", (unsigned long long)value + 1);
+      *json += number;
+      return at;
+    case 3:
+      if (info == 31 || at + value > length) return 0;
+      *json += '"';
+      for (size_t i = 0; i < value; i++) {
+        unsigned char c = data[at + i];
+        if (c == '"' || c == '\\') {
+          *json += '\\';
+          *json += (char)c;
+        } else if (c < 0x20) {
+          snprintf(number, sizeof(number), "\\u%04x", c);
+          *json += number;
+        } else {
+          *json += (char)c;
+        }
+      }
+      *json += '"';
+      return at + value;
+    case 4:
+    case 5: {
+      bool map = major == 5;
+      *json += map ? '{' : '[';
+      for (uint64_t i = 0; info == 31 ? (at < length && data[at] != 0xff) : i < value; i++) {
+        if (i) *json += ',';
+        if (!(at = cborItem(data, length, at, json))) return 0;
+        if (map) {
+          *json += ':';
+          if (!(at = cborItem(data, length, at, json))) return 0;
+        }
+      }
+      if (info == 31) {
+        if (at >= length) return 0;
+        at++;  //the break
+      }
+      *json += map ? '}' : ']';
+      return at;
+    }
+    case 6:
+      return cborItem(data, length, at, json);
+    case 7:
+      if (info == 20 || info == 21) {
+        *json += info == 21 ? "true" : "false";
+      } else if (info == 22) {
+        *json += "null";
+      } else if (info == 26) {
+        uint32_t bits = value;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        if (!isfinite(f)) {
+          *json += "null";
+        } else {
+          snprintf(number, sizeof(number), "%.9g", (double)f);
+          *json += number;
+        }
+      } else {
+        return 0;
+      }
+      return at;
+    default:
+      return 0;
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef RPCCLIENT_HPP_
+#define RPCCLIENT_HPP_
+
+#include "RpcFrame.hpp"
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+/////////////////////////////////////////////////
+/// \brief A response of the board, see RpcFrame.hpp.
+/////////////////////////////////////////////////
+struct RpcResponse {
+  uint16_t id;
+  uint8_t status;
+  std::vector<uint8_t> payload;
+};
+
+/////////////////////////////////////////////////
+/// \brief Talks to the RPC server of a board over its console port.
+///
+/// send() writes a request and returns at once, so several requests may be on their way; receive() waits
+/// for the next response. call() does both for a single request and sends it again when no response came
+/// in time: a request whose frame was corrupted is dropped by the board. The port is read in chunks and
+/// cut at the zero bytes like TelemetryDecoder does; what is not a response, the console text, its CBOR
+/// replies and the telemetry frames, goes to the text file given.
+/////////////////////////////////////////////////
+class RpcClient {
+public:
+  RpcClient(int fd, FILE* text = 0);
+  static int openPort(const char* path);
+  uint16_t send(uint8_t method, const void* payload, size_t length);
+  bool receive(RpcResponse* response, int timeoutMs);
+  bool call(uint8_t method, const void* payload, size_t length, RpcResponse* response, int timeoutMs = 500, int tries = 3);
+  uint64_t getCorrupt();
+  static const char* getStatusName(uint8_t status);
+  static bool cborToJson(const uint8_t* data, size_t length, std::string* json);
+
+private:
+  int fd;
+  FILE* text;
+  uint16_t nextId;
+  uint8_t part[RPC_MAX_ENCODED_RESPONSE_SIZE];
+  size_t used;
+  bool overflow;  //the part outgrew a response and is text
+  std::deque<RpcResponse> received;
+  uint64_t corrupt;
+
+  void feed(const uint8_t* data, size_t length);
+  void endPart();
+  static size_t cborItem(const uint8_t* data, size_t length, size_t at, std::string* json);
+};
+
+#endif /* RPCCLIENT_HPP_ */
@@ -0,0 +1,118 @@
+/**@file rpc_client.cpp
+ * Sends a request to the RPC server of a board on its console port (see RpcFrame.hpp) and prints the response.
+ *
+ *   g++ -O2 -std=gnu++14 -I../.. -I../telemetry_decoder -o rpc_client rpc_client.cpp RpcClient.cpp \
+ *       ../telemetry_decoder/TelemetryDecoder.cpp ../../TelemetryFrame.cpp
+ *
+ *   ./rpc_client [-t timeout_ms] <port> <request>
+ *     ping [text]            the text back and the round trip time
+ *     snapshot               the telemetry frame of the last tick, a CSV line and a line per module
+ *     get <name>             a parameter, as the config command lists it
+ *     set <name> <value>     sets a parameter and saves the settings
+ *     stats profiler|power|console
+ *     history                the historic extremes of the pack and the sticky faults
+ *
+ * The port is the USB serial port of a board or the pseudo terminal of rpc_benchmark. The documents are
+ * printed as a line of JSON. The console text and the telemetry frames on the port are ignored, the
+ * console stays usable from a terminal at the same time. Returns 1 when the board answered with an error,
+ * 2 when it did not answer.
+ */
+#include "RpcClient.hpp"
+#include "TelemetryDecoder.hpp"
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage() {
+  fprintf(stderr, "usage: rpc_client [-t timeout_ms] <port> ping [text] | snapshot | get <name> | set <name> <value> |\n"
+                  "                  stats profiler|power|console | history\n");
+}
+
+int main(int argc, char** argv) {
+  static const char* const stats[] = { "profiler", "power", "console" };
+  int timeoutMs = 500;
+  int i = 1;
+  if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+    timeoutMs = atoi(argv[2]);
+    i = 3;
+  }
+  if (argc - i < 2) {
+    usage();
+    return 2;
+  }
+  const char* path = argv[i++];
+  const char* request = argv[i++];
+  int args = argc - i;
+  uint8_t method;
+  std::string payload;
+
+  if (strcmp(request, "ping") == 0 && args <= 1) {
+    method = RPC_PING;
+    if (args) payload = argv[i];
+  } else if (strcmp(request, "snapshot") == 0 && args == 0) {
+    method = RPC_SNAPSHOT;
+  } else if (strcmp(request, "get") == 0 && args == 1) {
+    method = RPC_GET_PARAM;
+    payload = argv[i];
+  } else if (strcmp(request, "set") == 0 && args == 2) {
+    method = RPC_SET_PARAM;
+    payload = argv[i];
+    payload += '\0';
+    payload += argv[i + 1];
+  } else if (strcmp(request, "stats") == 0 && args == 1) {
+    method = RPC_STATS;
+    for (uint8_t s = 0; s < sizeof(stats) / sizeof(stats[0]); s++) {
+      if (strcmp(argv[i], stats[s]) == 0) payload = std::string(1, (char)s);
+    }
+    if (payload.empty()) {
+      usage();
+      return 2;
+    }
+  } else if (strcmp(request, "history") == 0 && args == 0) {
+    method = RPC_HISTORY;
+  } else {
+    usage();
+    return 2;
+  }
+
+  int fd = RpcClient::openPort(path);
+  if (fd < 0) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 2;
+  }
+  RpcClient client(fd);
+  RpcResponse response;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (!client.call(method, payload.data(), payload.size(), &response, timeoutMs)) {
+    fprintf(stderr, "no response from %s\n", path);
+    return 2;
+  }
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  if (response.status != RPC_OK) {
+    fprintf(stderr, "%s: %s\n", request, RpcClient::getStatusName(response.status));
+    return 1;
+  }
+
+  std::string json;
+  if (method == RPC_PING) {
+    printf("%.*s\n%.3f ms\n", (int)response.payload.size(), (const char*)response.payload.data(), ms);
+  } else if (method == RPC_SNAPSHOT) {
+    //the frame goes through the decoder of the telemetry stream, encoded as it would have been sent
+    std::vector<uint8_t> encoded(response.payload.size() + response.payload.size() / 254 + 3);
+    TelemetryCsvWriter csv(stdout, stdout);
+    TelemetryDecoder decoder(&csv);
+    decoder.feed(encoded.data(), TelemetryFrame::encode(response.payload.data(), response.payload.size(), encoded.data()));
+    if (decoder.getFrames() != 1) {
+      fprintf(stderr, "the snapshot is not a telemetry frame\n");
+      return 1;
+    }
+  } else if (method == RPC_SET_PARAM) {
+    printf("%s set\n", argv[i]);
+  } else if (RpcClient::cborToJson(response.payload.data(), response.payload.size(), &json)) {
+    printf("%s\n", json.c_str());
+  } else {
+    fprintf(stderr, "the response is not a CBOR document\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,278 @@
+/**@file state_machine_replay.cpp
+ * Host harness for the controller state machine tables.
+ *
+ * Only ControllerStateMachine is compiled, the guards work on input snapshots so no hardware is needed:
+ *
+ *   g++ -O2 -std=gnu++14 -I../.. state_machine_replay.cpp ../../ControllerStateMachine.cpp -o state_machine_replay
+ *
+ *   ./state_machine_replay                  exhaustive check of every state against every input snapshot
+ *   ./state_machine_replay fuzz [N] [seed]  replays N random input traces with random tick periods
+ *   ./state_machine_replay replay <file>    replays a trace, one "dt_ms run charging evse_disc cycle top" per line
+ *
+ * Returns 0 when all the properties hold.
+ */
+#include "ControllerStateMachine.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+typedef ControllerStateMachine SM;
+
+static const uint32_t NUMBER_OF_INPUTS = 8;
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+  do { \
+    if (!(cond)) { \
+      failures++; \
+      printf("FAIL: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+    } \
+  } while (0)
+
+static SM::Inputs makeInputs(uint32_t bits) {
+  SM::Inputs in;
+  in.run = bits & 0x01;
+  in.charging = bits & 0x02;
+  in.evseDisconnected = bits & 0x04;
+  in.chargeCycleNeeded = bits & 0x08;
+  in.topBalanceReached = bits & 0x10;
+  in.stateTimerExpired = bits & 0x20;
+  in.stateTimeoutExpired = bits & 0x40;
+  in.disconnectDebounced = bits & 0x80;
+  return in;
+}
+
+/////////////////////////////////////////////////
+/// \brief Mirrors the timer handling of the Controller on a simulated clock.
+/////////////////////////////////////////////////
+class Replay {
+public:
+  Replay(SM* sm)
+    : sm(sm),
+      now(0),
+      state(SM::INIT),
+      enteredAt(0),
+      disconnectSince(0),
+      disconnectHeld(false),
+      debounceArmed(false),
+      debounceDeadline(0),
+      transitions(0) {
+    arm();
+  }
+
+  /////////////////////////////////////////////////
+  /// \brief runs one controller tick dt milliseconds after the previous one and checks the timing properties.
+  /////////////////////////////////////////////////
+  void tick(uint32_t dt, bool run, bool charging, bool evseDisc, bool cycle, bool top, bool verbose) {
+    SM::Inputs in;
+    bool disconnected = evseDisc || !charging;
+    const SM::Transition* t;
+    uint32_t inState;
+
+    now += dt;
+    if (disconnected && !disconnectHeld) disconnectSince = now;
+    disconnectHeld = disconnected;
+
+    in.run = run;
+    in.charging = charging;
+    in.evseDisconnected = evseDisc;
+    in.chargeCycleNeeded = cycle;
+    in.topBalanceReached = top;
+    in.stateTimerExpired = stateDeadline && now >= stateDeadline;
+    in.stateTimeoutExpired = timeoutDeadline && now >= timeoutDeadline;
+    if (!disconnected) {
+      debounceArmed = false;
+    } else if (!debounceArmed) {
+      debounceArmed = true;
+      debounceDeadline = now + SM::CHARGE_DISCONNECT_DEBOUNCE_MS;
+    }
+    in.disconnectDebounced = debounceArmed && now >= debounceDeadline;
+
+    t = sm->next(state, in);
+    inState = now - enteredAt;
+    if (state == SM::PRE_CHARGE && sm->getStateDef(state).timeoutMs) {
+      CHECK(inState < sm->getStateDef(state).timeoutMs + dt, "PRE_CHARGE lasted %ums", inState);
+    }
+    if (!t) return;
+
+    if (t->to == SM::POST_CHARGE && (state == SM::CHARGING || state == SM::TOP_BALANCING) && sm->getStateDef(state).minTimeMs == 0) {
+      CHECK(disconnected && now - disconnectSince >= SM::CHARGE_DISCONNECT_DEBOUNCE_MS,
+            "%s left after a %ums disconnect", sm->getStateDef(state).name, (unsigned)(disconnected ? now - disconnectSince : 0));
+    }
+    if (sm->getStateDef(state).minTimeMs) {
+      //a transition that is not taken without the state timer must wait for it
+      SM::Inputs early = in;
+      early.stateTimerExpired = false;
+      if (sm->next(state, early) != t) {
+        CHECK(inState >= sm->getStateDef(state).minTimeMs, "%s left after %ums", sm->getStateDef(state).name, inState);
+      }
+    }
+    if (verbose) {
+      printf("%10llu ms: %s -> %s%s", (unsigned long long)now, sm->getStateDef(state).name, sm->getStateDef(t->to).name, t->error ? " error: " : "\n");
+      if (t->error) printf("%s", t->error);
+    }
+    state = t->to;
+    enteredAt = now;
+    debounceArmed = false;
+    transitions++;
+    arm();
+  }
+
+  uint64_t getTransitions() {
+    return transitions;
+  }
+
+  uint64_t getNow() {
+    return now;
+  }
+
+private:
+  SM* sm;
+  uint64_t now;
+  SM::State state;
+  uint64_t enteredAt;
+  uint64_t stateDeadline;
+  uint64_t timeoutDeadline;
+  uint64_t disconnectSince;
+  bool disconnectHeld;
+  bool debounceArmed;
+  uint64_t debounceDeadline;
+  uint64_t transitions;
+
+  void arm() {
+    const SM::StateDef& def = sm->getStateDef(state);
+    stateDeadline = def.minTimeMs ? now + def.minTimeMs : 0;
+    timeoutDeadline = def.timeoutMs ? now + def.timeoutMs : 0;
+  }
+};
+
+/////////////////////////////////////////////////
+/// \brief checks every state against all the 2^8 input snapshots and the reachability of the states.
+/////////////////////////////////////////////////
+static void exhaustive(bool cycling) {
+  SM sm(cycling);
+  bool edge[SM::NUMBER_OF_STATES][SM::NUMBER_OF_STATES];
+  bool reached[SM::NUMBER_OF_STATES];
+  bool changed = true;
+  const char* machine = cycling ? "cycling" : "normal";
+
+  memset(edge, 0, sizeof(edge));
+  for (uint32_t s = 0; s < SM::NUMBER_OF_STATES; s++) {
+    for (uint32_t bits = 0; bits < (1u << NUMBER_OF_INPUTS); bits++) {
+      SM::Inputs in = makeInputs(bits);
+      const SM::Transition* t = sm.next((SM::State)s, in);
+      if (!t) continue;
+      edge[s][t->to] = true;
+      CHECK(t->to != s, "%s: %s transitions to itself", machine, sm.getStateDef((SM::State)s).name);
+      if (cycling) continue;
+      CHECK(t->to != SM::RUN || in.run, "%s: RUN entered from %s without INH_RUN", machine, sm.getStateDef((SM::State)s).name);
+      CHECK(t->to != SM::CHARGING || in.charging, "%s: CHARGING entered from %s without INH_CHARGING", machine, sm.getStateDef((SM::State)s).name);
+      CHECK(!(t->to == SM::TOP_BALANCING || t->to == SM::POST_CHARGE) || s == SM::CHARGING || s == SM::TOP_BALANCING,
+            "%s: %s entered from %s", machine, sm.getStateDef(t->to).name, sm.getStateDef((SM::State)s).name);
+    }
+    if (!cycling && s == SM::RUN) {
+      CHECK(sm.next(SM::RUN, makeInputs(0)) && sm.next(SM::RUN, makeInputs(0))->to == SM::STANDBY, "%s: RUN does not fall back to STANDBY", machine);
+    }
+  }
+
+  //every state is reachable from INIT
+  memset(reached, 0, sizeof(reached));
+  reached[SM::INIT] = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t a = 0; a < SM::NUMBER_OF_STATES; a++) {
+      for (uint32_t b = 0; b < SM::NUMBER_OF_STATES; b++) {
+        if (reached[a] && edge[a][b] && !reached[b]) reached[b] = changed = true;
+      }
+    }
+  }
+  for (uint32_t s = 0; s < SM::NUMBER_OF_STATES; s++) {
+    CHECK(reached[s], "%s: %s is unreachable", machine, sm.getStateDef((SM::State)s).name);
+  }
+
+  //STANDBY is reachable from every state, nothing gets stuck
+  for (uint32_t s = 0; s < SM::NUMBER_OF_STATES; s++) {
+    memset(reached, 0, sizeof(reached));
+    reached[s] = true;
+    changed = true;
+    while (changed) {
+      changed = false;
+      for (uint32_t a = 0; a < SM::NUMBER_OF_STATES; a++) {
+        for (uint32_t b = 0; b < SM::NUMBER_OF_STATES; b++) {
+          if (reached[a] && edge[a][b] && !reached[b]) reached[b] = changed = true;
+        }
+      }
+    }
+    CHECK(reached[SM::STANDBY], "%s: STANDBY unreachable from %s", machine, sm.getStateDef((SM::State)s).name);
+  }
+  printf("%s: %u states x %u input snapshots checked\n", machine, SM::NUMBER_OF_STATES, 1u << NUMBER_OF_INPUTS);
+}
+
+/////////////////////////////////////////////////
+/// \brief replays random traces with random tick periods to check the timings do not depend on the tick rate.
+/////////////////////////////////////////////////
+static void fuzz(uint64_t traces, uint32_t seed) {
+  static const uint32_t periods[] = { 200, 400, 2000, 4000 };
+  SM sm(false);
+  uint64_t ticks = 0, transitions = 0, simulatedMs = 0;
+  uint32_t inputs = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  double elapsed;
+
+  srand(seed);
+  for (uint64_t trace = 0; trace < traces; trace++) {
+    Replay replay(&sm);
+    uint32_t period = periods[rand() % 4];
+    for (uint32_t i = 0; i < 2000; i++) {
+      if (rand() % 8 == 0) inputs ^= 1u << (rand() % 5);  //inputs hold for a few ticks
+      replay.tick(period + rand() % 50, inputs & 1, inputs & 2, inputs & 4, inputs & 8, inputs & 16, false);
+      ticks++;
+    }
+    transitions += replay.getTransitions();
+    simulatedMs += replay.getNow();
+  }
+  elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("fuzz: %llu ticks, %llu transitions, %.1f simulated hours in %.2fs (%.0fx real time)\n",
+         (unsigned long long)ticks, (unsigned long long)transitions, simulatedMs / 3600000.0, elapsed,
+         simulatedMs / 1000.0 / (elapsed > 0 ? elapsed : 1e-9));
+}
+
+/////////////////////////////////////////////////
+/// \brief replays a recorded trace and prints the transitions.
+/////////////////////////////////////////////////
+static void replayFile(const char* path) {
+  SM sm(false);
+  Replay replay(&sm);
+  unsigned dt, run, charging, evseDisc, cycle, top;
+  char line[128];
+  FILE* f = fopen(path, "r");
+
+  if (!f) {
+    printf("cannot open %s\n", path);
+    failures++;
+    return;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%u %u %u %u %u %u", &dt, &run, &charging, &evseDisc, &cycle, &top) == 6) {
+      replay.tick(dt, run, charging, evseDisc, cycle, top, true);
+    }
+  }
+  fclose(f);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "fuzz") == 0) {
+    fuzz(argc > 2 ? strtoull(argv[2], 0, 10) : 10000, argc > 3 ? strtoul(argv[3], 0, 10) : 1);
+  } else if (argc > 2 && strcmp(argv[1], "replay") == 0) {
+    replayFile(argv[2]);
+  } else {
+    exhaustive(false);
+    exhaustive(true);
+  }
+  printf("%s (%d failures)\n", failures ? "FAILED" : "PASSED", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+/**@file telemetry_benchmark.cpp
+ * Measures what delta frames save on a recorded telemetry stream and what they cost to encode.
+ *
+ *   g++ -O2 -std=gnu++14 -I../.. -I../telemetry_decoder -o telemetry_benchmark telemetry_benchmark.cpp \
+ *       ../telemetry_decoder/TelemetryDecoder.cpp ../../TelemetryFrame.cpp
+ *
+ *   ./telemetry_benchmark [stream]
+ *
+ * The stream is one the board sends with 'tl' or one pack_simulator -T writes, read from the file given
+ * or stdin. Its frames are decoded back to full frames, then sent again, as Telemetry would send them,
+ * with every keyframe interval of the table: a keyframe every that many frames, delta frames against the
+ * previous frame between them. Every frame is decoded again and compared to the original. The table gives
+ * the bytes on the wire (COBS and delimiters included) per frame and against full frames only, the share
+ * of delta frames whose payload fits the 8 bytes of a CAN frame and the time the encoder took per frame:
+ * makeDelta() and the COBS encoding, not the composition of the frame from the controller.
+ */
+#include "TelemetryDecoder.hpp"
+#include <chrono>
+#include <string.h>
+
+/////////////////////////////////////////////////
+/// \brief Keeps every full frame the decoder finds.
+/////////////////////////////////////////////////
+class Recorder : public TelemetrySink {
+public:
+  Recorder()
+    : decoder(0) {
+  }
+  void frame(const TelemetrySample&) {
+    size_t length;
+    const uint8_t* frame = decoder->getFrame(&length);
+    frames.push_back(std::vector<uint8_t>(frame, frame + length));
+  }
+
+  TelemetryDecoder* decoder;
+  std::vector<std::vector<uint8_t> > frames;
+};
+
+int main(int argc, char** argv) {
+  static const uint8_t intervals[] = { 1, 2, 5, 10, 25, 100, 255 };
+  FILE* in = stdin;
+  Recorder recorder;
+  TelemetryDecoder decoder(&recorder);
+  static uint8_t buffer[1 << 16];
+  size_t n;
+
+  if (argc > 2 || (argc == 2 && !(in = fopen(argv[1], "rb")))) {
+    fprintf(stderr, "usage: telemetry_benchmark [stream]\n");
+    return 2;
+  }
+  recorder.decoder = &decoder;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) decoder.feed(buffer, n);
+  decoder.end();
+  if (recorder.frames.empty()) {
+    fprintf(stderr, "no frames in the stream\n");
+    return 1;
+  }
+
+  std::vector<std::vector<uint8_t> >& frames = recorder.frames;
+  uint8_t delta[TELEMETRY_MAX_SIZE];
+  uint8_t encoded[TELEMETRY_MAX_ENCODED_SIZE];
+  uint8_t decoded[TELEMETRY_MAX_SIZE];
+  uint8_t rebuilt[TELEMETRY_MAX_SIZE];
+  uint64_t fullBytes = 0;
+  int errors = 0;
+
+  printf("%lu frames of %u modules\n", (unsigned long)frames.size(), frames[0][TLM_MODULES]);
+  printf("%9s | %10s | %10s | %8s | %9s | %9s | %8s\n", "keyframes", "bytes", "per frame", "ratio", "deltas", "CAN fit", "ns/frame");
+  for (size_t k = 0; k < sizeof(intervals); k++) {
+    uint64_t bytes = 0;
+    uint32_t deltas = 0;
+    uint32_t canFit = 0;
+    uint32_t sinceKeyframe = 0;
+    double encodeNs = 0;
+
+    for (size_t i = 0; i < frames.size(); i++) {
+      const uint8_t* frame = frames[i].data();
+      size_t length = frames[i].size();
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      n = 0;
+      if (i > 0 && sinceKeyframe + 1 < intervals[k]) n = TelemetryFrame::makeDelta(frames[i - 1].data(), frame, delta, length - 1);
+      bool keyframe = n == 0;
+      size_t wire = keyframe ? TelemetryFrame::encode(frame, length, encoded) : TelemetryFrame::encode(delta, n, encoded);
+      encodeNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+      sinceKeyframe = keyframe ? 0 : sinceKeyframe + 1;
+      bytes += wire;
+      if (k == 0) fullBytes += wire;
+      if (!keyframe) {
+        deltas++;
+        if (n - TELEMETRY_CRC_SIZE <= 8) canFit++;
+      }
+
+      //the way back, as the decoder takes it
+      size_t m = TelemetryFrame::decode(encoded + 1, wire - 2, decoded, sizeof(decoded));
+      if (keyframe) {
+        if (!TelemetryFrame::check(decoded, m) || m != length || memcmp(decoded, frame, length) != 0) errors++;
+      } else if (!TelemetryFrame::checkDelta(decoded, m) ||
+                 TelemetryFrame::applyDelta(frames[i - 1].data(), frames[i - 1].size(), decoded, m, rebuilt) != length ||
+                 memcmp(rebuilt, frame, length) != 0) {
+        errors++;
+      }
+    }
+    printf("%9u | %10llu | %10.1f | %7.1f%% | %9u | %8.1f%% | %8.0f\n", intervals[k], (unsigned long long)bytes,
+           (double)bytes / frames.size(), 100.0 * bytes / fullBytes, deltas, deltas ? 100.0 * canFit / deltas : 0.0,
+           encodeNs / frames.size());
+  }
+  if (errors) printf("%d frames did not decode to the original\n", errors);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,364 @@
+#include "TelemetryDecoder.hpp"
+#include <string.h>
+
+/////////////////////////////////////////////////
+/// \brief Constructor, what is found in the stream goes to sink.
+/////////////////////////////////////////////////
+TelemetryDecoder::TelemetryDecoder(TelemetrySink* sink)
+  : sink(sink),
+    used(0),
+    overflow(false),
+    holding(false),
+    first(true),
+    sequence(0),
+    frameLength(0),
+    frames(0),
+    deltas(0),
+    corrupt(0),
+    lost(0),
+    textBytes(0),
+    rpcFrames(0) {
+}
+
+/////////////////////////////////////////////////
+/// \brief decodes the next length bytes of the stream.
+/////////////////////////////////////////////////
+void TelemetryDecoder::feed(const uint8_t* data, size_t length) {
+  while (length) {
+    const uint8_t* zero = (const uint8_t*)memchr(data, 0, length);
+    size_t n = zero ? zero - data : length;
+
+    if (!overflow && used + n > sizeof(part)) {
+      //longer than any telemetry frame, text or a frame of the RPC channel: its first byte after the COBS code
+      uint8_t kind = used >= 2 ? part[1] : data[1 - used];
+      holding = kind == RPC_REQUEST || kind == RPC_RESPONSE || kind == RPC_DOCUMENT;
+      if (holding) {
+        held.assign(part, part + used);
+      } else {
+        sink->text(part, used);
+        textBytes += used;
+      }
+      used = 0;
+      overflow = true;
+    }
+    if (holding) {
+      held.insert(held.end(), data, data + n);
+    } else if (overflow) {
+      sink->text(data, n);
+      textBytes += n;
+    } else {
+      memcpy(part + used, data, n);
+      used += n;
+    }
+    if (!zero) return;
+    endPart();
+    data += n + 1;
+    length -= n + 1;
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief passes on what is left at the end of the stream, text or a frame cut short.
+/////////////////////////////////////////////////
+void TelemetryDecoder::end() {
+  endPart();
+}
+
+uint64_t TelemetryDecoder::getFrames() {
+  return frames;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of frames dropped because their CRC or their length was wrong.
+/////////////////////////////////////////////////
+uint64_t TelemetryDecoder::getCorrupt() {
+  return corrupt;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of frames missing from the sequence numbers between the first and the last one.
+/////////////////////////////////////////////////
+uint64_t TelemetryDecoder::getLost() {
+  return lost;
+}
+
+uint64_t TelemetryDecoder::getTextBytes() {
+  return textBytes;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of frames that came as delta frames.
+/////////////////////////////////////////////////
+uint64_t TelemetryDecoder::getDeltas() {
+  return deltas;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the number of frames of the RPC channel skipped, requests, responses and CBOR replies.
+/////////////////////////////////////////////////
+uint64_t TelemetryDecoder::getRpcFrames() {
+  return rpcFrames;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns the last frame decoded as a full frame, also when it came as a delta frame.
+/////////////////////////////////////////////////
+const uint8_t* TelemetryDecoder::getFrame(size_t* length) {
+  *length = frameLength;
+  return frame;
+}
+
+/////////////////////////////////////////////////
+/// \brief sorts out the part between two zero bytes: a frame, a corrupt frame, a frame of the RPC channel or text.
+/////////////////////////////////////////////////
+void TelemetryDecoder::endPart() {
+  uint8_t decoded[TELEMETRY_MAX_SIZE];
+  uint8_t full[TELEMETRY_MAX_SIZE];
+  size_t n;
+
+  if (holding) {
+    if (isRpcFrame(held.data(), held.size())) {
+      rpcFrames++;
+    } else {
+      sink->text(held.data(), held.size());
+      textBytes += held.size();
+    }
+    held.clear();
+    holding = false;
+  }
+  if (overflow || used == 0) {
+    overflow = false;
+    used = 0;
+    return;
+  }
+  if (isRpcFrame(part, used)) {
+    rpcFrames++;
+    used = 0;
+    return;
+  }
+  n = TelemetryFrame::decode(part, used, decoded, sizeof(decoded));
+  if (n < TELEMETRY_DELTA_MIN_SIZE || (decoded[TLM_VERSION] & ~TELEMETRY_DELTA) != TELEMETRY_VERSION) {
+    sink->text(part, used);
+    textBytes += used;
+  } else if (decoded[TLM_VERSION] & TELEMETRY_DELTA ? !TelemetryFrame::checkDelta(decoded, n) : !TelemetryFrame::check(decoded, n)) {
+    corrupt++;
+  } else if (decoded[TLM_VERSION] & TELEMETRY_DELTA) {
+    //a delta frame whose reference was lost is dropped, it shows as a gap in the sequence numbers
+    if (frameLength && (n = TelemetryFrame::applyDelta(frame, frameLength, decoded, n, full)) != 0) {
+      deltas++;
+      accept(full, n);
+    }
+  } else {
+    accept(decoded, n);
+  }
+  used = 0;
+}
+
+/////////////////////////////////////////////////
+/// \brief returns true if the part decodes to a frame of the RPC channel with a good CRC.
+/////////////////////////////////////////////////
+bool TelemetryDecoder::isRpcFrame(const uint8_t* part, size_t length) {
+  std::vector<uint8_t> frame(length);
+  size_t n = TelemetryFrame::decode(part, length, frame.data(), frame.size());
+
+  if (n < 1 + RPC_CRC_SIZE) return false;
+  if (frame[RPC_KIND] != RPC_REQUEST && frame[RPC_KIND] != RPC_RESPONSE && frame[RPC_KIND] != RPC_DOCUMENT) return false;
+  return TelemetryFrame::crc16(frame.data(), n - RPC_CRC_SIZE) == TelemetryFrame::get16(frame.data() + n - RPC_CRC_SIZE);
+}
+
+/////////////////////////////////////////////////
+/// \brief passes on a checked full frame and keeps it as the reference of the next delta frame.
+/////////////////////////////////////////////////
+void TelemetryDecoder::accept(const uint8_t* decoded, size_t length) {
+  TelemetrySample sample;
+
+  memcpy(frame, decoded, length);
+  frameLength = length;
+  parse(frame, &sample);
+  if (!first) lost += (uint16_t)(sample.sequence - sequence - 1);
+  first = false;
+  sequence = sample.sequence;
+  frames++;
+  sink->frame(sample);
+}
+
+/////////////////////////////////////////////////
+/// \brief reads the fields of a checked frame into sample.
+/////////////////////////////////////////////////
+void TelemetryDecoder::parse(const uint8_t* frame, TelemetrySample* sample) {
+  sample->version = frame[TLM_VERSION];
+  sample->modules = frame[TLM_MODULES];
+  sample->sequence = TelemetryFrame::get16(frame + TLM_SEQUENCE);
+  sample->millis = TelemetryFrame::get32(frame + TLM_MILLIS);
+  sample->active = TelemetryFrame::get32(frame + TLM_ACTIVE);
+  sample->sticky = TelemetryFrame::get32(frame + TLM_STICKY);
+  sample->bat12vMv = TelemetryFrame::get16(frame + TLM_BAT12V);
+  sample->loopMeanUs = TelemetryFrame::get16(frame + TLM_LOOP_MEAN);
+  sample->loopMaxUs = TelemetryFrame::get16(frame + TLM_LOOP_MAX);
+  sample->controllerMaxUs = TelemetryFrame::get16(frame + TLM_CONTROLLER_MAX);
+  sample->state = frame[TLM_STATE];
+  sample->outputs = frame[TLM_OUTPUTS];
+  sample->pump = frame[TLM_PUMP];
+
+  const uint8_t* p = frame + TELEMETRY_HEADER_SIZE;
+  for (int m = 0; m < sample->modules; m++, p += TELEMETRY_MODULE_SIZE) {
+    TelemetrySample::Module* module = &sample->module[m];
+    module->address = p[TLM_MODULE_ADDRESS];
+    module->faults = p[TLM_MODULE_FAULTS];
+    module->alerts = p[TLM_MODULE_ALERTS];
+    for (int cell = 0; cell < 6; cell++) {
+      module->cells[cell] = TelemetryFrame::get16(p + TLM_MODULE_CELLS + 2 * cell);
+    }
+    for (int sensor = 0; sensor < 2; sensor++) {
+      module->temps[sensor] = (int16_t)TelemetryFrame::get16(p + TLM_MODULE_TEMPS + 2 * sensor);
+    }
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief Constructor, writes the header lines of the files that are not 0.
+/////////////////////////////////////////////////
+TelemetryCsvWriter::TelemetryCsvWriter(FILE* frames, FILE* modules)
+  : frames(frames),
+    modules(modules) {
+  if (frames) {
+    fputs("sequence,time (ms),state,outputs,pump,12V (V),active faults,sticky faults,loop mean (us),loop max (us),"
+          "doController max (us),modules\n", frames);
+  }
+  if (modules) {
+    fputs("sequence,Module#,time (ms),faults,alerts,cell1,cell2,cell3,cell4,cell5,cell6,temp1,temp2\n", modules);
+  }
+}
+
+void TelemetryCsvWriter::frame(const TelemetrySample& sample) {
+  int n;
+
+  if (frames) {
+    n = snprintf(line, sizeof(line), "%u,%lu,%u,0x%02x,%u,%.3f,0x%08lx,0x%08lx,%u,%u,%u,%u\n", sample.sequence,
+                 (unsigned long)sample.millis, sample.state, sample.outputs, sample.pump, sample.bat12vMv / 1000.0,
+                 (unsigned long)sample.active, (unsigned long)sample.sticky, sample.loopMeanUs, sample.loopMaxUs,
+                 sample.controllerMaxUs, sample.modules);
+    fwrite(line, 1, n, frames);
+  }
+  if (!modules) return;
+  for (int m = 0; m < sample.modules; m++) {
+    const TelemetrySample::Module& module = sample.module[m];
+    n = snprintf(line, sizeof(line), "%u,%u,%lu,0x%02x,0x%02x", sample.sequence, module.address, (unsigned long)sample.millis,
+                 module.faults, module.alerts);
+    for (int cell = 0; cell < 6; cell++) {
+      n += snprintf(line + n, sizeof(line) - n, ",%.3f", module.cells[cell] * TELEMETRY_CELL_V_PER_COUNT);
+    }
+    for (int sensor = 0; sensor < 2; sensor++) {
+      if (module.temps[sensor] == TELEMETRY_NO_TEMPERATURE) {
+        line[n++] = ',';
+      } else {
+        n += snprintf(line + n, sizeof(line) - n, ",%.2f", module.temps[sensor] / 100.0);
+      }
+    }
+    line[n++] = '\n';
+    fwrite(line, 1, n, modules);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief Constructor, the blocks are written to out.
+/////////////////////////////////////////////////
+TelemetryColumnWriter::TelemetryColumnWriter(FILE* out)
+  : out(out) {
+  static const char* cellNames[6] = { "cell1", "cell2", "cell3", "cell4", "cell5", "cell6" };
+
+  frames.id = 0;
+  frames.rows = 0;
+  addColumn(&frames, "sequence", 2);
+  addColumn(&frames, "millis", 4);
+  addColumn(&frames, "state", 1);
+  addColumn(&frames, "outputs", 1);
+  addColumn(&frames, "pump", 1);
+  addColumn(&frames, "bat12v_mv", 2);
+  addColumn(&frames, "active", 4);
+  addColumn(&frames, "sticky", 4);
+  addColumn(&frames, "loop_mean_us", 2);
+  addColumn(&frames, "loop_max_us", 2);
+  addColumn(&frames, "controller_max_us", 2);
+  addColumn(&frames, "modules", 1);
+
+  modules.id = 1;
+  modules.rows = 0;
+  addColumn(&modules, "sequence", 2);
+  addColumn(&modules, "address", 1);
+  addColumn(&modules, "faults", 1);
+  addColumn(&modules, "alerts", 1);
+  for (int cell = 0; cell < 6; cell++) addColumn(&modules, cellNames[cell], 2);
+  addColumn(&modules, "temp1_centi_c", 0x82);
+  addColumn(&modules, "temp2_centi_c", 0x82);
+}
+
+void TelemetryColumnWriter::frame(const TelemetrySample& sample) {
+  Column* c = &frames.columns[0];
+  put(c++, sample.sequence);
+  put(c++, sample.millis);
+  put(c++, sample.state);
+  put(c++, sample.outputs);
+  put(c++, sample.pump);
+  put(c++, sample.bat12vMv);
+  put(c++, sample.active);
+  put(c++, sample.sticky);
+  put(c++, sample.loopMeanUs);
+  put(c++, sample.loopMaxUs);
+  put(c++, sample.controllerMaxUs);
+  put(c++, sample.modules);
+  if (++frames.rows == BLOCK_ROWS) writeBlock(&frames);
+
+  for (int m = 0; m < sample.modules; m++) {
+    const TelemetrySample::Module& module = sample.module[m];
+    c = &modules.columns[0];
+    put(c++, sample.sequence);
+    put(c++, module.address);
+    put(c++, module.faults);
+    put(c++, module.alerts);
+    for (int cell = 0; cell < 6; cell++) put(c++, module.cells[cell]);
+    put(c++, (uint16_t)module.temps[0]);
+    put(c++, (uint16_t)module.temps[1]);
+    if (++modules.rows == BLOCK_ROWS) writeBlock(&modules);
+  }
+}
+
+/////////////////////////////////////////////////
+/// \brief writes the rows not written yet, at the end of the stream.
+/////////////////////////////////////////////////
+void TelemetryColumnWriter::flush() {
+  if (frames.rows) writeBlock(&frames);
+  if (modules.rows) writeBlock(&modules);
+  fflush(out);
+}
+
+void TelemetryColumnWriter::addColumn(Table* table, const char* name, uint8_t type) {
+  Column column;
+  column.name = name;
+  column.type = type;
+  column.data.reserve(BLOCK_ROWS * (type & 0x0f));
+  table->columns.push_back(column);
+}
+
+void TelemetryColumnWriter::put(Column* column, uint32_t v) {
+  for (uint8_t i = 0; i < (column->type & 0x0f); i++, v >>= 8) {
+    column->data.push_back(v);
+  }
+}
+
+void TelemetryColumnWriter::writeBlock(Table* table) {
+  uint8_t header[12] = { 'T', 'L', 'M', 'C', TELEMETRY_VERSION, table->id };
+
+  TelemetryFrame::put16(header + 6, table->columns.size());
+  TelemetryFrame::put32(header + 8, table->rows);
+  fwrite(header, 1, sizeof(header), out);
+  for (size_t i = 0; i < table->columns.size(); i++) {
+    Column& column = table->columns[i];
+    uint8_t name[2] = { column.type, (uint8_t)strlen(column.name) };
+    fwrite(name, 1, 2, out);
+    fwrite(column.name, 1, name[1], out);
+    fwrite(column.data.data(), 1, column.data.size(), out);
+    column.data.clear();
+  }
+  table->rows = 0;
+}
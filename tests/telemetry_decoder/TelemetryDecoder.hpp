@@ -0,0 +1,150 @@
+#ifndef TELEMETRYDECODER_HPP_
+#define TELEMETRYDECODER_HPP_
+
+#include "TelemetryFrame.hpp"
+#include "RpcFrame.hpp"
+#include <stdio.h>
+#include <vector>
+
+/////////////////////////////////////////////////
+/// \brief The fields of a telemetry frame, see TelemetryField.
+/////////////////////////////////////////////////
+struct TelemetrySample {
+  struct Module {
+    uint8_t address;
+    uint8_t faults;
+    uint8_t alerts;
+    uint16_t cells[6];  //raw ADC counts
+    int16_t temps[2];   //0.01C
+  };
+  uint8_t version;
+  uint8_t modules;
+  uint16_t sequence;
+  uint32_t millis;
+  uint32_t active;
+  uint32_t sticky;
+  uint16_t bat12vMv;
+  uint16_t loopMeanUs;
+  uint16_t loopMaxUs;
+  uint16_t controllerMaxUs;
+  uint8_t state;
+  uint8_t outputs;
+  uint8_t pump;
+  Module module[TELEMETRY_MAX_MODULES];
+};
+
+/////////////////////////////////////////////////
+/// \brief Receives what a TelemetryDecoder finds in a stream.
+/////////////////////////////////////////////////
+class TelemetrySink {
+public:
+  virtual ~TelemetrySink() {}
+  virtual void frame(const TelemetrySample& sample) = 0;
+  virtual void text(const uint8_t* /*data*/, size_t /*length*/) {}
+};
+
+/////////////////////////////////////////////////
+/// \brief Splits what the console port of the board sends into telemetry frames and console text.
+///
+/// The stream is fed in chunks of any size and cut at the zero bytes. A part that decodes to a frame of
+/// TELEMETRY_VERSION with a good CRC goes to the sink as a sample; a part that decodes to a frame whose
+/// CRC or length is wrong, a frame cut on the way, is counted and dropped; a frame of the RPC channel with
+/// a good CRC, a request, a response or a CBOR reply of the console (see RpcFrame.hpp), is counted and
+/// skipped; anything else is console text. A part longer than a telemetry frame can be is text too and is
+/// passed on as it comes, unless it starts like a frame of the RPC channel: it is then kept up to its end
+/// and checked, a CBOR reply is longer than a telemetry frame. A delta frame is applied
+/// to the last frame decoded when it is the one it refers to, and dropped otherwise. The frames lost are
+/// the gaps in the sequence numbers: the frames the board dropped, the corrupt ones and the delta frames
+/// whose reference was lost.
+/////////////////////////////////////////////////
+class TelemetryDecoder {
+public:
+  TelemetryDecoder(TelemetrySink* sink);
+  void feed(const uint8_t* data, size_t length);
+  void end();
+  uint64_t getFrames();
+  uint64_t getCorrupt();
+  uint64_t getLost();
+  uint64_t getTextBytes();
+  uint64_t getDeltas();
+  uint64_t getRpcFrames();
+  const uint8_t* getFrame(size_t* length);
+
+private:
+  TelemetrySink* sink;
+  uint8_t part[TELEMETRY_MAX_ENCODED_SIZE];
+  size_t used;
+  bool overflow;   //the part outgrew a frame and is text
+  bool holding;    //the part outgrew a frame and may be a frame of the RPC channel, it is kept in held
+  std::vector<uint8_t> held;
+  bool first;      //no frame yet, nothing to count lost frames from
+  uint16_t sequence;
+  uint8_t frame[TELEMETRY_MAX_SIZE];  //the last frame decoded, whole, the reference of the delta frames
+  size_t frameLength;
+  uint64_t frames;
+  uint64_t deltas;
+  uint64_t corrupt;
+  uint64_t lost;
+  uint64_t textBytes;
+  uint64_t rpcFrames;
+
+  void endPart();
+  static bool isRpcFrame(const uint8_t* part, size_t length);
+  void accept(const uint8_t* decoded, size_t length);
+  static void parse(const uint8_t* frame, TelemetrySample* sample);
+};
+
+/////////////////////////////////////////////////
+/// \brief Writes the samples as CSV: a line per frame to one file, a line per module of every frame to another.
+///
+/// Both files start with a header line, either may be 0. Cell voltages are scaled from their counts like
+/// BMSModule scales them, temperatures are in C, the modules file has the columns of printAllCSV.
+/////////////////////////////////////////////////
+class TelemetryCsvWriter : public TelemetrySink {
+public:
+  TelemetryCsvWriter(FILE* frames, FILE* modules);
+  void frame(const TelemetrySample& sample);
+
+private:
+  FILE* frames;
+  FILE* modules;
+  char line[256];
+};
+
+/////////////////////////////////////////////////
+/// \brief Writes the samples as columns: the frames table and the modules table in blocks of BLOCK_ROWS rows.
+///
+/// A block is "TLMC", the u8 telemetry version, the u8 table (0 frames, 1 modules), the u16 number of
+/// columns and the u32 number of rows, then every column: its u8 type (the size in bytes of a value, 0x80
+/// set for a signed one), the u8 length of its name, the name and the values, little endian. The modules
+/// table has a row per module of every frame and starts with the sequence number of its frame.
+/////////////////////////////////////////////////
+class TelemetryColumnWriter : public TelemetrySink {
+public:
+  static const uint32_t BLOCK_ROWS = 65536;
+
+  TelemetryColumnWriter(FILE* out);
+  void frame(const TelemetrySample& sample);
+  void flush();
+
+private:
+  struct Column {
+    const char* name;
+    uint8_t type;
+    std::vector<uint8_t> data;
+  };
+  struct Table {
+    uint8_t id;
+    uint32_t rows;
+    std::vector<Column> columns;
+  };
+  FILE* out;
+  Table frames;
+  Table modules;
+
+  static void addColumn(Table* table, const char* name, uint8_t type);
+  static void put(Column* column, uint32_t v);
+  void writeBlock(Table* table);
+};
+
+#endif /* TELEMETRYDECODER_HPP_ */
@@ -0,0 +1,109 @@
+/**@file telemetry_decoder.cpp
+ * Decodes the binary telemetry a board sends on its console port (see TelemetryFrame.hpp) to CSV or columns.
+ *
+ *   g++ -O2 -std=gnu++14 -I../.. -o telemetry_decoder telemetry_decoder.cpp TelemetryDecoder.cpp ../../TelemetryFrame.cpp
+ *
+ *   ./telemetry_decoder [options] [stream]
+ *     -f <file>          a CSV line per frame: state, outputs, faults, loop timing
+ *     -m <file>          a CSV line per module of every frame, the columns of the CSV command
+ *     -b <file>          both tables as columns (see TelemetryColumnWriter)
+ *     -t <file>          the console text between the frames
+ *
+ * The stream is read from the file or device given, stdin without one, until its end. On the board the
+ * telemetry is started from the console with 'tl <ms>'; the port must be raw, e.g.
+ *
+ *   stty -F /dev/ttyACM0 raw && ./telemetry_decoder -b pack.tlmc -t console.txt /dev/ttyACM0
+ *
+ * or on the host with pack_simulator -T. The counters of the frames and the rate the stream was decoded
+ * at are printed on stderr at the end.
+ */
+#include "TelemetryDecoder.hpp"
+#include <chrono>
+#include <string.h>
+
+/////////////////////////////////////////////////
+/// \brief Passes the frames to the writers asked for and the text to its file.
+/////////////////////////////////////////////////
+class Outputs : public TelemetrySink {
+public:
+  Outputs(TelemetryCsvWriter* csv, TelemetryColumnWriter* columns, FILE* textOut)
+    : csv(csv),
+      columns(columns),
+      textOut(textOut) {
+  }
+  void frame(const TelemetrySample& sample) {
+    if (csv) csv->frame(sample);
+    if (columns) columns->frame(sample);
+  }
+  void text(const uint8_t* data, size_t length) {
+    if (textOut) fwrite(data, 1, length, textOut);
+  }
+
+private:
+  TelemetryCsvWriter* csv;
+  TelemetryColumnWriter* columns;
+  FILE* textOut;
+};
+
+static void usage() {
+  fprintf(stderr, "usage: telemetry_decoder [-f file] [-m file] [-b file] [-t file] [stream]\n");
+}
+
+static FILE* openFile(const char* path, const char* mode) {
+  FILE* f = fopen(path, mode);
+  if (!f) fprintf(stderr, "cannot open %s\n", path);
+  return f;
+}
+
+int main(int argc, char** argv) {
+  const char* paths[4] = { 0 };  //-f, -m, -b, -t
+  const char* options = "fmbt";
+  const char* streamPath = 0;
+  FILE* files[4] = { 0 };
+  FILE* in = stdin;
+
+  for (int i = 1; i < argc; i++) {
+    const char* option = argv[i][0] == '-' && argv[i][1] ? strchr(options, argv[i][1]) : 0;
+    if (option && argv[i][2] == 0 && i + 1 < argc) {
+      paths[option - options] = argv[++i];
+    } else if (argv[i][0] != '-' && !streamPath) {
+      streamPath = argv[i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    if (paths[i] && !(files[i] = openFile(paths[i], i == 2 ? "wb" : "w"))) return 2;
+  }
+  if (streamPath && !(in = openFile(streamPath, "rb"))) return 2;
+
+  TelemetryCsvWriter csv(files[0], files[1]);
+  TelemetryColumnWriter columns(files[2]);
+  Outputs outputs(files[0] || files[1] ? &csv : 0, files[2] ? &columns : 0, files[3]);
+  TelemetryDecoder decoder(&outputs);
+  static uint8_t buffer[1 << 16];
+  uint64_t bytes = 0;
+  size_t n;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    decoder.feed(buffer, n);
+    bytes += n;
+  }
+  decoder.end();
+  if (files[2]) columns.flush();
+  for (int i = 0; i < 4; i++) {
+    if (files[i]) fclose(files[i]);
+  }
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "%llu bytes, %llu frames (%llu deltas), %llu lost, %llu corrupt, %llu bytes of text, %llu RPC frames, "
+          "decoded at %.1f MB/s\n",
+          (unsigned long long)bytes, (unsigned long long)decoder.getFrames(), (unsigned long long)decoder.getDeltas(),
+          (unsigned long long)decoder.getLost(),
+          (unsigned long long)decoder.getCorrupt(), (unsigned long long)decoder.getTextBytes(),
+          (unsigned long long)decoder.getRpcFrames(),
+          bytes / 1e6 / (elapsed > 0 ? elapsed : 1e-9));
+  return 0;
+}
@@ -0,0 +1,120 @@
+/**@file trace_replay.cpp
+ * Replays a trace recorded by TraceRecorder through the real driver, controller and console.
+ *
+ *   g++ -O2 -std=gnu++14 -fno-rtti -I../host -I../.. -o trace_replay trace_replay.cpp ../host/HostBoard.cpp \
+ *       ../host/TraceReplay.cpp ../../TraceRecorder.cpp ../../Cons.cpp ../../CellGraph.cpp ../../Dashboard.cpp \
+ *       ../../Telemetry.cpp ../../TelemetryFrame.cpp ../../RpcServer.cpp ../../WatchTable.cpp \
+ *       ../../Config.cpp ../../StructuredWriter.cpp ../../Logger.cpp ../../ConsoleOut.cpp ../../Profiler.cpp ../../BMSDriver.cpp \
+ *       ../../BMSModule.cpp ../../BMSModuleManager.cpp ../../Controller.cpp ../../PowerManager.cpp \
+ *       ../../ModulePowerManager.cpp ../../TimerWheel.cpp ../../CellFaultMonitor.cpp ../../FaultRegistry.cpp \
+ *       ../../ControllerStateMachine.cpp
+ *
+ *   ./trace_replay [-v] [-u seconds] <trace>
+ *     -v                 prints the controller console on stderr
+ *     -u <seconds>       stops at that time of the trace and prints the state of the controller
+ *
+ * A trace is captured on the board by setting trace_capture to 1 on a firmware built with the Dual Serial
+ * USB type and saving the second port to a file from the next boot (e.g. cat /dev/ttyACM1 > boat.trace),
+ * or on the host with pack_simulator -t. The replay runs the sketch main loop on the clock of the trace:
+ * a tick is a run of the controller, after the console fed the input typed since the previous one, the
+ * modules and the inputs answering what they answered on the board. It prints the state transitions of the controller and exits with 1 at the first
+ * point where the replayed controller does something the recorded one did not, so a field problem can be
+ * bisected with -u and -v on a desk.
+ */
+#include "Arduino.h"
+#include "TraceReplay.hpp"
+#include "Controller.hpp"
+#include "Cons.hpp"
+
+static void usage() {
+  fprintf(stderr, "usage: trace_replay [-v] [-u seconds] <trace>\n");
+}
+
+int main(int argc, char** argv) {
+  const char* path = 0;
+  uint32_t untilMs = 0;
+  TraceReplay replay;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "-v") == 0) {
+      Serial.setOutput(stderr);
+    } else if (strcmp(argv[i], "-u") == 0 && hasValue) {
+      untilMs = strtoul(argv[++i], 0, 10) * 1000;
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (!path) {
+    usage();
+    return 2;
+  }
+  if (!replay.load(path)) {
+    fprintf(stderr, "cannot read %s, or it is not a version %d trace\n", path, TRACE_VERSION);
+    return 2;
+  }
+  if (replay.settings.size() > sizeof(EEPROM.mem)) {
+    fprintf(stderr, "%s has %u bytes of settings\n", path, (unsigned)replay.settings.size());
+    return 2;
+  }
+
+  //the controller loads the recorded settings, on the clock it was built at
+  host_board.reset(replay.rtc);
+  memcpy(EEPROM.mem, &replay.settings[0], replay.settings.size());
+  host_board.advance(replay.wheelMs);
+  static ReplayPort port(&replay);
+  static BMSDriverT<ReplayPort> driver(&port, &log_inst);
+  static Controller controller(&driver, &log_inst);
+  static Cons cons(&controller);
+  if (controller.getSettingsPtr()->eeprom_version.getVal() != EEPROM_VERSION) {
+    fprintf(stderr, "the trace was recorded with settings version %u, this build is version %u\n",
+            controller.getSettingsPtr()->eeprom_version.getVal(), EEPROM_VERSION);
+    return 2;
+  }
+  host_board.advance(replay.beginMs - replay.wheelMs);
+  replay.begin();
+
+  bool diverged = false;
+  ControllerStateMachine::State last = controller.getState();
+  printf("%10.3f %s\n", millis() / 1000.0, controller.getStateName(last));
+  while (replay.beginTick()) {
+    if (untilMs && millis() >= untilMs) break;
+    if (controller.getState() != replay.getState()) {
+      printf("tick %u (%.3fs): the controller is in %s, it was in %s\n", replay.getTicks(), millis() / 1000.0,
+             controller.getStateName(controller.getState()), controller.getStateName((ControllerStateMachine::State)replay.getState()));
+      diverged = true;
+      break;
+    }
+    if (strstr(replay.getConsoleInput().c_str(), "reboot")) {
+      printf("tick %u (%.3fs): the board was rebooted from the console\n", replay.getTicks(), millis() / 1000.0);
+      break;
+    }
+    Serial.inject(replay.getConsoleInput().c_str());
+
+    cons.doConsole();
+    controller.doController();
+    controller.getLoggerPtr()->drain();
+    console_out.pump();
+
+    if (controller.getState() != last) {
+      last = controller.getState();
+      printf("%10.3f %s\n", millis() / 1000.0, controller.getStateName(last));
+    }
+  }
+
+  if (replay.isDiverged()) {
+    printf("%s\n", replay.getDivergence());
+    diverged = true;
+  }
+  if (untilMs) {
+    console_out.pump();
+    Serial.setOutput(stdout);
+    controller.printControllerState();
+    console_out.pump();
+  }
+  printf("%s after %u ticks, %.3fs\n", diverged ? "diverged" : "identical", replay.getTicks(), millis() / 1000.0);
+  return diverged ? 1 : 0;
+}